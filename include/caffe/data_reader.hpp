@@ -8,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/internal_thread.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/datum_view.hpp"
 #include "caffe/util/db.hpp"
 
 namespace caffe {
@@ -19,16 +20,26 @@ namespace caffe {
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
  * way to keep parallel training deterministic.
+ *
+ * Records are handed out as DatumView, which points into the database's
+ * memory when the backend maps it (LMDB), so they are not copied.
+ *
+ * The source can be split into shards and read by several cursors at once
+ * (see DataParameter.shard and num_readers). Each cursor then runs on its own
+ * thread and the body merges their records in a fixed order. The sequence
+ * can be shuffled by visiting blocks of records in random order and by
+ * drawing records from a buffer (DataParameter.shuffle_block and
+ * shuffle_buffer), both seeded by Caffe::set_random_seed.
  */
 class DataReader {
  public:
   explicit DataReader(const LayerParameter& param);
   ~DataReader();
 
-  inline BlockingQueue<Datum*>& free() const {
+  inline BlockingQueue<DatumView*>& free() const {
     return queue_pair_->free_;
   }
-  inline BlockingQueue<Datum*>& full() const {
+  inline BlockingQueue<DatumView*>& full() const {
     return queue_pair_->full_;
   }
 
@@ -39,12 +50,67 @@ class DataReader {
     explicit QueuePair(int size);
     ~QueuePair();
 
-    BlockingQueue<Datum*> free_;
-    BlockingQueue<Datum*> full_;
+    BlockingQueue<DatumView*> free_;
+    BlockingQueue<DatumView*> full_;
 
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  // Walks one open database from its first record with a cursor of its own,
+  // restarting at the end. With shuffle_block set, every pass visits the
+  // blocks of that many consecutive records in a new random order drawn from
+  // seed.
+  class Records {
+   public:
+    Records(const DataParameter& param, shared_ptr<db::DB> db,
+        const string& source, unsigned int seed);
+
+    // Reads the current record
+    void Read(DatumView* datum);
+    // Moves steps records on
+    void Skip(int steps);
+
+   protected:
+    void NextBlock();
+
+    shared_ptr<db::DB> db_;
+    shared_ptr<db::Cursor> cursor_;
+    const int block_size_;
+    // The first key of each block, and the order of this pass
+    vector<string> block_keys_;
+    vector<int> block_order_;
+    int block_;
+    int block_offset_;
+    Caffe::RNG rng_;
+
+  DISABLE_COPY_AND_ASSIGN(Records);
+  };
+
+  // Reads every stride-th record of one database, starting from record
+  // offset, into its own pool of views. The lanes of a shard share its
+  // database handle, as LevelDB cannot be opened twice by one process.
+  class Lane : public InternalThread {
+   public:
+    Lane(const DataParameter& param, shared_ptr<db::DB> db,
+        const string& source, unsigned int seed, int offset, int stride,
+        int size);
+    virtual ~Lane();
+
+    BlockingQueue<DatumView*> free_;
+    BlockingQueue<DatumView*> full_;
+
+   protected:
+    void InternalThreadEntry();
+
+    // Set up on the body's thread, where the cursors of a database are
+    // opened one at a time.
+    Records records_;
+    const int offset_;
+    const int stride_;
+
+  DISABLE_COPY_AND_ASSIGN(Lane);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -53,10 +119,19 @@ class DataReader {
 
    protected:
     void InternalThreadEntry();
-    void read_one(db::Cursor* cursor, QueuePair* qp);
+    void read_one(QueuePair* qp);
+    // Reads the next record of the merged sequence
+    void read_next(DatumView* datum);
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
+    // The only database, when a single cursor reads
+    shared_ptr<Records> records_;
+    // Lanes in merge order, when more than one cursor reads
+    vector<shared_ptr<Lane> > lanes_;
+    int next_lane_;
+    // Records held back for shuffling
+    vector<shared_ptr<DatumView> > shuffle_buffer_;
 
     friend class DataReader;
 
@@ -66,7 +141,11 @@ class DataReader {
   // A source is uniquely identified by its layer name + path, in case
   // the same database is read from two different locations in the net.
   static inline string source_key(const LayerParameter& param) {
-    return param.name() + ":" + param.data_param().source();
+    string key = param.name() + ":" + param.data_param().source();
+    for (int i = 0; i < param.data_param().shard_size(); ++i) {
+      key += ":" + param.data_param().shard(i);
+    }
+    return key;
   }
 
   const shared_ptr<QueuePair> queue_pair_;
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_view.hpp"
 
 namespace caffe {
 
@@ -37,6 +38,17 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation to a Datum read by DataReader, reading
+   * the pixels in place when the view points into the database.
+   *
+   * @param datum
+   *    DatumView containing the data to be transformed.
+   * @param transformed_blob
+   *    This is destination blob. See data_layer.cpp for an example.
+   */
+  void Transform(const DatumView& datum, Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -98,6 +110,14 @@ class DataTransformer {
    *    Datum containing the data to be transformed.
    */
   vector<int> InferBlobShape(const Datum& datum);
+  /**
+   * @brief Infers the shape of transformed_blob will have when
+   *    the transformation is applied to the data.
+   *
+   * @param datum
+   *    DatumView containing the data to be transformed.
+   */
+  vector<int> InferBlobShape(const DatumView& datum);
   /**
    * @brief Infers the shape of transformed_blob will have when
    *    the transformation is applied to the data.
@@ -139,6 +159,15 @@ class DataTransformer {
   virtual int Rand(int n);
 
   void Transform(const Datum& datum, Dtype* transformed_data);
+  // Crops, mirrors, subtracts the mean from and scales the pixels of a
+  // datum_channels x datum_height x datum_width image of uint8_t or float.
+  template <typename Src>
+  void TransformPixels(const Src* pixels, int datum_channels,
+      int datum_height, int datum_width, Dtype* transformed_data);
+  void CheckTransformedShape(int datum_channels, int datum_height,
+      int datum_width, const Blob<Dtype>* transformed_blob) const;
+  vector<int> InferDatumShape(int datum_channels, int datum_height,
+      int datum_width) const;
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -38,7 +38,7 @@ class Layer {
    * layer.
    */
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param), is_shared_(false) {
+    : layer_param_(param), is_shared_(false), inference_only_(false) {
       // Set phase and copy blobs (if there are any).
       phase_ = param.phase();
       if (layer_param_.blobs_size() > 0) {
@@ -116,6 +116,15 @@ class Layer {
     is_shared_ = is_shared;
   }
 
+  /**
+   * @brief Set whether this layer only ever runs Forward, so that it need not
+   *        keep what only Backward uses. Net sets it before SetUp.
+   */
+  inline void set_inference_only(bool inference_only) {
+    inference_only_ = inference_only;
+  }
+  inline bool inference_only() const { return inference_only_; }
+
   /**
    * @brief Adjust the shapes of top blobs and internal buffers to accommodate
    *        the shapes of the bottom blobs.
@@ -431,6 +440,9 @@ class Layer {
   /** Whether this layer is actually shared by other nets*/
   bool is_shared_;
 
+  /** Whether this layer never runs Backward */
+  bool inference_only_;
+
   /** The mutex for sequential forward if this layer is shared */
   shared_ptr<boost::mutex> forward_mutex_;
 
@@ -31,14 +31,16 @@ class BaseConvolutionLayer : public Layer<Dtype> {
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // we just called weight_cpu_gemm with the same input. Subclasses that build
+  // col_buffer_ themselves also pass skip_im2col to forward/weight gemm, and
+  // skip_col2im to backward gemm to keep the column gradient in col_buffer_.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, bool skip_col2im = false);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, bool skip_im2col = false);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
 
 #ifndef CPU_ONLY
@@ -46,9 +48,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
       Dtype* output, bool skip_im2col = false);
   void forward_gpu_bias(Dtype* output, const Dtype* bias);
   void backward_gpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* col_output);
+      Dtype* col_output, bool skip_col2im = false);
   void weight_gpu_gemm(const Dtype* col_input, const Dtype* output, Dtype*
-      weights);
+      weights, bool skip_im2col = false);
   void backward_gpu_bias(Dtype* bias, const Dtype* input);
 #endif
 
@@ -93,6 +95,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool is_1x1_;
   bool force_nd_im2col_;
 
+  /// @brief One image worth of im2col columns (or their gradient).
+  Blob<Dtype> col_buffer_;
+
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
   inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
@@ -165,7 +170,6 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int col_offset_;
   int output_offset_;
 
-  Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
 };
 
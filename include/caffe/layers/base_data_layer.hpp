@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <boost/function.hpp>
+
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -12,6 +14,8 @@
 
 namespace caffe {
 
+class ThreadPool;
+
 /**
  * @brief Provides base for data layers that feed blobs to the Net.
  *
@@ -74,11 +78,28 @@ class BasePrefetchingDataLayer :
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
 
+  /**
+   * @brief Calls load_items(transformer, begin, end) on the transform
+   *        workers (transform_param.num_workers) over disjoint ranges of
+   *        items covering [0, num_items). Every worker always gets the same
+   *        range and its own DataTransformer, so batches do not depend on
+   *        the timing of the workers.
+   */
+  void ParallelLoad(int num_items, const boost::function<
+      void(DataTransformer<Dtype>*, int, int)>& load_items);
+  void LoadWorkerItems(int num_items, const boost::function<
+      void(DataTransformer<Dtype>*, int, int)>* load_items, int begin,
+      int end);
+
   Batch<Dtype> prefetch_[PREFETCH_COUNT];
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
 
   Blob<Dtype> transformed_data_;
+  /// One transformer per transform worker; the first is data_transformer_.
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  /// Runs the transform workers; NULL for a single worker.
+  shared_ptr<ThreadPool> transform_pool_;
 };
 
 }  // namespace caffe
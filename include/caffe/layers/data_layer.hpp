@@ -11,6 +11,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/image_cache.hpp"
 
 namespace caffe {
 
@@ -30,8 +31,17 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
+  /// Transforms the datums [begin, end) of a batch into their slots.
+  void TransformDatums(const vector<DatumView*>* datums, Dtype* top_data,
+      Dtype* top_label, DataTransformer<Dtype>* transformer, int begin,
+      int end);
+  /// Decodes an encoded datum, or takes it from cache_. Returns NULL if there
+  /// is no cache or the datum is not encoded.
+  shared_ptr<const CachedImage> DecodeCached(const DatumView& datum);
 
   DataReader reader_;
+  /// Decoded images of encoded datums; NULL unless image_cache is set.
+  shared_ptr<ImageCache> cache_;
 };
 
 }  // namespace caffe
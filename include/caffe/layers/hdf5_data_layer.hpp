@@ -7,23 +7,35 @@
 #include <vector>
 
 #include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 
 #include "caffe/layers/base_data_layer.hpp"
 
 namespace caffe {
 
+/// The blobs of one prefetched batch, one per top.
+template <typename Dtype>
+class HDF5Batch {
+ public:
+  vector<shared_ptr<Blob<Dtype> > > blobs_;
+};
+
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * Each top reads the dataset of the same name. The files are streamed in
+ * chunks of consecutive rows read with hyperslabs, so files need not fit in
+ * memory, and batches are prefetched on a background thread. With shuffling,
+ * the chunks of all files are visited in random order and the rows of
+ * several chunks are shuffled together (see HDF5DataParameter).
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public Layer<Dtype>, public InternalThread {
  public:
-  explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+  explicit HDF5DataLayer(const LayerParameter& param);
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -37,6 +49,9 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
 
+  // Double-buffers the batches: one is read while the other is used.
+  static const int PREFETCH_COUNT = 2;
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -46,15 +61,39 @@ class HDF5DataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+
+  virtual void InternalThreadEntry();
+  virtual void load_batch(HDF5Batch<Dtype>* batch);
+  /// Reads the next chunks of the epoch into rows_ and orders their rows.
+  virtual void LoadChunks();
+  void OpenHDF5File(int file);
+  void CloseHDF5File();
+
+  /// A run of consecutive rows of one file.
+  struct Chunk {
+    int file;
+    hsize_t begin;
+    hsize_t end;
+  };
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
-  unsigned int current_file_;
-  hsize_t current_row_;
-  std::vector<shared_ptr<Blob<Dtype> > > hdf_blobs_;
-  std::vector<unsigned int> data_permutation_;
-  std::vector<unsigned int> file_permutation_;
+  std::vector<Chunk> chunks_;
+  /// The order of the chunks in this epoch, and the next one to read.
+  std::vector<int> chunk_order_;
+  int current_chunk_;
+  /// The file open on the prefetch thread, or -1.
+  int current_file_;
+  hid_t file_id_;
+  /// The rows read by LoadChunks, one blob per top, and the order in which
+  /// the batches take them.
+  std::vector<shared_ptr<Blob<Dtype> > > rows_;
+  std::vector<int> row_order_;
+  int current_row_;
+
+  HDF5Batch<Dtype> prefetch_[PREFETCH_COUNT];
+  BlockingQueue<HDF5Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<HDF5Batch<Dtype>*> prefetch_full_;
 };
 
 }  // namespace caffe
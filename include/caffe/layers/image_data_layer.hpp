@@ -11,6 +11,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
 
 namespace caffe {
 
@@ -36,9 +37,21 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  /// Reads and transforms the images [begin, end) of a batch into their slots.
+  void LoadImages(const vector<std::pair<std::string, int> >* lines,
+      Dtype* top_data, Dtype* top_label, DataTransformer<Dtype>* transformer,
+      int begin, int end);
+#ifdef USE_OPENCV
+  /// Reads and resizes an image, or takes it from cache_. The result may
+  /// point into *cached, which must outlive it.
+  cv::Mat ReadImage(const string& filename,
+      shared_ptr<const CachedImage>* cached);
+#endif  // USE_OPENCV
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  /// Decoded images by filename; NULL unless image_cache is set.
+  shared_ptr<ImageCache> cache_;
 };
 
 
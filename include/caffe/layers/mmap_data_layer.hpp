@@ -0,0 +1,59 @@
+#ifndef CAFFE_MMAP_DATA_LAYER_HPP_
+#define CAFFE_MMAP_DATA_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mmap_tensor.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Provides data to the Net from a memory-mapped raw tensor file
+ *        (see MmapTensorReader), with no decoding.
+ *
+ * When the records need no transformation, are stored as Dtype and are read
+ * in order, the prefetched batches point straight at the mapped pages.
+ * Otherwise the records are copied, converted or transformed into the batch.
+ */
+template <typename Dtype>
+class MmapDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit MmapDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param), zero_copy_(false),
+        needs_transform_(false), pos_(0) {}
+  virtual ~MmapDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual inline const char* type() const { return "MmapData"; }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+  /// Whether batches point at the mapped records instead of copies.
+  inline bool zero_copy() const { return zero_copy_; }
+
+ protected:
+  virtual void load_batch(Batch<Dtype>* batch);
+  /// Copies or transforms the records of items [begin, end) into top_data.
+  void LoadRecords(Dtype* top_data, DataTransformer<Dtype>* transformer,
+      int begin, int end);
+
+  MmapTensorReader reader_;
+  bool zero_copy_;
+  bool needs_transform_;
+  /// The records of the batch being loaded, and the order of this epoch.
+  vector<int> batch_records_;
+  vector<int> order_;
+  int pos_;
+  /// Memory for batches that cannot point at the mapped records.
+  Blob<Dtype> buffers_[BasePrefetchingDataLayer<Dtype>::PREFETCH_COUNT];
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_MMAP_DATA_LAYER_HPP_
@@ -0,0 +1,69 @@
+#ifndef CAFFE_NEIGHBOUR_CONV_LAYER_HPP_
+#define CAFFE_NEIGHBOUR_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/base_conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Computes the same tops as a NeighbourLayer followed by a
+ *        ConvolutionLayer with kernel and stride equal to the neighbourhood
+ *        size, without materializing the neighbourhood differences.
+ *
+ *   The kernel_size^2 times larger NeighbourLayer tops are exactly the
+ *   im2col matrices of that convolution, so this layer writes the differences
+ *   of one image straight into the column buffer and hands it to the usual
+ *   GEMM. Like a ConvolutionLayer with two bottoms, both tops share one set
+ *   of filters. The bottom gradient follows NeighbourLayer, i.e. each bottom
+ *   element receives the mean of the column gradients it contributed to.
+ */
+template <typename Dtype>
+class NeighbourConvolutionLayer : public BaseConvolutionLayer<Dtype> {
+ public:
+  /**
+   * @param param provides NeighbourParameter neigh_param, giving the
+   *    neighbourhood kernel_size, stride and dilation, and
+   *    ConvolutionParameter convolution_param with the filter options
+   *    num_output, bias_term, group, weight_filler and bias_filler.
+   *    kernel_size and stride of convolution_param are derived from
+   *    neigh_param and may be left unset; pad and dilation must stay unset.
+   */
+  explicit NeighbourConvolutionLayer(const LayerParameter& param)
+      : BaseConvolutionLayer<Dtype>(param) {}
+
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "NeighbourConvolution"; }
+  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  virtual inline int ExactNumTopBlobs() const { return 2; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual inline bool reverse_dimensions() { return false; }
+  virtual void compute_output_shape();
+
+  int neigh_kernel_, neigh_stride_, neigh_dilation_;
+  int height_, width_;
+  /// Number of column gradients summed into each bottom position.
+  Blob<Dtype> neighbour_count_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NEIGHBOUR_CONV_LAYER_HPP_
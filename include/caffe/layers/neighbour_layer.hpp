@@ -13,12 +13,23 @@
 namespace caffe {
 
 
+/**
+ * @brief Computes cross-input neighbourhood differences of two feature maps.
+ *
+ * For each sampled position (h, w) and window tap (y, x), top[0] holds
+ * bottom[0](h, w) - bottom[1](h + (y - r) * dilation, w + (x - r) * dilation)
+ * with r = (kernel_size - 1) / 2 and zero padding, laid out as a
+ * kernel_size x kernel_size block per position; top[1] swaps the bottoms.
+ * Positions are sampled every NeighbourParameter::stride pixels.
+ */
 template <typename Dtype>
 class NeighbourLayer : public Layer<Dtype> {
  public:
  explicit NeighbourLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
      
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
       
@@ -40,6 +51,9 @@ class NeighbourLayer : public Layer<Dtype> {
   int channels_i, channels_j;
   int height_i, width_i;
   int height_j, width_j;
+  int kernel_size_, stride_, dilation_;
+  /// Number of sampled positions along each axis.
+  int out_height_, out_width_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,74 @@
+#ifndef CAFFE_NORMALIZED_TRIPLET_LOSS_LAYER_HPP_
+#define CAFFE_NORMALIZED_TRIPLET_LOSS_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/loss_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Triplet hinge loss on L2-normalized (anchor, positive, negative)
+ *        embeddings, fusing the normalization into the loss.
+ *
+ * With x' = x / ||x|| and the margin alpha read from threshold_param, as
+ * TripletLossLayer does, the EUCLIDEAN form is @f$ \frac{1}{2N} \sum_n
+ * \max(0, \alpha + ||a'_n - p'_n||^2 - ||a'_n - n'_n||^2) @f$, i.e.
+ * TripletLossLayer applied to the normalized bottoms, and the COSINE form
+ * is @f$ \frac{1}{N} \sum_n \max(0, \alpha + (1 - a'_n \cdot p'_n) -
+ * (1 - a'_n \cdot n'_n)) @f$. Both only depend on the norms and the two
+ * dot products of each sample, which one pass over the bottoms computes;
+ * the backward pass goes through the normalization analytically, so no
+ * embedding-sized intermediates are kept.
+ */
+template <typename Dtype>
+class NormalizedTripletLossLayer : public LossLayer<Dtype> {
+ public:
+  explicit NormalizedTripletLossLayer(const LayerParameter& param)
+      : LossLayer<Dtype>(param) {}
+
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+                          const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+                       const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "NormalizedTripletLoss"; }
+  virtual inline int ExactNumBottomBlobs() const { return 3; }
+  virtual inline bool AllowForceBackward(const int bottom_index) const {
+    return true;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+                           const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+                            const vector<bool>& propagate_down,
+                            const vector<Blob<Dtype>*>& bottom);
+
+  /// Fills the per-sample norms and similarities for samples [begin, end).
+  void ForwardSamples(const Dtype* const* data, int begin, int end);
+  /// Writes the gradients of samples [begin, end) into the non-NULL diffs.
+  void BackwardSamples(const Dtype* const* data, Dtype* const* diff,
+      Dtype scale, int begin, int end);
+
+  Dtype alpha_;
+  /// Weight of the similarity difference inside the hinge: 2 for EUCLIDEAN
+  /// (||x' - y'||^2 = 2 - 2 x'.y'), 1 for COSINE.
+  Dtype distance_scale_;
+  int batch_size_;
+  int vec_dimension_;
+  /// Per-sample norms of anchor, positive and negative.
+  vector<Dtype> norm_anchor_, norm_positive_, norm_negative_;
+  /// Per-sample cosine similarities a'.p' and a'.n'.
+  vector<Dtype> sim_positive_, sim_negative_;
+  /// Per-sample hinge argument before clipping.
+  vector<Dtype> vec_loss_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NORMALIZED_TRIPLET_LOSS_LAYER_HPP_
@@ -0,0 +1,82 @@
+#ifndef CAFFE_TRIPLET_DATA_LAYER_HPP_
+#define CAFFE_TRIPLET_DATA_LAYER_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_view.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Provides batches for metric learning, sampled by label from a
+ *        database of Datums (data_param.source and data_param.backend).
+ *
+ * The database is indexed by label once at setup. With PK sampling every
+ * batch holds num_identities distinct labels times num_instances records,
+ * grouped by label, for TripletLossLayer's online mining. With TRIPLETS
+ * sampling the tops are aligned anchor, positive and negative records.
+ * Sampling runs on the prefetch thread and is deterministic under
+ * Caffe::set_random_seed.
+ */
+template <typename Dtype>
+class TripletDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit TripletDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param) {}
+  virtual ~TripletDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual inline const char* type() const { return "TripletData"; }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 4; }
+
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// Number of records of each label in the database.
+  inline int num_records(int label) const {
+    return keys_by_label_.find(label)->second.size();
+  }
+  inline const vector<int>& labels() const { return labels_; }
+
+ protected:
+  virtual void load_batch(Batch<Dtype>* batch);
+  /// Fills keys_ with the records of a batch, in top order.
+  void SampleIdentities();
+  void SampleTriplets();
+  /// Returns a random record of label, other than the record except.
+  const string& SampleRecord(int label, const string* except);
+  /// Transforms the records [begin, end) of a batch into their slots.
+  void TransformDatums(Dtype* top_data, DataTransformer<Dtype>* transformer,
+      int begin, int end);
+
+  /// Opened by the prefetch thread, which reads the records by key.
+  shared_ptr<db::DB> db_;
+  shared_ptr<db::Cursor> cursor_;
+  TripletDataParameter_Sampling sampling_;
+  /// Records per batch: P x K, or three per triplet.
+  int batch_items_;
+  /// Database keys of every label, and the labels in increasing order.
+  std::map<int, vector<string> > keys_by_label_;
+  vector<int> labels_;
+  /// Labels with at least two records, which can provide positives.
+  vector<int> anchor_labels_;
+  /// The records of the batch being loaded.
+  vector<const string*> keys_;
+  vector<shared_ptr<DatumView> > datums_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_TRIPLET_DATA_LAYER_HPP_
@@ -11,6 +11,16 @@
 
 namespace caffe {
 
+/**
+ * @brief Computes the triplet hinge loss
+ *        @f$ \frac{1}{2T} \sum_t \max(0, \alpha + ||a_t - p_t||^2 -
+ *        ||a_t - n_t||^2) @f$ with margin alpha from threshold_param.
+ *
+ * By default the T = N triplets come in as three (N x D) bottoms. With
+ * TripletParameter::mining set, the bottoms are one (N x D) embedding blob
+ * and N labels instead: all pairwise squared distances are computed with a
+ * single GEMM and the batch-hard or semi-hard triplets are selected from them.
+ */
 template <typename Dtype>
 class TripletLossLayer : public LossLayer<Dtype> {
  public:
@@ -21,8 +31,14 @@ class TripletLossLayer : public LossLayer<Dtype> {
                const vector<Blob<Dtype>*>& top);
 
   inline const char* type() const { return "TripletLoss"; }
-  inline int ExactNumBottomBlobs() const { return 3; }
-  inline bool AllowForceBackward(const int bottom_index) const { return true; }
+  inline int ExactNumBottomBlobs() const { return -1; }
+  inline int MinBottomBlobs() const { return 2; }
+  inline int MaxBottomBlobs() const { return 3; }
+  /// In mining mode the labels in bottom[1] take no gradient.
+  inline bool AllowForceBackward(const int bottom_index) const {
+    return this->layer_param_.triplet_param().mining() ==
+        TripletParameter_Mining_NONE || bottom_index != 1;
+  }
 
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
                           const vector<Blob<Dtype>*>& top);
@@ -35,12 +51,23 @@ class TripletLossLayer : public LossLayer<Dtype> {
                             const vector<bool>& propagate_down,
                             const vector<Blob<Dtype>*>& bottom);
 
+  /// Picks the triplets_ of the batch from the distance matrix dist_.
+  void MineTriplets(const Dtype* label);
+
   Blob<Dtype> diff_same_class_;
   Blob<Dtype> diff_diff_class_;
   Dtype alpha_;
   vector<Dtype> vec_loss_;
   int batch_size_;
   int vec_dimension_;
+
+  TripletParameter_Mining mining_;
+  /// Gram matrix of the embeddings, then their pairwise squared distances.
+  Blob<Dtype> dist_;
+  /// Coefficients C with embedding gradient C * embeddings.
+  Blob<Dtype> coeff_;
+  /// (anchor, positive, negative) indices of the mined triplets.
+  vector<int> triplets_;
 };
 
 }  // namespace caffe
@@ -1,5 +1,5 @@
-#ifndef CAFFE_TRIPLET_LOSS_LAYER_HPP_
-#define CAFFE_TRIPLET_LOSS_LAYER_HPP_
+#ifndef CAFFE_TRIPLET_LOSS_REG_LAYER_HPP_
+#define CAFFE_TRIPLET_LOSS_REG_LAYER_HPP_
 
 #include <vector>
 
@@ -11,6 +11,17 @@
 
 namespace caffe {
 
+/**
+ * @brief Triplet hinge loss with a regularizer pulling each embedding
+ *        towards a reference vector:
+ *        @f$ \frac{1}{N} \sum_n \max(0, \alpha + ||a_n - p_n||^2 -
+ *        ||a_n - n_n||^2) + \gamma (||a_n - a'_n||^2 + ||p_n - p'_n||^2 +
+ *        ||n_n - n'_n||^2) @f$.
+ *
+ * Bottoms are (a, p, n, a', p', n'); the references a', p', n' are treated
+ * as constants. Each sample is handled in a single pass over the six
+ * bottoms and only per-sample scalars are kept for the backward pass.
+ */
 template <typename Dtype>
 class TripletLossRegLayer : public LossLayer<Dtype> {
  public:
@@ -22,6 +33,9 @@ class TripletLossRegLayer : public LossLayer<Dtype> {
 
   inline const char* type() const { return "TripletLossReg"; }
   inline int ExactNumBottomBlobs() const { return 6; }
+  inline bool AllowForceBackward(const int bottom_index) const {
+    return bottom_index < 3;
+  }
   
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
                           const vector<Blob<Dtype>*>& top);
@@ -34,15 +48,20 @@ class TripletLossRegLayer : public LossLayer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
                             const vector<bool>& propagate_down,
                             const vector<Blob<Dtype>*>& bottom);
-  
-  Blob<Dtype> diff_same_class_;
-  Blob<Dtype> diff_diff_class_;
-  Blob<Dtype> lab_anch_class_;
-  Blob<Dtype> lab_pos_class_;
-  Blob<Dtype> lab_neg_class_;
+
+  /// Fills vec_loss_ and vec_diff_ for samples [begin, end) of the six
+  /// bottom data pointers.
+  void ForwardSamples(const Dtype* const* data, int begin, int end);
+  /// Writes the gradients of samples [begin, end) into the non-NULL diffs of
+  /// bottoms 0 to 2.
+  void BackwardSamples(const Dtype* const* data, Dtype* const* diff,
+      Dtype scale, int begin, int end);
+
   Dtype alpha_;
   Dtype gamma_;
+  /// Per-sample hinge argument alpha + d(a, p) - d(a, n), before clipping.
   vector<Dtype> vec_loss_;
+  /// Per-sample regularizer sum.
   vector<Dtype> vec_diff_;
   int batch_size_;
   int vec_dimension_;
@@ -50,4 +69,4 @@ class TripletLossRegLayer : public LossLayer<Dtype> {
 
 }  // namespace caffe
 
-#endif  // CAFFE_TRIPLET_LOSS_LAYER_HPP_
+#endif  // CAFFE_TRIPLET_LOSS_REG_LAYER_HPP_
@@ -36,6 +36,11 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   virtual unsigned int PrefetchRand();
   virtual void load_batch(Batch<Dtype>* batch);
+  /// Crops and warps the sampled windows [begin, end) of a batch into their
+  /// slots, setting loaded[i] for each window whose image could be read.
+  void LoadWindows(const vector<vector<float> >* windows,
+      const vector<int>* mirrors, const Dtype* mean, Dtype* top_data,
+      Dtype* top_label, vector<int>* loaded, int begin, int end);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
@@ -14,6 +14,9 @@
 
 namespace caffe {
 
+class DagExecutor;
+class ThreadPool;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -191,6 +194,12 @@ class Net {
   const map<string, int>& param_names_index() const {
     return param_names_index_;
   }
+  inline const vector<vector<int> >& param_id_vecs() const {
+    return param_id_vecs_;
+  }
+  inline const vector<int>& learnable_param_ids() const {
+    return learnable_param_ids_;
+  }
   inline const vector<int>& param_owners() const { return param_owners_; }
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
@@ -217,6 +226,60 @@ class Net {
 
   void set_debug_info(const bool value) { debug_info_ = value; }
 
+  /// @brief Whether the net was built for Forward only.
+  inline bool inference_only() const { return inference_only_; }
+
+  /// @brief Invoked after the Backward of each layer that needs it, on the
+  ///        thread that ran the layer, with the learnable params whose diffs
+  ///        the layer made final: no other layer left in the pass
+  ///        accumulates into them, counting every layer a shared param has.
+  class Callback {
+   protected:
+    virtual void run(int layer, const vector<int>& learnable_param_ids) = 0;
+
+    template <typename T>
+    friend class Net;
+  };
+  const vector<Callback*>& after_backward() const { return after_backward_; }
+  void add_after_backward(Callback* value) {
+    after_backward_.push_back(value);
+  }
+
+  /// @brief Bytes of activation memory the memory plan covers, without and
+  ///        with sharing; both 0 without a plan.
+  inline size_t unplanned_memory() const { return unplanned_memory_; }
+  inline size_t planned_memory() const { return planned_memory_; }
+
+  /**
+   * @brief Returns a blob whose data and diff hold those of all learnable
+   *        params, or NULL if they were not flattened or in GPU mode.
+   *
+   * Learnable param i starts at flat_param_offsets()[i], aligned to
+   * kFlatParamAlignment bytes; the padding between params stays zero. The
+   * params view host memory only, so use the blob in CPU mode. Also NULL
+   * once a param no longer views the arena, e.g. after sharing another
+   * net's weights or being reshaped to a different count.
+   */
+  Blob<Dtype>* flat_params();
+  inline const vector<int>& flat_param_offsets() const {
+    return flat_param_offsets_;
+  }
+  static const int kFlatParamAlignment = 64;
+  /**
+   * @brief Makes the learnable params view the data of other's flat params,
+   *        which must be laid out alike, while keeping their own diffs.
+   *
+   * Lets replicas of a net share one copy of the weights in data
+   * parallelism on the CPU. The params keep other's arena alive.
+   */
+  void ShareFlatParamData(Net* other);
+  /**
+   * @brief Moves the data and diffs of the learnable params into one arena
+   *        each. Init calls this when flat_params is set; data parallelism
+   *        on the CPU calls it regardless. Does nothing once flattened.
+   */
+  void FlattenParams();
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -242,6 +305,22 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Finds the layers that may run concurrently and sets up the
+  ///        executor, thread pools and random streams for layer_threads.
+  void InitLayerSchedule(const NetParameter& param);
+  /// @brief Lets the blobs with disjoint lifetimes share memory arenas, as
+  ///        set by memory_plan. Init logs the plan; Reshape calls this
+  ///        again with verbose false, which logs it only in debug builds.
+  void PlanMemory(bool verbose);
+  /// @brief Whether Forward and Backward go through layer_executor_.
+  bool UseLayerExecutor() const;
+  /// @brief Runs Forward of one layer with its own thread pool and random
+  ///        stream, if any, on the calling thread.
+  Dtype ForwardLayer(int layer_id);
+  void ForwardLayerInto(int layer_id, vector<Dtype>* layer_losses);
+  /// @brief Runs Backward of one layer if it needs it, like ForwardLayer.
+  void BackwardLayer(int layer_id);
+
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -306,6 +385,34 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether the net only runs Forward; see NetParameter.inference_only.
+  bool inference_only_;
+  /// Layers that have to wait for each layer in Forward and in Backward.
+  vector<vector<int> > forward_successors_;
+  vector<vector<int> > backward_successors_;
+  /// Layers in the same group never run Backward at the same time; -1 when
+  /// unconstrained. Used for parameter sharing unless deterministic.
+  vector<int> backward_exclusive_group_;
+  /// Runs independent layers concurrently; NULL when layer_threads is 1.
+  shared_ptr<DagExecutor> layer_executor_;
+  /// Thread pools of the layers that set num_threads, or NULL.
+  vector<shared_ptr<ThreadPool> > layer_pools_;
+  /// Random streams of the layers in deterministic scheduling, or NULL.
+  vector<shared_ptr<Caffe::RNG> > layer_rngs_;
+  /// How blobs share memory, and the arenas they share.
+  NetParameter_MemoryPlan memory_plan_;
+  vector<shared_ptr<SyncedMemory> > memory_arenas_;
+  size_t unplanned_memory_;
+  size_t planned_memory_;
+  /// The arena of the learnable params, if flattened, and the memory its
+  /// aligned data and diff live in.
+  shared_ptr<Blob<Dtype> > flat_params_;
+  vector<int> flat_param_offsets_;
+  vector<shared_ptr<SyncedMemory> > flat_param_memory_;
+  vector<Callback*> after_backward_;
+  /// Layers of the current backward pass yet to accumulate into each
+  /// learnable param, counted only with after_backward_ callbacks.
+  vector<int> pending_param_layers_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
   DISABLE_COPY_AND_ASSIGN(Net);
@@ -3,6 +3,7 @@
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -13,6 +14,9 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/tcp_ring.hpp"
+
+namespace boost { class barrier; class mutex; }
 
 namespace caffe {
 
@@ -116,6 +120,99 @@ class P2PSync : public GPUParams<Dtype>, public Solver<Dtype>::Callback,
   using Params<Dtype>::diff_;
 };
 
+// Synchronous data parallelism between solver replicas on CPU threads of one
+// process. The replicas' nets view the weights of the root solver's flat
+// params, so the root's update needs no broadcast. Each replica sums one slice
+// of all replicas' flat diffs into the root's diffs once gradients are ready.
+template<typename Dtype>
+class CPUSync : public Solver<Dtype>::Callback, public InternalThread {
+ public:
+  explicit CPUSync(shared_ptr<Solver<Dtype> > root_solver,
+                   CPUSync<Dtype>* root = NULL, int rank = 0);
+  virtual ~CPUSync() {}
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  // Trains with num_workers replicas, each on its own share of the threads
+  // of the global pool. Caffe::solver_count() must be num_workers when the
+  // root solver is created, so that data readers deal records to every one.
+  void Run(int num_workers);
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+
+  void InternalThreadEntry();
+
+  CPUSync<Dtype>* root_;
+  const int rank_;
+  const int initial_iter_;
+  shared_ptr<Solver<Dtype> > solver_;
+  // The flat diffs of this replica's net.
+  Dtype* diff_;
+  int size_;
+  int threads_per_worker_;
+  // Held by the root, and shared by all replicas.
+  vector<CPUSync<Dtype>*> syncs_;
+  vector<shared_ptr<CPUSync<Dtype> > > workers_;
+  shared_ptr<boost::barrier> barrier_;
+
+DISABLE_COPY_AND_ASSIGN(CPUSync);
+};
+
+// Synchronous data parallelism between processes, possibly on different
+// machines, that each train a full replica on their own data. Rank 0's
+// weights are broadcast at the start, and gradients are summed around a
+// TCPRing in buckets of consecutive flat params. A communication thread
+// reduces each bucket as soon as Backward has produced all of its gradients,
+// so that communication overlaps the rest of Backward.
+template<typename Dtype>
+class TCPSync : public Solver<Dtype>::Callback, public InternalThread {
+ public:
+  TCPSync(shared_ptr<Solver<Dtype> > solver, const vector<string>& hosts,
+          int rank, size_t bucket_bytes);
+  virtual ~TCPSync();
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  // Trains, reducing gradients on a thread of their own.
+  void Run();
+
+ protected:
+  void on_start();
+  void on_param_gradients_ready(const vector<int>& param_ids);
+  void on_gradients_ready();
+
+  void InternalThreadEntry();
+  // Hands a bucket to the communication thread; call under mutex_.
+  void Ready(int bucket);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  TCPRing ring_;
+  // The flat diffs of the net.
+  Dtype* diff_;
+  // Bucket b covers [bucket_begin_[b], bucket_end_[b]) of the flat diffs.
+  // Buckets are numbered from the last learnable param, in the order
+  // Backward completes them.
+  vector<int> bucket_begin_;
+  vector<int> bucket_end_;
+  vector<int> param_bucket_;
+  // Learnable params in each bucket that some layer computes a gradient for.
+  vector<int> bucket_params_;
+  // Countdowns of the current iteration, under mutex_.
+  shared_ptr<boost::mutex> mutex_;
+  vector<int> pending_params_;
+  vector<bool> queued_;
+  BlockingQueue<int> ready_;
+  BlockingQueue<int> reduced_;
+
+DISABLE_COPY_AND_ASSIGN(TCPSync);
+};
+
 }  // namespace caffe
 
 #endif
@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "caffe/solver.hpp"
+#include "caffe/util/solver_update.hpp"
 
 namespace caffe {
 
@@ -31,6 +32,18 @@ class SGDSolver : public Solver<Dtype> {
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
   virtual void ClipGradients();
+  /// The factor that scales the gradients down to clip_gradients, or 1.
+  Dtype GetClipScale();
+  /// Whether ApplyUpdate takes the fused CPU path, which skips Normalize,
+  /// Regularize and ComputeUpdateValue. True only for the solvers in this
+  /// file themselves: their subclasses take the per-param path unless they
+  /// override this, along with update_type and GetParamUpdate.
+  virtual bool fused_update() const;
+  /// The rule of the fused CPU update.
+  virtual inline SolverUpdateType update_type() const { return SGD_UPDATE; }
+  /// Describes a param for the fused CPU update (caffe_cpu_solver_update).
+  virtual void GetParamUpdate(int param_id, Dtype rate,
+      SolverParamUpdate<Dtype>* update);
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
@@ -56,6 +69,9 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline SolverUpdateType update_type() const {
+    return NESTEROV_UPDATE;
+  }
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -71,6 +87,7 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline SolverUpdateType update_type() const { return ADAGRAD_UPDATE; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -91,6 +108,7 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline SolverUpdateType update_type() const { return RMSPROP_UPDATE; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -115,6 +133,11 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline SolverUpdateType update_type() const {
+    return ADADELTA_UPDATE;
+  }
+  virtual void GetParamUpdate(int param_id, Dtype rate,
+      SolverParamUpdate<Dtype>* update);
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -139,6 +162,9 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline SolverUpdateType update_type() const { return ADAM_UPDATE; }
+  virtual void GetParamUpdate(int param_id, Dtype rate,
+      SolverParamUpdate<Dtype>* update);
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
@@ -78,6 +78,11 @@ class Solver {
   class Callback {
    protected:
     virtual void on_start() = 0;
+    // Called during the last Backward of an iteration, on the thread that
+    // ran a layer, with learnable params whose gradients are now final, so
+    // that they can be reduced or updated while Backward goes on. Calls for
+    // different layers may come from several threads at once.
+    virtual void on_param_gradients_ready(const vector<int>& param_ids) {}
     virtual void on_gradients_ready() = 0;
 
     template <typename T>
@@ -85,6 +90,9 @@ class Solver {
   };
   const vector<Callback*>& callbacks() const { return callbacks_; }
   void add_callback(Callback* value) {
+    if (callbacks_.empty()) {
+      net_->add_after_backward(&param_gradients_relay_);
+    }
     callbacks_.push_back(value);
   }
 
@@ -109,12 +117,27 @@ class Solver {
   void DisplayOutputBlobs(const int net_id);
   void UpdateSmoothedLoss(Dtype loss, int start_iter, int average_loss);
 
+  // Passes the params the net made final to the callbacks.
+  class ParamGradientsRelay : public Net<Dtype>::Callback {
+   public:
+    explicit ParamGradientsRelay(Solver* solver) : solver_(solver) {}
+
+   protected:
+    void run(int layer, const vector<int>& learnable_param_ids);
+
+    Solver* solver_;
+  };
+
   SolverParameter param_;
   int iter_;
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
   vector<Callback*> callbacks_;
+  ParamGradientsRelay param_gradients_relay_;
+  // Whether the running ForwardBackward is the last of the iteration, after
+  // which the gradients are final.
+  bool last_backward_;
   vector<Dtype> losses_;
   Dtype smoothed_loss_;
 
@@ -55,6 +55,8 @@ class SyncedMemory {
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
+  /// Views data inside owner's host memory, keeping owner alive.
+  void set_cpu_data(void* data, const shared_ptr<SyncedMemory>& owner);
   const void* gpu_data();
   void set_gpu_data(void* data);
   void* mutable_cpu_data();
@@ -78,6 +80,7 @@ class SyncedMemory {
   bool cpu_malloc_use_cuda_;
   bool own_gpu_data_;
   int gpu_device_;
+  shared_ptr<SyncedMemory> cpu_owner_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,51 @@
+#ifndef CAFFE_UTIL_DAG_EXECUTOR_HPP_
+#define CAFFE_UTIL_DAG_EXECUTOR_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs the nodes of a directed acyclic graph on a fixed number of
+ *        threads, starting each node once all of its predecessors are done.
+ *
+ * Among the nodes that are ready, the one with the lowest rank is started
+ * first. Nodes that share a non-negative exclusive group never run at the
+ * same time, in whatever order they become ready.
+ */
+class DagExecutor {
+ public:
+  explicit DagExecutor(int num_threads);
+
+  inline int num_threads() const { return pool_.num_threads(); }
+
+  /**
+   * @brief Calls run(i) for every node i with active[i] set.
+   *
+   * @param successors successors[i] lists the nodes that must wait for i.
+   *        Edges from or to inactive nodes are ignored.
+   * @param rank scheduling priority of each node; lower starts first.
+   * @param exclusive_group group of each node, or -1 for none.
+   */
+  void Run(const vector<vector<int> >& successors, const vector<bool>& active,
+      const vector<int>& rank, const vector<int>& exclusive_group,
+      const boost::function<void(int)>& run);
+
+ protected:
+  class State;
+
+  void Worker(State* state, int begin, int end);
+
+  ThreadPool pool_;
+
+DISABLE_COPY_AND_ASSIGN(DagExecutor);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DAG_EXECUTOR_HPP_
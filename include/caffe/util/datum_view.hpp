@@ -0,0 +1,71 @@
+#ifndef CAFFE_UTIL_DATUM_VIEW_HPP_
+#define CAFFE_UTIL_DATUM_VIEW_HPP_
+
+#include <stddef.h>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+namespace db { class Cursor; }
+
+/**
+ * @brief A Datum read from a database, either as a view of its serialized
+ *        bytes or, as a fallback, as a fully parsed Datum.
+ *
+ * Parse reads the header fields of a serialized Datum and points data() at
+ * its pixel bytes in place, so a record held in a memory-mapped database is
+ * neither copied nor allocated for. Records the view cannot express, those
+ * with float_data or an encoded image, are parsed into datum() instead.
+ */
+class DatumView {
+ public:
+  DatumView()
+      : channels_(0), height_(0), width_(0), label_(0), data_(NULL),
+        data_size_(0), has_datum_(false) {}
+
+  /// @brief Views the serialized Datum in buffer, which must outlive the
+  ///        view. Returns false, leaving the view empty, if the record has
+  ///        float_data, is encoded or cannot be read.
+  bool Parse(const char* buffer, size_t size);
+  /// @brief Parses the serialized Datum in buffer into datum().
+  void ParseDatum(const char* buffer, size_t size);
+  /// @brief Reads the record at the cursor, in place when the backend can
+  ///        view its values, and otherwise from a copy.
+  void Read(db::Cursor* cursor);
+  /// @brief Exchanges the contents of two views without copying pixels.
+  void Swap(DatumView* other);
+
+  /// @brief Whether the fields live in datum() rather than in the view.
+  inline bool has_datum() const { return has_datum_; }
+  inline const Datum& datum() const { return datum_; }
+
+  inline int channels() const {
+    return has_datum_ ? datum_.channels() : channels_;
+  }
+  inline int height() const { return has_datum_ ? datum_.height() : height_; }
+  inline int width() const { return has_datum_ ? datum_.width() : width_; }
+  inline int label() const { return has_datum_ ? datum_.label() : label_; }
+  /// @brief The uint8 pixels of a viewed record; check has_datum() first.
+  inline const char* data() const { return data_; }
+  inline size_t data_size() const { return data_size_; }
+
+ protected:
+  void Clear();
+
+  int channels_;
+  int height_;
+  int width_;
+  int label_;
+  const char* data_;
+  size_t data_size_;
+  bool has_datum_;
+  Datum datum_;
+
+  DISABLE_COPY_AND_ASSIGN(DatumView);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DATUM_VIEW_HPP_
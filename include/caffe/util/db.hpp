@@ -16,8 +16,15 @@ class Cursor {
   virtual ~Cursor() { }
   virtual void SeekToFirst() = 0;
   virtual void Next() = 0;
+  /// @brief Moves to the first key not less than key.
+  virtual void Seek(const string& key) = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  /// @brief Points *data at the current value without copying it. Backends
+  ///        whose values stay in memory for the lifetime of the cursor, such
+  ///        as a memory-mapped LMDB, return true; the others return false
+  ///        and the value must be copied with value().
+  virtual bool value_view(const char** data, size_t* size) { return false; }
   virtual bool valid() = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
@@ -27,6 +27,11 @@ class LMDBCursor : public Cursor {
   }
   virtual void SeekToFirst() { Seek(MDB_FIRST); }
   virtual void Next() { Seek(MDB_NEXT); }
+  virtual void Seek(const string& key) {
+    mdb_key_.mv_size = key.size();
+    mdb_key_.mv_data = const_cast<char*>(key.data());
+    Seek(MDB_SET_RANGE);
+  }
   virtual string key() {
     return string(static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size);
   }
@@ -34,6 +39,13 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  // Values live in the read-only memory map, and stay valid until the read
+  // transaction ends with the cursor.
+  virtual bool value_view(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+    return true;
+  }
   virtual bool valid() { return valid_; }
 
  private:
@@ -2,14 +2,28 @@
 #define CAFFE_UTIL_HDF5_H_
 
 #include <string>
+#include <vector>
 
 #include "hdf5/serial/hdf5.h"
 #include "hdf5/serial/hdf5_hl.h"
 
 #include "caffe/blob.hpp"
 
+namespace boost { class recursive_mutex; }
+
 namespace caffe {
 
+/**
+ * @brief Serializes HDF5 calls, as the library is not thread-safe unless
+ *        built to be and prefetching layers read files off the main thread.
+ *        The helpers below take it; code calling libhdf5 directly must hold
+ *        it as well. It is recursive, so holders may call the helpers.
+ */
+boost::recursive_mutex& hdf5_mutex();
+
+std::vector<hsize_t> hdf5_get_dataset_shape(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -20,6 +34,15 @@ void hdf5_load_nd_dataset(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob);
 
+/**
+ * @brief Reads rows [begin, end) of the first axis of a dataset into data,
+ *        without loading the rest of the dataset.
+ */
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+    hid_t file_id, const char* dataset_name_, hsize_t begin, hsize_t end,
+    Dtype* data);
+
 template <typename Dtype>
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob,
@@ -0,0 +1,102 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace boost { class mutex; }
+#ifdef USE_OPENCV
+namespace cv { class Mat; }
+#endif  // USE_OPENCV
+
+namespace caffe {
+
+/// A decoded 8-bit image, with its pixels in OpenCV (HWC, BGR) order.
+struct CachedImage {
+  int channels;
+  int height;
+  int width;
+  string data;
+  /// Set by callers whose keys may collide, e.g. a second digest of the
+  /// encoded bytes, to verify a hit; 0 otherwise.
+  uint64_t check;
+};
+
+/**
+ * @brief Caches decoded images by key so that data layers decode each image
+ *        once rather than every epoch.
+ *
+ * Images are held in memory up to ImageCacheParameter.memory_bytes, evicting
+ * the least recently used ones. Evicted images can spill to a local scratch
+ * file mapped into memory, which keeps them until it holds spill_bytes.
+ * The cache may be used from several threads.
+ */
+class ImageCache {
+ public:
+  explicit ImageCache(const ImageCacheParameter& param);
+  ~ImageCache();
+
+  /// Returns the image cached under key, or NULL on a miss.
+  shared_ptr<const CachedImage> Get(const string& key);
+  /// Caches image under key, evicting the least recently used images.
+  void Put(const string& key, const shared_ptr<const CachedImage>& image);
+
+  uint64_t hits() const;
+  uint64_t misses() const;
+  /// The bytes of the images held in memory and in the spill file.
+  size_t memory_bytes() const;
+  size_t spill_bytes() const;
+  /// Hits, misses and sizes, for the prefetch logs.
+  string Stats() const;
+
+ protected:
+  struct Entry {
+    shared_ptr<const CachedImage> image;
+    std::list<string>::iterator lru;
+  };
+  struct SpillEntry {
+    int channels;
+    int height;
+    int width;
+    uint64_t check;
+    size_t offset;
+    size_t size;
+  };
+
+  /// Moves an image into the spill file if it has room; else drops it.
+  void Spill(const string& key, const CachedImage& image);
+
+  const size_t memory_capacity_;
+  size_t spill_capacity_;
+  size_t memory_bytes_;
+  size_t spill_bytes_;
+  uint64_t hits_;
+  uint64_t misses_;
+  /// Keys in memory, most recently used first.
+  std::list<string> lru_;
+  std::map<string, Entry> entries_;
+  std::map<string, SpillEntry> spilled_;
+  char* spill_;
+  shared_ptr<boost::mutex> mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+#ifdef USE_OPENCV
+/// Copies a decoded 8-bit image into a CachedImage.
+shared_ptr<const CachedImage> CVMatToCachedImage(const cv::Mat& cv_img,
+    uint64_t check = 0);
+/// Wraps the pixels of a cached image, which must outlive the result.
+cv::Mat CachedImageToCVMat(const CachedImage& image);
+#endif  // USE_OPENCV
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
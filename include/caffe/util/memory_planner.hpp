@@ -0,0 +1,54 @@
+#ifndef CAFFE_UTIL_MEMORY_PLANNER_HPP_
+#define CAFFE_UTIL_MEMORY_PLANNER_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Assigns buffers with known lifetimes to shared arenas, so that the
+ *        buffers in one arena are never live at the same time.
+ *
+ * Lifetimes are closed ranges of steps. Buffers are placed from the largest
+ * down, each into the best fitting arena it does not overlap with, which
+ * keeps the sum of the arena sizes close to the peak of live bytes.
+ */
+class MemoryPlanner {
+ public:
+  MemoryPlanner() {}
+
+  /// @brief Adds a buffer of size bytes live from step first to step last,
+  ///        inclusive, and returns its index.
+  int Add(size_t size, int first, int last);
+  /// @brief Assigns every buffer added so far to an arena.
+  void Plan();
+
+  inline int num_buffers() const { return sizes_.size(); }
+  inline int num_arenas() const { return arena_sizes_.size(); }
+  /// @brief The arena of a buffer; valid after Plan.
+  inline int arena(int buffer_id) const { return arenas_[buffer_id]; }
+  inline size_t arena_size(int arena_id) const {
+    return arena_sizes_[arena_id];
+  }
+  /// @brief Bytes needed without sharing: the sum of the buffer sizes.
+  size_t total_size() const;
+  /// @brief Bytes needed with sharing: the sum of the arena sizes.
+  size_t planned_size() const;
+
+ protected:
+  bool Overlaps(int buffer_id, int arena_id) const;
+
+  vector<size_t> sizes_;
+  vector<int> first_;
+  vector<int> last_;
+  vector<int> arenas_;
+  vector<size_t> arena_sizes_;
+  /// The buffers placed in each arena.
+  vector<vector<int> > arena_buffers_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEMORY_PLANNER_HPP_
@@ -0,0 +1,112 @@
+#ifndef CAFFE_UTIL_MMAP_TENSOR_HPP_
+#define CAFFE_UTIL_MMAP_TENSOR_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A raw tensor file holds fixed-size records that can be read in
+ *        place through mmap, with no decoding.
+ *
+ * The file starts with a one-page MmapTensorHeader in native byte order.
+ * The records follow back to back from the next page boundary, each holding
+ * the elements of one record shape in C order. One float label per record
+ * comes after the records.
+ */
+enum MmapTensorType {
+  MMAP_TENSOR_UINT8 = 0,
+  MMAP_TENSOR_FLOAT = 1,
+  MMAP_TENSOR_DOUBLE = 2
+};
+
+struct MmapTensorHeader {
+  static const int kMaxAxes = 8;
+  static const size_t kSize = 4096;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t type;
+  uint64_t num;
+  uint64_t data_offset;
+  uint64_t label_offset;
+  uint32_t num_axes;
+  uint32_t shape[kMaxAxes];
+};
+
+/// Size in bytes of an element of the given type.
+size_t mmap_tensor_type_size(MmapTensorType type);
+
+/// @brief Writes a raw tensor file record by record.
+class MmapTensorWriter {
+ public:
+  MmapTensorWriter() : file_(NULL) {}
+  ~MmapTensorWriter();
+
+  /// Creates the file for records of the given shape and element type.
+  void Open(const string& filename, const vector<int>& shape,
+      MmapTensorType type);
+  /// Appends a record of record_bytes() bytes.
+  void Write(const void* data, float label);
+  /// Writes the labels and the header.
+  void Close();
+
+  inline size_t record_bytes() const { return record_bytes_; }
+
+ protected:
+  FILE* file_;
+  string filename_;
+  MmapTensorHeader header_;
+  size_t record_bytes_;
+  vector<float> labels_;
+
+  DISABLE_COPY_AND_ASSIGN(MmapTensorWriter);
+};
+
+/// @brief Maps a raw tensor file read-only.
+class MmapTensorReader {
+ public:
+  MmapTensorReader() : data_(NULL), size_(0) {}
+  ~MmapTensorReader() { Close(); }
+
+  void Open(const string& filename);
+  void Close();
+
+  inline int num() const { return header_.num; }
+  /// The shape of one record.
+  inline const vector<int>& shape() const { return shape_; }
+  inline MmapTensorType type() const {
+    return static_cast<MmapTensorType>(header_.type);
+  }
+  inline size_t record_bytes() const { return record_bytes_; }
+  /// Number of elements of a record.
+  inline int record_count() const { return record_count_; }
+  inline const char* record(int index) const {
+    return data_ + header_.data_offset + index * record_bytes_;
+  }
+  inline float label(int index) const { return labels_[index]; }
+  /// Asks the kernel to read records [begin, end) ahead of their use.
+  void WillNeed(int begin, int end) const;
+
+ protected:
+  const char* data_;
+  size_t size_;
+  MmapTensorHeader header_;
+  vector<int> shape_;
+  size_t record_bytes_;
+  int record_count_;
+  const float* labels_;
+
+  DISABLE_COPY_AND_ASSIGN(MmapTensorReader);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MMAP_TENSOR_HPP_
@@ -0,0 +1,64 @@
+#ifndef CAFFE_UTIL_SOLVER_UPDATE_HPP_
+#define CAFFE_UTIL_SOLVER_UPDATE_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/// The update rules of the SGD-family solvers.
+enum SolverUpdateType {
+  SGD_UPDATE,
+  NESTEROV_UPDATE,
+  ADAGRAD_UPDATE,
+  RMSPROP_UPDATE,
+  ADADELTA_UPDATE,
+  ADAM_UPDATE
+};
+
+/**
+ * @brief The memory and hyperparameters of one learnable param for
+ *        caffe_cpu_solver_update.
+ *
+ * The gradient is first normalized and regularized,
+ *   g = normalization * diff + decay * (l1 ? sign(data) : data),
+ * and then turned into the update of the rule, which is left in diff and
+ * subtracted from data. rate is the local learning rate, including the
+ * param's lr_mult and, for Adam, the bias correction.
+ */
+template <typename Dtype>
+struct SolverParamUpdate {
+  int count;
+  Dtype* data;
+  Dtype* diff;
+  /// The solver history: momentum, squared gradients or Adam's m.
+  Dtype* history;
+  /// AdaDelta's squared updates or Adam's v; unused by other rules.
+  Dtype* history2;
+  Dtype normalization;
+  Dtype decay;
+  bool l1;
+  Dtype rate;
+  Dtype momentum;
+  Dtype momentum2;
+  Dtype rms_decay;
+  Dtype delta;
+};
+
+/**
+ * @brief Applies a solver step to all params in one sweep: for every
+ *        element, data, diff and history are read once and written once.
+ *
+ * This fuses the normalization, regularization, update computation and
+ * Net::Update passes of the solvers. The params form one flat range that
+ * is split evenly over the threads of the current ThreadPool, however many
+ * small params it holds.
+ */
+template <typename Dtype>
+void caffe_cpu_solver_update(SolverUpdateType type,
+    const std::vector<SolverParamUpdate<Dtype> >& params);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SOLVER_UPDATE_HPP_
@@ -0,0 +1,61 @@
+#ifndef CAFFE_UTIL_TCP_RING_HPP_
+#define CAFFE_UTIL_TCP_RING_HPP_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Connects the ranks of a distributed job in a ring of TCP
+ *        connections, and reduces or broadcasts buffers around it.
+ *
+ * hosts lists "host:port" for every rank, the same on all ranks. Each rank
+ * listens on the port of its own entry, connects to the next rank and
+ * accepts the previous one, retrying until connect_timeout_ms has passed so
+ * that ranks can start in any order. A single rank has no connections and
+ * leaves buffers as they are.
+ */
+class TCPRing {
+ public:
+  TCPRing(const vector<string>& hosts, int rank,
+      int connect_timeout_ms = 60000);
+  ~TCPRing();
+
+  inline int rank() const { return rank_; }
+  inline int size() const { return size_; }
+
+  /// Sums data over all ranks, leaving the same result on every rank. Each
+  /// rank sends and receives 2 * (size - 1) / size of the buffer.
+  template <typename Dtype>
+  void AllreduceSum(Dtype* data, int count);
+  /// Copies data from rank 0 to all other ranks.
+  template <typename Dtype>
+  void Broadcast(Dtype* data, int count);
+
+ protected:
+  /// Sends to the next rank while receiving from the previous one, so that
+  /// neither side blocks on a full socket buffer.
+  void SendRecv(const char* send, size_t send_bytes, char* recv,
+      size_t recv_bytes);
+
+  const int rank_;
+  const int size_;
+  int next_fd_;
+  int prev_fd_;
+  // Receives the chunks summed into data by AllreduceSum.
+  vector<char> buffer_;
+
+  DISABLE_COPY_AND_ASSIGN(TCPRing);
+};
+
+/// Splits "host:port" into its parts; LOG(FATAL) if malformed.
+void ParseHostPort(const string& host_port, string* host, int* port);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TCP_RING_HPP_
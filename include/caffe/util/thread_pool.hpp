@@ -0,0 +1,91 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+/**
+ Forward declare boost::thread instead of including boost/thread.hpp
+ to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+ */
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of worker threads for data-parallel CPU loops.
+ *
+ * ParallelFor splits an index range into at most num_threads() contiguous
+ * chunks. Chunk boundaries only depend on the range and the pool size, so a
+ * body that writes disjoint outputs per index gives the same result on every
+ * run. Calls made from inside a running body, or while another thread holds
+ * the pool, execute serially on the calling thread instead of blocking.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  /// Number of threads taking part in a ParallelFor, including the caller.
+  inline int num_threads() const { return num_threads_; }
+
+  /// Calls body(begin, end) over [0, n) and returns once all chunks are done.
+  void ParallelFor(int n, const boost::function<void(int, int)>& body);
+
+  /// The process-wide pool used by the CPU layer and solver kernels. Hold
+  /// the result while using it, as SetGlobalThreads may replace the pool.
+  static shared_ptr<ThreadPool> Global();
+  /// The pool caffe_parallel_for uses on the calling thread: the one set by
+  /// the innermost ScopedThreadPool, which the result does not own, or
+  /// Global().
+  static shared_ptr<ThreadPool> Current();
+  /// Resizes the global pool; 0 picks the number of hardware threads. Loops
+  /// already running finish on the previous pool, which goes away with them.
+  static void SetGlobalThreads(int num_threads);
+
+ protected:
+  class sync;
+
+  void WorkerEntry();
+  void RunChunks();
+
+  int num_threads_;
+  std::vector<shared_ptr<boost::thread> > workers_;
+  shared_ptr<sync> sync_;
+
+  const boost::function<void(int, int)>* body_;
+  int n_;
+  int num_chunks_;
+  int next_chunk_;
+  int pending_;
+  bool stop_;
+
+DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+/**
+ * @brief Makes caffe_parallel_for on the calling thread use the given pool
+ *        while in scope, even inside another pool's ParallelFor body. This
+ *        gives work scheduled on a pool worker its own thread budget.
+ */
+class ScopedThreadPool {
+ public:
+  explicit ScopedThreadPool(ThreadPool* pool);
+  ~ScopedThreadPool();
+
+ private:
+  ThreadPool* previous_pool_;
+  bool previous_in_parallel_region_;
+
+DISABLE_COPY_AND_ASSIGN(ScopedThreadPool);
+};
+
+/// Shorthand for ThreadPool::Current()->ParallelFor(n, body).
+void caffe_parallel_for(int n, const boost::function<void(int, int)>& body);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
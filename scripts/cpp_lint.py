@@ -1611,7 +1611,9 @@ def CheckCaffeDataLayerSetUp(filename, clean_lines, linenum, error):
        line.find('void DataLayer<Dtype>::LayerSetUp') != -1 or
        line.find('void ImageDataLayer<Dtype>::LayerSetUp') != -1 or
        line.find('void MemoryDataLayer<Dtype>::LayerSetUp') != -1 or
-       line.find('void WindowDataLayer<Dtype>::LayerSetUp') != -1):
+       line.find('void WindowDataLayer<Dtype>::LayerSetUp') != -1 or
+       line.find('void TripletDataLayer<Dtype>::LayerSetUp') != -1 or
+       line.find('void MmapDataLayer<Dtype>::LayerSetUp') != -1):
       error(filename, linenum, 'caffe/data_layer_setup', 2,
             'Except the base classes, Caffe DataLayer should define'
             + ' DataLayerSetUp instead of LayerSetUp. The base DataLayers'
@@ -1623,7 +1625,9 @@ def CheckCaffeDataLayerSetUp(filename, clean_lines, linenum, error):
        line.find('void DataLayer<Dtype>::DataLayerSetUp') == -1 and
        line.find('void ImageDataLayer<Dtype>::DataLayerSetUp') == -1 and
        line.find('void MemoryDataLayer<Dtype>::DataLayerSetUp') == -1 and
-       line.find('void WindowDataLayer<Dtype>::DataLayerSetUp') == -1):
+       line.find('void WindowDataLayer<Dtype>::DataLayerSetUp') == -1 and
+       line.find('void TripletDataLayer<Dtype>::DataLayerSetUp') == -1 and
+       line.find('void MmapDataLayer<Dtype>::DataLayerSetUp') == -1):
       error(filename, linenum, 'caffe/data_layer_setup', 2,
             'Except the base classes, Caffe DataLayer should define'
             + ' DataLayerSetUp instead of LayerSetUp. The base DataLayers'
@@ -7,6 +7,8 @@
 #include "caffe/data_reader.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -44,12 +46,12 @@ DataReader::~DataReader() {
 DataReader::QueuePair::QueuePair(int size) {
   // Initialize the free queue with requested number of datums
   for (int i = 0; i < size; ++i) {
-    free_.push(new Datum());
+    free_.push(new DatumView());
   }
 }
 
 DataReader::QueuePair::~QueuePair() {
-  Datum* datum;
+  DatumView* datum;
   while (free_.try_pop(&datum)) {
     delete datum;
   }
@@ -60,9 +62,101 @@ DataReader::QueuePair::~QueuePair() {
 
 //
 
+DataReader::Records::Records(const DataParameter& param,
+    shared_ptr<db::DB> db, const string& source, unsigned int seed)
+    : db_(db),
+      block_size_(param.shuffle_block()),
+      block_(0),
+      block_offset_(0),
+      rng_(seed) {
+  cursor_.reset(db_->NewCursor());
+  CHECK(cursor_->valid()) << "The database " << source << " is empty.";
+  if (block_size_ > 0) {
+    for (int i = 0; cursor_->valid(); ++i, cursor_->Next()) {
+      if (i % block_size_ == 0) {
+        block_keys_.push_back(cursor_->key());
+      }
+    }
+    for (int i = 0; i < block_keys_.size(); ++i) {
+      block_order_.push_back(i);
+    }
+    DLOG(INFO) << "Shuffling " << block_keys_.size() << " blocks of "
+               << block_size_ << " records from " << source;
+    block_ = block_order_.size() - 1;
+    NextBlock();
+  }
+}
+
+void DataReader::Records::Read(DatumView* datum) {
+  datum->Read(cursor_.get());
+}
+
+void DataReader::Records::Skip(int steps) {
+  for (int i = 0; i < steps; ++i) {
+    cursor_->Next();
+    if (block_size_ > 0) {
+      if (++block_offset_ == block_size_ || !cursor_->valid()) {
+        NextBlock();
+      }
+    } else if (!cursor_->valid()) {
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      cursor_->SeekToFirst();
+    }
+  }
+}
+
+void DataReader::Records::NextBlock() {
+  if (++block_ == block_order_.size()) {
+    shuffle(block_order_.begin(), block_order_.end(),
+        static_cast<caffe::rng_t*>(rng_.generator()));
+    block_ = 0;
+  }
+  cursor_->Seek(block_keys_[block_order_[block_]]);
+  CHECK(cursor_->valid());
+  block_offset_ = 0;
+}
+
+//
+
+DataReader::Lane::Lane(const DataParameter& param, shared_ptr<db::DB> db,
+    const string& source, unsigned int seed, int offset, int stride, int size)
+    : records_(param, db, source, seed), offset_(offset), stride_(stride) {
+  for (int i = 0; i < size; ++i) {
+    free_.push(new DatumView());
+  }
+  StartInternalThread();
+}
+DataReader::Lane::~Lane() {
+  StopInternalThread();
+  DatumView* datum;
+  while (free_.try_pop(&datum)) {
+    delete datum;
+  }
+  while (full_.try_pop(&datum)) {
+    delete datum;
+  }
+}
+
+void DataReader::Lane::InternalThreadEntry() {
+  try {
+    records_.Skip(offset_);
+    while (!must_stop()) {
+      DatumView* datum = free_.pop();
+      records_.Read(datum);
+      full_.push(datum);
+      records_.Skip(stride_);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+//
+
 DataReader::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      next_lane_(0) {
   StartInternalThread();
 }
 
@@ -71,11 +165,43 @@ DataReader::Body::~Body() {
 }
 
 void DataReader::Body::InternalThreadEntry() {
-  shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
-  db->Open(param_.data_param().source(), db::READ);
-  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  const DataParameter& data_param = param_.data_param();
+  vector<string> sources(data_param.shard().begin(), data_param.shard().end());
+  if (sources.empty()) {
+    sources.push_back(data_param.source());
+  }
+  const int num_readers = data_param.num_readers();
+  CHECK_GT(num_readers, 0);
+  const int num_lanes = sources.size() * num_readers;
+  // The readers of a shard share its seed, so they see the same blocks, and
+  // its database, with a cursor each.
+  vector<unsigned int> seeds(sources.size());
+  vector<shared_ptr<db::DB> > dbs(sources.size());
+  for (int s = 0; s < sources.size(); ++s) {
+    seeds[s] = caffe_rng_rand();
+    dbs[s].reset(db::GetDB(data_param.backend()));
+    dbs[s]->Open(sources[s], db::READ);
+  }
+  if (num_lanes == 1) {
+    records_.reset(new Records(data_param, dbs[0], sources[0], seeds[0]));
+  } else {
+    // Record i of the merged sequence is record i / shards of shard
+    // i % shards, which reader (i / shards) % num_readers of that shard reads.
+    const int lane_size =
+        data_param.prefetch() * data_param.batch_size() / num_lanes + 1;
+    for (int r = 0; r < num_readers; ++r) {
+      for (int s = 0; s < sources.size(); ++s) {
+        lanes_.push_back(shared_ptr<Lane>(new Lane(data_param, dbs[s],
+            sources[s], seeds[s], r, num_readers, lane_size)));
+      }
+    }
+  }
   vector<shared_ptr<QueuePair> > qps;
   try {
+    for (int i = 0; i < data_param.shuffle_buffer(); ++i) {
+      shuffle_buffer_.push_back(shared_ptr<DatumView>(new DatumView()));
+      read_next(shuffle_buffer_.back().get());
+    }
     int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
 
     // To ensure deterministic runs, only start running once all solvers
@@ -83,13 +209,13 @@ void DataReader::Body::InternalThreadEntry() {
     // so read one item, then wait for the next solver.
     for (int i = 0; i < solver_count; ++i) {
       shared_ptr<QueuePair> qp(new_queue_pairs_.pop());
-      read_one(cursor.get(), qp.get());
+      read_one(qp.get());
       qps.push_back(qp);
     }
     // Main loop
     while (!must_stop()) {
       for (int i = 0; i < solver_count; ++i) {
-        read_one(cursor.get(), qps[i].get());
+        read_one(qps[i].get());
       }
       // Check no additional readers have been created. This can happen if
       // more than one net is trained at a time per process, whether single
@@ -100,19 +226,38 @@ void DataReader::Body::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  shuffle_buffer_.clear();
+  records_.reset();
+  lanes_.clear();
 }
 
-void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
-  Datum* datum = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  datum->ParseFromString(cursor->value());
+void DataReader::Body::read_one(QueuePair* qp) {
+  DatumView* datum = qp->free_.pop();
+  if (shuffle_buffer_.empty()) {
+    read_next(datum);
+  } else {
+    // Hand out a random record of the buffer and refill its slot.
+    DatumView* held =
+        shuffle_buffer_[caffe_rng_rand() % shuffle_buffer_.size()].get();
+    datum->Swap(held);
+    read_next(held);
+  }
   qp->full_.push(datum);
+}
 
-  // go to the next iter
-  cursor->Next();
-  if (!cursor->valid()) {
-    DLOG(INFO) << "Restarting data prefetching from start.";
-    cursor->SeekToFirst();
+void DataReader::Body::read_next(DatumView* datum) {
+  if (records_) {
+    records_->Read(datum);
+    // go to the next iter
+    records_->Skip(1);
+  } else {
+    // Take the lanes in turn. Swapping contents keeps every view in the pool
+    // of the queue that owns it.
+    Lane* lane = lanes_[next_lane_].get();
+    DatumView* ready = lane->full_.pop();
+    datum->Swap(ready);
+    lane->free_.push(ready);
+    next_lane_ = (next_lane_ + 1) % lanes_.size();
   }
 }
 
@@ -281,7 +281,7 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
+    const Dtype* weights, Dtype* input, bool skip_col2im) {
   Dtype* col_buff = col_buffer_.mutable_cpu_data();
   if (is_1x1_) {
     col_buff = input;
@@ -292,17 +292,19 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
         (Dtype)1., weights + weight_offset_ * g, output + output_offset_ * g,
         (Dtype)0., col_buff + col_offset_ * g);
   }
-  if (!is_1x1_) {
+  if (!is_1x1_ && !skip_col2im) {
     conv_col2im_cpu(col_buff, input);
   }
 }
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
+    const Dtype* output, Dtype* weights, bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+    if (!skip_im2col) {
+      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+    }
     col_buff = col_buffer_.cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
@@ -350,7 +352,7 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
+    const Dtype* weights, Dtype* input, bool skip_col2im) {
   Dtype* col_buff = col_buffer_.mutable_gpu_data();
   if (is_1x1_) {
     col_buff = input;
@@ -361,17 +363,19 @@ void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
         (Dtype)1., weights + weight_offset_ * g, output + output_offset_ * g,
         (Dtype)0., col_buff + col_offset_ * g);
   }
-  if (!is_1x1_) {
+  if (!is_1x1_ && !skip_col2im) {
     conv_col2im_gpu(col_buff, input);
   }
 }
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
+    const Dtype* output, Dtype* weights, bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+    if (!skip_im2col) {
+      conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+    }
     col_buff = col_buffer_.gpu_data();
   }
   for (int g = 0; g < group_; ++g) {
@@ -1,4 +1,7 @@
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -8,6 +11,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -68,10 +72,44 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
 #endif
   DLOG(INFO) << "Initializing prefetch";
   this->data_transformer_->InitRand();
+  const int num_workers = std::max<int>(this->transform_param_.num_workers(),
+      1);
+  transformers_.assign(1, this->data_transformer_);
+  for (int i = 1; i < num_workers; ++i) {
+    transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    transformers_[i]->InitRand();
+  }
+  transform_pool_.reset(num_workers > 1 ? new ThreadPool(num_workers) : NULL);
   StartInternalThread();
   DLOG(INFO) << "Prefetch initialized.";
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::ParallelLoad(int num_items,
+    const boost::function<void(DataTransformer<Dtype>*, int, int)>&
+    load_items) {
+  if (!transform_pool_) {
+    load_items(transformers_[0].get(), 0, num_items);
+    return;
+  }
+  transform_pool_->ParallelFor(transformers_.size(), boost::bind(
+      &BasePrefetchingDataLayer<Dtype>::LoadWorkerItems, this, num_items,
+      &load_items, _1, _2));
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::LoadWorkerItems(int num_items,
+    const boost::function<void(DataTransformer<Dtype>*, int, int)>*
+    load_items, int begin, int end) {
+  const int num_workers = transformers_.size();
+  for (int worker = begin; worker < end; ++worker) {
+    (*load_items)(transformers_[worker].get(),
+        static_cast<int64_t>(num_items) * worker / num_workers,
+        static_cast<int64_t>(num_items) * (worker + 1) / num_workers);
+  }
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #ifndef CPU_ONLY
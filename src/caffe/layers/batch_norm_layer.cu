@@ -85,8 +85,10 @@ void BatchNormLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   caffe_gpu_div(temp_.count(), top_data, temp_.gpu_data(), top_data);
   // TODO(cdoersch): The caching is only needed because later in-place layers
   //                 might clobber the data.  Can we skip this if they won't?
-  caffe_copy(x_norm_.count(), top_data,
-      x_norm_.mutable_gpu_data());
+  if (!this->inference_only()) {
+    caffe_copy(x_norm_.count(), top_data,
+        x_norm_.mutable_gpu_data());
+  }
 }
 
 template <typename Dtype>
@@ -3,11 +3,17 @@
 #endif  // USE_OPENCV
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
 
 namespace caffe {
 
@@ -26,8 +32,15 @@ template <typename Dtype>
 void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int batch_size = this->layer_param_.data_param().batch_size();
+#ifdef USE_OPENCV
+  const ImageCacheParameter& cache_param =
+      this->layer_param_.data_param().image_cache();
+  if (cache_param.memory_bytes() || cache_param.spill_bytes()) {
+    cache_.reset(new ImageCache(cache_param));
+  }
+#endif  // USE_OPENCV
   // Read a data point, and use it to initialize the top blob.
-  Datum& datum = *(reader_.full().peek());
+  DatumView& datum = *(reader_.full().peek());
 
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
@@ -65,9 +78,19 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   // Reshape according to the first datum of each batch
   // on single input batches allows for inputs of varying dimension.
   const int batch_size = this->layer_param_.data_param().batch_size();
-  Datum& datum = *(reader_.full().peek());
+  DatumView& datum = *(reader_.full().peek());
   // Use data_transformer to infer the expected blob shape from datum.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
+  vector<int> top_shape;
+#ifdef USE_OPENCV
+  shared_ptr<const CachedImage> image = DecodeCached(datum);
+  if (image) {
+    top_shape = this->data_transformer_->InferBlobShape(
+        CachedImageToCVMat(*image));
+  }
+#endif  // USE_OPENCV
+  if (top_shape.empty()) {
+    top_shape = this->data_transformer_->InferBlobShape(datum);
+  }
   this->transformed_data_.Reshape(top_shape);
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
@@ -79,29 +102,112 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   if (this->output_labels_) {
     top_label = batch->label_.mutable_cpu_data();
   }
+  // Datums are taken in order here, then transformed in parallel.
+  timer.Start();
+  vector<DatumView*> datums(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
-    // get a datum
-    Datum& datum = *(reader_.full().pop("Waiting for data"));
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply data transformations (mirror, scale, crop...)
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-    }
-    trans_time += timer.MicroSeconds();
-
-    reader_.free().push(const_cast<Datum*>(&datum));
+    datums[item_id] = reader_.full().pop("Waiting for data");
+  }
+  read_time += timer.MicroSeconds();
+  timer.Start();
+  this->ParallelLoad(batch_size, boost::bind(
+      &DataLayer<Dtype>::TransformDatums, this, &datums, top_data, top_label,
+      _1, _2, _3));
+  trans_time += timer.MicroSeconds();
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    reader_.free().push(datums[item_id]);
   }
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  // The reader does not tell where an epoch ends, so log every so many
+  // batches instead.
+  if (cache_) {
+    LOG_EVERY_N(INFO, 1000) << cache_->Stats();
+  }
+}
+
+// This function is called on the transform workers
+template<typename Dtype>
+void DataLayer<Dtype>::TransformDatums(const vector<DatumView*>* datums,
+    Dtype* top_data, Dtype* top_label, DataTransformer<Dtype>* transformer,
+    int begin, int end) {
+  Blob<Dtype> transformed_data(this->transformed_data_.shape());
+  const int item_size = transformed_data.count();
+  for (int item_id = begin; item_id < end; ++item_id) {
+    const DatumView& datum = *(*datums)[item_id];
+    // Apply data transformations (mirror, scale, crop...)
+    transformed_data.set_cpu_data(top_data + item_id * item_size);
+#ifdef USE_OPENCV
+    shared_ptr<const CachedImage> image = DecodeCached(datum);
+    if (image) {
+      transformer->Transform(CachedImageToCVMat(*image), &transformed_data);
+    } else {
+      transformer->Transform(datum, &transformed_data);
+    }
+#else
+    transformer->Transform(datum, &transformed_data);
+#endif  // USE_OPENCV
+    // Copy label.
+    if (top_label) {
+      top_label[item_id] = datum.label();
+    }
+  }
+}
+
+#ifdef USE_OPENCV
+// FNV-1a, as a check on hits that is independent of the key's boost::hash.
+static uint64_t EncodedDigest(const string& data) {
+  uint64_t digest = 14695981039346656037ULL;
+  for (size_t i = 0; i < data.size(); ++i) {
+    digest = (digest ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+  }
+  return digest;
+}
+#endif  // USE_OPENCV
+
+// Encoded datums are cached by a hash of their bytes and the color mode, as
+// the reader does not pass on the keys. A second digest stored with each
+// image tells apart datums whose keys collide.
+template <typename Dtype>
+shared_ptr<const CachedImage> DataLayer<Dtype>::DecodeCached(
+    const DatumView& datum) {
+  if (!cache_ || !datum.has_datum() || !datum.datum().encoded()) {
+    return shared_ptr<const CachedImage>();
+  }
+#ifdef USE_OPENCV
+  const bool force_color = this->transform_param_.force_color();
+  const bool force_gray = this->transform_param_.force_gray();
+  CHECK(!(force_color && force_gray))
+      << "cannot set both force_color and force_gray";
+  const string& data = datum.datum().data();
+  const uint64_t digest = EncodedDigest(data);
+  std::ostringstream key;
+  key << (force_color ? "color:" : force_gray ? "gray:" : "native:")
+      << boost::hash_range(data.begin(), data.end()) << ":" << data.size();
+  shared_ptr<const CachedImage> image = cache_->Get(key.str());
+  if (image && image->check == digest) {
+    return image;
+  }
+  cv::Mat cv_img;
+  if (force_color || force_gray) {
+    // If force_color then decode in color otherwise decode in gray.
+    cv_img = DecodeDatumToCVMat(datum.datum(), force_color);
+  } else {
+    cv_img = DecodeDatumToCVMatNative(datum.datum());
+  }
+  shared_ptr<const CachedImage> decoded = CVMatToCachedImage(cv_img, digest);
+  // On a collision the cached image stays; this one is used uncached.
+  if (!image) {
+    cache_->Put(key.str(), decoded);
+  }
+  return decoded;
+#else
+  LOG(FATAL) << "Encoded datum requires OpenCV; compile with USE_OPENCV.";
+  return shared_ptr<const CachedImage>();
+#endif  // USE_OPENCV
 }
 
 INSTANTIATE_CLASS(DataLayer);
@@ -1,11 +1,7 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <climits>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -16,56 +12,53 @@ TODO:
 
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+HDF5DataLayer<Dtype>::HDF5DataLayer(const LayerParameter& param)
+    : Layer<Dtype>(param), num_files_(0), current_chunk_(0),
+      current_file_(-1), file_id_(-1), current_row_(0) {
+  for (int i = 0; i < PREFETCH_COUNT; ++i) {
+    prefetch_free_.push(&prefetch_[i]);
+  }
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  DLOG(INFO) << "Loading HDF5 file: " << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  this->StopInternalThread();
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+  CloseHDF5File();
+}
+
+// Must be called holding hdf5_mutex().
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::OpenHDF5File(int file) {
+  if (current_file_ == file) {
+    return;
+  }
+  CloseHDF5File();
+  const char* filename = hdf_filenames_[file].c_str();
+  DLOG(INFO) << "Opening HDF5 file: " << filename;
+  file_id_ = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file_id_ < 0) {
     LOG(FATAL) << "Failed opening HDF5 file: " << filename;
   }
+  current_file_ = file;
+}
 
-  int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
-
-  const int MIN_DATA_DIM = 1;
-  const int MAX_DATA_DIM = INT_MAX;
-
-  for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i] = shared_ptr<Blob<Dtype> >(new Blob<Dtype>());
-    hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get());
-  }
-
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
-
-  // MinTopBlobs==1 guarantees at least one top blob
-  CHECK_GE(hdf_blobs_[0]->num_axes(), 1) << "Input must have at least 1 axis.";
-  const int num = hdf_blobs_[0]->shape(0);
-  for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->shape(0), num);
-  }
-  // Default to identity permutation.
-  data_permutation_.clear();
-  data_permutation_.resize(hdf_blobs_[0]->shape(0));
-  for (int i = 0; i < hdf_blobs_[0]->shape(0); i++)
-    data_permutation_[i] = i;
-
-  // Shuffle if needed.
-  if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
-    DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->shape(0)
-               << " rows (shuffled)";
-  } else {
-    DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->shape(0) << " rows";
+// Must be called holding hdf5_mutex().
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CloseHDF5File() {
+  if (current_file_ < 0) {
+    return;
   }
+  herr_t status = H5Fclose(file_id_);
+  CHECK_GE(status, 0) << "Failed to close HDF5 file: "
+                      << hdf_filenames_[current_file_];
+  current_file_ = -1;
 }
 
 template <typename Dtype>
@@ -74,8 +67,19 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  // Stop prefetching from an earlier setup and take back its batches.
+  this->StopInternalThread();
+  HDF5Batch<Dtype>* batch;
+  while (prefetch_full_.try_pop(&batch)) {
+    prefetch_free_.push(batch);
+  }
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+  CloseHDF5File();
+
   // Read the source to parse the filenames.
-  const string& source = this->layer_param_.hdf5_data_param().source();
+  const HDF5DataParameter& hdf5_data_param =
+      this->layer_param_.hdf5_data_param();
+  const string& source = hdf5_data_param.source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
   hdf_filenames_.clear();
   std::ifstream source_file(source.c_str());
@@ -89,71 +93,172 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   source_file.close();
   num_files_ = hdf_filenames_.size();
-  current_file_ = 0;
   LOG(INFO) << "Number of HDF5 files: " << num_files_;
   CHECK_GE(num_files_, 1) << "Must have at least 1 HDF5 filename listed in "
     << source;
 
-  file_permutation_.clear();
-  file_permutation_.resize(num_files_);
-  // Default to identity permutation.
-  for (int i = 0; i < num_files_; i++) {
-    file_permutation_[i] = i;
+  // Split the files into chunks, reading only the shapes of the datasets.
+  const int batch_size = hdf5_data_param.batch_size();
+  const int chunk_size = hdf5_data_param.chunk_size() ?
+      hdf5_data_param.chunk_size() : batch_size;
+  CHECK_GT(chunk_size, 0) << "Positive batch size required";
+  const int top_size = this->layer_param_.top_size();
+  vector<vector<hsize_t> > row_shapes(top_size);
+  chunks_.clear();
+  for (int file = 0; file < num_files_; ++file) {
+    OpenHDF5File(file);
+    hsize_t num = 0;
+    for (int i = 0; i < top_size; ++i) {
+      vector<hsize_t> shape = hdf5_get_dataset_shape(file_id_,
+          this->layer_param_.top(i).c_str(), 1, INT_MAX);
+      // MinTopBlobs==1 guarantees at least one top blob
+      if (i == 0) {
+        num = shape[0];
+      }
+      CHECK_EQ(shape[0], num);
+      shape.erase(shape.begin());
+      if (file == 0) {
+        row_shapes[i] = shape;
+      }
+      CHECK(shape == row_shapes[i]) << "Dataset " << this->layer_param_.top(i)
+          << " of " << hdf_filenames_[file] << " differs in shape.";
+    }
+    for (hsize_t begin = 0; begin < num; begin += chunk_size) {
+      Chunk chunk;
+      chunk.file = file;
+      chunk.begin = begin;
+      chunk.end = std::min<hsize_t>(begin + chunk_size, num);
+      chunks_.push_back(chunk);
+    }
   }
-
-  // Shuffle if needed.
-  if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(file_permutation_.begin(), file_permutation_.end());
+  CloseHDF5File();
+  CHECK(!chunks_.empty()) << "The HDF5 files listed in " << source
+      << " hold no rows.";
+  LOG(INFO) << "Number of HDF5 chunks: " << chunks_.size();
+  chunk_order_.resize(chunks_.size());
+  for (int i = 0; i < chunks_.size(); ++i) {
+    chunk_order_[i] = i;
   }
-
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  current_chunk_ = 0;
+  row_order_.clear();
   current_row_ = 0;
 
   // Reshape blobs.
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  const int top_size = this->layer_param_.top_size();
+  const int max_rows = chunk_size * (hdf5_data_param.shuffle() ?
+      std::max<int>(hdf5_data_param.shuffle_chunks(), 1) : 1);
+  rows_.resize(top_size);
+  for (int j = 0; j < PREFETCH_COUNT; ++j) {
+    prefetch_[j].blobs_.resize(top_size);
+  }
   vector<int> top_shape;
   for (int i = 0; i < top_size; ++i) {
-    top_shape.resize(hdf_blobs_[i]->num_axes());
-    top_shape[0] = batch_size;
+    top_shape.resize(row_shapes[i].size() + 1);
     for (int j = 1; j < top_shape.size(); ++j) {
-      top_shape[j] = hdf_blobs_[i]->shape(j);
+      top_shape[j] = row_shapes[i][j - 1];
     }
+    top_shape[0] = max_rows;
+    rows_[i].reset(new Blob<Dtype>(top_shape));
+    top_shape[0] = batch_size;
     top[i]->Reshape(top_shape);
+    for (int j = 0; j < PREFETCH_COUNT; ++j) {
+      prefetch_[j].blobs_[i].reset(new Blob<Dtype>(top_shape));
+      prefetch_[j].blobs_[i]->mutable_cpu_data();
+    }
   }
+  lock.unlock();
+  StartInternalThread();
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
+void HDF5DataLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      HDF5Batch<Dtype>* batch = prefetch_free_.pop();
+      load_batch(batch);
+      prefetch_full_.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::LoadChunks() {
+  const HDF5DataParameter& hdf5_data_param =
+      this->layer_param_.hdf5_data_param();
+  const bool shuffle_rows = hdf5_data_param.shuffle();
+  const int num_chunks = shuffle_rows ?
+      std::max<int>(hdf5_data_param.shuffle_chunks(), 1) : 1;
+  if (current_chunk_ == chunks_.size()) {
+    DLOG(INFO) << "Looping around to first chunk.";
+    current_chunk_ = 0;
+  }
+  if (current_chunk_ == 0 && shuffle_rows) {
+    shuffle(chunk_order_.begin(), chunk_order_.end());
+  }
+  // Chunks are shuffled together within an epoch only, so every epoch
+  // outputs each row once.
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+  int num_rows = 0;
+  for (int i = 0; i < num_chunks && current_chunk_ < chunks_.size(); ++i) {
+    const Chunk& chunk = chunks_[chunk_order_[current_chunk_++]];
+    OpenHDF5File(chunk.file);
+    for (int j = 0; j < rows_.size(); ++j) {
+      hdf5_load_nd_dataset_rows(file_id_, this->layer_param_.top(j).c_str(),
+          chunk.begin, chunk.end,
+          rows_[j]->mutable_cpu_data() + num_rows * rows_[j]->count(1));
+    }
+    num_rows += chunk.end - chunk.begin;
+  }
+  lock.unlock();
+  row_order_.resize(num_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    row_order_[i] = i;
+  }
+  if (shuffle_rows) {
+    shuffle(row_order_.begin(), row_order_.end());
+  }
+  current_row_ = 0;
+  DLOG(INFO) << "Read " << num_rows << " rows"
+             << (shuffle_rows ? " (shuffled)" : "");
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::load_batch(HDF5Batch<Dtype>* batch) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == hdf_blobs_[0]->shape(0)) {
-      if (num_files_ > 1) {
-        ++current_file_;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          if (this->layer_param_.hdf5_data_param().shuffle()) {
-            std::random_shuffle(file_permutation_.begin(),
-                                file_permutation_.end());
-          }
-          DLOG(INFO) << "Looping around to first file.";
-        }
-        LoadHDF5FileData(
-            hdf_filenames_[file_permutation_[current_file_]].c_str());
-      }
-      current_row_ = 0;
-      if (this->layer_param_.hdf5_data_param().shuffle())
-        std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
+  const bool shuffle_rows = this->layer_param_.hdf5_data_param().shuffle();
+  int item_id = 0;
+  while (item_id < batch_size) {
+    if (current_row_ == row_order_.size()) {
+      LoadChunks();
     }
-    for (int j = 0; j < this->layer_param_.top_size(); ++j) {
-      int data_dim = top[j]->count() / top[j]->shape(0);
-      caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
-            * data_dim], &top[j]->mutable_cpu_data()[i * data_dim]);
+    // Rows in order are copied in runs.
+    const int num_items = shuffle_rows ? 1 : std::min<int>(
+        batch_size - item_id, row_order_.size() - current_row_);
+    for (int j = 0; j < rows_.size(); ++j) {
+      const int data_dim = rows_[j]->count(1);
+      caffe_copy(num_items * data_dim,
+          rows_[j]->cpu_data() + row_order_[current_row_] * data_dim,
+          batch->blobs_[j]->mutable_cpu_data() + item_id * data_dim);
     }
+    item_id += num_items;
+    current_row_ += num_items;
+  }
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  HDF5Batch<Dtype>* batch =
+      prefetch_full_.pop("HDF5 data layer prefetch queue empty");
+  for (int j = 0; j < this->layer_param_.top_size(); ++j) {
+    const Blob<Dtype>& blob = *batch->blobs_[j];
+    top[j]->ReshapeLike(blob);
+    caffe_copy(blob.count(), blob.cpu_data(), top[j]->mutable_cpu_data());
   }
+  prefetch_free_.push(batch);
 }
 
 #ifdef CPU_ONLY
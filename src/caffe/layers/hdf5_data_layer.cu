@@ -1,48 +1,21 @@
-/*
-TODO:
-- only load parts of the file, in accordance with a prototxt param "max_mem"
-*/
-
-#include <stdint.h>
 #include <vector>
 
-#include "hdf5/serial/hdf5.h"
-#include "hdf5/serial/hdf5_hl.h"
-
 #include "caffe/layers/hdf5_data_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
 void HDF5DataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == hdf_blobs_[0]->shape(0)) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          if (this->layer_param_.hdf5_data_param().shuffle()) {
-            std::random_shuffle(file_permutation_.begin(),
-                                file_permutation_.end());
-          }
-          DLOG(INFO) << "Looping around to first file.";
-        }
-        LoadHDF5FileData(
-            hdf_filenames_[file_permutation_[current_file_]].c_str());
-      }
-      current_row_ = 0;
-      if (this->layer_param_.hdf5_data_param().shuffle())
-        std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
-    }
-    for (int j = 0; j < this->layer_param_.top_size(); ++j) {
-      int data_dim = top[j]->count() / top[j]->shape(0);
-      caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
-            * data_dim], &top[j]->mutable_gpu_data()[i * data_dim]);
-    }
+  HDF5Batch<Dtype>* batch =
+      prefetch_full_.pop("HDF5 data layer prefetch queue empty");
+  for (int j = 0; j < this->layer_param_.top_size(); ++j) {
+    const Blob<Dtype>& blob = *batch->blobs_[j];
+    top[j]->ReshapeLike(blob);
+    caffe_copy(blob.count(), blob.cpu_data(), top[j]->mutable_gpu_data());
   }
+  prefetch_free_.push(batch);
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS(HDF5DataLayer);
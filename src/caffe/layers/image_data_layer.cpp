@@ -1,6 +1,8 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 
+#include <boost/bind.hpp>
+
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -48,6 +50,12 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   CHECK(!lines_.empty()) << "File is empty";
 
+  const ImageCacheParameter& cache_param =
+      this->layer_param_.image_data_param().image_cache();
+  if (cache_param.memory_bytes() || cache_param.spill_bytes()) {
+    cache_.reset(new ImageCache(cache_param));
+  }
+
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
@@ -105,23 +113,17 @@ template <typename Dtype>
 void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
   double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
   const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
-  string root_folder = image_data_param.root_folder();
 
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+  shared_ptr<const CachedImage> cached;
+  cv::Mat cv_img = ReadImage(lines_[lines_id_].first, &cached);
   // Use data_transformer to infer the expected blob shape from a cv_img.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape);
@@ -132,39 +134,77 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   Dtype* prefetch_data = batch->data_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
-  // datum scales
+  // The lines of the batch are taken in order here, then the images are read
+  // and transformed in parallel.
   const int lines_size = lines_.size();
+  vector<std::pair<std::string, int> > lines(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    prefetch_label[item_id] = lines_[lines_id_].second;
+    lines[item_id] = lines_[lines_id_];
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
       // We have reached the end. Restart from the first.
       DLOG(INFO) << "Restarting data prefetching from start.";
       lines_id_ = 0;
+      if (cache_) {
+        LOG(INFO) << cache_->Stats();
+      }
       if (this->layer_param_.image_data_param().shuffle()) {
         ShuffleImages();
       }
     }
   }
+  timer.Start();
+  this->ParallelLoad(batch_size, boost::bind(
+      &ImageDataLayer<Dtype>::LoadImages, this, &lines, prefetch_data,
+      prefetch_label, _1, _2, _3));
+  trans_time += timer.MicroSeconds();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  DLOG(INFO) << "Read and transform time: " << trans_time / 1000 << " ms.";
+  if (cache_) {
+    DLOG(INFO) << cache_->Stats();
+  }
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::LoadImages(
+    const vector<std::pair<std::string, int> >* lines, Dtype* top_data,
+    Dtype* top_label, DataTransformer<Dtype>* transformer, int begin,
+    int end) {
+  Blob<Dtype> transformed_data(this->transformed_data_.shape());
+  const int item_size = transformed_data.count();
+  for (int item_id = begin; item_id < end; ++item_id) {
+    const std::pair<std::string, int>& line = (*lines)[item_id];
+    shared_ptr<const CachedImage> cached;
+    cv::Mat cv_img = ReadImage(line.first, &cached);
+    // Apply transformations (mirror, crop...) to the image
+    transformed_data.set_cpu_data(top_data + item_id * item_size);
+    transformer->Transform(cv_img, &transformed_data);
+    top_label[item_id] = line.second;
+  }
+}
+
+template <typename Dtype>
+cv::Mat ImageDataLayer<Dtype>::ReadImage(const string& filename,
+    shared_ptr<const CachedImage>* cached) {
+  if (cache_) {
+    *cached = cache_->Get(filename);
+    if (*cached) {
+      return CachedImageToCVMat(**cached);
+    }
+  }
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  cv::Mat cv_img = ReadImageToCVMat(image_data_param.root_folder() + filename,
+      image_data_param.new_height(), image_data_param.new_width(),
+      image_data_param.is_color());
+  CHECK(cv_img.data) << "Could not load " << filename;
+  if (cache_) {
+    cache_->Put(filename, CVMatToCachedImage(cv_img));
+  }
+  return cv_img;
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
@@ -0,0 +1,190 @@
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "caffe/data_transformer.hpp"
+#include "caffe/layers/mmap_data_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+namespace {
+
+template <typename Src, typename Dtype>
+void convert_record(const Src* src, int count, Dtype* dst) {
+  for (int i = 0; i < count; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+// Records stored as Dtype are copied in bulk.
+template <typename Dtype>
+void convert_record(const Dtype* src, int count, Dtype* dst) {
+  caffe_copy(count, src, dst);
+}
+
+template <typename Dtype>
+void copy_record(MmapTensorType type, const char* src, int count,
+    Dtype* dst) {
+  switch (type) {
+  case MMAP_TENSOR_UINT8:
+    convert_record(reinterpret_cast<const uint8_t*>(src), count, dst);
+    break;
+  case MMAP_TENSOR_FLOAT:
+    convert_record(reinterpret_cast<const float*>(src), count, dst);
+    break;
+  case MMAP_TENSOR_DOUBLE:
+    convert_record(reinterpret_cast<const double*>(src), count, dst);
+    break;
+  default:
+    LOG(FATAL) << "Unknown raw tensor type " << type;
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+MmapDataLayer<Dtype>::~MmapDataLayer() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void MmapDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const MmapDataParameter& mmap_data_param =
+      this->layer_param_.mmap_data_param();
+  const int batch_size = mmap_data_param.batch_size();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  reader_.Open(mmap_data_param.source());
+  CHECK_GT(reader_.num(), 0) << mmap_data_param.source() << " is empty.";
+  for (int i = 0; i < reader_.num(); ++i) {
+    order_.push_back(i);
+  }
+  batch_records_.resize(batch_size);
+
+  const TransformationParameter& transform_param = this->transform_param_;
+  needs_transform_ = transform_param.scale() != 1 ||
+      transform_param.mirror() || transform_param.crop_size() > 0 ||
+      transform_param.has_mean_file() || transform_param.mean_value_size() > 0;
+  const MmapTensorType dtype_type =
+      sizeof(Dtype) == sizeof(float) ? MMAP_TENSOR_FLOAT : MMAP_TENSOR_DOUBLE;
+  zero_copy_ = !needs_transform_ && !mmap_data_param.shuffle() &&
+      reader_.type() == dtype_type;
+
+  // The shape of one transformed record.
+  vector<int> top_shape(1, 1);
+  top_shape.insert(top_shape.end(), reader_.shape().begin(),
+      reader_.shape().end());
+  if (needs_transform_) {
+    // DataTransformer takes records of at most (channels, height, width).
+    CHECK_LE(reader_.shape().size(), 3)
+        << "Transformed records have at most 3 axes.";
+    const int crop_size = transform_param.crop_size();
+    if (crop_size) {
+      CHECK_EQ(reader_.shape().size(), 3) << "Cropped records are images.";
+      top_shape[2] = crop_size;
+      top_shape[3] = crop_size;
+    }
+  }
+  this->transformed_data_.Reshape(top_shape);
+  top_shape[0] = batch_size;
+  top[0]->Reshape(top_shape);
+  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
+    this->prefetch_[i].data_.Reshape(top_shape);
+  }
+  LOG(INFO) << "output data size: " << top[0]->shape_string() << ", "
+            << reader_.num() << " records"
+            << (zero_copy_ ? ", read in place" : "");
+  // label
+  if (this->output_labels_) {
+    vector<int> label_shape(1, batch_size);
+    top[1]->Reshape(label_shape);
+    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
+      this->prefetch_[i].label_.Reshape(label_shape);
+    }
+  }
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void MmapDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  const int batch_size = batch_records_.size();
+  const bool shuffle_records = this->layer_param_.mmap_data_param().shuffle();
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    if (pos_ == 0 && shuffle_records) {
+      shuffle(order_.begin(), order_.end());
+    }
+    batch_records_[item_id] = order_[pos_];
+    pos_ = (pos_ + 1) % order_.size();
+  }
+
+  const int first = batch_records_[0];
+  if (zero_copy_ && first + batch_size <= reader_.num()) {
+    // Point the batch at the records, and have them read ahead of use.
+    reader_.WillNeed(first, first + batch_size);
+    batch->data_.set_cpu_data(reinterpret_cast<Dtype*>(
+        const_cast<char*>(reader_.record(first))));
+  } else {
+    Dtype* top_data;
+    if (zero_copy_) {
+      // This batch wraps around the end of the file. The batch blob does
+      // not own memory any more, so give it a buffer of its own.
+      Blob<Dtype>& buffer = buffers_[batch - this->prefetch_];
+      buffer.ReshapeLike(batch->data_);
+      top_data = buffer.mutable_cpu_data();
+      batch->data_.set_cpu_data(top_data);
+    } else {
+      top_data = batch->data_.mutable_cpu_data();
+    }
+    this->ParallelLoad(batch_size, boost::bind(
+        &MmapDataLayer<Dtype>::LoadRecords, this, top_data, _1, _2, _3));
+  }
+  if (this->output_labels_) {
+    Dtype* top_label = batch->label_.mutable_cpu_data();
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      top_label[item_id] = reader_.label(batch_records_[item_id]);
+    }
+  }
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+}
+
+// This function is called on the transform workers
+template <typename Dtype>
+void MmapDataLayer<Dtype>::LoadRecords(Dtype* top_data,
+    DataTransformer<Dtype>* transformer, int begin, int end) {
+  const int record_count = reader_.record_count();
+  const int item_size = this->transformed_data_.count();
+  Blob<Dtype> record;
+  Blob<Dtype> transformed_data;
+  if (needs_transform_) {
+    vector<int> record_shape(1, 1);
+    record_shape.insert(record_shape.end(), reader_.shape().begin(),
+        reader_.shape().end());
+    record.Reshape(record_shape);
+    transformed_data.Reshape(this->transformed_data_.shape());
+  }
+  for (int item_id = begin; item_id < end; ++item_id) {
+    const char* src = reader_.record(batch_records_[item_id]);
+    Dtype* dst = top_data + item_id * item_size;
+    if (!needs_transform_) {
+      copy_record(reader_.type(), src, record_count, dst);
+      continue;
+    }
+    // Transform works in place on its input, so convert into a scratch blob.
+    copy_record(reader_.type(), src, record_count, record.mutable_cpu_data());
+    transformed_data.set_cpu_data(dst);
+    transformer->Transform(&record, &transformed_data);
+  }
+}
+
+INSTANTIATE_CLASS(MmapDataLayer);
+REGISTER_LAYER_CLASS(MmapData);
+
+}  // namespace caffe
@@ -0,0 +1,301 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "caffe/layers/neighbour_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Converts between one image of the two bottoms and the im2col matrix of the
+// NeighbourLayer top built from them, one channel per ParallelFor index.
+template <typename Dtype>
+struct NeighbourColumns {
+  int height, width;
+  int out_height, out_width;
+  int kernel_size, stride, dilation;
+
+  // Fills col((c * k + y) * k + x, ph * out_width + pw) with
+  // in(c, h, w) - other(c, h + (y - r) * dilation, w + (x - r) * dilation),
+  // where (h, w) = stride * (ph, pw) and taps outside the map read as zero.
+  void Im2col(const Dtype* in, const Dtype* other, Dtype* col,
+      int channel_begin, int channel_end) const {
+    const int radius = (kernel_size - 1) / 2;
+    const int plane = height * width;
+    const int out_plane = out_height * out_width;
+    for (int c = channel_begin; c < channel_end; ++c) {
+      const Dtype* in_c = in + c * plane;
+      const Dtype* other_c = other + c * plane;
+      for (int y = 0; y < kernel_size; ++y) {
+        for (int x = 0; x < kernel_size; ++x) {
+          Dtype* col_row =
+              col + ((c * kernel_size + y) * kernel_size + x) * out_plane;
+          for (int ph = 0; ph < out_height; ++ph) {
+            const int h = ph * stride;
+            const int other_h = h + (y - radius) * dilation;
+            const Dtype* in_row = in_c + h * width;
+            Dtype* out = col_row + ph * out_width;
+            if (other_h < 0 || other_h >= height) {
+              for (int pw = 0; pw < out_width; ++pw) {
+                out[pw] = in_row[pw * stride] - Dtype(0);
+              }
+              continue;
+            }
+            const Dtype* other_row = other_c + other_h * width;
+            for (int pw = 0; pw < out_width; ++pw) {
+              const int other_w = pw * stride + (x - radius) * dilation;
+              out[pw] = (other_w < 0 || other_w >= width) ?
+                  in_row[pw * stride] - Dtype(0) :
+                  in_row[pw * stride] - other_row[other_w];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Gathers the column gradient back onto the bottoms: in_diff(c, h, w)
+  // gains the column entries that read it as the centre, and other_diff
+  // loses those that read it as a neighbour. Either diff may be NULL.
+  void Col2im(const Dtype* col, Dtype* in_diff, Dtype* other_diff,
+      int channel_begin, int channel_end) const {
+    const int radius = (kernel_size - 1) / 2;
+    const int plane = height * width;
+    const int out_plane = out_height * out_width;
+    const int taps = kernel_size * kernel_size;
+    for (int c = channel_begin; c < channel_end; ++c) {
+      const Dtype* col_c = col + c * taps * out_plane;
+      for (int h = 0; h < height; ++h) {
+        for (int w = 0; w < width; ++w) {
+          const int index = c * plane + h * width + w;
+          if (in_diff && h % stride == 0 && w % stride == 0) {
+            const int position = (h / stride) * out_width + w / stride;
+            Dtype sum = 0;
+            for (int tap = 0; tap < taps; ++tap) {
+              sum += col_c[tap * out_plane + position];
+            }
+            in_diff[index] += sum;
+          }
+          if (!other_diff) {
+            continue;
+          }
+          Dtype sum = 0;
+          for (int y = 0; y < kernel_size; ++y) {
+            const int centre_h = h - (y - radius) * dilation;
+            if (centre_h < 0 || centre_h % stride != 0 ||
+                centre_h / stride >= out_height) {
+              continue;
+            }
+            for (int x = 0; x < kernel_size; ++x) {
+              const int centre_w = w - (x - radius) * dilation;
+              if (centre_w < 0 || centre_w % stride != 0 ||
+                  centre_w / stride >= out_width) {
+                continue;
+              }
+              sum += col_c[(y * kernel_size + x) * out_plane +
+                  (centre_h / stride) * out_width + centre_w / stride];
+            }
+          }
+          other_diff[index] -= sum;
+        }
+      }
+    }
+  }
+};
+
+}  // namespace
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const NeighbourParameter& neigh_param = this->layer_param_.neigh_param();
+  neigh_kernel_ = neigh_param.kernel_size();
+  neigh_stride_ = neigh_param.stride();
+  neigh_dilation_ = neigh_param.dilation();
+  CHECK_GT(neigh_kernel_, 1) << "kernel_size must be greater than 1.";
+  CHECK_EQ(neigh_kernel_ % 2, 1) << "kernel_size must be odd.";
+  CHECK_GT(neigh_stride_, 0) << "stride must be positive.";
+  CHECK_GT(neigh_dilation_, 0) << "dilation must be positive.";
+  CHECK_EQ(4, bottom[0]->num_axes()) << "Input must have 4 axes, "
+      << "corresponding to (num, channels, height, width)";
+  // The filters tile the neighbourhood blocks exactly: kernel and stride both
+  // equal the neighbourhood size, with no padding or dilation.
+  ConvolutionParameter* conv_param =
+      this->layer_param_.mutable_convolution_param();
+  CHECK(!conv_param->has_kernel_h() && !conv_param->has_kernel_w() &&
+      !conv_param->has_stride_h() && !conv_param->has_stride_w() &&
+      !conv_param->has_pad_h() && !conv_param->has_pad_w() &&
+      conv_param->pad_size() == 0 && conv_param->dilation_size() == 0)
+      << "NeighbourConvolution derives the filter geometry from neigh_param.";
+  for (int i = 0; i < conv_param->kernel_size_size(); ++i) {
+    CHECK_EQ(neigh_kernel_, conv_param->kernel_size(i))
+        << "convolution kernel_size must match neigh_param kernel_size.";
+  }
+  for (int i = 0; i < conv_param->stride_size(); ++i) {
+    CHECK_EQ(neigh_kernel_, conv_param->stride(i))
+        << "convolution stride must match neigh_param kernel_size.";
+  }
+  CHECK_EQ(1, bottom[0]->CanonicalAxisIndex(conv_param->axis()));
+  CHECK(!conv_param->force_nd_im2col());
+  conv_param->clear_kernel_size();
+  conv_param->add_kernel_size(neigh_kernel_);
+  conv_param->clear_stride();
+  conv_param->add_stride(neigh_kernel_);
+  BaseConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+}
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::Reshape(bottom, top);
+  height_ = bottom[0]->height();
+  width_ = bottom[0]->width();
+  const int out_height = this->output_shape_[0];
+  const int out_width = this->output_shape_[1];
+  const int radius = (neigh_kernel_ - 1) / 2;
+  // Number of window taps for which each row (column) is the neighbour of
+  // some sampled position.
+  vector<int> rows(height_, 0), cols(width_, 0);
+  for (int tap = 0; tap < neigh_kernel_; ++tap) {
+    const int offset = (tap - radius) * neigh_dilation_;
+    for (int h = 0; h < height_; ++h) {
+      const int centre = h - offset;
+      rows[h] += (centre >= 0 && centre % neigh_stride_ == 0 &&
+          centre / neigh_stride_ < out_height);
+    }
+    for (int w = 0; w < width_; ++w) {
+      const int centre = w - offset;
+      cols[w] += (centre >= 0 && centre % neigh_stride_ == 0 &&
+          centre / neigh_stride_ < out_width);
+    }
+  }
+  neighbour_count_.Reshape(1, 1, height_, width_);
+  Dtype* count = neighbour_count_.mutable_cpu_data();
+  for (int h = 0; h < height_; ++h) {
+    for (int w = 0; w < width_; ++w) {
+      const bool sampled = h % neigh_stride_ == 0 && w % neigh_stride_ == 0;
+      count[h * width_ + w] = rows[h] * cols[w] +
+          (sampled ? neigh_kernel_ * neigh_kernel_ : 0);
+    }
+  }
+}
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::compute_output_shape() {
+  this->output_shape_.clear();
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    // i + 1 to skip channel axis
+    const int input_dim = this->input_shape(i + 1);
+    this->output_shape_.push_back((input_dim - 1) / neigh_stride_ + 1);
+  }
+}
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  NeighbourColumns<Dtype> columns = { height_, width_,
+      this->output_shape_[0], this->output_shape_[1],
+      neigh_kernel_, neigh_stride_, neigh_dilation_ };
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  for (int i = 0; i < 2; ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    const Dtype* other_data = bottom[1 - i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      const int offset = n * this->bottom_dim_;
+      caffe_parallel_for(this->channels_, boost::bind(
+          &NeighbourColumns<Dtype>::Im2col, &columns, bottom_data + offset,
+          other_data + offset, this->col_buffer_.mutable_cpu_data(), _1, _2));
+      this->forward_cpu_gemm(bottom_data + offset, weight,
+          top_data + n * this->top_dim_, true);
+      if (this->bias_term_) {
+        const Dtype* bias = this->blobs_[1]->cpu_data();
+        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  NeighbourColumns<Dtype> columns = { height_, width_,
+      this->output_shape_[0], this->output_shape_[1],
+      neigh_kernel_, neigh_stride_, neigh_dilation_ };
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  Dtype* bottom_diff[2] = { NULL, NULL };
+  for (int i = 0; i < 2; ++i) {
+    if (propagate_down[i]) {
+      bottom_diff[i] = bottom[i]->mutable_cpu_diff();
+      caffe_set(bottom[i]->count(), Dtype(0), bottom_diff[i]);
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    const Dtype* other_data = bottom[1 - i]->cpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    if (!this->param_propagate_down_[0] && !propagate_down[0] &&
+        !propagate_down[1]) {
+      continue;
+    }
+    for (int n = 0; n < this->num_; ++n) {
+      const int offset = n * this->bottom_dim_;
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (this->param_propagate_down_[0]) {
+        caffe_parallel_for(this->channels_, boost::bind(
+            &NeighbourColumns<Dtype>::Im2col, &columns,
+            bottom_data + offset, other_data + offset,
+            this->col_buffer_.mutable_cpu_data(), _1, _2));
+        this->weight_cpu_gemm(bottom_data + offset,
+            top_diff + n * this->top_dim_, weight_diff, true);
+      }
+      // gradient w.r.t. both bottoms, gathered from the column gradient.
+      if (propagate_down[0] || propagate_down[1]) {
+        this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+            NULL, true);
+        caffe_parallel_for(this->channels_, boost::bind(
+            &NeighbourColumns<Dtype>::Col2im, &columns,
+            this->col_buffer_.cpu_data(),
+            bottom_diff[i] ? bottom_diff[i] + offset : NULL,
+            bottom_diff[1 - i] ? bottom_diff[1 - i] + offset : NULL,
+            _1, _2));
+      }
+    }
+  }
+  // Average over the contributions, as NeighbourLayer does.
+  const int plane = height_ * width_;
+  const Dtype* count = neighbour_count_.cpu_data();
+  for (int i = 0; i < 2; ++i) {
+    if (!bottom_diff[i]) {
+      continue;
+    }
+    for (int j = 0; j < bottom[i]->count(); j += plane) {
+      for (int k = 0; k < plane; ++k) {
+        if (count[k] > 0) {
+          bottom_diff[i][j + k] /= count[k];
+        }
+      }
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(NeighbourConvolutionLayer);
+#endif
+
+INSTANTIATE_CLASS(NeighbourConvolutionLayer);
+REGISTER_LAYER_CLASS(NeighbourConvolution);
+
+}  // namespace caffe
@@ -0,0 +1,194 @@
+#include <vector>
+
+#include "caffe/layers/neighbour_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+__global__ void NeighbourConvIm2col(const int n_threads, const Dtype* in,
+    const Dtype* other, const int height, const int width,
+    const int out_height, const int out_width, const int kernel_size,
+    const int stride, const int dilation, Dtype* col) {
+  CUDA_KERNEL_LOOP(index, n_threads) {
+    const int pw = index % out_width;
+    const int ph = (index / out_width) % out_height;
+    const int x = (index / out_width / out_height) % kernel_size;
+    const int y = (index / out_width / out_height / kernel_size) % kernel_size;
+    const int c = index / out_width / out_height / kernel_size / kernel_size;
+    const int radius = (kernel_size - 1) / 2;
+    const int h = ph * stride;
+    const int w = pw * stride;
+    const int other_h = h + (y - radius) * dilation;
+    const int other_w = w + (x - radius) * dilation;
+    const int plane = c * height * width;
+    Dtype neighbour = 0;
+    if (other_h >= 0 && other_h < height && other_w >= 0 && other_w < width) {
+      neighbour = other[plane + other_h * width + other_w];
+    }
+    col[index] = in[plane + h * width + w] - neighbour;
+  }
+}
+
+template <typename Dtype>
+__global__ void NeighbourConvCol2im(const int n_threads, const Dtype* col,
+    const int height, const int width, const int out_height,
+    const int out_width, const int kernel_size, const int stride,
+    const int dilation, Dtype* in_diff, Dtype* other_diff) {
+  CUDA_KERNEL_LOOP(index, n_threads) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const int c = index / width / height;
+    const int radius = (kernel_size - 1) / 2;
+    const int out_plane = out_height * out_width;
+    const int taps = kernel_size * kernel_size;
+    const Dtype* col_c = col + c * taps * out_plane;
+    if (in_diff && h % stride == 0 && w % stride == 0) {
+      const int position = (h / stride) * out_width + w / stride;
+      Dtype sum = 0;
+      for (int tap = 0; tap < taps; ++tap) {
+        sum += col_c[tap * out_plane + position];
+      }
+      in_diff[index] += sum;
+    }
+    if (other_diff) {
+      Dtype sum = 0;
+      for (int y = 0; y < kernel_size; ++y) {
+        const int centre_h = h - (y - radius) * dilation;
+        if (centre_h < 0 || centre_h % stride != 0 ||
+            centre_h / stride >= out_height) {
+          continue;
+        }
+        for (int x = 0; x < kernel_size; ++x) {
+          const int centre_w = w - (x - radius) * dilation;
+          if (centre_w < 0 || centre_w % stride != 0 ||
+              centre_w / stride >= out_width) {
+            continue;
+          }
+          sum += col_c[(y * kernel_size + x) * out_plane +
+              (centre_h / stride) * out_width + centre_w / stride];
+        }
+      }
+      other_diff[index] -= sum;
+    }
+  }
+}
+
+template <typename Dtype>
+__global__ void NeighbourConvAverage(const int n_threads, const int plane,
+    const Dtype* count, Dtype* diff) {
+  CUDA_KERNEL_LOOP(index, n_threads) {
+    const Dtype n = count[index % plane];
+    if (n > 0) {
+      diff[index] /= n;
+    }
+  }
+}
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int out_height = this->output_shape_[0];
+  const int out_width = this->output_shape_[1];
+  const int col_count = this->col_buffer_.count();
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  for (int i = 0; i < 2; ++i) {
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    const Dtype* other_data = bottom[1 - i]->gpu_data();
+    Dtype* top_data = top[i]->mutable_gpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      const int offset = n * this->bottom_dim_;
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      NeighbourConvIm2col<Dtype><<<CAFFE_GET_BLOCKS(col_count),
+          CAFFE_CUDA_NUM_THREADS>>>(col_count, bottom_data + offset,
+          other_data + offset, height_, width_, out_height, out_width,
+          neigh_kernel_, neigh_stride_, neigh_dilation_,
+          this->col_buffer_.mutable_gpu_data());
+      CUDA_POST_KERNEL_CHECK;
+      this->forward_gpu_gemm(bottom_data + offset, weight,
+          top_data + n * this->top_dim_, true);
+      if (this->bias_term_) {
+        const Dtype* bias = this->blobs_[1]->gpu_data();
+        this->forward_gpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void NeighbourConvolutionLayer<Dtype>::Backward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const int out_height = this->output_shape_[0];
+  const int out_width = this->output_shape_[1];
+  const int col_count = this->col_buffer_.count();
+  const int image_count = this->channels_ * height_ * width_;
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
+  Dtype* bottom_diff[2] = { NULL, NULL };
+  for (int i = 0; i < 2; ++i) {
+    if (propagate_down[i]) {
+      bottom_diff[i] = bottom[i]->mutable_gpu_diff();
+      caffe_gpu_set(bottom[i]->count(), Dtype(0), bottom_diff[i]);
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    const Dtype* top_diff = top[i]->gpu_diff();
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    const Dtype* other_data = bottom[1 - i]->gpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_gpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_gpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    if (!this->param_propagate_down_[0] && !propagate_down[0] &&
+        !propagate_down[1]) {
+      continue;
+    }
+    for (int n = 0; n < this->num_; ++n) {
+      const int offset = n * this->bottom_dim_;
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (this->param_propagate_down_[0]) {
+        // NOLINT_NEXT_LINE(whitespace/operators)
+        NeighbourConvIm2col<Dtype><<<CAFFE_GET_BLOCKS(col_count),
+            CAFFE_CUDA_NUM_THREADS>>>(col_count, bottom_data + offset,
+            other_data + offset, height_, width_, out_height, out_width,
+            neigh_kernel_, neigh_stride_, neigh_dilation_,
+            this->col_buffer_.mutable_gpu_data());
+        CUDA_POST_KERNEL_CHECK;
+        this->weight_gpu_gemm(bottom_data + offset,
+            top_diff + n * this->top_dim_, weight_diff, true);
+      }
+      // gradient w.r.t. both bottoms, gathered from the column gradient.
+      if (propagate_down[0] || propagate_down[1]) {
+        this->backward_gpu_gemm(top_diff + n * this->top_dim_, weight,
+            NULL, true);
+        // NOLINT_NEXT_LINE(whitespace/operators)
+        NeighbourConvCol2im<Dtype><<<CAFFE_GET_BLOCKS(image_count),
+            CAFFE_CUDA_NUM_THREADS>>>(image_count,
+            this->col_buffer_.gpu_data(), height_, width_, out_height,
+            out_width, neigh_kernel_, neigh_stride_, neigh_dilation_,
+            bottom_diff[i] ? bottom_diff[i] + offset : NULL,
+            bottom_diff[1 - i] ? bottom_diff[1 - i] + offset : NULL);
+        CUDA_POST_KERNEL_CHECK;
+      }
+    }
+  }
+  // Average over the contributions, as NeighbourLayer does.
+  for (int i = 0; i < 2; ++i) {
+    if (bottom_diff[i]) {
+      const int count = bottom[i]->count();
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      NeighbourConvAverage<Dtype><<<CAFFE_GET_BLOCKS(count),
+          CAFFE_CUDA_NUM_THREADS>>>(count, height_ * width_,
+          neighbour_count_.gpu_data(), bottom_diff[i]);
+      CUDA_POST_KERNEL_CHECK;
+    }
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(NeighbourConvolutionLayer);
+
+}  // namespace caffe
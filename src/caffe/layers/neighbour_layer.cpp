@@ -1,3 +1,6 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -6,11 +9,223 @@
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/im2col.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/layers/neighbour_layer.hpp"
 
 namespace caffe {
 	
 
+namespace {
+
+// Shape of one bottom plane and of the window sampled on it.
+struct NeighbourGeometry {
+  int height, width;
+  int out_height, out_width;
+  int kernel_size, stride, dilation;
+};
+
+// Finds the sampled positions [*begin, *end) along one axis of length size
+// whose whole window, reaching reach pixels to either side, stays inside.
+inline void neighbour_interior(const int size, const int out_size,
+    const int reach, const int stride, int* begin, int* end) {
+  *begin = std::min(out_size, (reach + stride - 1) / stride);
+  *end = (size - 1 - reach < 0) ? 0 :
+      std::min(out_size, (size - 1 - reach) / stride + 1);
+  *end = std::max(*begin, *end);
+}
+
+// Writes the kernel x kernel top block of sampled position (ph, pw):
+// out(y, x) = in(h, w) - other(h + (y - r) * dilation, w + (x - r) * dilation)
+// where (h, w) = stride * (ph, pw) and taps outside the map read as zero.
+// kKernel > 0 fixes the kernel size at compile time so the block loops are
+// fully unrolled; 0 takes it from the geometry. Interior positions take the
+// unchecked path so that each block row is a branch-free strided
+// subtraction the compiler can vectorize.
+template <typename Dtype, int kKernel, bool kCheckBounds>
+inline void neighbour_forward_block(const Dtype* in, const Dtype* other,
+    const NeighbourGeometry& g, const int ph, const int pw, Dtype* out) {
+  const int kernel = kKernel > 0 ? kKernel : g.kernel_size;
+  const int radius = (kernel - 1) / 2;
+  const int top_width = kernel * g.out_width;
+  const int h = ph * g.stride;
+  const int w = pw * g.stride;
+  const Dtype value = in[h * g.width + w];
+  out += (kernel * ph) * top_width + kernel * pw;
+  for (int y = 0; y < kernel; ++y) {
+    const int other_h = h + (y - radius) * g.dilation;
+    Dtype* out_row = out + y * top_width;
+    if (!kCheckBounds) {
+      const Dtype* other_row =
+          other + other_h * g.width + w - radius * g.dilation;
+      for (int x = 0; x < kernel; ++x) {
+        out_row[x] = value - other_row[x * g.dilation];
+      }
+    } else if (other_h < 0 || other_h >= g.height) {
+      for (int x = 0; x < kernel; ++x) {
+        out_row[x] = value - Dtype(0);
+      }
+    } else {
+      for (int x = 0; x < kernel; ++x) {
+        const int other_w = w + (x - radius) * g.dilation;
+        out_row[x] = (other_w < 0 || other_w >= g.width) ?
+            value - Dtype(0) : value - other[other_h * g.width + other_w];
+      }
+    }
+  }
+}
+
+template <typename Dtype, int kKernel>
+void neighbour_forward_plane(const Dtype* in, const Dtype* other,
+    const NeighbourGeometry& g, Dtype* out) {
+  const int reach = (g.kernel_size - 1) / 2 * g.dilation;
+  int h_begin, h_end, w_begin, w_end;
+  neighbour_interior(g.height, g.out_height, reach, g.stride, &h_begin,
+      &h_end);
+  neighbour_interior(g.width, g.out_width, reach, g.stride, &w_begin, &w_end);
+  for (int ph = 0; ph < g.out_height; ++ph) {
+    if (ph < h_begin || ph >= h_end) {
+      for (int pw = 0; pw < g.out_width; ++pw) {
+        neighbour_forward_block<Dtype, kKernel, true>(in, other, g, ph, pw,
+            out);
+      }
+      continue;
+    }
+    for (int pw = 0; pw < w_begin; ++pw) {
+      neighbour_forward_block<Dtype, kKernel, true>(in, other, g, ph, pw,
+          out);
+    }
+    for (int pw = w_begin; pw < w_end; ++pw) {
+      neighbour_forward_block<Dtype, kKernel, false>(in, other, g, ph, pw,
+          out);
+    }
+    for (int pw = w_end; pw < g.out_width; ++pw) {
+      neighbour_forward_block<Dtype, kKernel, true>(in, other, g, ph, pw,
+          out);
+    }
+  }
+}
+
+// Computes the top planes [begin, end) of both tops.
+template <typename Dtype, int kKernel>
+void neighbour_forward_planes(const Dtype* bottom0, const Dtype* bottom1,
+    const NeighbourGeometry g, Dtype* top0, Dtype* top1, const int begin,
+    const int end) {
+  const int bottom_dim = g.height * g.width;
+  const int top_dim =
+      g.kernel_size * g.kernel_size * g.out_height * g.out_width;
+  for (int p = begin; p < end; ++p) {
+    neighbour_forward_plane<Dtype, kKernel>(bottom0 + p * bottom_dim,
+        bottom1 + p * bottom_dim, g, top0 + p * top_dim);
+    neighbour_forward_plane<Dtype, kKernel>(bottom1 + p * bottom_dim,
+        bottom0 + p * bottom_dim, g, top1 + p * top_dim);
+  }
+}
+
+// Gathers the gradient of input position (h, w): its own top block, if
+// (h, w) is sampled, plus the mirrored entries of the other top where (h, w)
+// was the subtracted neighbour, averaged over the number of terms. Every
+// bottom element only reads top diffs, so planes can be processed in any
+// order or concurrently. The unchecked path is only taken with stride 1,
+// where every interior position owns a block and all of its mirrors exist.
+template <typename Dtype, int kKernel, bool kCheckBounds>
+inline Dtype neighbour_backward_element(const Dtype* top_diff,
+    const Dtype* other_diff, const NeighbourGeometry& g, const int h,
+    const int w) {
+  const int kernel = kKernel > 0 ? kKernel : g.kernel_size;
+  const int radius = (kernel - 1) / 2;
+  const int top_width = kernel * g.out_width;
+  const bool sampled = !kCheckBounds ||
+      (h % g.stride == 0 && w % g.stride == 0);
+  const Dtype* own = top_diff + (kernel * (h / g.stride)) * top_width +
+      kernel * (w / g.stride);
+  Dtype sum = 0;
+  int count = 0;
+  for (int y = 0; y < kernel; ++y) {
+    const int other_h = h + (y - radius) * g.dilation;
+    for (int x = 0; x < kernel; ++x) {
+      const int other_w = w + (x - radius) * g.dilation;
+      if (sampled) {
+        sum += own[y * top_width + x];
+        ++count;
+      }
+      if (kCheckBounds && (other_w >= g.width || other_h >= g.height ||
+          other_w < 0 || other_h < 0 || other_h % g.stride != 0 ||
+          other_w % g.stride != 0)) {
+        continue;
+      }
+      sum -= other_diff[(kernel * (other_h / g.stride) + kernel - 1 - y) *
+          top_width + kernel * (other_w / g.stride) + kernel - 1 - x];
+      ++count;
+    }
+  }
+  return count > 0 ? sum / count : Dtype(0);
+}
+
+template <typename Dtype, int kKernel>
+void neighbour_backward_plane(const Dtype* top_diff, const Dtype* other_diff,
+    const NeighbourGeometry& g, Dtype* bottom_diff) {
+  const int reach = (g.kernel_size - 1) / 2 * g.dilation;
+  int h_begin = 0, h_end = 0, w_begin = 0, w_end = 0;
+  if (g.stride == 1) {
+    neighbour_interior(g.height, g.height, reach, 1, &h_begin, &h_end);
+    neighbour_interior(g.width, g.width, reach, 1, &w_begin, &w_end);
+  }
+  for (int h = 0; h < g.height; ++h) {
+    const bool row_interior = h >= h_begin && h < h_end;
+    for (int w = 0; w < g.width; ++w) {
+      bottom_diff[h * g.width + w] =
+          (row_interior && w >= w_begin && w < w_end) ?
+          neighbour_backward_element<Dtype, kKernel, false>(top_diff,
+              other_diff, g, h, w) :
+          neighbour_backward_element<Dtype, kKernel, true>(top_diff,
+              other_diff, g, h, w);
+    }
+  }
+}
+
+// Computes the bottom diff planes [begin, end) of one bottom.
+template <typename Dtype, int kKernel>
+void neighbour_backward_planes(const Dtype* top_diff, const Dtype* other_diff,
+    const NeighbourGeometry g, Dtype* bottom_diff, const int begin,
+    const int end) {
+  const int bottom_dim = g.height * g.width;
+  const int top_dim =
+      g.kernel_size * g.kernel_size * g.out_height * g.out_width;
+  for (int p = begin; p < end; ++p) {
+    neighbour_backward_plane<Dtype, kKernel>(top_diff + p * top_dim,
+        other_diff + p * top_dim, g, bottom_diff + p * bottom_dim);
+  }
+}
+
+inline NeighbourGeometry neighbour_geometry(const int height, const int width,
+    const int out_height, const int out_width, const int kernel_size,
+    const int stride, const int dilation) {
+  NeighbourGeometry g;
+  g.height = height;
+  g.width = width;
+  g.out_height = out_height;
+  g.out_width = out_width;
+  g.kernel_size = kernel_size;
+  g.stride = stride;
+  g.dilation = dilation;
+  return g;
+}
+
+}  // namespace
+
+template <typename Dtype>
+void NeighbourLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const NeighbourParameter& neigh_param = this->layer_param_.neigh_param();
+  kernel_size_ = neigh_param.kernel_size();
+  stride_ = neigh_param.stride();
+  dilation_ = neigh_param.dilation();
+  CHECK_GT(kernel_size_, 0) << "kernel_size must be positive.";
+  CHECK_EQ(kernel_size_ % 2, 1) << "kernel_size must be odd.";
+  CHECK_GT(stride_, 0) << "stride must be positive.";
+  CHECK_GT(dilation_, 0) << "dilation must be positive.";
+}
+
 template <typename Dtype>
 void NeighbourLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 	const vector<Blob<Dtype>*>& top) {
@@ -31,120 +246,74 @@ void NeighbourLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 	CHECK_EQ(height_i,height_j) << "Dimensions (height) must agree.";
 	CHECK_EQ(width_i,width_j) << "Dimensions (width) must agree.";
 	CHECK_EQ(channels_i,channels_j) << "Dimensions (channels) must agree.";
-	top[0]->Reshape(bottom[0]->num(),channels_i,5*height_i,5*width_i); 
-	top[1]->Reshape(bottom[0]->num(),channels_i,5*height_i,5*width_i);
+	out_height_ = (height_i - 1) / stride_ + 1;
+	out_width_ = (width_i - 1) / stride_ + 1;
+	top[0]->Reshape(bottom[0]->num(),channels_i,kernel_size_*out_height_,
+	    kernel_size_*out_width_);
+	top[1]->Reshape(bottom[0]->num(),channels_i,kernel_size_*out_height_,
+	    kernel_size_*out_width_);
 }
 
 template <typename Dtype>
 void NeighbourLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-	
-	Dtype* top_data = top[0]->mutable_cpu_data();
-	Dtype* top_data2 = top[1]->mutable_cpu_data();
-	const Dtype* bottom_data = bottom[0]->cpu_data();
-	
-	Dtype value_f = 0;
-	Dtype value_f2 = 0;
-	Dtype temp = 0;
-	Dtype temp2 = 0;
-
-	for (int n = 0; n < bottom[0]->num(); ++n){
-		for (int c = 0; c < channels_i; ++c){
-			for (int h = 0; h < height_i; ++h){
-				const int index_h = 5*h;
-				for (int w = 0; w < width_i; ++w){
-					int count_y = 0;
-					const int index_w = 5*w;
-					value_f = bottom[0]->data_at(n,c,h,w);
-					value_f2 = bottom[1]->data_at(n,c,h,w);
-
-					for (int y = -2; y < 3; ++y){
-						int count_x = 0;
-						for (int x = -2; x < 3; ++x){
-							int test1 = h+y;
-							int test2 = w+x;
-	
-							//Check if at boundary
-							if (test1 < 0 || test2 < 0 || test1 >= height_i || test2 >= width_i){
-								temp = 0;
-								temp2 = 0;
-							}
-							else{
-								temp = bottom[1]->data_at(n,c,h+y,w+x);
-								temp2 = bottom[0]->data_at(n,c,h+y,w+x);
-							 }
-							 top_data[top[0]->offset(n,c,index_h+count_y,index_w+count_x)] = value_f-temp;
-							 top_data2[top[1]->offset(n,c,index_h+count_y,index_w+count_x)] = value_f2-temp2;
-							count_x += 1;
-						}	
-						count_y += 1;
-					}
-				}
-			}
-		}
-	} 
-} 
+  const NeighbourGeometry g = neighbour_geometry(height_i, width_i,
+      out_height_, out_width_, kernel_size_, stride_, dilation_);
+  const Dtype* bottom0 = bottom[0]->cpu_data();
+  const Dtype* bottom1 = bottom[1]->cpu_data();
+  Dtype* top0 = top[0]->mutable_cpu_data();
+  Dtype* top1 = top[1]->mutable_cpu_data();
+  // Each (n, c) plane is independent, so planes are split over the pool.
+  const int num_planes = bottom[0]->num() * channels_i;
+  switch (kernel_size_) {
+  case 3:
+    caffe_parallel_for(num_planes, boost::bind(
+        &neighbour_forward_planes<Dtype, 3>, bottom0, bottom1, g, top0, top1,
+        _1, _2));
+    break;
+  case 5:
+    caffe_parallel_for(num_planes, boost::bind(
+        &neighbour_forward_planes<Dtype, 5>, bottom0, bottom1, g, top0, top1,
+        _1, _2));
+    break;
+  default:
+    caffe_parallel_for(num_planes, boost::bind(
+        &neighbour_forward_planes<Dtype, 0>, bottom0, bottom1, g, top0, top1,
+        _1, _2));
+  }
+}
 
 template <typename Dtype>
 void NeighbourLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-
-
-for (int i = 0; i < bottom.size(); ++i) {
-  Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
-  const int other = (i == 0) ? 1 : 0;
-  
-  for (int n = 0; n < top[i]->num(); ++n) {
-	for (int c = 0; c < channels_i; ++c) {
-		for (int h = 0; h < height_i; ++h) {
-			const int index_h = 5*h;
-			for (int w = 0; w < width_i; ++w) {
-				int count = 0;
-				const int index_w = 5*w;
-				// Vers 1.0 - min error
-				//Dtype min_val = top[0]->diff_at(n,c,5*h,5*w);
-				//Dtype min_val2 = top[1]->diff_at(n,c,5*h,5*w);
-				/*for (int y = 0; y < 5; ++y) {
-					for (int x = 0; x < 5; ++x) {
-						min_temp = top[i]->diff_at(n,c,(5*h)+y,(5*w)+x);
-						min_temp2 = top[1]->diff_at(n,c,(5*h)+y,(5*w)+x);
-						
-						if (min_temp < min_val){
-							min_val = min_temp;
-						}
-						if (min_temp2 < min_val2) {
-							min_val2 = min_temp2;
-						}
-					}
-				} 
-				//bottom_diff[bottom[0]->offset(n,c,h,w)] = min_val;
-				//bottom_diff2[bottom[1]->offset(n,c,h,w)] = min_val2; */
-				
-				// Vers. 2.0 - average error gradient w.r.t. bottom	
-				for (int y = 0; y < 5; ++y){
-					for (int x = 0; x < 5; ++x){
-						count += 1;
-						bottom_diff[bottom[i]->offset(n,c,h,w)] += top[i]->diff_at(n,c,index_h+y,index_w+x);
-						if ((x-2)+w >= width_i || (y-2)+h >= height_i || (x-2)+w < 0 || (y-2)+h < 0){
-							continue;
-						}
-						else{
-							int off_y = 2-(y-2);
-							int off_x = 2-(x-2);
-							int H = 5*((y-2)+h)+off_y;
-							int W = 5*((x-2)+w)+off_x;
-							bottom_diff[bottom[i]->offset(n,c,h,w)] += (-1*top[other]->diff_at(n,c,H,W));
-							count += 1;	
-						}
-					}
-				} 
-				
-				bottom_diff[bottom[i]->offset(n,c,h,w)] /= count;
-			}
-		}
-	}
+  const NeighbourGeometry g = neighbour_geometry(height_i, width_i,
+      out_height_, out_width_, kernel_size_, stride_, dilation_);
+  // Bottom diffs are overwritten, not accumulated, and frozen branches
+  // are skipped entirely.
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (!propagate_down[i]) { continue; }
+    const int other = (i == 0) ? 1 : 0;
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* other_diff = top[other]->cpu_diff();
+    Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+    const int num_planes = bottom[i]->num() * channels_i;
+    switch (kernel_size_) {
+    case 3:
+      caffe_parallel_for(num_planes, boost::bind(
+          &neighbour_backward_planes<Dtype, 3>, top_diff, other_diff, g,
+          bottom_diff, _1, _2));
+      break;
+    case 5:
+      caffe_parallel_for(num_planes, boost::bind(
+          &neighbour_backward_planes<Dtype, 5>, top_diff, other_diff, g,
+          bottom_diff, _1, _2));
+      break;
+    default:
+      caffe_parallel_for(num_planes, boost::bind(
+          &neighbour_backward_planes<Dtype, 0>, top_diff, other_diff, g,
+          bottom_diff, _1, _2));
+    }
   }
- }	
 }
 
 #ifdef CPU_ONLY
@@ -16,39 +16,43 @@
 namespace caffe {
 
 template <typename Dtype>
-__global__ void NeighbourLayerForward(const int n_threads, const int count,
-	const int channels, const int height, const int width,
-    const Dtype* in1, const Dtype* in2, Dtype* out1, Dtype* out2, Dtype temp1, Dtype temp2) {
-  CUDA_KERNEL_LOOP(index, count) {
-    const int w = index % width;
-    const int h = (index / width) % height;
-    const int c = (index / width / height) % channels;
-    const int n = index / width / height / channels;
-
-	const Dtype* bot_slice1 = in1 + (n * channels + c) * height * width;
-	const Dtype* bot_slice2 = in2 + (n * channels + c) * height * width;
-	Dtype value_f1 = bot_slice1[h*width+w];
-	Dtype value_f2 = bot_slice2[h*width+w];	
+__global__ void NeighbourLayerForward(const int n_threads,
+    const int height, const int width, const int out_height,
+    const int out_width, const int kernel_size, const int stride,
+    const int dilation, const Dtype* in1, const Dtype* in2, Dtype* out1,
+    Dtype* out2) {
+  CUDA_KERNEL_LOOP(index, n_threads) {
+    const int pw = index % out_width;
+    const int ph = (index / out_width) % out_height;
+    const int plane = index / out_width / out_height;
+    const int h = ph * stride;
+    const int w = pw * stride;
+    const int radius = (kernel_size - 1) / 2;
+    const int top_width = kernel_size * out_width;
 
-    for (int y = -2; y < 3; ++y){
-		for (int x = -2; x < 3; ++x){
-			int test1 = h+y;
-			int test2 = w+x;
+    const Dtype* bot_slice1 = in1 + plane * height * width;
+    const Dtype* bot_slice2 = in2 + plane * height * width;
+    const Dtype value_f1 = bot_slice1[h * width + w];
+    const Dtype value_f2 = bot_slice2[h * width + w];
+    Dtype* out_slice1 = out1 + (plane * kernel_size * out_height +
+        kernel_size * ph) * top_width + kernel_size * pw;
+    Dtype* out_slice2 = out2 + (plane * kernel_size * out_height +
+        kernel_size * ph) * top_width + kernel_size * pw;
 
-			if (test1 < 0 || test2 < 0 || test1 >= height || test2 >= width){
-				temp1 = 0;
-				temp2 = 0;
-			}
-			else{
-				temp1 = bot_slice1[(h+y)*width+w+x];
-				temp2 = bot_slice2[(h+y)*width+w+x];				
-				
-			}
-			int index_out = ((n * channels + c) * (5*height) + (5*h) + y + 2) * (5*width) + (5*w) + x + 2;
-			out1[index_out] = (value_f1-temp2);
-			out2[index_out] = (value_f2-temp1);
-		}
-	}
+    for (int y = 0; y < kernel_size; ++y) {
+      for (int x = 0; x < kernel_size; ++x) {
+        const int test1 = h + (y - radius) * dilation;
+        const int test2 = w + (x - radius) * dilation;
+        Dtype temp1 = 0;
+        Dtype temp2 = 0;
+        if (test1 >= 0 && test2 >= 0 && test1 < height && test2 < width) {
+          temp1 = bot_slice1[test1 * width + test2];
+          temp2 = bot_slice2[test1 * width + test2];
+        }
+        out_slice1[y * top_width + x] = value_f1 - temp2;
+        out_slice2[y * top_width + x] = value_f2 - temp1;
+      }
+    }
   }
 }
 
@@ -60,97 +64,75 @@ void NeighbourLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 
   Dtype* top_data = top[0]->mutable_gpu_data();
   Dtype* top_data2 = top[1]->mutable_gpu_data();
-  int count = top[0]->count();
-  int count_bottom = bottom[0]->count();
-  Dtype temp1 = 0;
-  Dtype temp2 = 0;
+  const int count = bottom[0]->num() * channels_i * out_height_ * out_width_;
   // NOLINT_NEXT_LINE(whitespace/operators)
   NeighbourLayerForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
-      count, count_bottom, channels_i,
-      height_i, width_i, bottom_data, bottom_data2, top_data, top_data2, temp1, temp2);
+      count, height_i, width_i, out_height_, out_width_, kernel_size_,
+      stride_, dilation_, bottom_data, bottom_data2, top_data, top_data2);
   CUDA_POST_KERNEL_CHECK;
-}	
-	
+}
+
+// Gathers the averaged gradient of each bottom element from its own top
+// block and the mirrored entries of the other top; see neighbour_layer.cpp.
 template <typename Dtype>
-__global__ void NeighbourLayerBackward(const int n_threads, const int count,
-	const int channels, const int height, const int width,
-    const Dtype* const in1, const Dtype* const in2, Dtype* const out1, Dtype temp1, Dtype temp2, int other) {
-  CUDA_KERNEL_LOOP(index, count) {
+__global__ void NeighbourLayerBackward(const int n_threads,
+    const int height, const int width, const int out_height,
+    const int out_width, const int kernel_size, const int stride,
+    const int dilation, const Dtype* const in1, const Dtype* const in2,
+    Dtype* const out1) {
+  CUDA_KERNEL_LOOP(index, n_threads) {
     const int w = index % width;
     const int h = (index / width) % height;
-    const int c = (index / width / height) % channels;
-    const int n = index / width / height / channels;
-	
-    //Dtype min_val1 = in1[((n * channels + c) * (5*height) + (5*h)) * (5*width) + (5*w)];
-    //Dtype min_val2 = in2[((n * channels + c) * (5*height) + (5*h)) * (5*width) + (5*w)];	
+    const int plane = index / width / height;
+    const int radius = (kernel_size - 1) / 2;
+    const int top_width = kernel_size * out_width;
+    const int top_dim = kernel_size * out_height * top_width;
+    const Dtype* top_slice1 = in1 + plane * top_dim;
+    const Dtype* top_slice2 = in2 + plane * top_dim;
+    const bool sampled = (h % stride == 0 && w % stride == 0);
 
-    // Vers. 1.0
-   /* for (int y = 0; y < 5; ++y){
-		for (int x = 0; x < 5; ++x){
-			temp1 = in1[((n * channels + c) * (5*height) + (5*h+y)) * (5*width) + (5*w+x)];
-			temp2 = in2[((n * channels + c) * (5*height) + (5*h+y)) * (5*width) + (5*w+x)];
-			
-			if (temp1 < min_val1){
-				min_val1 = temp1;
-			}
-			if (temp2 < min_val2){
-				min_val2 = temp2;
-			}
-		}
-	} */ 
-	
-	int count = 0;
-	int index_o = ((n * channels + c) * height + h) * width + w;
-	
-	// Vers 2.0
-		for (int y = 0; y < 5; ++y){
-			for (int x = 0; x < 5; ++x){
-				count += 1;
-				out1[index_o] += in1[((n * channels + c) * (5*height) + (5*h) + y) * 5*width + (5*w) + x];
-				if ((x-2)+w >= width || (y-2)+h >= height || (x-2)+w < 0 || (y-2)+h < 0){
-					continue;
-				}
-				else{
-					int off_y = 2-(y-2);
-					int off_x = 2-(x-2);
-					out1[index_o] += -1*in2[((n * channels + c) * (5*height) + 5*((y-2)+h)+off_y) * (5*width) + 5*((x-2)+w) + off_x];
-					count += 1;
-				}
-			}
-		} 
-		
-	out1[index_o] /= count;
-	/*if (other == 1){
-	out1[index_o] = min_val1;
-	}
-	else{
-	out1[index_o] = min_val2;
-	}*/
+    int count = 0;
+    Dtype sum = 0;
+    for (int y = 0; y < kernel_size; ++y) {
+      for (int x = 0; x < kernel_size; ++x) {
+        if (sampled) {
+          sum += top_slice1[(kernel_size * (h / stride) + y) * top_width +
+              kernel_size * (w / stride) + x];
+          count += 1;
+        }
+        const int nh = h + (y - radius) * dilation;
+        const int nw = w + (x - radius) * dilation;
+        if (nw >= width || nh >= height || nw < 0 || nh < 0 ||
+            nh % stride != 0 || nw % stride != 0) {
+          continue;
+        }
+        sum -= top_slice2[(kernel_size * (nh / stride) + kernel_size - 1 - y) *
+            top_width + kernel_size * (nw / stride) + kernel_size - 1 - x];
+        count += 1;
+      }
+    }
+    out1[index] = count > 0 ? sum / count : Dtype(0);
   }
 }
 
 template <typename Dtype>
 void NeighbourLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (!propagate_down[i]) { continue; }
+    const int other = (i == 0) ? 1 : 0;
 
-  for (int i = 0; i < bottom.size(); ++i){
-	  const int other = (i == 0) ? 1 : 0;
-	  
-	  const Dtype* top_diff = top[i]->gpu_diff();
-	  const Dtype* top_diff2 = top[other]->gpu_diff();
-	  Dtype* bottom_data = bottom[i]->mutable_gpu_diff();
-	  
-	  const int count = top[i]->count();
-	  const int bottom_count = bottom[i]->count();
-	  Dtype temp1 = 0;
-	  Dtype temp2 = 0;
+    const Dtype* top_diff = top[i]->gpu_diff();
+    const Dtype* top_diff2 = top[other]->gpu_diff();
+    Dtype* bottom_diff = bottom[i]->mutable_gpu_diff();
+    const int bottom_count = bottom[i]->count();
 
-	  // NOLINT_NEXT_LINE(whitespace/operators)
-	  NeighbourLayerBackward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
-		  count, bottom_count, channels_i,
-		  height_i, width_i, top_diff, top_diff2, bottom_data, temp1, temp2, other);
-	  CUDA_POST_KERNEL_CHECK;
-	}
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    NeighbourLayerBackward<Dtype><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
+        bottom_count, height_i, width_i, out_height_, out_width_,
+        kernel_size_, stride_, dilation_, top_diff, top_diff2, bottom_diff);
+    CUDA_POST_KERNEL_CHECK;
+  }
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS(NeighbourLayer);
@@ -0,0 +1,146 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/normalized_triplet_loss_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void NormalizedTripletLossLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  LossLayer<Dtype>::LayerSetUp(bottom, top);
+  alpha_ = this->layer_param_.threshold_param().threshold();
+  distance_scale_ = this->layer_param_.triplet_param().distance() ==
+      TripletParameter_Distance_COSINE ? 1 : 2;
+}
+
+template <typename Dtype>
+void NormalizedTripletLossLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  CHECK(bottom[0]->shape() == bottom[1]->shape())
+      << "Inputs must have the same dimension.";
+  CHECK(bottom[0]->shape() == bottom[2]->shape())
+      << "Inputs must have the same dimension.";
+  vector<int> loss_shape(0);  // Loss layers output a scalar; 0 axes.
+  top[0]->Reshape(loss_shape);
+  batch_size_ = bottom[0]->shape(0);
+  vec_dimension_ = bottom[0]->count() / batch_size_;
+  norm_anchor_.resize(batch_size_);
+  norm_positive_.resize(batch_size_);
+  norm_negative_.resize(batch_size_);
+  sim_positive_.resize(batch_size_);
+  sim_negative_.resize(batch_size_);
+  vec_loss_.resize(batch_size_);
+}
+
+template <typename Dtype>
+void NormalizedTripletLossLayer<Dtype>::ForwardSamples(
+    const Dtype* const* data, int begin, int end) {
+  // Keeps all-zero embeddings from dividing by zero.
+  const Dtype kMinNorm = 1e-12;
+  for (int v = begin; v < end; ++v) {
+    const int offset = v * vec_dimension_;
+    const Dtype* anchor = data[0] + offset;
+    const Dtype* positive = data[1] + offset;
+    const Dtype* negative = data[2] + offset;
+    Dtype aa = 0, pp = 0, nn = 0, ap = 0, an = 0;
+    for (int k = 0; k < vec_dimension_; ++k) {
+      aa += anchor[k] * anchor[k];
+      pp += positive[k] * positive[k];
+      nn += negative[k] * negative[k];
+      ap += anchor[k] * positive[k];
+      an += anchor[k] * negative[k];
+    }
+    norm_anchor_[v] = std::max(Dtype(sqrt(aa)), kMinNorm);
+    norm_positive_[v] = std::max(Dtype(sqrt(pp)), kMinNorm);
+    norm_negative_[v] = std::max(Dtype(sqrt(nn)), kMinNorm);
+    sim_positive_[v] = ap / (norm_anchor_[v] * norm_positive_[v]);
+    sim_negative_[v] = an / (norm_anchor_[v] * norm_negative_[v]);
+    vec_loss_[v] =
+        alpha_ + distance_scale_ * (sim_negative_[v] - sim_positive_[v]);
+  }
+}
+
+template <typename Dtype>
+void NormalizedTripletLossLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* data[3];
+  for (int i = 0; i < 3; ++i) {
+    data[i] = bottom[i]->cpu_data();
+  }
+  caffe_parallel_for(batch_size_, boost::bind(
+      &NormalizedTripletLossLayer<Dtype>::ForwardSamples, this, data,
+      _1, _2));
+  Dtype loss = 0;
+  for (int v = 0; v < batch_size_; ++v) {
+    loss += std::max(Dtype(0), vec_loss_[v]);
+  }
+  top[0]->mutable_cpu_data()[0] = loss / (distance_scale_ * batch_size_);
+}
+
+template <typename Dtype>
+void NormalizedTripletLossLayer<Dtype>::BackwardSamples(
+    const Dtype* const* data, Dtype* const* diff, Dtype scale, int begin,
+    int end) {
+  for (int v = begin; v < end; ++v) {
+    const int offset = v * vec_dimension_;
+    const Dtype* anchor = data[0] + offset;
+    const Dtype* positive = data[1] + offset;
+    const Dtype* negative = data[2] + offset;
+    // The loss moves with sim_negative - sim_positive while the hinge is
+    // active, and d(x'.y')/dx = (y' - (x'.y') x') / ||x||.
+    const Dtype g = vec_loss_[v] > 0 ? scale : Dtype(0);
+    const Dtype inv_a = 1 / norm_anchor_[v];
+    const Dtype inv_p = 1 / norm_positive_[v];
+    const Dtype inv_n = 1 / norm_negative_[v];
+    const Dtype s_p = sim_positive_[v];
+    const Dtype s_n = sim_negative_[v];
+    if (diff[0]) {
+      Dtype* anchor_diff = diff[0] + offset;
+      for (int k = 0; k < vec_dimension_; ++k) {
+        anchor_diff[k] = g * inv_a * (negative[k] * inv_n -
+            positive[k] * inv_p + (s_p - s_n) * anchor[k] * inv_a);
+      }
+    }
+    if (diff[1]) {
+      Dtype* positive_diff = diff[1] + offset;
+      for (int k = 0; k < vec_dimension_; ++k) {
+        positive_diff[k] = -g * inv_p *
+            (anchor[k] * inv_a - s_p * positive[k] * inv_p);
+      }
+    }
+    if (diff[2]) {
+      Dtype* negative_diff = diff[2] + offset;
+      for (int k = 0; k < vec_dimension_; ++k) {
+        negative_diff[k] = g * inv_n *
+            (anchor[k] * inv_a - s_n * negative[k] * inv_n);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void NormalizedTripletLossLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const Dtype scale = top[0]->cpu_diff()[0] / batch_size_;
+  const Dtype* data[3];
+  Dtype* diff[3];
+  for (int i = 0; i < 3; ++i) {
+    data[i] = bottom[i]->cpu_data();
+    diff[i] = propagate_down[i] ? bottom[i]->mutable_cpu_diff() : NULL;
+  }
+  caffe_parallel_for(batch_size_, boost::bind(
+      &NormalizedTripletLossLayer<Dtype>::BackwardSamples, this, data, diff,
+      scale, _1, _2));
+}
+
+INSTANTIATE_CLASS(NormalizedTripletLossLayer);
+REGISTER_LAYER_CLASS(NormalizedTripletLoss);
+
+}  // namespace caffe
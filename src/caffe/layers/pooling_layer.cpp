@@ -108,9 +108,11 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   if (top.size() > 1) {
     top[1]->ReshapeLike(*top[0]);
   }
-  // If max pooling, we will initialize the vector index part.
+  // If max pooling, we will initialize the vector index part, which only
+  // Backward reads.
   if (this->layer_param_.pooling_param().pool() ==
-      PoolingParameter_PoolMethod_MAX && top.size() == 1) {
+      PoolingParameter_PoolMethod_MAX && top.size() == 1 &&
+      !this->inference_only()) {
     max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
         pooled_width_);
   }
@@ -142,7 +144,7 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
       caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
+    } else if (!this->inference_only()) {
       mask = max_idx_.mutable_cpu_data();
       caffe_set(top_count, -1, mask);
     }
@@ -166,7 +168,7 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
                   top_data[pool_index] = bottom_data[index];
                   if (use_top_mask) {
                     top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
+                  } else if (mask) {
                     mask[pool_index] = index;
                   }
                 }
@@ -179,7 +181,7 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         top_data += top[0]->offset(0, 1);
         if (use_top_mask) {
           top_mask += top[0]->offset(0, 1);
-        } else {
+        } else if (mask) {
           mask += top[0]->offset(0, 1);
         }
       }
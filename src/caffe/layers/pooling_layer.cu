@@ -40,7 +40,7 @@ __global__ void MaxPoolForward(const int nthreads,
     top_data[index] = maxval;
     if (mask) {
       mask[index] = maxidx;
-    } else {
+    } else if (top_mask) {
       top_mask[index] = maxidx;
     }
   }
@@ -168,7 +168,7 @@ void PoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   case PoolingParameter_PoolMethod_MAX:
     if (use_top_mask) {
       top_mask = top[1]->mutable_gpu_data();
-    } else {
+    } else if (!this->inference_only()) {
       mask = max_idx_.mutable_gpu_data();
     }
     // NOLINT_NEXT_LINE(whitespace/operators)
@@ -0,0 +1,264 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/data_transformer.hpp"
+#include "caffe/layers/triplet_data_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+TripletDataLayer<Dtype>::~TripletDataLayer() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void TripletDataLayer<Dtype>::DataLayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const TripletDataParameter& triplet_data_param =
+      this->layer_param_.triplet_data_param();
+  sampling_ = triplet_data_param.sampling();
+  int batch_size;
+  if (sampling_ == TripletDataParameter_Sampling_PK) {
+    CHECK_LE(top.size(), 2) << "PK sampling gives data and labels.";
+    CHECK_GT(triplet_data_param.num_identities(), 0);
+    CHECK_GT(triplet_data_param.num_instances(), 0);
+    batch_size = triplet_data_param.num_identities() *
+        triplet_data_param.num_instances();
+    batch_items_ = batch_size;
+  } else {
+    CHECK_GE(top.size(), 3)
+        << "TRIPLETS sampling gives anchors, positives and negatives.";
+    CHECK_GT(triplet_data_param.num_triplets(), 0);
+    this->output_labels_ = top.size() == 4;
+    batch_size = triplet_data_param.num_triplets();
+    batch_items_ = 3 * batch_size;
+  }
+
+  // Index the database by label. The prefetch thread opens its own cursor.
+  shared_ptr<db::DB> db(db::GetDB(data_param.backend()));
+  db->Open(data_param.source(), db::READ);
+  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  DatumView datum;
+  vector<int> top_shape;
+  for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+    datum.Read(cursor.get());
+    if (top_shape.empty()) {
+      // Use data_transformer to infer the expected blob shape from datum.
+      top_shape = this->data_transformer_->InferBlobShape(datum);
+    }
+    keys_by_label_[datum.label()].push_back(cursor->key());
+  }
+  CHECK(!top_shape.empty()) << "The database " << data_param.source()
+                            << " is empty.";
+  for (std::map<int, vector<string> >::const_iterator it =
+       keys_by_label_.begin(); it != keys_by_label_.end(); ++it) {
+    labels_.push_back(it->first);
+    if (it->second.size() > 1) {
+      anchor_labels_.push_back(it->first);
+    }
+  }
+  LOG(INFO) << "Indexed " << labels_.size() << " labels, "
+            << anchor_labels_.size() << " with more than one record.";
+  if (sampling_ == TripletDataParameter_Sampling_PK) {
+    CHECK_LE(triplet_data_param.num_identities(), labels_.size())
+        << "Not enough labels for num_identities.";
+  } else {
+    CHECK(!anchor_labels_.empty()) << "No label has a positive pair.";
+    CHECK_GT(labels_.size(), 1) << "Negatives need a second label.";
+  }
+  keys_.resize(batch_items_);
+  for (int i = 0; i < batch_items_; ++i) {
+    datums_.push_back(shared_ptr<DatumView>(new DatumView()));
+  }
+
+  this->transformed_data_.Reshape(top_shape);
+  top_shape[0] = batch_items_;
+  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
+    this->prefetch_[i].data_.Reshape(top_shape);
+  }
+  top_shape[0] = batch_size;
+  const int num_data_tops =
+      sampling_ == TripletDataParameter_Sampling_PK ? 1 : 3;
+  for (int i = 0; i < num_data_tops; ++i) {
+    top[i]->Reshape(top_shape);
+  }
+  LOG(INFO) << "output data size: " << top[0]->num() << ","
+      << top[0]->channels() << "," << top[0]->height() << ","
+      << top[0]->width();
+  // label
+  if (this->output_labels_) {
+    vector<int> label_shape(1, batch_size);
+    top[num_data_tops]->Reshape(label_shape);
+    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
+      this->prefetch_[i].label_.Reshape(label_shape);
+    }
+  }
+}
+
+template <typename Dtype>
+void TripletDataLayer<Dtype>::SampleIdentities() {
+  const int num_identities =
+      this->layer_param_.triplet_data_param().num_identities();
+  const int num_instances =
+      this->layer_param_.triplet_data_param().num_instances();
+  // Draw the identities, then the instances of each, by partial shuffles.
+  vector<int> labels(labels_);
+  for (int p = 0; p < num_identities; ++p) {
+    std::swap(labels[p],
+        labels[p + caffe_rng_rand() % (labels.size() - p)]);
+    const vector<string>& keys = keys_by_label_[labels[p]];
+    const int num_keys = keys.size();
+    if (num_keys < num_instances) {
+      for (int k = 0; k < num_instances; ++k) {
+        keys_[p * num_instances + k] = &keys[caffe_rng_rand() % num_keys];
+      }
+      continue;
+    }
+    vector<int> order(num_keys);
+    for (int i = 0; i < num_keys; ++i) {
+      order[i] = i;
+    }
+    for (int k = 0; k < num_instances; ++k) {
+      std::swap(order[k], order[k + caffe_rng_rand() % (num_keys - k)]);
+      keys_[p * num_instances + k] = &keys[order[k]];
+    }
+  }
+}
+
+template <typename Dtype>
+void TripletDataLayer<Dtype>::SampleTriplets() {
+  const int num_triplets =
+      this->layer_param_.triplet_data_param().num_triplets();
+  for (int t = 0; t < num_triplets; ++t) {
+    const int label =
+        anchor_labels_[caffe_rng_rand() % anchor_labels_.size()];
+    int negative_label;
+    do {
+      negative_label = labels_[caffe_rng_rand() % labels_.size()];
+    } while (negative_label == label);
+    keys_[t] = &SampleRecord(label, NULL);
+    keys_[num_triplets + t] = &SampleRecord(label, keys_[t]);
+    keys_[2 * num_triplets + t] = &SampleRecord(negative_label, NULL);
+  }
+}
+
+template <typename Dtype>
+const string& TripletDataLayer<Dtype>::SampleRecord(int label,
+    const string* except) {
+  const vector<string>& keys = keys_by_label_[label];
+  if (!except) {
+    return keys[caffe_rng_rand() % keys.size()];
+  }
+  // Skip over the excluded record.
+  const int excluded = except - &keys[0];
+  int i = caffe_rng_rand() % (keys.size() - 1);
+  if (i >= excluded) {
+    ++i;
+  }
+  return keys[i];
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void TripletDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  CPUTimer timer;
+  CHECK(batch->data_.count());
+  if (!cursor_) {
+    const DataParameter& data_param = this->layer_param_.data_param();
+    db_.reset(db::GetDB(data_param.backend()));
+    db_->Open(data_param.source(), db::READ);
+    cursor_.reset(db_->NewCursor());
+  }
+
+  timer.Start();
+  if (sampling_ == TripletDataParameter_Sampling_PK) {
+    SampleIdentities();
+  } else {
+    SampleTriplets();
+  }
+  for (int item_id = 0; item_id < batch_items_; ++item_id) {
+    cursor_->Seek(*keys_[item_id]);
+    CHECK(cursor_->valid()) << "Missing record " << *keys_[item_id];
+    datums_[item_id]->Read(cursor_.get());
+  }
+  const double read_time = timer.MicroSeconds();
+
+  // Reshape according to the first datum of each batch
+  // on single input batches allows for inputs of varying dimension.
+  vector<int> top_shape = this->data_transformer_->InferBlobShape(
+      *datums_[0]);
+  this->transformed_data_.Reshape(top_shape);
+  top_shape[0] = batch_items_;
+  batch->data_.Reshape(top_shape);
+  if (this->output_labels_) {
+    // Labels of the records, or of the anchors.
+    Dtype* top_label = batch->label_.mutable_cpu_data();
+    for (int item_id = 0; item_id < batch->label_.count(); ++item_id) {
+      top_label[item_id] = datums_[item_id]->label();
+    }
+  }
+  timer.Start();
+  this->ParallelLoad(batch_items_, boost::bind(
+      &TripletDataLayer<Dtype>::TransformDatums, this,
+      batch->data_.mutable_cpu_data(), _1, _2, _3));
+  const double trans_time = timer.MicroSeconds();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+}
+
+// This function is called on the transform workers
+template <typename Dtype>
+void TripletDataLayer<Dtype>::TransformDatums(Dtype* top_data,
+    DataTransformer<Dtype>* transformer, int begin, int end) {
+  Blob<Dtype> transformed_data(this->transformed_data_.shape());
+  const int item_size = transformed_data.count();
+  for (int item_id = begin; item_id < end; ++item_id) {
+    transformed_data.set_cpu_data(top_data + item_id * item_size);
+    transformer->Transform(*datums_[item_id], &transformed_data);
+  }
+}
+
+template <typename Dtype>
+void TripletDataLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (sampling_ == TripletDataParameter_Sampling_PK) {
+    BasePrefetchingDataLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  Batch<Dtype>* batch =
+      this->prefetch_full_.pop("Data layer prefetch queue empty");
+  // Split the anchors, positives and negatives into their tops.
+  vector<int> top_shape = batch->data_.shape();
+  top_shape[0] /= 3;
+  for (int i = 0; i < 3; ++i) {
+    top[i]->Reshape(top_shape);
+    caffe_copy(top[i]->count(), batch->data_.cpu_data() + i * top[i]->count(),
+        top[i]->mutable_cpu_data());
+  }
+  if (this->output_labels_) {
+    top[3]->ReshapeLike(batch->label_);
+    caffe_copy(batch->label_.count(), batch->label_.cpu_data(),
+        top[3]->mutable_cpu_data());
+  }
+  this->prefetch_free_.push(batch);
+}
+
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(TripletDataLayer, Forward);
+#endif
+
+INSTANTIATE_CLASS(TripletDataLayer);
+REGISTER_LAYER_CLASS(TripletData);
+
+}  // namespace caffe
@@ -0,0 +1,37 @@
+#include <vector>
+
+#include "caffe/layers/triplet_data_layer.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void TripletDataLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (sampling_ == TripletDataParameter_Sampling_PK) {
+    BasePrefetchingDataLayer<Dtype>::Forward_gpu(bottom, top);
+    return;
+  }
+  Batch<Dtype>* batch =
+      this->prefetch_full_.pop("Data layer prefetch queue empty");
+  // Split the anchors, positives and negatives into their tops.
+  vector<int> top_shape = batch->data_.shape();
+  top_shape[0] /= 3;
+  for (int i = 0; i < 3; ++i) {
+    top[i]->Reshape(top_shape);
+    caffe_copy(top[i]->count(), batch->data_.gpu_data() + i * top[i]->count(),
+        top[i]->mutable_gpu_data());
+  }
+  if (this->output_labels_) {
+    top[3]->ReshapeLike(batch->label_);
+    caffe_copy(batch->label_.count(), batch->label_.gpu_data(),
+        top[3]->mutable_gpu_data());
+  }
+  // Ensure the copy is synchronous wrt the host, so that the next batch isn't
+  // copied in meanwhile.
+  CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
+  this->prefetch_free_.push(batch);
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD(TripletDataLayer);
+
+}  // namespace caffe
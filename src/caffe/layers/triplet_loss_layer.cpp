@@ -9,6 +9,17 @@ namespace caffe {
 template <typename Dtype>
 void TripletLossLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
                                       const vector<Blob<Dtype>*>& top) {
+  if (mining_ != TripletParameter_Mining_NONE) {
+    batch_size_ = bottom[0]->shape(0);
+    vec_dimension_ = bottom[0]->count() / batch_size_;
+    CHECK_EQ(batch_size_, bottom[1]->count())
+        << "Mining needs one label per embedding.";
+    dist_.Reshape(batch_size_, batch_size_, 1, 1);
+    coeff_.Reshape(batch_size_, batch_size_, 1, 1);
+    vector<int> loss_shape(0);  // Loss layers output a scalar; 0 axes.
+    top[0]->Reshape(loss_shape);
+    return;
+  }
   CHECK(bottom[0]->shape() == bottom[1]->shape())
       << "Inputs must have the same dimension.";
   CHECK(bottom[0]->shape() == bottom[2]->shape())
@@ -28,11 +39,99 @@ void TripletLossLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
                                          const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
   alpha_ = this->layer_param_.threshold_param().threshold();
+  mining_ = this->layer_param_.triplet_param().mining();
+  CHECK_EQ(mining_ == TripletParameter_Mining_NONE ? 3 : 2, bottom.size())
+      << "TripletLoss takes (anchor, positive, negative) bottoms, or "
+      << "(embeddings, labels) when mining.";
+}
+
+template <typename Dtype>
+void TripletLossLayer<Dtype>::MineTriplets(const Dtype* label) {
+  const Dtype* dist = dist_.cpu_data();
+  triplets_.clear();
+  for (int a = 0; a < batch_size_; ++a) {
+    const int anchor_label = static_cast<int>(label[a]);
+    const Dtype* row = dist + a * batch_size_;
+    if (mining_ == TripletParameter_Mining_BATCH_HARD) {
+      int positive = -1, negative = -1;
+      for (int j = 0; j < batch_size_; ++j) {
+        if (j == a) {
+          continue;
+        }
+        if (static_cast<int>(label[j]) == anchor_label) {
+          if (positive < 0 || row[j] > row[positive]) {
+            positive = j;
+          }
+        } else if (negative < 0 || row[j] < row[negative]) {
+          negative = j;
+        }
+      }
+      if (positive >= 0 && negative >= 0) {
+        triplets_.push_back(a);
+        triplets_.push_back(positive);
+        triplets_.push_back(negative);
+      }
+      continue;
+    }
+    // SEMI_HARD
+    for (int p = 0; p < batch_size_; ++p) {
+      if (p == a || static_cast<int>(label[p]) != anchor_label) {
+        continue;
+      }
+      int semi_hard = -1, farthest = -1;
+      for (int j = 0; j < batch_size_; ++j) {
+        if (static_cast<int>(label[j]) == anchor_label) {
+          continue;
+        }
+        if (row[j] > row[p] && (semi_hard < 0 || row[j] < row[semi_hard])) {
+          semi_hard = j;
+        }
+        if (farthest < 0 || row[j] > row[farthest]) {
+          farthest = j;
+        }
+      }
+      if (farthest >= 0) {
+        triplets_.push_back(a);
+        triplets_.push_back(p);
+        triplets_.push_back(semi_hard >= 0 ? semi_hard : farthest);
+      }
+    }
+  }
 }
 
 template <typename Dtype>
 void TripletLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
                                           const vector<Blob<Dtype>*>& top) {
+  if (mining_ != TripletParameter_Mining_NONE) {
+    // ||x_i - x_j||^2 = ||x_i||^2 + ||x_j||^2 - 2 x_i.x_j from one GEMM.
+    const Dtype* embedding = bottom[0]->cpu_data();
+    Dtype* dist = dist_.mutable_cpu_data();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, batch_size_, batch_size_,
+        vec_dimension_, Dtype(1), embedding, embedding, Dtype(0), dist);
+    vector<Dtype> norm(batch_size_);
+    for (int i = 0; i < batch_size_; ++i) {
+      norm[i] = dist[i * batch_size_ + i];
+    }
+    for (int i = 0; i < batch_size_; ++i) {
+      for (int j = 0; j < batch_size_; ++j) {
+        Dtype* d = dist + i * batch_size_ + j;
+        *d = std::max(Dtype(0), norm[i] + norm[j] - 2 * *d);
+      }
+    }
+    MineTriplets(bottom[1]->cpu_data());
+    const int num_triplets = triplets_.size() / 3;
+    vec_loss_.resize(num_triplets);
+    Dtype loss = 0;
+    for (int t = 0; t < num_triplets; ++t) {
+      const Dtype* row = dist + triplets_[3 * t] * batch_size_;
+      vec_loss_[t] = std::max(Dtype(0),
+          alpha_ + row[triplets_[3 * t + 1]] - row[triplets_[3 * t + 2]]);
+      loss += vec_loss_[t];
+    }
+    top[0]->mutable_cpu_data()[0] =
+        num_triplets > 0 ? loss / (num_triplets * Dtype(2)) : Dtype(0);
+    return;
+  }
   int count = bottom[0]->count();
 
   caffe_sub(count, bottom[0]->cpu_data(), bottom[1]->cpu_data(),
@@ -62,6 +161,40 @@ template <typename Dtype>
 void TripletLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
                                            const vector<bool>& propagate_down,
                                            const vector<Blob<Dtype>*>& bottom) {
+  if (mining_ != TripletParameter_Mining_NONE) {
+    if (propagate_down[1]) {
+      LOG(FATAL) << this->type()
+                 << " Layer cannot backpropagate to label inputs.";
+    }
+    if (!propagate_down[0]) {
+      return;
+    }
+    // Each active triplet adds (n - p, p - a, a - n) / T to the gradients of
+    // (a, p, n); collect these as coefficients and apply them in one GEMM.
+    const int num_triplets = triplets_.size() / 3;
+    const Dtype scale = num_triplets > 0 ?
+        top[0]->cpu_diff()[0] / num_triplets : Dtype(0);
+    Dtype* coeff = coeff_.mutable_cpu_data();
+    caffe_set(coeff_.count(), Dtype(0), coeff);
+    for (int t = 0; t < num_triplets; ++t) {
+      if (vec_loss_[t] == 0) {
+        continue;
+      }
+      const int a = triplets_[3 * t];
+      const int p = triplets_[3 * t + 1];
+      const int n = triplets_[3 * t + 2];
+      coeff[a * batch_size_ + n] += scale;
+      coeff[a * batch_size_ + p] -= scale;
+      coeff[p * batch_size_ + p] += scale;
+      coeff[p * batch_size_ + a] -= scale;
+      coeff[n * batch_size_ + a] += scale;
+      coeff[n * batch_size_ + n] -= scale;
+    }
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, batch_size_,
+        vec_dimension_, batch_size_, Dtype(1), coeff, bottom[0]->cpu_data(),
+        Dtype(0), bottom[0]->mutable_cpu_diff());
+    return;
+  }
   const Dtype scale = top[0]->cpu_diff()[0] / bottom[0]->num();
   const int n = bottom[0]->count();
 
@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
 #include "caffe/layers/triplet_loss_reg_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -19,16 +22,11 @@ void TripletLossRegLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       << "Inputs must have the same dimension.";
   CHECK(bottom[2]->shape(1) == bottom[5]->shape(1))
       << "Inputs must have the same dimension.";
-  int num_ = bottom[0]->num();
-  int channels_ = bottom[0]->channels();
-  int height_ = bottom[0]->height();
-  int width_ = bottom[0]->width();
-  diff_same_class_.Reshape(num_,channels_,height_,width_);
-  diff_diff_class_.Reshape(num_,channels_,height_,width_);
-  lab_anch_class_.Reshape(num_,channels_,height_,width_);
-  lab_pos_class_.Reshape(num_,channels_,height_,width_);
-  lab_neg_class_.Reshape(num_,channels_,height_,width_);
-  
+  for (int i = 3; i < 6; ++i) {
+    CHECK_EQ(bottom[0]->count(), bottom[i]->count())
+        << "Inputs must have the same dimension.";
+  }
+
   vector<int> loss_shape(0);  // Loss layers output a scalar; 0 axes.
   top[0]->Reshape(loss_shape);
   batch_size_ = bottom[0]->shape(0);
@@ -42,103 +40,115 @@ void TripletLossRegLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
                                          const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
   TripletParameter param = this->layer_param_.triplet_param();
-  
+
   alpha_ = param.alpha();
   gamma_ = param.gamma();
 }
 
+template <typename Dtype>
+void TripletLossRegLayer<Dtype>::ForwardSamples(const Dtype* const* data,
+    int begin, int end) {
+  for (int v = begin; v < end; ++v) {
+    const int offset = v * vec_dimension_;
+    const Dtype* anchor = data[0] + offset;
+    const Dtype* positive = data[1] + offset;
+    const Dtype* negative = data[2] + offset;
+    const Dtype* anchor_ref = data[3] + offset;
+    const Dtype* positive_ref = data[4] + offset;
+    const Dtype* negative_ref = data[5] + offset;
+    Dtype dist_same = 0, dist_diff = 0, reg = 0;
+    for (int k = 0; k < vec_dimension_; ++k) {
+      const Dtype same = anchor[k] - positive[k];
+      const Dtype diff = anchor[k] - negative[k];
+      const Dtype reg_anchor = anchor[k] - anchor_ref[k];
+      const Dtype reg_positive = positive[k] - positive_ref[k];
+      const Dtype reg_negative = negative[k] - negative_ref[k];
+      dist_same += same * same;
+      dist_diff += diff * diff;
+      reg += reg_anchor * reg_anchor + reg_positive * reg_positive +
+          reg_negative * reg_negative;
+    }
+    vec_loss_[v] = alpha_ + dist_same - dist_diff;
+    vec_diff_[v] = reg;
+  }
+}
+
 template <typename Dtype>
 void TripletLossRegLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 											const vector<Blob<Dtype>*>& top) {
-	
-  int count = bottom[0]->count();
-  caffe_sub(count, bottom[0]->cpu_data(), bottom[1]->cpu_data(),
-            diff_same_class_.mutable_cpu_data());
-  caffe_sub(count, bottom[0]->cpu_data(), bottom[2]->cpu_data(),
-            diff_diff_class_.mutable_cpu_data());
-  caffe_sub(count, bottom[0]->cpu_data(), bottom[3]->cpu_data(),
-			lab_anch_class_.mutable_cpu_data());
-  caffe_sub(count, bottom[1]->cpu_data(), bottom[4]->cpu_data(),
-			lab_pos_class_.mutable_cpu_data());
-  caffe_sub(count, bottom[2]->cpu_data(), bottom[5]->cpu_data(),
-			lab_neg_class_.mutable_cpu_data());
-
+  const Dtype* data[6];
+  for (int i = 0; i < 6; ++i) {
+    data[i] = bottom[i]->cpu_data();
+  }
+  caffe_parallel_for(batch_size_, boost::bind(
+      &TripletLossRegLayer<Dtype>::ForwardSamples, this, data, _1, _2));
   Dtype loss = 0;
   for (int v = 0; v < batch_size_; ++v) {
-	vec_diff_[v] = 
-		caffe_cpu_dot(vec_dimension_,
-                      lab_anch_class_.cpu_data() + v * vec_dimension_,
-                      lab_anch_class_.cpu_data() + v * vec_dimension_) +
-        caffe_cpu_dot(vec_dimension_,
-                      lab_pos_class_.cpu_data() + v * vec_dimension_,
-                      lab_pos_class_.cpu_data() + v * vec_dimension_) +
-        caffe_cpu_dot(vec_dimension_,
-                      lab_neg_class_.cpu_data() + v * vec_dimension_,
-                      lab_neg_class_.cpu_data() + v * vec_dimension_);
-	
-    vec_loss_[v] =
-        alpha_ +
-        caffe_cpu_dot(vec_dimension_,
-                      diff_same_class_.cpu_data() + v * vec_dimension_,
-                      diff_same_class_.cpu_data() + v * vec_dimension_) -
-        caffe_cpu_dot(vec_dimension_,
-                      diff_diff_class_.cpu_data() + v * vec_dimension_,
-                      diff_diff_class_.cpu_data() + v * vec_dimension_);
-               
-    vec_loss_[v] = std::max(Dtype(0), vec_loss_[v]) + gamma_*vec_diff_[v];
-    loss += vec_loss_[v];
-    
+    loss += std::max(Dtype(0), vec_loss_[v]) + gamma_ * vec_diff_[v];
   }
   top[0]->mutable_cpu_data()[0] = loss / batch_size_;
 }
 
+template <typename Dtype>
+void TripletLossRegLayer<Dtype>::BackwardSamples(const Dtype* const* data,
+    Dtype* const* diff, Dtype scale, int begin, int end) {
+  for (int v = begin; v < end; ++v) {
+    const int offset = v * vec_dimension_;
+    const Dtype* anchor = data[0] + offset;
+    const Dtype* positive = data[1] + offset;
+    const Dtype* negative = data[2] + offset;
+    // The hinge only contributes while it is active.
+    const Dtype hinge = vec_loss_[v] > 0 ? scale : Dtype(0);
+    const Dtype reg = scale * gamma_;
+    if (diff[0]) {
+      const Dtype* anchor_ref = data[3] + offset;
+      Dtype* anchor_diff = diff[0] + offset;
+      for (int k = 0; k < vec_dimension_; ++k) {
+        anchor_diff[k] = hinge * (negative[k] - positive[k]) +
+            reg * (anchor[k] - anchor_ref[k]);
+      }
+    }
+    if (diff[1]) {
+      const Dtype* positive_ref = data[4] + offset;
+      Dtype* positive_diff = diff[1] + offset;
+      for (int k = 0; k < vec_dimension_; ++k) {
+        positive_diff[k] = hinge * (positive[k] - anchor[k]) +
+            reg * (positive[k] - positive_ref[k]);
+      }
+    }
+    if (diff[2]) {
+      const Dtype* negative_ref = data[5] + offset;
+      Dtype* negative_diff = diff[2] + offset;
+      for (int k = 0; k < vec_dimension_; ++k) {
+        negative_diff[k] = hinge * (anchor[k] - negative[k]) +
+            reg * (negative[k] - negative_ref[k]);
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void TripletLossRegLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
                                            const vector<bool>& propagate_down,
                                            const vector<Blob<Dtype>*>& bottom) {
-  /*if (propagate_down[3]) {
-    LOG(FATAL) << this->type()
-               << " Layer cannot backpropagate to label inputs.";
-  } */	
-  const Dtype scale = Dtype(2) * top[0]->cpu_diff()[0] / bottom[0]->num();
-  const int n = bottom[0]->count();
-
-  caffe_sub(n, diff_same_class_.cpu_data(), diff_diff_class_.cpu_data(),
-            bottom[0]->mutable_cpu_diff());
-  caffe_cpu_axpby(n, -gamma_, lab_anch_class_.cpu_data(), Dtype(1),
-				  bottom[0]->mutable_cpu_diff());
-  caffe_scal(n, scale, bottom[0]->mutable_cpu_diff());
- 
-  caffe_copy(n, diff_same_class_.cpu_data(), bottom[1]->mutable_cpu_diff());
-  caffe_axpy(n, -gamma_, lab_pos_class_.cpu_data(), bottom[1]->mutable_cpu_diff());
-  caffe_scal(n, -scale, bottom[1]->mutable_cpu_diff());
-
-  caffe_copy(n, diff_diff_class_.cpu_data(), bottom[2]->mutable_cpu_diff());
-  caffe_axpy(n, -gamma_, lab_neg_class_.cpu_data(), bottom[2]->mutable_cpu_diff());
-  caffe_scal(n, scale, bottom[2]->mutable_cpu_diff());
-  
-  ///// Old version ///////
-  
-  /*caffe_sub(n, diff_same_class_.cpu_data(), diff_diff_class_.cpu_data(),
-            bottom[0]->mutable_cpu_diff());
-  caffe_scal(n, scale, bottom[0]->mutable_cpu_diff());
-
-  caffe_cpu_scale(n, -scale, diff_same_class_.cpu_data(),
-                  bottom[1]->mutable_cpu_diff());
-
-  caffe_cpu_scale(n, scale, diff_diff_class_.cpu_data(),
-                  bottom[2]->mutable_cpu_diff()); */
-
-  for (int v = 0; v < batch_size_; ++v) {
-    if (vec_loss_[v] == 0) {
-      caffe_set(vec_dimension_, Dtype(0),
-                bottom[0]->mutable_cpu_diff() + v * vec_dimension_);
-      caffe_set(vec_dimension_, Dtype(0),
-                bottom[1]->mutable_cpu_diff() + v * vec_dimension_);
-      caffe_set(vec_dimension_, Dtype(0),
-                bottom[2]->mutable_cpu_diff() + v * vec_dimension_);
+  // The references are treated as constants.
+  for (int i = 3; i < 6; ++i) {
+    if (propagate_down[i]) {
+      caffe_set(bottom[i]->count(), Dtype(0), bottom[i]->mutable_cpu_diff());
     }
   }
+  const Dtype scale = Dtype(2) * top[0]->cpu_diff()[0] / bottom[0]->num();
+  const Dtype* data[6];
+  Dtype* diff[3];
+  for (int i = 0; i < 6; ++i) {
+    data[i] = bottom[i]->cpu_data();
+  }
+  for (int i = 0; i < 3; ++i) {
+    diff[i] = propagate_down[i] ? bottom[i]->mutable_cpu_diff() : NULL;
+  }
+  caffe_parallel_for(batch_size_, boost::bind(
+      &TripletLossRegLayer<Dtype>::BackwardSamples, this, data, diff, scale,
+      _1, _2));
 }
 
 #ifdef CPU_ONLY
@@ -2,6 +2,8 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <map>
 #include <string>
@@ -27,6 +29,9 @@
 
 namespace caffe {
 
+// Times a batch redraws the windows whose image failed to load.
+const int kMaxWindowLoadAttempts = 10;
+
 template <typename Dtype>
 WindowDataLayer<Dtype>::~WindowDataLayer<Dtype>() {
   this->StopInternalThread();
@@ -230,32 +235,18 @@ void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   // windows and N*(1-p) are background (non-object) windows
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
   double trans_time = 0;
   CPUTimer timer;
   Dtype* top_data = batch->data_.mutable_cpu_data();
   Dtype* top_label = batch->label_.mutable_cpu_data();
-  const Dtype scale = this->layer_param_.window_data_param().scale();
   const int batch_size = this->layer_param_.window_data_param().batch_size();
-  const int context_pad = this->layer_param_.window_data_param().context_pad();
-  const int crop_size = this->transform_param_.crop_size();
   const bool mirror = this->transform_param_.mirror();
   const float fg_fraction =
       this->layer_param_.window_data_param().fg_fraction();
-  Dtype* mean = NULL;
-  int mean_off = 0;
-  int mean_width = 0;
-  int mean_height = 0;
+  const Dtype* mean = NULL;
   if (this->has_mean_file_) {
-    mean = this->data_mean_.mutable_cpu_data();
-    mean_off = (this->data_mean_.width() - crop_size) / 2;
-    mean_width = this->data_mean_.width();
-    mean_height = this->data_mean_.height();
+    mean = this->data_mean_.cpu_data();
   }
-  cv::Size cv_crop_size(crop_size, crop_size);
-  const string& crop_mode = this->layer_param_.window_data_param().crop_mode();
-
-  bool use_square = (crop_mode == "square") ? true : false;
 
   // zero out batch
   caffe_set(batch->data_.count(), Dtype(0), top_data);
@@ -268,205 +259,228 @@ void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK_GT(fg_windows_.size(), 0);
   CHECK_GT(bg_windows_.size(), 0);
 
-  // sample from bg set then fg set
+  // sample from bg set then fg set; the windows are sampled in order here,
+  // then cropped and warped in parallel.
+  vector<vector<float> > windows(batch_size);
+  vector<int> mirrors(batch_size);
   for (int is_fg = 0; is_fg < 2; ++is_fg) {
     for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
       // sample a window
-      timer.Start();
       const unsigned int rand_index = PrefetchRand();
-      vector<float> window = (is_fg) ?
+      windows[item_id] = (is_fg) ?
+          fg_windows_[rand_index % fg_windows_.size()] :
+          bg_windows_[rand_index % bg_windows_.size()];
+      mirrors[item_id] = mirror && PrefetchRand() % 2;
+      item_id++;
+    }
+  }
+  timer.Start();
+  vector<int> loaded(batch_size, 0);
+  this->ParallelLoad(batch_size, boost::bind(
+      &WindowDataLayer<Dtype>::LoadWindows, this, &windows, &mirrors, mean,
+      top_data, top_label, &loaded, _2, _3));
+  // Draw another window of the same set for each image that failed to load,
+  // in item order so that the draws stay reproducible. The slot of a failed
+  // item is still zero.
+  for (int attempt = 0; ; ++attempt) {
+    vector<int> failed;
+    for (int i = 0; i < batch_size; ++i) {
+      if (!loaded[i]) {
+        failed.push_back(i);
+      }
+    }
+    if (failed.empty()) {
+      break;
+    }
+    CHECK_LT(attempt, kMaxWindowLoadAttempts) << "Failed to load "
+        << failed.size() << " windows of a batch after " << attempt
+        << " redraws";
+    for (int j = 0; j < failed.size(); ++j) {
+      const int i = failed[j];
+      const unsigned int rand_index = PrefetchRand();
+      windows[i] = (i >= num_samples[0]) ?
           fg_windows_[rand_index % fg_windows_.size()] :
           bg_windows_[rand_index % bg_windows_.size()];
+      mirrors[i] = mirror && PrefetchRand() % 2;
+      LoadWindows(&windows, &mirrors, mean, top_data, top_label, &loaded, i,
+          i + 1);
+    }
+  }
+  trans_time += timer.MicroSeconds();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+  DLOG(INFO) << "Read and transform time: " << trans_time / 1000 << " ms.";
+}
 
-      bool do_mirror = mirror && PrefetchRand() % 2;
+template <typename Dtype>
+void WindowDataLayer<Dtype>::LoadWindows(const vector<vector<float> >* windows,
+    const vector<int>* mirrors, const Dtype* mean, Dtype* top_data,
+    Dtype* top_label, vector<int>* loaded, int begin, int end) {
+  const Dtype scale = this->layer_param_.window_data_param().scale();
+  const int context_pad = this->layer_param_.window_data_param().context_pad();
+  const int crop_size = this->transform_param_.crop_size();
+  int mean_off = 0;
+  int mean_width = 0;
+  int mean_height = 0;
+  if (this->has_mean_file_) {
+    mean_off = (this->data_mean_.width() - crop_size) / 2;
+    mean_width = this->data_mean_.width();
+    mean_height = this->data_mean_.height();
+  }
+  const string& crop_mode = this->layer_param_.window_data_param().crop_mode();
 
-      // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
+  bool use_square = (crop_mode == "square") ? true : false;
 
-      cv::Mat cv_img;
-      if (this->cache_images_) {
-        pair<std::string, Datum> image_cached =
-          image_database_cache_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
-        cv_img = DecodeDatumToCVMat(image_cached.second, true);
-      } else {
-        cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-        if (!cv_img.data) {
-          LOG(ERROR) << "Could not open or find file " << image.first;
-          return;
-        }
+  for (int item_id = begin; item_id < end; ++item_id) {
+    const vector<float>& window = (*windows)[item_id];
+    const bool do_mirror = (*mirrors)[item_id];
+    cv::Size cv_crop_size(crop_size, crop_size);
+
+    // load the image containing the window
+    const pair<std::string, vector<int> >& image =
+        image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
+
+    cv::Mat cv_img;
+    if (this->cache_images_) {
+      const pair<std::string, Datum>& image_cached =
+        image_database_cache_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
+      cv_img = DecodeDatumToCVMat(image_cached.second, true);
+    } else {
+      cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
+      if (!cv_img.data) {
+        LOG(ERROR) << "Could not open or find file " << image.first;
+        continue;
       }
-      read_time += timer.MicroSeconds();
-      timer.Start();
-      const int channels = cv_img.channels();
-
-      // crop window out of image and warp it
-      int x1 = window[WindowDataLayer<Dtype>::X1];
-      int y1 = window[WindowDataLayer<Dtype>::Y1];
-      int x2 = window[WindowDataLayer<Dtype>::X2];
-      int y2 = window[WindowDataLayer<Dtype>::Y2];
-
-      int pad_w = 0;
-      int pad_h = 0;
-      if (context_pad > 0 || use_square) {
-        // scale factor by which to expand the original region
-        // such that after warping the expanded region to crop_size x crop_size
-        // there's exactly context_pad amount of padding on each side
-        Dtype context_scale = static_cast<Dtype>(crop_size) /
-            static_cast<Dtype>(crop_size - 2*context_pad);
-
-        // compute the expanded region
-        Dtype half_height = static_cast<Dtype>(y2-y1+1)/2.0;
-        Dtype half_width = static_cast<Dtype>(x2-x1+1)/2.0;
-        Dtype center_x = static_cast<Dtype>(x1) + half_width;
-        Dtype center_y = static_cast<Dtype>(y1) + half_height;
-        if (use_square) {
-          if (half_height > half_width) {
-            half_width = half_height;
-          } else {
-            half_height = half_width;
-          }
-        }
-        x1 = static_cast<int>(round(center_x - half_width*context_scale));
-        x2 = static_cast<int>(round(center_x + half_width*context_scale));
-        y1 = static_cast<int>(round(center_y - half_height*context_scale));
-        y2 = static_cast<int>(round(center_y + half_height*context_scale));
-
-        // the expanded region may go outside of the image
-        // so we compute the clipped (expanded) region and keep track of
-        // the extent beyond the image
-        int unclipped_height = y2-y1+1;
-        int unclipped_width = x2-x1+1;
-        int pad_x1 = std::max(0, -x1);
-        int pad_y1 = std::max(0, -y1);
-        int pad_x2 = std::max(0, x2 - cv_img.cols + 1);
-        int pad_y2 = std::max(0, y2 - cv_img.rows + 1);
-        // clip bounds
-        x1 = x1 + pad_x1;
-        x2 = x2 - pad_x2;
-        y1 = y1 + pad_y1;
-        y2 = y2 - pad_y2;
-        CHECK_GT(x1, -1);
-        CHECK_GT(y1, -1);
-        CHECK_LT(x2, cv_img.cols);
-        CHECK_LT(y2, cv_img.rows);
-
-        int clipped_height = y2-y1+1;
-        int clipped_width = x2-x1+1;
-
-        // scale factors that would be used to warp the unclipped
-        // expanded region
-        Dtype scale_x =
-            static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_width);
-        Dtype scale_y =
-            static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_height);
-
-        // size to warp the clipped expanded region to
-        cv_crop_size.width =
-            static_cast<int>(round(static_cast<Dtype>(clipped_width)*scale_x));
-        cv_crop_size.height =
-            static_cast<int>(round(static_cast<Dtype>(clipped_height)*scale_y));
-        pad_x1 = static_cast<int>(round(static_cast<Dtype>(pad_x1)*scale_x));
-        pad_x2 = static_cast<int>(round(static_cast<Dtype>(pad_x2)*scale_x));
-        pad_y1 = static_cast<int>(round(static_cast<Dtype>(pad_y1)*scale_y));
-        pad_y2 = static_cast<int>(round(static_cast<Dtype>(pad_y2)*scale_y));
-
-        pad_h = pad_y1;
-        // if we're mirroring, we mirror the padding too (to be pedantic)
-        if (do_mirror) {
-          pad_w = pad_x2;
+    }
+    const int channels = cv_img.channels();
+
+    // crop window out of image and warp it
+    int x1 = window[WindowDataLayer<Dtype>::X1];
+    int y1 = window[WindowDataLayer<Dtype>::Y1];
+    int x2 = window[WindowDataLayer<Dtype>::X2];
+    int y2 = window[WindowDataLayer<Dtype>::Y2];
+
+    int pad_w = 0;
+    int pad_h = 0;
+    if (context_pad > 0 || use_square) {
+      // scale factor by which to expand the original region
+      // such that after warping the expanded region to crop_size x crop_size
+      // there's exactly context_pad amount of padding on each side
+      Dtype context_scale = static_cast<Dtype>(crop_size) /
+          static_cast<Dtype>(crop_size - 2*context_pad);
+
+      // compute the expanded region
+      Dtype half_height = static_cast<Dtype>(y2-y1+1)/2.0;
+      Dtype half_width = static_cast<Dtype>(x2-x1+1)/2.0;
+      Dtype center_x = static_cast<Dtype>(x1) + half_width;
+      Dtype center_y = static_cast<Dtype>(y1) + half_height;
+      if (use_square) {
+        if (half_height > half_width) {
+          half_width = half_height;
         } else {
-          pad_w = pad_x1;
+          half_height = half_width;
         }
+      }
+      x1 = static_cast<int>(round(center_x - half_width*context_scale));
+      x2 = static_cast<int>(round(center_x + half_width*context_scale));
+      y1 = static_cast<int>(round(center_y - half_height*context_scale));
+      y2 = static_cast<int>(round(center_y + half_height*context_scale));
+
+      // the expanded region may go outside of the image
+      // so we compute the clipped (expanded) region and keep track of
+      // the extent beyond the image
+      int unclipped_height = y2-y1+1;
+      int unclipped_width = x2-x1+1;
+      int pad_x1 = std::max(0, -x1);
+      int pad_y1 = std::max(0, -y1);
+      int pad_x2 = std::max(0, x2 - cv_img.cols + 1);
+      int pad_y2 = std::max(0, y2 - cv_img.rows + 1);
+      // clip bounds
+      x1 = x1 + pad_x1;
+      x2 = x2 - pad_x2;
+      y1 = y1 + pad_y1;
+      y2 = y2 - pad_y2;
+      CHECK_GT(x1, -1);
+      CHECK_GT(y1, -1);
+      CHECK_LT(x2, cv_img.cols);
+      CHECK_LT(y2, cv_img.rows);
+
+      int clipped_height = y2-y1+1;
+      int clipped_width = x2-x1+1;
+
+      // scale factors that would be used to warp the unclipped
+      // expanded region
+      Dtype scale_x =
+          static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_width);
+      Dtype scale_y =
+          static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_height);
+
+      // size to warp the clipped expanded region to
+      cv_crop_size.width =
+          static_cast<int>(round(static_cast<Dtype>(clipped_width)*scale_x));
+      cv_crop_size.height =
+          static_cast<int>(round(static_cast<Dtype>(clipped_height)*scale_y));
+      pad_x1 = static_cast<int>(round(static_cast<Dtype>(pad_x1)*scale_x));
+      pad_x2 = static_cast<int>(round(static_cast<Dtype>(pad_x2)*scale_x));
+      pad_y1 = static_cast<int>(round(static_cast<Dtype>(pad_y1)*scale_y));
+      pad_y2 = static_cast<int>(round(static_cast<Dtype>(pad_y2)*scale_y));
+
+      pad_h = pad_y1;
+      // if we're mirroring, we mirror the padding too (to be pedantic)
+      if (do_mirror) {
+        pad_w = pad_x2;
+      } else {
+        pad_w = pad_x1;
+      }
 
-        // ensure that the warped, clipped region plus the padding fits in the
-        // crop_size x crop_size image (it might not due to rounding)
-        if (pad_h + cv_crop_size.height > crop_size) {
-          cv_crop_size.height = crop_size - pad_h;
-        }
-        if (pad_w + cv_crop_size.width > crop_size) {
-          cv_crop_size.width = crop_size - pad_w;
-        }
+      // ensure that the warped, clipped region plus the padding fits in the
+      // crop_size x crop_size image (it might not due to rounding)
+      if (pad_h + cv_crop_size.height > crop_size) {
+        cv_crop_size.height = crop_size - pad_h;
+      }
+      if (pad_w + cv_crop_size.width > crop_size) {
+        cv_crop_size.width = crop_size - pad_w;
       }
+    }
 
-      cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
-          cv_crop_size, 0, 0, cv::INTER_LINEAR);
+    cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
+    cv::Mat cv_cropped_img = cv_img(roi);
+    cv::resize(cv_cropped_img, cv_cropped_img,
+        cv_crop_size, 0, 0, cv::INTER_LINEAR);
 
-      // horizontal flip at random
-      if (do_mirror) {
-        cv::flip(cv_cropped_img, cv_cropped_img, 1);
-      }
+    // horizontal flip at random
+    if (do_mirror) {
+      cv::flip(cv_cropped_img, cv_cropped_img, 1);
+    }
 
-      // copy the warped window into top_data
-      for (int h = 0; h < cv_cropped_img.rows; ++h) {
-        const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img.cols; ++w) {
-          for (int c = 0; c < channels; ++c) {
-            int top_index = ((item_id * channels + c) * crop_size + h + pad_h)
-                     * crop_size + w + pad_w;
-            // int top_index = (c * height + h) * width + w;
-            Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-            if (this->has_mean_file_) {
-              int mean_index = (c * mean_height + h + mean_off + pad_h)
-                           * mean_width + w + mean_off + pad_w;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
+    // copy the warped window into top_data
+    for (int h = 0; h < cv_cropped_img.rows; ++h) {
+      const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
+      int img_index = 0;
+      for (int w = 0; w < cv_cropped_img.cols; ++w) {
+        for (int c = 0; c < channels; ++c) {
+          int top_index = ((item_id * channels + c) * crop_size + h + pad_h)
+                   * crop_size + w + pad_w;
+          // int top_index = (c * height + h) * width + w;
+          Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
+          if (this->has_mean_file_) {
+            int mean_index = (c * mean_height + h + mean_off + pad_h)
+                         * mean_width + w + mean_off + pad_w;
+            top_data[top_index] = (pixel - mean[mean_index]) * scale;
+          } else {
+            if (this->has_mean_values_) {
+              top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
             } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
+              top_data[top_index] = pixel * scale;
             }
           }
         }
       }
-      trans_time += timer.MicroSeconds();
-      // get window label
-      top_label[item_id] = window[WindowDataLayer<Dtype>::LABEL];
-
-      #if 0
-      // useful debugging code for dumping transformed windows to disk
-      string file_id;
-      std::stringstream ss;
-      ss << PrefetchRand();
-      ss >> file_id;
-      std::ofstream inf((string("dump/") + file_id +
-          string("_info.txt")).c_str(), std::ofstream::out);
-      inf << image.first << std::endl
-          << window[WindowDataLayer<Dtype>::X1]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::Y1]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::X2]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::Y2]+1 << std::endl
-          << do_mirror << std::endl
-          << top_label[item_id] << std::endl
-          << is_fg << std::endl;
-      inf.close();
-      std::ofstream top_data_file((string("dump/") + file_id +
-          string("_data.txt")).c_str(),
-          std::ofstream::out | std::ofstream::binary);
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            top_data_file.write(reinterpret_cast<char*>(
-                &top_data[((item_id * channels + c) * crop_size + h)
-                          * crop_size + w]),
-                sizeof(Dtype));
-          }
-        }
-      }
-      top_data_file.close();
-      #endif
-
-      item_id++;
     }
+    // get window label
+    top_label[item_id] = window[WindowDataLayer<Dtype>::LABEL];
+    (*loaded)[item_id] = 1;
   }
-  batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
 INSTANTIATE_CLASS(WindowDataLayer);
@@ -1,6 +1,10 @@
+#include <boost/bind.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+
 #include <algorithm>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -12,9 +16,12 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/dag_executor.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_planner.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -51,6 +58,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       << "root_net_ needs to be set for all non-root solvers";
   // Set phase from the state.
   phase_ = in_param.state().phase();
+  inference_only_ = in_param.inference_only();
   // Filter layers based on their include/exclude rules and
   // the current NetState.
   NetParameter filtered_param;
@@ -59,8 +67,13 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       << "Initializing net from parameters: " << std::endl
       << filtered_param.DebugString();
   // Create a copy of filtered_param with splits added where necessary.
+  // Splits only sum diffs, so inference-only nets read shared blobs directly.
   NetParameter param;
-  InsertSplits(filtered_param, &param);
+  if (inference_only_) {
+    param.CopyFrom(filtered_param);
+  } else {
+    InsertSplits(filtered_param, &param);
+  }
   // Basically, build all the layers and set up their connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -95,6 +108,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       layers_[layer_id]->SetShared(true);
     } else {
       layers_.push_back(LayerRegistry<Dtype>::CreateLayer(layer_param));
+      layers_[layer_id]->set_inference_only(inference_only_);
     }
     layer_names_.push_back(layer_param.name());
     LOG_IF(INFO, Caffe::root_solver())
@@ -172,7 +186,8 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
       const ParamSpec* param_spec = (param_id < param_size) ?
           &layer_param.param(param_id) : &default_param_spec;
-      const bool param_need_backward = param_spec->lr_mult() != 0;
+      const bool param_need_backward =
+          !inference_only_ && param_spec->lr_mult() != 0;
       need_backward |= param_need_backward;
       layers_[layer_id]->set_param_propagate_down(param_id,
                                                   param_need_backward);
@@ -246,7 +261,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     }
   }
   // Handle force_backward if needed.
-  if (param.force_backward()) {
+  if (param.force_backward() && !inference_only_) {
     for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
       layer_need_backward_[layer_id] = true;
       for (int bottom_id = 0;
@@ -280,9 +295,319 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  InitLayerSchedule(param);
+  memory_plan_ = param.memory_plan();
+  if (memory_plan_ != NetParameter_MemoryPlan_NO_PLAN && layer_executor_) {
+    LOG(WARNING) << "Ignoring memory_plan since layers run concurrently.";
+    memory_plan_ = NetParameter_MemoryPlan_NO_PLAN;
+  }
+  memory_arenas_.clear();
+  PlanMemory(true);
+  if (param.flat_params()) {
+    FlattenParams();
+  }
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+template <typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  // Test nets share the weights of the train net instead.
+  if (flat_params_ || inference_only_ || phase_ != TRAIN ||
+      learnable_params_.empty() || Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  const int align = kFlatParamAlignment / sizeof(Dtype);
+  flat_param_offsets_.resize(learnable_params_.size());
+  int count = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    flat_param_offsets_[i] = count;
+    count += (learnable_params_[i]->count() + align - 1) / align * align;
+  }
+  flat_params_.reset(new Blob<Dtype>(vector<int>(1, count)));
+  flat_param_memory_.resize(2);
+  for (int i = 0; i < 2; ++i) {
+    // Zeroed, with room to align the start of the arena.
+    flat_param_memory_[i].reset(new SyncedMemory(
+        count * sizeof(Dtype) + kFlatParamAlignment));
+    char* memory =
+        static_cast<char*>(flat_param_memory_[i]->mutable_cpu_data());
+    const size_t misalignment =
+        reinterpret_cast<size_t>(memory) % kFlatParamAlignment;
+    if (misalignment) {
+      memory += kFlatParamAlignment - misalignment;
+    }
+    SyncedMemory* arena = i == 0 ? flat_params_->data().get() :
+        flat_params_->diff().get();
+    arena->set_cpu_data(memory, flat_param_memory_[i]);
+  }
+  Dtype* data = flat_params_->mutable_cpu_data();
+  Dtype* diff = flat_params_->mutable_cpu_diff();
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    const int offset = flat_param_offsets_[i];
+    caffe_copy(param->count(), param->cpu_data(), data + offset);
+    caffe_copy(param->count(), param->cpu_diff(), diff + offset);
+    // Sharers hold the same SyncedMemory, so they view the arena as well.
+    param->data()->set_cpu_data(data + offset, flat_param_memory_[0]);
+    param->diff()->set_cpu_data(diff + offset, flat_param_memory_[1]);
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Flattened " << learnable_params_.size() << " learnable params into "
+      << count << " elements.";
+}
+
+template <typename Dtype>
+Blob<Dtype>* Net<Dtype>::flat_params() {
+  if (!flat_params_ || Caffe::mode() != Caffe::CPU) {
+    return NULL;
+  }
+  Dtype* data = flat_params_->mutable_cpu_data();
+  Dtype* diff = flat_params_->mutable_cpu_diff();
+  const int align = kFlatParamAlignment / sizeof(Dtype);
+  int count = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    const int offset = flat_param_offsets_[i];
+    // The mutable accessors also bring the params' heads to the CPU, so
+    // writes through the arena are seen by a later switch to GPU mode.
+    if (offset != count || param->mutable_cpu_data() != data + offset ||
+        param->mutable_cpu_diff() != diff + offset) {
+      return NULL;
+    }
+    count = offset + param->count();
+    count = (count + align - 1) / align * align;
+  }
+  return count == flat_params_->count() ? flat_params_.get() : NULL;
+}
+
+// The steps at which the storage of the blobs is used, for the memory plan.
+class StorageLifetimes {
+ public:
+  void Pin(SyncedMemory* storage) { pinned_.insert(storage); }
+  void Touch(SyncedMemory* storage, int step) {
+    if (pinned_.count(storage)) { return; }
+    map<SyncedMemory*, int>::iterator it = index_.find(storage);
+    if (it == index_.end()) {
+      index_[storage] = storage_.size();
+      storage_.push_back(storage);
+      first_.push_back(step);
+      last_.push_back(step);
+    } else {
+      first_[it->second] = std::min(first_[it->second], step);
+      last_[it->second] = std::max(last_[it->second], step);
+    }
+  }
+
+  // In order of first use, so the plan does not depend on addresses.
+  vector<SyncedMemory*> storage_;
+  vector<int> first_;
+  vector<int> last_;
+
+ private:
+  set<SyncedMemory*> pinned_;
+  map<SyncedMemory*, int> index_;
+};
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory(bool verbose) {
+  unplanned_memory_ = 0;
+  planned_memory_ = 0;
+  if (memory_plan_ == NetParameter_MemoryPlan_NO_PLAN) {
+    return;
+  }
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG_IF(WARNING, verbose) << "Ignoring memory_plan in GPU mode.";
+    return;
+  }
+  const bool training = memory_plan_ == NetParameter_MemoryPlan_TRAINING;
+  const int num_layers = layers_.size();
+  StorageLifetimes lifetimes;
+  // Storage the caller or the next pass reads keeps its own memory; blobs
+  // sharing it, e.g. through split layers, are pinned along with it.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    const Blob<Dtype>& blob = *blobs_[net_input_blob_indices_[i]];
+    if (blob.count() == 0) { continue; }
+    lifetimes.Pin(blob.data().get());
+    lifetimes.Pin(blob.diff().get());
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    const Blob<Dtype>& blob = *blobs_[net_output_blob_indices_[i]];
+    if (blob.count() == 0) { continue; }
+    lifetimes.Pin(blob.data().get());
+    lifetimes.Pin(blob.diff().get());
+  }
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+      const Blob<Dtype>& blob = *top_vecs_[layer_id][top_id];
+      if (blob.count() == 0) { continue; }
+      // Data layers may fill their tops once, at setup.
+      if (bottom_vecs_[layer_id].empty()) {
+        lifetimes.Pin(blob.data().get());
+      }
+      // Loss layers read their loss weight from the top diff.
+      if (layers_[layer_id]->loss(top_id) != 0) {
+        lifetimes.Pin(blob.diff().get());
+      }
+    }
+  }
+  // Forward of layer i runs at step i, and its Backward at step
+  // 2 * num_layers - 1 - i.
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const int backward_step = 2 * num_layers - 1 - layer_id;
+    const bool backward = training && layer_need_backward_[layer_id];
+    for (int i = 0; i < 2; ++i) {
+      const vector<Blob<Dtype>*>& blobs =
+          i == 0 ? bottom_vecs_[layer_id] : top_vecs_[layer_id];
+      for (int j = 0; j < blobs.size(); ++j) {
+        if (blobs[j]->count() == 0) { continue; }
+        lifetimes.Touch(blobs[j]->data().get(), layer_id);
+        if (backward) {
+          lifetimes.Touch(blobs[j]->data().get(), backward_step);
+          lifetimes.Touch(blobs[j]->diff().get(), backward_step);
+        }
+      }
+    }
+  }
+  MemoryPlanner planner;
+  for (int i = 0; i < lifetimes.storage_.size(); ++i) {
+    planner.Add(lifetimes.storage_[i]->size(), lifetimes.first_[i],
+        lifetimes.last_[i]);
+  }
+  planner.Plan();
+  vector<shared_ptr<SyncedMemory> > arenas(planner.num_arenas());
+  for (int a = 0; a < arenas.size(); ++a) {
+    arenas[a].reset(new SyncedMemory(planner.arena_size(a)));
+  }
+  for (int i = 0; i < lifetimes.storage_.size(); ++i) {
+    lifetimes.storage_[i]->set_cpu_data(
+        arenas[planner.arena(i)]->mutable_cpu_data());
+  }
+  memory_arenas_.swap(arenas);
+  unplanned_memory_ = planner.total_size();
+  planned_memory_ = planner.planned_size();
+  std::ostringstream summary;
+  summary << "Memory plan fits " << unplanned_memory_ << " bytes of "
+      << (training ? "training" : "inference") << " activations into "
+      << planned_memory_ << " bytes in " << planner.num_arenas()
+      << " arenas, " << (unplanned_memory_ - planned_memory_)
+      << " bytes less.";
+  if (verbose) {
+    LOG_IF(INFO, Caffe::root_solver()) << summary.str();
+  } else {
+    DLOG(INFO) << summary.str();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitLayerSchedule(const NetParameter& param) {
+  const int num_layers = layers_.size();
+  // A layer waits in Forward for the last layer writing each blob it reads
+  // or writes, and for the layers reading each blob it overwrites since.
+  // Backward runs the same graph in reverse, which covers the diffs.
+  vector<set<int> > predecessors(num_layers);
+  vector<int> last_writer(blobs_.size(), -1);
+  vector<vector<int> > readers(blobs_.size());
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      if (last_writer[bottom_ids[i]] >= 0) {
+        predecessors[layer_id].insert(last_writer[bottom_ids[i]]);
+      }
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      if (last_writer[top_ids[i]] >= 0) {
+        predecessors[layer_id].insert(last_writer[top_ids[i]]);
+      }
+      const vector<int>& blob_readers = readers[top_ids[i]];
+      for (int j = 0; j < blob_readers.size(); ++j) {
+        if (blob_readers[j] != layer_id) {
+          predecessors[layer_id].insert(blob_readers[j]);
+        }
+      }
+    }
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      readers[bottom_ids[i]].push_back(layer_id);
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      last_writer[top_ids[i]] = layer_id;
+      readers[top_ids[i]].clear();
+    }
+  }
+  forward_successors_.assign(num_layers, vector<int>());
+  backward_successors_.assign(num_layers, vector<int>());
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    for (set<int>::iterator it = predecessors[layer_id].begin();
+         it != predecessors[layer_id].end(); ++it) {
+      forward_successors_[*it].push_back(layer_id);
+      backward_successors_[layer_id].push_back(*it);
+    }
+  }
+  // Layers sharing a parameter accumulate into the same diff, so they must
+  // not run Backward at the same time. Group them by their first layer.
+  vector<int> param_group(num_layers);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    param_group[layer_id] = layer_id;
+  }
+  for (int param_id = 0; param_id < params_.size(); ++param_id) {
+    if (param_owners_[param_id] < 0) { continue; }
+    int a = param_layer_indices_[param_id].first;
+    int b = param_layer_indices_[param_owners_[param_id]].first;
+    while (param_group[a] != a) { a = param_group[a]; }
+    while (param_group[b] != b) { b = param_group[b]; }
+    param_group[std::max(a, b)] = std::min(a, b);
+  }
+  vector<int> group_size(num_layers, 0);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    int root = layer_id;
+    while (param_group[root] != root) { root = param_group[root]; }
+    param_group[layer_id] = root;
+    ++group_size[root];
+  }
+  const bool deterministic = param.deterministic_layers();
+  backward_exclusive_group_.assign(num_layers, -1);
+  vector<int> previous_in_group(num_layers, -1);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const int group = param_group[layer_id];
+    if (group_size[group] < 2) { continue; }
+    if (deterministic) {
+      // Accumulate in the same order as running the layers one by one.
+      if (previous_in_group[group] >= 0) {
+        backward_successors_[layer_id].push_back(previous_in_group[group]);
+      }
+      previous_in_group[group] = layer_id;
+    } else {
+      backward_exclusive_group_[layer_id] = group;
+    }
+  }
+
+  layer_pools_.assign(num_layers, shared_ptr<ThreadPool>());
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const int num_threads = param.layer(layer_id).num_threads();
+    CHECK_GE(num_threads, 0) << "num_threads of layer "
+        << layer_names_[layer_id] << " must not be negative.";
+    if (num_threads > 0) {
+      layer_pools_[layer_id].reset(new ThreadPool(num_threads));
+    }
+  }
+  const int layer_threads = param.layer_threads();
+  CHECK_GE(layer_threads, 1) << "layer_threads must be positive.";
+  layer_executor_.reset();
+  layer_rngs_.assign(num_layers, shared_ptr<Caffe::RNG>());
+  if (layer_threads == 1) {
+    return;
+  }
+  layer_executor_.reset(new DagExecutor(layer_threads));
+  if (deterministic) {
+    for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+      layer_rngs_[layer_id].reset(new Caffe::RNG(caffe_rng_rand()));
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Running independent layers on "
+      << layer_threads << " threads"
+      << (deterministic ? " deterministically." : ".");
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -426,7 +751,11 @@ int Net<Dtype>::AppendBottom(const NetParameter& param, const int layer_id,
     map<string, int>* blob_name_to_idx) {
   const LayerParameter& layer_param = param.layer(layer_id);
   const string& blob_name = layer_param.bottom(bottom_id);
-  if (available_blobs->find(blob_name) == available_blobs->end()) {
+  // Without split layers, a blob may feed several layers.
+  const bool available = inference_only_ ?
+      blob_name_to_idx->count(blob_name) > 0 :
+      available_blobs->find(blob_name) != available_blobs->end();
+  if (!available) {
     LOG(FATAL) << "Unknown bottom blob '" << blob_name << "' (layer '"
                << layer_param.name() << "', bottom index " << bottom_id << ")";
   }
@@ -439,7 +768,7 @@ int Net<Dtype>::AppendBottom(const NetParameter& param, const int layer_id,
   bool need_backward = blob_need_backward_[blob_id];
   // Check if the backpropagation on bottom_id should be skipped
   if (layer_param.propagate_down_size() > 0) {
-    need_backward = layer_param.propagate_down(bottom_id);
+    need_backward = layer_param.propagate_down(bottom_id) && !inference_only_;
   }
   bottom_need_backward_[layer_id].push_back(need_backward);
   return blob_id;
@@ -540,14 +869,100 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int layer_id,
   }
 }
 
+// Installs a layer's own thread pool and random stream on the calling thread
+// while the layer runs.
+class LayerRunScope {
+ public:
+  LayerRunScope(ThreadPool* pool, const Caffe::RNG* rng) {
+    if (pool) {
+      pool_scope_.reset(new ScopedThreadPool(pool));
+    }
+    if (rng) {
+      saved_rng_.reset(new Caffe::RNG(Caffe::rng_stream()));
+      Caffe::rng_stream() = *rng;
+    }
+  }
+  ~LayerRunScope() {
+    if (saved_rng_) {
+      Caffe::rng_stream() = *saved_rng_;
+    }
+  }
+
+ private:
+  shared_ptr<ScopedThreadPool> pool_scope_;
+  shared_ptr<Caffe::RNG> saved_rng_;
+
+DISABLE_COPY_AND_ASSIGN(LayerRunScope);
+};
+
+template <typename Dtype>
+bool Net<Dtype>::UseLayerExecutor() const {
+  // GPU kernels are queued on one stream anyway, and debug info is printed
+  // in layer order.
+  return layer_executor_ && Caffe::mode() == Caffe::CPU && !debug_info_;
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardLayer(int layer_id) {
+  LayerRunScope scope(layer_pools_[layer_id].get(),
+      layer_rngs_[layer_id].get());
+  return layers_[layer_id]->Forward(bottom_vecs_[layer_id],
+      top_vecs_[layer_id]);
+}
+
+template <typename Dtype>
+void Net<Dtype>::ForwardLayerInto(int layer_id, vector<Dtype>* layer_losses) {
+  (*layer_losses)[layer_id] = ForwardLayer(layer_id);
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardLayer(int layer_id) {
+  if (!layer_need_backward_[layer_id]) { return; }
+  LayerRunScope scope(layer_pools_[layer_id].get(),
+      layer_rngs_[layer_id].get());
+  layers_[layer_id]->Backward(top_vecs_[layer_id],
+      bottom_need_backward_[layer_id], bottom_vecs_[layer_id]);
+  if (after_backward_.empty()) { return; }
+  // Layers sharing a param never run Backward at the same time, so each
+  // count is only changed by one thread at once.
+  vector<int> final_params;
+  for (int i = 0; i < param_id_vecs_[layer_id].size(); ++i) {
+    const int id = learnable_param_ids_[param_id_vecs_[layer_id][i]];
+    if (--pending_param_layers_[id] == 0) {
+      final_params.push_back(id);
+    }
+  }
+  for (int i = 0; i < after_backward_.size(); ++i) {
+    after_backward_[i]->run(layer_id, final_params);
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   Dtype loss = 0;
+  if (UseLayerExecutor()) {
+    const int num_layers = layers_.size();
+    vector<bool> active(num_layers, false);
+    vector<int> rank(num_layers);
+    for (int i = 0; i < num_layers; ++i) {
+      active[i] = i >= start && i <= end;
+      rank[i] = i;
+    }
+    vector<Dtype> layer_losses(num_layers, Dtype(0));
+    layer_executor_->Run(forward_successors_, active, rank,
+        vector<int>(num_layers, -1), boost::bind(
+        &Net<Dtype>::ForwardLayerInto, this, _1, &layer_losses));
+    // Summed in layer order so the loss does not depend on the schedule.
+    for (int i = start; i <= end; ++i) {
+      loss += layer_losses[i];
+    }
+    return loss;
+  }
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    Dtype layer_loss = ForwardLayer(i);
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
   }
@@ -590,10 +1005,36 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(!inference_only_) << "Backward is not available in inference-only "
+      << "nets.";
+  CHECK_NE(memory_plan_, NetParameter_MemoryPlan_INFERENCE)
+      << "The inference memory plan does not keep what Backward needs.";
+  if (after_backward_.size()) {
+    // Shared params count under the learnable id of their owner.
+    pending_param_layers_.assign(learnable_params_.size(), 0);
+    for (int i = end; i <= start; ++i) {
+      if (!layer_need_backward_[i]) { continue; }
+      for (int j = 0; j < param_id_vecs_[i].size(); ++j) {
+        ++pending_param_layers_[learnable_param_ids_[param_id_vecs_[i][j]]];
+      }
+    }
+  }
+  if (UseLayerExecutor()) {
+    const int num_layers = layers_.size();
+    vector<bool> active(num_layers, false);
+    vector<int> rank(num_layers);
+    for (int i = 0; i < num_layers; ++i) {
+      active[i] = i <= start && i >= end;
+      rank[i] = -i;
+    }
+    layer_executor_->Run(backward_successors_, active, rank,
+        backward_exclusive_group_, boost::bind(
+        &Net<Dtype>::BackwardLayer, this, _1));
+    return;
+  }
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
-      layers_[i]->Backward(
-          top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      BackwardLayer(i);
       if (debug_info_) { BackwardDebugInfo(i); }
     }
   }
@@ -680,6 +1121,7 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
 
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  set<Blob<Dtype>*> shared;
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -706,6 +1148,19 @@ void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
           << source_blob->shape_string() << "; target param shape is "
           << target_blobs[j]->shape_string();
       target_blobs[j]->ShareData(*source_blob);
+      shared.insert(target_blobs[j].get());
+    }
+  }
+  // Once no param views the flat data arena, release it; the diffs keep
+  // theirs alive.
+  if (flat_params_) {
+    bool arena_used = false;
+    for (int i = 0; i < learnable_params_.size(); ++i) {
+      arena_used = arena_used || !shared.count(learnable_params_[i]);
+    }
+    if (!arena_used) {
+      flat_params_.reset();
+      flat_param_memory_.clear();
     }
   }
 }
@@ -744,6 +1199,7 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  PlanMemory(false);
 }
 
 template <typename Dtype>
@@ -804,6 +1260,7 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
@@ -866,6 +1323,7 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -921,8 +1379,32 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::ShareFlatParamData(Net* other) {
+  Blob<Dtype>* flat = flat_params();
+  Blob<Dtype>* other_flat = other->flat_params();
+  CHECK(flat && other_flat) << "Both nets need flat_params to share them";
+  CHECK(flat_param_offsets_ == other->flat_param_offsets_ &&
+      flat->count() == other_flat->count())
+      << "The nets' learnable params differ";
+  Dtype* data = other_flat->mutable_cpu_data();
+  const shared_ptr<SyncedMemory>& arena = other->flat_param_memory_[0];
+  flat->data()->set_cpu_data(data, arena);
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->data()->set_cpu_data(data + flat_param_offsets_[i],
+        arena);
+  }
+  // Nothing views this net's own data arena any more.
+  flat_param_memory_[0].reset();
+}
+
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  Blob<Dtype>* flat = flat_params();
+  if (flat) {
+    flat->Update();
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     learnable_params_[i]->Update();
   }
@@ -930,6 +1412,11 @@ void Net<Dtype>::Update() {
 
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  Blob<Dtype>* flat = flat_params();
+  if (flat) {
+    caffe_set(flat->count(), static_cast<Dtype>(0), flat->mutable_cpu_diff());
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -4,13 +4,16 @@
 #include <glog/logging.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "boost/thread.hpp"
+#include "boost/thread/barrier.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -436,8 +439,252 @@ void P2PSync<Dtype>::Run(const vector<int>& gpus) {
   }
 }
 
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > root_solver,
+                        CPUSync<Dtype>* root, int rank)
+    : root_(root),
+      rank_(rank),
+      initial_iter_(root_solver->iter()),
+      solver_(),
+      threads_per_worker_(1) {
+  CHECK(Caffe::mode() == Caffe::CPU) << "CPUSync runs in CPU mode only";
+  if (root == NULL) {
+    solver_ = root_solver;
+  } else {
+    Caffe::set_root_solver(false);
+    solver_.reset(new WorkerSolver<Dtype>(root_solver->param(),
+        root_solver.get()));
+    Caffe::set_root_solver(true);
+  }
+  // The replicas share the weights and reduce the gradients through the
+  // arena, whether or not the net sets flat_params.
+  solver_->net()->FlattenParams();
+  if (root != NULL) {
+    solver_->net()->ShareFlatParamData(root_solver->net().get());
+  }
+  Blob<Dtype>* flat = solver_->net()->flat_params();
+  CHECK(flat) << "CPU data parallelism needs the net's flat_params";
+  diff_ = flat->mutable_cpu_diff();
+  size_ = flat->count();
+  solver_->add_callback(this);
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::InternalThreadEntry() {
+  CHECK(Caffe::root_solver());
+  Caffe::set_root_solver(false);
+  // As for GPUs, give every replica its own random stream.
+  if (solver_->param().random_seed() >= 0) {
+    Caffe::set_random_seed(solver_->param().random_seed() + rank_);
+  }
+  ThreadPool pool(root_->threads_per_worker_);
+  ScopedThreadPool scoped_pool(&pool);
+  try {
+    solver_->Step(solver_->param().max_iter() - initial_iter_);
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected when the root stops early
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_start() {
+  // Wait for the root to finish updating the shared weights.
+  CPUSync<Dtype>* root = root_ ? root_ : this;
+  root->barrier_->wait();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  CPUSync<Dtype>* root = root_ ? root_ : this;
+  const vector<CPUSync<Dtype>*>& syncs = root->syncs_;
+  const int num_workers = syncs.size();
+  root->barrier_->wait();
+  // Reduce this replica's slice into the root. Loss functions divide
+  // gradients by the batch size, so to compensate for the split batch, the
+  // sum is divided by the number of replicas.
+  const int begin = static_cast<int64_t>(size_) * rank_ / num_workers;
+  const int end = static_cast<int64_t>(size_) * (rank_ + 1) / num_workers;
+  Dtype* dst = root->diff_ + begin;
+  for (int i = 1; i < num_workers; ++i) {
+    caffe_axpy(end - begin, Dtype(1), syncs[i]->diff_ + begin, dst);
+  }
+  caffe_scal(end - begin, Dtype(1) / num_workers, dst);
+  // Replicas clear their diffs next, so wait for every slice.
+  root->barrier_->wait();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Run(int num_workers) {
+  CHECK(root_ == NULL) << "Run the root CPUSync";
+  CHECK_GT(num_workers, 0);
+  CHECK_EQ(Caffe::solver_count(), num_workers)
+      << "Set the solver count before creating the root solver";
+  threads_per_worker_ =
+      std::max(1, ThreadPool::Global()->num_threads() / num_workers);
+  barrier_.reset(new boost::barrier(num_workers));
+  syncs_.push_back(this);
+  for (int i = 1; i < num_workers; ++i) {
+    workers_.push_back(shared_ptr<CPUSync<Dtype> >(
+        new CPUSync<Dtype>(solver_, this, i)));
+    syncs_.push_back(workers_.back().get());
+  }
+  LOG(INFO) << "Starting Optimization on " << num_workers
+            << " CPU workers of " << threads_per_worker_ << " threads";
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->StartInternalThread();
+  }
+  {
+    // Run root solver on current thread
+    ThreadPool pool(threads_per_worker_);
+    ScopedThreadPool scoped_pool(&pool);
+    solver_->Solve();
+  }
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->StopInternalThread();
+  }
+  workers_.clear();
+  syncs_.clear();
+}
+
+template<typename Dtype>
+TCPSync<Dtype>::TCPSync(shared_ptr<Solver<Dtype> > solver,
+                        const vector<string>& hosts, int rank,
+                        size_t bucket_bytes)
+    : solver_(solver),
+      ring_(hosts, rank),
+      mutex_(new boost::mutex()) {
+  CHECK(Caffe::mode() == Caffe::CPU) << "TCPSync runs in CPU mode only";
+  Net<Dtype>* net = solver_->net().get();
+  // The ring reduces the gradients through the arena.
+  net->FlattenParams();
+  Blob<Dtype>* flat = net->flat_params();
+  CHECK(flat) << "Distributed training needs the net's flat_params";
+  diff_ = flat->mutable_cpu_diff();
+  // Start every rank from the same weights.
+  ring_.Broadcast(flat->mutable_cpu_data(), flat->count());
+
+  // The net only reports the params of layers that run Backward.
+  const int num_params = net->learnable_params().size();
+  vector<bool> has_gradient(num_params, false);
+  for (int i = 0; i < net->layers().size(); ++i) {
+    if (!net->layer_need_backward()[i]) {
+      continue;
+    }
+    for (int j = 0; j < net->param_id_vecs()[i].size(); ++j) {
+      has_gradient[net->learnable_param_ids()[net->param_id_vecs()[i][j]]] =
+          true;
+    }
+  }
+  // Group the params from the last one backwards, closing a bucket once it
+  // holds bucket_bytes.
+  const vector<int>& offsets = net->flat_param_offsets();
+  param_bucket_.resize(num_params);
+  for (int end = flat->count(), i = num_params - 1; i >= 0; --i) {
+    if (bucket_end_.size() == bucket_begin_.size()) {
+      bucket_end_.push_back(end);
+      bucket_params_.push_back(0);
+    }
+    param_bucket_[i] = bucket_end_.size() - 1;
+    bucket_params_.back() += has_gradient[i];
+    if (i == 0 || (end - offsets[i]) * sizeof(Dtype) >= bucket_bytes) {
+      bucket_begin_.push_back(i == 0 ? 0 : offsets[i]);
+      end = offsets[i];
+    }
+  }
+  LOG(INFO) << "Reducing " << num_params << " params in "
+            << bucket_begin_.size() << " buckets";
+  solver_->add_callback(this);
+}
+
+template<typename Dtype>
+TCPSync<Dtype>::~TCPSync() {
+  StopInternalThread();
+}
+
+template<typename Dtype>
+void TCPSync<Dtype>::InternalThreadEntry() {
+  const int num_buckets = bucket_begin_.size();
+  vector<bool> arrived(num_buckets, false);
+  try {
+    while (!must_stop()) {
+      // Buckets become ready in different orders on different ranks, but
+      // the ring must reduce them in the same order everywhere.
+      for (int b = 0; b < num_buckets; ++b) {
+        while (!arrived[b]) {
+          arrived[ready_.pop()] = true;
+        }
+        const int count = bucket_end_[b] - bucket_begin_[b];
+        Dtype* diff = diff_ + bucket_begin_[b];
+        ring_.AllreduceSum(diff, count);
+        // As for local replicas, average the gradients of the split batch.
+        caffe_scal(count, Dtype(1) / ring_.size(), diff);
+        reduced_.push(b);
+      }
+      arrived.assign(num_buckets, false);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on exit
+  }
+}
+
+template<typename Dtype>
+void TCPSync<Dtype>::Ready(int bucket) {
+  queued_[bucket] = true;
+  ready_.push(bucket);
+}
+
+template<typename Dtype>
+void TCPSync<Dtype>::on_start() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  pending_params_ = bucket_params_;
+  queued_.assign(bucket_begin_.size(), false);
+  for (int b = 0; b < bucket_params_.size(); ++b) {
+    if (bucket_params_[b] == 0) {
+      Ready(b);
+    }
+  }
+}
+
+template<typename Dtype>
+void TCPSync<Dtype>::on_param_gradients_ready(const vector<int>& param_ids) {
+  // Layers may run Backward concurrently.
+  boost::mutex::scoped_lock lock(*mutex_);
+  for (int i = 0; i < param_ids.size(); ++i) {
+    const int b = param_bucket_[param_ids[i]];
+    if (--pending_params_[b] == 0) {
+      Ready(b);
+    }
+  }
+}
+
+template<typename Dtype>
+void TCPSync<Dtype>::on_gradients_ready() {
+  {
+    boost::mutex::scoped_lock lock(*mutex_);
+    for (int b = 0; b < queued_.size(); ++b) {
+      if (!queued_[b]) {
+        Ready(b);
+      }
+    }
+  }
+  for (int b = 0; b < queued_.size(); ++b) {
+    reduced_.pop();
+  }
+}
+
+template<typename Dtype>
+void TCPSync<Dtype>::Run() {
+  LOG(INFO) << "Starting Optimization on rank " << ring_.rank() << " of "
+            << ring_.size();
+  StartInternalThread();
+  solver_->Solve();
+  StopInternalThread();
+}
+
 INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(P2PSync);
+INSTANTIATE_CLASS(CPUSync);
+INSTANTIATE_CLASS(TCPSync);
 
 }  // namespace caffe
@@ -27,14 +27,16 @@ SolverAction::Enum Solver<Dtype>::GetRequestedAction() {
 
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param, const Solver* root_solver)
-    : net_(), callbacks_(), root_solver_(root_solver),
+    : net_(), callbacks_(), param_gradients_relay_(this),
+      last_backward_(false), root_solver_(root_solver),
       requested_early_exit_(false) {
   Init(param);
 }
 
 template <typename Dtype>
 Solver<Dtype>::Solver(const string& param_file, const Solver* root_solver)
-    : net_(), callbacks_(), root_solver_(root_solver),
+    : net_(), callbacks_(), param_gradients_relay_(this),
+      last_backward_(false), root_solver_(root_solver),
       requested_early_exit_(false) {
   SolverParameter param;
   ReadSolverParamsFromTextFileOrDie(param_file, &param);
@@ -219,8 +221,10 @@ void Solver<Dtype>::Step(int iters) {
     // accumulate the loss and gradient
     Dtype loss = 0;
     for (int i = 0; i < param_.iter_size(); ++i) {
+      last_backward_ = i == param_.iter_size() - 1;
       loss += net_->ForwardBackward();
     }
+    last_backward_ = false;
     loss /= param_.iter_size();
     // average the loss across iterations for smoothed reporting
     UpdateSmoothedLoss(loss, start_iter, average_loss);
@@ -478,6 +482,17 @@ void Solver<Dtype>::Restore(const char* state_file) {
   }
 }
 
+template <typename Dtype>
+void Solver<Dtype>::ParamGradientsRelay::run(int layer,
+    const vector<int>& learnable_param_ids) {
+  if (!solver_->last_backward_ || learnable_param_ids.empty()) {
+    return;
+  }
+  for (int i = 0; i < solver_->callbacks_.size(); ++i) {
+    solver_->callbacks_[i]->on_param_gradients_ready(learnable_param_ids);
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::UpdateSmoothedLoss(Dtype loss, int start_iter,
     int average_loss) {
@@ -106,6 +106,15 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::GetParamUpdate(int param_id, Dtype rate,
+    SolverParamUpdate<Dtype>* update) {
+  SGDSolver<Dtype>::GetParamUpdate(param_id, rate, update);
+  const size_t update_history_offset = this->net_->learnable_params().size();
+  update->history2 =
+      this->history_[update_history_offset + param_id]->mutable_cpu_data();
+}
+
 INSTANTIATE_CLASS(AdaDeltaSolver);
 REGISTER_SOLVER_CLASS(AdaDelta);
 
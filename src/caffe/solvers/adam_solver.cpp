@@ -88,6 +88,19 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdamSolver<Dtype>::GetParamUpdate(int param_id, Dtype rate,
+    SolverParamUpdate<Dtype>* update) {
+  SGDSolver<Dtype>::GetParamUpdate(param_id, rate, update);
+  const size_t update_history_offset = this->net_->learnable_params().size();
+  update->history2 =
+      this->history_[param_id + update_history_offset]->mutable_cpu_data();
+  // The bias correction is folded into the local rate.
+  const int t = this->iter_ + 1;
+  update->rate *= std::sqrt(Dtype(1) - pow(update->momentum2, t)) /
+      (Dtype(1.) - pow(update->momentum, t));
+}
+
 INSTANTIATE_CLASS(AdamSolver);
 REGISTER_SOLVER_CLASS(Adam);
 
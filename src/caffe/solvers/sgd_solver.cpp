@@ -1,4 +1,7 @@
+#include <boost/thread/recursive_mutex.hpp>
+
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -78,24 +81,41 @@ void SGDSolver<Dtype>::PreSolve() {
 }
 
 template <typename Dtype>
-void SGDSolver<Dtype>::ClipGradients() {
+Dtype SGDSolver<Dtype>::GetClipScale() {
   const Dtype clip_gradients = this->param_.clip_gradients();
-  if (clip_gradients < 0) { return; }
+  if (clip_gradients < 0) { return Dtype(1); }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  Blob<Dtype>* flat = this->net_->flat_params();
   Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
-  }
-  const Dtype l2norm_diff = std::sqrt(sumsq_diff);
-  if (l2norm_diff > clip_gradients) {
-    Dtype scale_factor = clip_gradients / l2norm_diff;
-    LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
-        << l2norm_diff << " > " << clip_gradients << ") "
-        << "by scale factor " << scale_factor;
+  if (flat) {
+    sumsq_diff = flat->sumsq_diff();
+  } else {
     for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
+      sumsq_diff += net_params[i]->sumsq_diff();
     }
   }
+  const Dtype l2norm_diff = std::sqrt(sumsq_diff);
+  if (l2norm_diff <= clip_gradients) { return Dtype(1); }
+  Dtype scale_factor = clip_gradients / l2norm_diff;
+  LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
+      << l2norm_diff << " > " << clip_gradients << ") "
+      << "by scale factor " << scale_factor;
+  return scale_factor;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ClipGradients() {
+  const Dtype scale_factor = GetClipScale();
+  if (scale_factor == Dtype(1)) { return; }
+  Blob<Dtype>* flat = this->net_->flat_params();
+  if (flat) {
+    flat->scale_diff(scale_factor);
+    return;
+  }
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  for (int i = 0; i < net_params.size(); ++i) {
+    net_params[i]->scale_diff(scale_factor);
+  }
 }
 
 template <typename Dtype>
@@ -105,6 +125,19 @@ void SGDSolver<Dtype>::ApplyUpdate() {
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
+  if (Caffe::mode() == Caffe::CPU && fused_update()) {
+    // Clipping, Normalize, Regularize, ComputeUpdateValue and Net::Update
+    // in a single sweep over the params.
+    const Dtype clip_scale = GetClipScale();
+    vector<SolverParamUpdate<Dtype> > updates(
+        this->net_->learnable_params().size());
+    for (int param_id = 0; param_id < updates.size(); ++param_id) {
+      GetParamUpdate(param_id, rate, &updates[param_id]);
+      updates[param_id].normalization *= clip_scale;
+    }
+    caffe_cpu_solver_update(update_type(), updates);
+    return;
+  }
   ClipGradients();
   for (int param_id = 0; param_id < this->net_->learnable_params().size();
        ++param_id) {
@@ -115,6 +148,44 @@ void SGDSolver<Dtype>::ApplyUpdate() {
   this->net_->Update();
 }
 
+template <typename Dtype>
+bool SGDSolver<Dtype>::fused_update() const {
+  const std::type_info& type = typeid(*this);
+  return type == typeid(SGDSolver<Dtype>) ||
+      type == typeid(NesterovSolver<Dtype>) ||
+      type == typeid(AdaGradSolver<Dtype>) ||
+      type == typeid(RMSPropSolver<Dtype>) ||
+      type == typeid(AdaDeltaSolver<Dtype>) ||
+      type == typeid(AdamSolver<Dtype>);
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::GetParamUpdate(int param_id, Dtype rate,
+    SolverParamUpdate<Dtype>* update) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const Dtype local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  const string& regularization_type = this->param_.regularization_type();
+  if (local_decay) {
+    CHECK(regularization_type == "L1" || regularization_type == "L2")
+        << "Unknown regularization type: " << regularization_type;
+  }
+  update->count = param->count();
+  update->data = param->mutable_cpu_data();
+  update->diff = param->mutable_cpu_diff();
+  update->history = history_[param_id]->mutable_cpu_data();
+  update->history2 = NULL;
+  // Scale gradient to counterbalance accumulation.
+  update->normalization = Dtype(1) / this->param_.iter_size();
+  update->decay = local_decay;
+  update->l1 = regularization_type == "L1";
+  update->rate = rate * this->net_->params_lr()[param_id];
+  update->momentum = this->param_.momentum();
+  update->momentum2 = this->param_.momentum2();
+  update->rms_decay = this->param_.rms_decay();
+  update->delta = this->param_.delta();
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -281,6 +352,7 @@ void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
   string snapshot_filename =
       Solver<Dtype>::SnapshotFilename(".solverstate.h5");
   LOG(INFO) << "Snapshotting solver state to HDF5 file " << snapshot_filename;
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fcreate(snapshot_filename.c_str(), H5F_ACC_TRUNC,
       H5P_DEFAULT, H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -323,6 +395,7 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
 
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fopen(state_file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open solver state file " << state_file;
   this->iter_ = hdf5_load_int(file_hid, "iter");
@@ -3,6 +3,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -42,6 +43,23 @@ TEST_F(CommonTest, TestRandSeedCPU) {
   }
 }
 
+TEST_F(CommonTest, TestRNGAssignment) {
+  // Layers swap their own streams in and out of the thread's, so assigned
+  // streams must share the generator and keep it alive.
+  Caffe::RNG rng(1701);
+  unsigned int expected;
+  {
+    Caffe::RNG other(1702);
+    rng = other;
+    EXPECT_EQ(other.generator(), rng.generator());
+    Caffe::RNG same_seed(1702);
+    expected = (*static_cast<rng_t*>(same_seed.generator()))();
+  }
+  EXPECT_EQ(expected, (*static_cast<rng_t*>(rng.generator()))());
+  rng = rng;
+  EXPECT_TRUE(rng.generator());
+}
+
 #ifndef CPU_ONLY  // GPU Caffe singleton test.
 
 TEST_F(CommonTest, TestRandSeedGPU) {
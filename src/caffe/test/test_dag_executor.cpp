@@ -0,0 +1,125 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dag_executor.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DagExecutorTest : public ::testing::Test {
+ public:
+  DagExecutorTest() : running_(0), max_running_(0) {}
+
+  // Records the order in which the nodes run and how many overlap.
+  void RunNode(int node) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      max_running_ = std::max(max_running_, ++running_);
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+    boost::mutex::scoped_lock lock(mutex_);
+    --running_;
+    order_.push_back(node);
+  }
+
+  int Position(int node) const {
+    for (int i = 0; i < order_.size(); ++i) {
+      if (order_[i] == node) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+ protected:
+  boost::mutex mutex_;
+  vector<int> order_;
+  int running_;
+  int max_running_;
+};
+
+TEST_F(DagExecutorTest, TestRespectsEdges) {
+  // 0 -> {1, 2, 3} -> 4, and 5 on its own.
+  const int kNodes = 6;
+  vector<vector<int> > successors(kNodes);
+  for (int i = 1; i <= 3; ++i) {
+    successors[0].push_back(i);
+    successors[i].push_back(4);
+  }
+  vector<int> rank(kNodes), groups(kNodes, -1);
+  for (int i = 0; i < kNodes; ++i) {
+    rank[i] = i;
+  }
+  for (int threads = 1; threads <= 4; ++threads) {
+    order_.clear();
+    max_running_ = 0;
+    DagExecutor executor(threads);
+    executor.Run(successors, vector<bool>(kNodes, true), rank, groups,
+        boost::bind(&DagExecutorTest::RunNode, this, _1));
+    ASSERT_EQ(kNodes, order_.size());
+    for (int i = 0; i < kNodes; ++i) {
+      EXPECT_GE(Position(i), 0);
+    }
+    for (int i = 1; i <= 3; ++i) {
+      EXPECT_LT(Position(0), Position(i));
+      EXPECT_LT(Position(i), Position(4));
+    }
+    EXPECT_LE(max_running_, threads);
+  }
+}
+
+TEST_F(DagExecutorTest, TestSkipsInactiveNodes) {
+  // A chain 0 -> 1 -> 2 -> 3 run from 1 to 2.
+  const int kNodes = 4;
+  vector<vector<int> > successors(kNodes);
+  for (int i = 0; i + 1 < kNodes; ++i) {
+    successors[i].push_back(i + 1);
+  }
+  vector<bool> active(kNodes, true);
+  active[0] = false;
+  active[3] = false;
+  vector<int> rank(kNodes, 0), groups(kNodes, -1);
+  DagExecutor executor(3);
+  executor.Run(successors, active, rank, groups,
+      boost::bind(&DagExecutorTest::RunNode, this, _1));
+  ASSERT_EQ(2, order_.size());
+  EXPECT_EQ(1, order_[0]);
+  EXPECT_EQ(2, order_[1]);
+}
+
+TEST_F(DagExecutorTest, TestExclusiveGroups) {
+  // Independent nodes, all in one group, never overlap.
+  const int kNodes = 8;
+  vector<vector<int> > successors(kNodes);
+  vector<int> rank(kNodes, 0), groups(kNodes, 0);
+  DagExecutor executor(4);
+  executor.Run(successors, vector<bool>(kNodes, true), rank, groups,
+      boost::bind(&DagExecutorTest::RunNode, this, _1));
+  EXPECT_EQ(kNodes, order_.size());
+  EXPECT_EQ(1, max_running_);
+}
+
+TEST_F(DagExecutorTest, TestRankOrderOnOneThread) {
+  const int kNodes = 5;
+  vector<vector<int> > successors(kNodes);
+  vector<int> rank(kNodes), groups(kNodes, -1);
+  for (int i = 0; i < kNodes; ++i) {
+    rank[i] = -i;
+  }
+  DagExecutor executor(1);
+  executor.Run(successors, vector<bool>(kNodes, true), rank, groups,
+      boost::bind(&DagExecutorTest::RunNode, this, _1));
+  ASSERT_EQ(kNodes, order_.size());
+  for (int i = 0; i < kNodes; ++i) {
+    EXPECT_EQ(kNodes - 1 - i, order_[i]);
+  }
+}
+
+}  // namespace caffe
@@ -1,4 +1,5 @@
 #ifdef USE_OPENCV
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -67,7 +68,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int num_workers = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -79,6 +80,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     TransformationParameter* transform_param =
         param.mutable_transform_param();
     transform_param->set_scale(scale);
+    transform_param->set_num_workers(num_workers);
 
     DataLayer<Dtype> layer(param);
     layer.SetUp(blob_bottom_vec_, blob_top_vec_);
@@ -105,6 +107,133 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Reads with several cursors; the labels must keep the database order.
+  void TestReadReaders(int num_readers) {
+    const int batch_size = 3;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_num_readers(num_readers);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        EXPECT_EQ((iter * batch_size + i) % 5, blob_top_label_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+      }
+    }
+  }
+
+  // Reads the labels of num_batches batches of five records.
+  vector<int> ReadShuffled(int shuffle_buffer, int shuffle_block,
+      int num_batches) {
+    const int batch_size = 5;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle_buffer(shuffle_buffer);
+    data_param->set_shuffle_block(shuffle_block);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<int> labels;
+    for (int iter = 0; iter < num_batches; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        labels.push_back(blob_top_label_->cpu_data()[i]);
+      }
+    }
+    return labels;
+  }
+
+  void TestReadShuffle(int shuffle_buffer, int shuffle_block) {
+    const int num_batches = 10;
+    Caffe::set_random_seed(this->seed_);
+    vector<int> labels = ReadShuffled(shuffle_buffer, shuffle_block,
+        num_batches);
+    bool sequential = true;
+    for (int i = 0; i < labels.size(); ++i) {
+      EXPECT_GE(labels[i], 0);
+      EXPECT_LT(labels[i], 5);
+      sequential &= labels[i] == i % 5;
+    }
+    EXPECT_FALSE(sequential);
+    if (shuffle_buffer == 0) {
+      // Without a buffer every pass still visits each record once.
+      for (int iter = 0; iter < num_batches; ++iter) {
+        vector<int> pass(labels.begin() + iter * 5,
+            labels.begin() + (iter + 1) * 5);
+        std::sort(pass.begin(), pass.end());
+        for (int i = 0; i < 5; ++i) {
+          EXPECT_EQ(i, pass[i]) << "debug: iter " << iter;
+        }
+      }
+    }
+    // The same seed gives the same sequence.
+    Caffe::set_random_seed(this->seed_);
+    vector<int> repeated = ReadShuffled(shuffle_buffer, shuffle_block,
+        num_batches);
+    EXPECT_TRUE(labels == repeated);
+  }
+
+  // Reads two shards of 3 and 4 records, labeled from 10 and 20, which are
+  // taken in turn and restart separately.
+  void TestReadShards(DataParameter_DB backend, int num_readers) {
+    const int num_records[2] = { 3, 4 };
+    const int batch_size = 5;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_backend(backend);
+    data_param->set_num_readers(num_readers);
+    for (int s = 0; s < 2; ++s) {
+      string shard;
+      MakeTempDir(&shard);
+      shard += "/db";
+      scoped_ptr<db::DB> db(db::GetDB(backend));
+      db->Open(shard, db::NEW);
+      scoped_ptr<db::Transaction> txn(db->NewTransaction());
+      for (int i = 0; i < num_records[s]; ++i) {
+        Datum datum;
+        datum.set_label(10 * (s + 1) + i);
+        datum.set_channels(1);
+        datum.set_height(1);
+        datum.set_width(2);
+        datum.mutable_data()->assign(2, static_cast<char>(i));
+        stringstream ss;
+        ss << i;
+        string out;
+        CHECK(datum.SerializeToString(&out));
+        txn->Put(ss.str(), out);
+      }
+      txn->Commit();
+      db->Close();
+      data_param->add_shard(shard);
+    }
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int iter = 0; iter < 6; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const int index = iter * batch_size + i;
+        const int s = index % 2;
+        EXPECT_EQ(10 * (s + 1) + (index / 2) % num_records[s],
+            blob_top_label_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+      }
+    }
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -224,7 +353,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(int num_workers = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
@@ -236,6 +365,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         param.mutable_transform_param();
     transform_param->set_crop_size(1);
     transform_param->set_mirror(true);
+    transform_param->set_num_workers(num_workers);
 
     // Get crop sequence with Caffe seed 1701.
     Caffe::set_random_seed(seed_);
@@ -356,6 +486,26 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadReadersLevelDB) {
+  // The readers share one handle, as LevelDB locks out a second open.
+  const bool unique_pixels = false;
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadReaders(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLevelDB) {
+  this->TestReadShards(DataParameter_DB_LEVELDB, 1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsReadersLevelDB) {
+  this->TestReadShards(DataParameter_DB_LEVELDB, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestReadShuffle(4, 2);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -396,6 +546,36 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadParallelLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadReadersLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadReaders(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLMDB) {
+  this->TestReadShards(DataParameter_DB_LMDB, 1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsReadersLMDB) {
+  this->TestReadShards(DataParameter_DB_LMDB, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleBlocksLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestReadShuffle(0, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleBufferLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestReadShuffle(4, 0);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -414,6 +594,13 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the crops stay reproducible when several workers fill a batch.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededParallelLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -340,5 +340,75 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestCropMirrorMeanMatchesPerPixel) {
+  // Rows wider than one vector, with a tail, for every datum type and mean
+  // mode; the output must equal the per-pixel definition, plain or mirrored.
+  const int channels = 2;
+  const int size = 40;
+  const int crop_size = 37;
+  const int offset = (size - crop_size) / 2;
+  const TypeParam scale = 0.5;
+  Datum uint8_datum;
+  FillDatum(0, channels, size, size, true, &uint8_datum);
+  Datum float_datum(uint8_datum);
+  float_datum.clear_data();
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(size);
+  blob_mean.set_width(size);
+  for (int j = 0; j < channels * size * size; ++j) {
+    float_datum.add_float_data(
+        static_cast<uint8_t>(uint8_datum.data()[j]) + 0.25);
+    blob_mean.add_data(j % 7);
+  }
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+  for (int d = 0; d < 2; ++d) {
+    const Datum& datum = d ? float_datum : uint8_datum;
+    for (int mean_mode = 0; mean_mode < 3; ++mean_mode) {
+      TransformationParameter transform_param;
+      transform_param.set_crop_size(crop_size);
+      transform_param.set_mirror(true);
+      transform_param.set_scale(scale);
+      if (mean_mode == 1) {
+        transform_param.add_mean_value(3);
+        transform_param.add_mean_value(5);
+      } else if (mean_mode == 2) {
+        transform_param.set_mean_file(mean_file);
+      }
+      Blob<TypeParam> blob(1, channels, crop_size, crop_size);
+      DataTransformer<TypeParam> transformer(transform_param, TEST);
+      transformer.InitRand();
+      for (int iter = 0; iter < this->num_iter_; ++iter) {
+        transformer.Transform(datum, &blob);
+        int num_plain = 0;
+        int num_mirrored = 0;
+        for (int c = 0; c < channels; ++c) {
+          for (int h = 0; h < crop_size; ++h) {
+            for (int w = 0; w < crop_size; ++w) {
+              const int index = (c * size + h + offset) * size + w + offset;
+              TypeParam value = d ? datum.float_data(index) :
+                  static_cast<uint8_t>(datum.data()[index]);
+              if (mean_mode == 1) {
+                value -= transform_param.mean_value(c);
+              } else if (mean_mode == 2) {
+                value -= blob_mean.data(index);
+              }
+              value *= scale;
+              const TypeParam* row = blob.cpu_data() + blob.offset(0, c, h);
+              num_plain += (row[w] == value);
+              num_mirrored += (row[crop_size - 1 - w] == value);
+            }
+          }
+        }
+        EXPECT_TRUE(num_plain == blob.count() || num_mirrored == blob.count())
+            << "datum " << d << " mean mode " << mean_mode;
+      }
+    }
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
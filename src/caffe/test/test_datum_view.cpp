@@ -0,0 +1,127 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_view.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DatumViewTest : public ::testing::Test {
+ protected:
+  DatumViewTest() {
+    datum_.set_channels(2);
+    datum_.set_height(3);
+    datum_.set_width(4);
+    datum_.set_label(-7);
+    for (int i = 0; i < 24; ++i) {
+      datum_.mutable_data()->push_back(static_cast<char>(i * 10));
+    }
+  }
+
+  Datum datum_;
+};
+
+TEST_F(DatumViewTest, TestParseInPlace) {
+  string serialized;
+  ASSERT_TRUE(datum_.SerializeToString(&serialized));
+  DatumView view;
+  ASSERT_TRUE(view.Parse(serialized.data(), serialized.size()));
+  EXPECT_FALSE(view.has_datum());
+  EXPECT_EQ(2, view.channels());
+  EXPECT_EQ(3, view.height());
+  EXPECT_EQ(4, view.width());
+  EXPECT_EQ(-7, view.label());
+  ASSERT_EQ(24, view.data_size());
+  // The pixels are not copied out of the serialized record.
+  EXPECT_GE(view.data(), serialized.data());
+  EXPECT_LE(view.data() + view.data_size(),
+      serialized.data() + serialized.size());
+  EXPECT_EQ(datum_.data(), string(view.data(), view.data_size()));
+}
+
+TEST_F(DatumViewTest, TestFloatDataFallsBack) {
+  datum_.clear_data();
+  for (int i = 0; i < 24; ++i) {
+    datum_.add_float_data(i * 0.5);
+  }
+  string serialized;
+  ASSERT_TRUE(datum_.SerializeToString(&serialized));
+  DatumView view;
+  EXPECT_FALSE(view.Parse(serialized.data(), serialized.size()));
+  view.ParseDatum(serialized.data(), serialized.size());
+  EXPECT_TRUE(view.has_datum());
+  EXPECT_EQ(2, view.channels());
+  EXPECT_EQ(-7, view.label());
+  EXPECT_EQ(24, view.datum().float_data_size());
+}
+
+TEST_F(DatumViewTest, TestEncodedFallsBack) {
+  datum_.set_encoded(true);
+  string serialized;
+  ASSERT_TRUE(datum_.SerializeToString(&serialized));
+  DatumView view;
+  EXPECT_FALSE(view.Parse(serialized.data(), serialized.size()));
+  datum_.set_encoded(false);
+  ASSERT_TRUE(datum_.SerializeToString(&serialized));
+  EXPECT_TRUE(view.Parse(serialized.data(), serialized.size()));
+}
+
+TEST_F(DatumViewTest, TestTruncatedRecordFails) {
+  string serialized;
+  ASSERT_TRUE(datum_.SerializeToString(&serialized));
+  DatumView view;
+  EXPECT_FALSE(view.Parse(serialized.data(), serialized.size() - 5));
+  EXPECT_EQ(0, view.channels());
+  EXPECT_EQ(NULL, view.data());
+}
+
+TEST_F(DatumViewTest, TestSwap) {
+  string serialized;
+  ASSERT_TRUE(datum_.SerializeToString(&serialized));
+  DatumView view, other;
+  ASSERT_TRUE(view.Parse(serialized.data(), serialized.size()));
+  other.ParseDatum(serialized.data(), serialized.size());
+  const char* data = view.data();
+  view.Swap(&other);
+  EXPECT_TRUE(view.has_datum());
+  EXPECT_EQ(datum_.data(), view.datum().data());
+  EXPECT_FALSE(other.has_datum());
+  EXPECT_EQ(data, other.data());
+  EXPECT_EQ(-7, other.label());
+}
+
+template <typename Dtype>
+class DatumViewTransformTest : public DatumViewTest {};
+
+TYPED_TEST_CASE(DatumViewTransformTest, TestDtypes);
+
+TYPED_TEST(DatumViewTransformTest, TestTransformMatchesDatum) {
+  TransformationParameter param;
+  param.set_crop_size(2);
+  param.set_scale(0.5);
+  param.add_mean_value(3);
+  string serialized;
+  ASSERT_TRUE(this->datum_.SerializeToString(&serialized));
+  DatumView view;
+  ASSERT_TRUE(view.Parse(serialized.data(), serialized.size()));
+  DataTransformer<TypeParam> transformer(param, TEST);
+  transformer.InitRand();
+  vector<int> shape = transformer.InferBlobShape(view);
+  EXPECT_TRUE(shape == transformer.InferBlobShape(this->datum_));
+  Blob<TypeParam> expected(shape);
+  Blob<TypeParam> transformed(shape);
+  transformer.Transform(this->datum_, &expected);
+  transformer.Transform(view, &transformed);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], transformed.cpu_data()[i]);
+  }
+}
+
+}  // namespace caffe
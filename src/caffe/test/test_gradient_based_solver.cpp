@@ -191,6 +191,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-CPU test on " << devices << " workers";
+      Caffe::set_solver_count(devices);
+      CPUSync<Dtype> sync(this->solver_);
+      sync.Run(devices);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -455,8 +461,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       const int iter_to_check = 0) {
     const int kNum = num_;
     const int kIterSize = 1;
-    // Test over all numbers of devices.
-    int available_devices = 1;
+    // Test over all numbers of devices, and two workers on the CPU.
+    int available_devices = 2;
 #ifndef CPU_ONLY
     if (Caffe::mode() == Caffe::GPU) {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
@@ -694,6 +700,46 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+// Counts the calls to Regularize, which the fused CPU update would skip.
+template <typename Dtype>
+class RegularizeCountingSolver : public SGDSolver<Dtype> {
+ public:
+  explicit RegularizeCountingSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param), regularize_calls_(0) {}
+
+  int regularize_calls_;
+
+ protected:
+  virtual void Regularize(int param_id) {
+    ++regularize_calls_;
+    SGDSolver<Dtype>::Regularize(param_id);
+  }
+};
+
+template <typename TypeParam>
+class SGDSubclassSolverTest : public GradientBasedSolverTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  virtual void InitSolver(const SolverParameter& param) {
+    this->solver_.reset(new RegularizeCountingSolver<Dtype>(param));
+  }
+};
+
+TYPED_TEST_CASE(SGDSubclassSolverTest, TestDtypesAndDevices);
+
+TYPED_TEST(SGDSubclassSolverTest, TestOverriddenHooksAreCalled) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 2;
+  this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum,
+      kNumIters);
+  EXPECT_GT(static_cast<RegularizeCountingSolver<Dtype>*>(
+      this->solver_.get())->regularize_calls_, 0);
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
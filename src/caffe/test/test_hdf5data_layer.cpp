@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -42,6 +43,59 @@ class HDF5DataLayerTest : public MultiDeviceTest<TypeParam> {
     delete filename;
   }
 
+  LayerParameter MakeParam(int batch_size) {
+    LayerParameter param;
+    param.add_top("data");
+    param.add_top("label");
+    param.add_top("label2");
+    HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+    hdf5_data_param->set_batch_size(batch_size);
+    hdf5_data_param->set_source(*filename);
+    return param;
+  }
+
+  // Returns the rows of the next batch, numbering the rows of the second
+  // file after those of the first, and checks the labels of each row.
+  vector<int> ReadRows(HDF5DataLayer<Dtype>* layer) {
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    // Rows hold 240 values; the data of row r starts at 240 * r.
+    const int data_size = blob_top_data_->count(1);
+    vector<int> rows;
+    for (int i = 0; i < blob_top_data_->num(); ++i) {
+      const int row = blob_top_data_->cpu_data()[i * data_size] / data_size;
+      EXPECT_EQ(row % 10 + 1, blob_top_label_->cpu_data()[i]);
+      EXPECT_EQ(row % 10 + 2, blob_top_label2_->cpu_data()[i]);
+      rows.push_back(row);
+    }
+    return rows;
+  }
+
+  // Reads two epochs of the 20 rows in batches of 4.
+  vector<int> ReadShuffled() {
+    LayerParameter param = MakeParam(4);
+    param.mutable_hdf5_data_param()->set_shuffle(true);
+    param.mutable_hdf5_data_param()->set_chunk_size(3);
+    param.mutable_hdf5_data_param()->set_shuffle_chunks(2);
+    HDF5DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<int> rows;
+    for (int epoch = 0; epoch < 2; ++epoch) {
+      vector<int> epoch_rows;
+      for (int iter = 0; iter < 5; ++iter) {
+        vector<int> batch_rows = ReadRows(&layer);
+        epoch_rows.insert(epoch_rows.end(), batch_rows.begin(),
+            batch_rows.end());
+      }
+      rows.insert(rows.end(), epoch_rows.begin(), epoch_rows.end());
+      // Every epoch visits each row once.
+      std::sort(epoch_rows.begin(), epoch_rows.end());
+      for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(i, epoch_rows[i]);
+      }
+    }
+    return rows;
+  }
+
   string* filename;
   Blob<Dtype>* const blob_top_data_;
   Blob<Dtype>* const blob_top_label_;
@@ -133,4 +187,33 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Chunks of 3 rows do not line up with the batches or the files.
+  LayerParameter param = this->MakeParam(4);
+  param.mutable_hdf5_data_param()->set_chunk_size(3);
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int iter = 0; iter < 10; ++iter) {
+    vector<int> rows = this->ReadRows(&layer);
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ((iter * 4 + i) % 20, rows[i]);
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestShuffle) {
+  Caffe::set_random_seed(1701);
+  vector<int> rows = this->ReadShuffled();
+  // Shuffling interleaves the rows of both files.
+  vector<int> in_order(rows.size());
+  for (int i = 0; i < in_order.size(); ++i) {
+    in_order[i] = i % 20;
+  }
+  EXPECT_FALSE(rows == in_order);
+  // The order only depends on the seed.
+  Caffe::set_random_seed(1701);
+  EXPECT_TRUE(rows == this->ReadShuffled());
+}
+
 }  // namespace caffe
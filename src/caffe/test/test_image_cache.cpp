@@ -0,0 +1,88 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  // An image of 10 bytes, each holding value.
+  shared_ptr<const CachedImage> MakeImage(char value) {
+    shared_ptr<CachedImage> image(new CachedImage());
+    image->channels = 1;
+    image->height = 2;
+    image->width = 5;
+    image->data.assign(10, value);
+    image->check = value;
+    return image;
+  }
+
+  void ExpectImage(char value, const shared_ptr<const CachedImage>& image) {
+    ASSERT_TRUE(image.get());
+    EXPECT_EQ(1, image->channels);
+    EXPECT_EQ(2, image->height);
+    EXPECT_EQ(5, image->width);
+    EXPECT_EQ(string(10, value), image->data);
+    EXPECT_EQ(static_cast<uint64_t>(value), image->check);
+  }
+};
+
+TEST_F(ImageCacheTest, TestHitMiss) {
+  ImageCacheParameter param;
+  param.set_memory_bytes(100);
+  ImageCache cache(param);
+  EXPECT_FALSE(cache.Get("a").get());
+  cache.Put("a", MakeImage('a'));
+  this->ExpectImage('a', cache.Get("a"));
+  EXPECT_FALSE(cache.Get("b").get());
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(2, cache.misses());
+  EXPECT_EQ(10, cache.memory_bytes());
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  ImageCacheParameter param;
+  param.set_memory_bytes(25);
+  ImageCache cache(param);
+  cache.Put("a", MakeImage('a'));
+  cache.Put("b", MakeImage('b'));
+  // Using a makes b the least recently used image.
+  cache.Get("a");
+  cache.Put("c", MakeImage('c'));
+  this->ExpectImage('a', cache.Get("a"));
+  EXPECT_FALSE(cache.Get("b").get());
+  this->ExpectImage('c', cache.Get("c"));
+  EXPECT_EQ(20, cache.memory_bytes());
+}
+
+TEST_F(ImageCacheTest, TestSpill) {
+  string filename;
+  MakeTempFilename(&filename);
+  ImageCacheParameter param;
+  param.set_memory_bytes(10);
+  param.set_spill_file(filename);
+  param.set_spill_bytes(25);
+  ImageCache cache(param);
+  cache.Put("a", MakeImage('a'));
+  cache.Put("b", MakeImage('b'));
+  cache.Put("c", MakeImage('c'));
+  cache.Put("d", MakeImage('d'));
+  // a and b were spilled, after which c found the spill file full.
+  EXPECT_EQ(10, cache.memory_bytes());
+  EXPECT_EQ(20, cache.spill_bytes());
+  this->ExpectImage('a', cache.Get("a"));
+  this->ExpectImage('b', cache.Get("b"));
+  EXPECT_FALSE(cache.Get("c").get());
+  this->ExpectImage('d', cache.Get("d"));
+  EXPECT_EQ(3, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+}
+
+}  // namespace caffe
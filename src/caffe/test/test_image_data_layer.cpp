@@ -97,6 +97,34 @@ TYPED_TEST(ImageDataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestReadParallel) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  param.mutable_transform_param()->set_num_workers(2);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 360);
+  EXPECT_EQ(this->blob_top_data_->width(), 480);
+  // Go through the data twice; each item holds the same image.
+  const int item_size = this->blob_top_data_->count(1);
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* data = this->blob_top_data_->cpu_data();
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+      for (int j = 0; j < item_size; j += 997) {
+        EXPECT_EQ(data[j], data[i * item_size + j]);
+      }
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestResize) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
@@ -216,5 +244,37 @@ TYPED_TEST(ImageDataLayerTest, TestSpace) {
   EXPECT_EQ(this->blob_top_label_->cpu_data()[0], 1);
 }
 
+TYPED_TEST(ImageDataLayerTest, TestReadCached) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(1);
+  image_data_param->set_source(this->filename_reshape_.c_str());
+  image_data_param->set_new_height(64);
+  image_data_param->set_new_width(48);
+  image_data_param->set_shuffle(false);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Only one of the two resized images fits in memory.
+  image_data_param->mutable_image_cache()->set_memory_bytes(64 * 48 * 3);
+  ImageDataLayer<Dtype> cached_layer(param);
+  Blob<Dtype> cached_data;
+  Blob<Dtype> cached_label;
+  vector<Blob<Dtype>*> cached_top_vec;
+  cached_top_vec.push_back(&cached_data);
+  cached_top_vec.push_back(&cached_label);
+  cached_layer.SetUp(this->blob_bottom_vec_, cached_top_vec);
+  // Cached images match decoded ones over several epochs.
+  for (int iter = 0; iter < 6; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    cached_layer.Forward(this->blob_bottom_vec_, cached_top_vec);
+    ASSERT_EQ(this->blob_top_data_->count(), cached_data.count());
+    EXPECT_EQ(this->blob_top_label_->cpu_data()[0], cached_label.cpu_data()[0]);
+    for (int i = 0; i < cached_data.count(); ++i) {
+      EXPECT_EQ(this->blob_top_data_->cpu_data()[i], cached_data.cpu_data()[i]);
+    }
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
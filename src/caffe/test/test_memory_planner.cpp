@@ -0,0 +1,53 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/memory_planner.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MemoryPlannerTest : public ::testing::Test {};
+
+TEST_F(MemoryPlannerTest, TestDisjointBuffersShare) {
+  MemoryPlanner planner;
+  // A chain where each buffer lives from its producer to its consumer.
+  for (int i = 0; i < 6; ++i) {
+    planner.Add(100 + i, i, i + 1);
+  }
+  planner.Plan();
+  EXPECT_EQ(2, planner.num_arenas());
+  EXPECT_EQ(615, planner.total_size());
+  EXPECT_EQ(105 + 104, planner.planned_size());
+  for (int i = 0; i + 1 < 6; ++i) {
+    EXPECT_NE(planner.arena(i), planner.arena(i + 1));
+  }
+}
+
+TEST_F(MemoryPlannerTest, TestOverlappingBuffersDoNotShare) {
+  MemoryPlanner planner;
+  planner.Add(10, 0, 5);
+  planner.Add(20, 5, 6);
+  planner.Add(30, 3, 5);
+  planner.Plan();
+  EXPECT_EQ(3, planner.num_arenas());
+  EXPECT_EQ(planner.total_size(), planner.planned_size());
+}
+
+TEST_F(MemoryPlannerTest, TestBestFit) {
+  MemoryPlanner planner;
+  const int big = planner.Add(1000, 0, 0);
+  const int small = planner.Add(10, 1, 1);
+  const int fits_small = planner.Add(8, 2, 2);
+  const int live_with_big = planner.Add(9, 0, 0);
+  planner.Plan();
+  EXPECT_EQ(2, planner.num_arenas());
+  // The small arena is the best fit, the big one stays free.
+  EXPECT_EQ(planner.arena(big), planner.arena(small));
+  EXPECT_EQ(planner.arena(live_with_big), planner.arena(fits_small));
+  EXPECT_EQ(1009, planner.planned_size());
+}
+
+}  // namespace caffe
@@ -0,0 +1,241 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/mmap_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mmap_tensor.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MmapTensorTest : public ::testing::Test {};
+
+TEST_F(MmapTensorTest, TestWriteRead) {
+  string filename;
+  MakeTempFilename(&filename);
+  vector<int> shape;
+  shape.push_back(3);
+  shape.push_back(5);
+  MmapTensorWriter writer;
+  writer.Open(filename, shape, MMAP_TENSOR_UINT8);
+  EXPECT_EQ(15, writer.record_bytes());
+  for (int i = 0; i < 4; ++i) {
+    vector<uint8_t> record(15);
+    for (int j = 0; j < 15; ++j) {
+      record[j] = i * 15 + j;
+    }
+    writer.Write(&record[0], i * 0.5);
+  }
+  writer.Close();
+
+  MmapTensorReader reader;
+  reader.Open(filename);
+  EXPECT_EQ(4, reader.num());
+  EXPECT_TRUE(reader.shape() == shape);
+  EXPECT_EQ(MMAP_TENSOR_UINT8, reader.type());
+  EXPECT_EQ(15, reader.record_count());
+  // The records are back to back from a page boundary.
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(reader.record(0)) % 4096);
+  EXPECT_EQ(reader.record(0) + 15, reader.record(1));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(i * 0.5, reader.label(i));
+    for (int j = 0; j < 15; ++j) {
+      EXPECT_EQ(i * 15 + j, static_cast<uint8_t>(reader.record(i)[j]));
+    }
+  }
+}
+
+template <typename TypeParam>
+class MmapDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  MmapDataLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()),
+        seed_(1701) {}
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+  }
+  virtual ~MmapDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  // Fill the file with 5 records of shape (2, 3, 4), where element j of
+  // record i holds i * 24 + j and the label is i.
+  void Fill(MmapTensorType type) {
+    vector<int> shape;
+    shape.push_back(2);
+    shape.push_back(3);
+    shape.push_back(4);
+    MmapTensorWriter writer;
+    writer.Open(filename_, shape, type);
+    for (int i = 0; i < 5; ++i) {
+      vector<uint8_t> bytes(24);
+      vector<float> floats(24);
+      vector<double> doubles(24);
+      for (int j = 0; j < 24; ++j) {
+        bytes[j] = floats[j] = doubles[j] = i * 24 + j;
+      }
+      switch (type) {
+      case MMAP_TENSOR_UINT8:
+        writer.Write(&bytes[0], i);
+        break;
+      case MMAP_TENSOR_FLOAT:
+        writer.Write(&floats[0], i);
+        break;
+      default:
+        writer.Write(&doubles[0], i);
+      }
+    }
+    writer.Close();
+  }
+
+  LayerParameter MakeParam(int batch_size) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    MmapDataParameter* mmap_data_param = param.mutable_mmap_data_param();
+    mmap_data_param->set_batch_size(batch_size);
+    mmap_data_param->set_source(filename_.c_str());
+    return param;
+  }
+
+  void TestRead(MmapTensorType type, bool expect_zero_copy) {
+    Fill(type);
+    const int batch_size = 3;
+    MmapDataLayer<Dtype> layer(MakeParam(batch_size));
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(expect_zero_copy, layer.zero_copy());
+    EXPECT_EQ(batch_size, blob_top_data_->num());
+    EXPECT_EQ(2, blob_top_data_->channels());
+    EXPECT_EQ(3, blob_top_data_->height());
+    EXPECT_EQ(4, blob_top_data_->width());
+    EXPECT_EQ(batch_size, blob_top_label_->num());
+    // Batches wrap around the end of the file.
+    for (int iter = 0; iter < 6; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const int record = (iter * batch_size + i) % 5;
+        EXPECT_EQ(record, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(record * 24 + j,
+              blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  void TestReadTransform() {
+    Fill(MMAP_TENSOR_UINT8);
+    const int batch_size = 2;
+    LayerParameter param = MakeParam(batch_size);
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_scale(0.5);
+    transform_param->set_crop_size(2);
+    param.set_phase(TEST);
+    MmapDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_FALSE(layer.zero_copy());
+    EXPECT_EQ(2, blob_top_data_->height());
+    EXPECT_EQ(2, blob_top_data_->width());
+    for (int iter = 0; iter < 3; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const int record = (iter * batch_size + i) % 5;
+        for (int c = 0; c < 2; ++c) {
+          for (int h = 0; h < 2; ++h) {
+            for (int w = 0; w < 2; ++w) {
+              // The center crop starts at row 0, column 1.
+              const int element = (c * 3 + h) * 4 + w + 1;
+              EXPECT_EQ((record * 24 + element) * 0.5,
+                  blob_top_data_->data_at(i, c, h, w));
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Reads the labels of two epochs.
+  vector<int> ReadShuffled() {
+    LayerParameter param = MakeParam(5);
+    param.mutable_mmap_data_param()->set_shuffle(true);
+    MmapDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_FALSE(layer.zero_copy());
+    vector<int> labels;
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<int> epoch;
+      for (int i = 0; i < 5; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        EXPECT_EQ(label * 24, blob_top_data_->cpu_data()[i * 24]);
+        epoch.push_back(label);
+      }
+      labels.insert(labels.end(), epoch.begin(), epoch.end());
+      // Every epoch visits each record once.
+      std::sort(epoch.begin(), epoch.end());
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, epoch[i]);
+      }
+    }
+    return labels;
+  }
+
+  void TestShuffleSeeded() {
+    Fill(MMAP_TENSOR_FLOAT);
+    Caffe::set_random_seed(seed_);
+    vector<int> labels = ReadShuffled();
+    Caffe::set_random_seed(seed_);
+    EXPECT_TRUE(labels == ReadShuffled());
+  }
+
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  int seed_;
+};
+
+TYPED_TEST_CASE(MmapDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(MmapDataLayerTest, TestReadInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->TestRead(sizeof(Dtype) == sizeof(float) ?
+      MMAP_TENSOR_FLOAT : MMAP_TENSOR_DOUBLE, true);
+}
+
+TYPED_TEST(MmapDataLayerTest, TestReadConverted) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->TestRead(sizeof(Dtype) == sizeof(float) ?
+      MMAP_TENSOR_DOUBLE : MMAP_TENSOR_FLOAT, false);
+}
+
+TYPED_TEST(MmapDataLayerTest, TestReadUint8) {
+  this->TestRead(MMAP_TENSOR_UINT8, false);
+}
+
+TYPED_TEST(MmapDataLayerTest, TestReadTransform) {
+  this->TestReadTransform();
+}
+
+TYPED_TEST(MmapDataLayerTest, TestShuffleSeeded) {
+  this->TestShuffleSeeded();
+}
+
+}  // namespace caffe
@@ -0,0 +1,192 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/neighbour_conv_layer.hpp"
+#include "caffe/layers/neighbour_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NeighbourConvolutionLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NeighbourConvolutionLayerTest()
+      : blob_bottom_0_(new Blob<Dtype>(2, 3, 7, 6)),
+        blob_bottom_1_(new Blob<Dtype>(2, 3, 7, 6)),
+        blob_top_0_(new Blob<Dtype>()),
+        blob_top_1_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_0_);
+    filler.Fill(this->blob_bottom_1_);
+    blob_bottom_vec_.push_back(blob_bottom_0_);
+    blob_bottom_vec_.push_back(blob_bottom_1_);
+    blob_top_vec_.push_back(blob_top_0_);
+    blob_top_vec_.push_back(blob_top_1_);
+  }
+  virtual ~NeighbourConvolutionLayerTest() {
+    delete blob_bottom_0_;
+    delete blob_bottom_1_;
+    delete blob_top_0_;
+    delete blob_top_1_;
+  }
+
+  LayerParameter MakeParam(int kernel_size, int stride, int dilation) {
+    LayerParameter layer_param;
+    NeighbourParameter* neigh_param = layer_param.mutable_neigh_param();
+    neigh_param->set_kernel_size(kernel_size);
+    neigh_param->set_stride(stride);
+    neigh_param->set_dilation(dilation);
+    ConvolutionParameter* conv_param =
+        layer_param.mutable_convolution_param();
+    conv_param->set_num_output(4);
+    conv_param->mutable_weight_filler()->set_type("gaussian");
+    conv_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  // Compares the fused layer with a NeighbourLayer feeding a
+  // ConvolutionLayer that uses the same filters, forward and backward.
+  void TestAgainstStack(const LayerParameter& layer_param,
+      const vector<bool>& propagate_down) {
+    NeighbourConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+    Blob<Dtype> neigh_0, neigh_1, expected_0, expected_1;
+    vector<Blob<Dtype>*> neigh_vec, expected_vec;
+    neigh_vec.push_back(&neigh_0);
+    neigh_vec.push_back(&neigh_1);
+    expected_vec.push_back(&expected_0);
+    expected_vec.push_back(&expected_1);
+    NeighbourLayer<Dtype> neighbour(layer_param);
+    neighbour.SetUp(this->blob_bottom_vec_, neigh_vec);
+    LayerParameter conv_param = layer_param;
+    const int k = layer_param.neigh_param().kernel_size();
+    conv_param.mutable_convolution_param()->clear_kernel_size();
+    conv_param.mutable_convolution_param()->add_kernel_size(k);
+    conv_param.mutable_convolution_param()->clear_stride();
+    conv_param.mutable_convolution_param()->add_stride(k);
+    ConvolutionLayer<Dtype> conv(conv_param);
+    conv.SetUp(neigh_vec, expected_vec);
+    ASSERT_EQ(layer.blobs().size(), conv.blobs().size());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      conv.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    neighbour.Forward(this->blob_bottom_vec_, neigh_vec);
+    conv.Forward(neigh_vec, expected_vec);
+    for (int t = 0; t < 2; ++t) {
+      ASSERT_TRUE(expected_vec[t]->shape() == this->blob_top_vec_[t]->shape());
+      for (int i = 0; i < expected_vec[t]->count(); ++i) {
+        EXPECT_NEAR(expected_vec[t]->cpu_data()[i],
+            this->blob_top_vec_[t]->cpu_data()[i], 1e-4);
+      }
+    }
+
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&expected_0);
+    filler.Fill(&expected_1);
+    caffe_copy(expected_0.count(), expected_0.cpu_data(),
+        expected_0.mutable_cpu_diff());
+    caffe_copy(expected_1.count(), expected_1.cpu_data(),
+        expected_1.mutable_cpu_diff());
+    caffe_copy(expected_0.count(), expected_0.cpu_data(),
+        this->blob_top_0_->mutable_cpu_diff());
+    caffe_copy(expected_1.count(), expected_1.cpu_data(),
+        this->blob_top_1_->mutable_cpu_diff());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      caffe_set(layer.blobs()[i]->count(), Dtype(0),
+          layer.blobs()[i]->mutable_cpu_diff());
+      caffe_set(conv.blobs()[i]->count(), Dtype(0),
+          conv.blobs()[i]->mutable_cpu_diff());
+    }
+    Blob<Dtype> expected_diff_0, expected_diff_1;
+    conv.Backward(expected_vec, vector<bool>(2, true), neigh_vec);
+    neighbour.Backward(neigh_vec, propagate_down, this->blob_bottom_vec_);
+    expected_diff_0.CopyFrom(*this->blob_bottom_0_, true, true);
+    expected_diff_1.CopyFrom(*this->blob_bottom_1_, true, true);
+    // Stale diffs must not leak into the fused gradient.
+    const Dtype kStale = 7;
+    caffe_set(this->blob_bottom_0_->count(), kStale,
+        this->blob_bottom_0_->mutable_cpu_diff());
+    caffe_set(this->blob_bottom_1_->count(), kStale,
+        this->blob_bottom_1_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    const Blob<Dtype>* expected_diff[2] = { &expected_diff_0,
+        &expected_diff_1 };
+    for (int b = 0; b < 2; ++b) {
+      const Dtype* diff = this->blob_bottom_vec_[b]->cpu_diff();
+      for (int i = 0; i < expected_diff[b]->count(); ++i) {
+        if (propagate_down[b]) {
+          EXPECT_NEAR(expected_diff[b]->cpu_diff()[i], diff[i], 1e-4);
+        } else {
+          EXPECT_EQ(kStale, diff[i]);
+        }
+      }
+    }
+    for (int p = 0; p < layer.blobs().size(); ++p) {
+      for (int i = 0; i < layer.blobs()[p]->count(); ++i) {
+        EXPECT_NEAR(conv.blobs()[p]->cpu_diff()[i],
+            layer.blobs()[p]->cpu_diff()[i], 1e-3);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_0_;
+  Blob<Dtype>* const blob_bottom_1_;
+  Blob<Dtype>* const blob_top_0_;
+  Blob<Dtype>* const blob_top_1_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(NeighbourConvolutionLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NeighbourConvolutionLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param = this->MakeParam(5, 2, 1);
+  NeighbourConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int t = 0; t < 2; ++t) {
+    EXPECT_EQ(2, this->blob_top_vec_[t]->num());
+    EXPECT_EQ(4, this->blob_top_vec_[t]->channels());
+    EXPECT_EQ(4, this->blob_top_vec_[t]->height());
+    EXPECT_EQ(3, this->blob_top_vec_[t]->width());
+  }
+  EXPECT_EQ(4, layer.blobs()[0]->num());
+  EXPECT_EQ(3, layer.blobs()[0]->channels());
+  EXPECT_EQ(5, layer.blobs()[0]->height());
+  EXPECT_EQ(5, layer.blobs()[0]->width());
+}
+
+TYPED_TEST(NeighbourConvolutionLayerTest, TestMatchesStack) {
+  vector<bool> propagate_down(2, true);
+  this->TestAgainstStack(this->MakeParam(5, 1, 1), propagate_down);
+}
+
+TYPED_TEST(NeighbourConvolutionLayerTest, TestMatchesStackStrideDilation) {
+  vector<bool> propagate_down(2, true);
+  this->TestAgainstStack(this->MakeParam(3, 2, 2), propagate_down);
+}
+
+TYPED_TEST(NeighbourConvolutionLayerTest, TestMatchesStackPropagateDown) {
+  LayerParameter layer_param = this->MakeParam(5, 1, 1);
+  vector<bool> propagate_down(2, true);
+  propagate_down[0] = false;
+  this->TestAgainstStack(layer_param, propagate_down);
+  propagate_down[0] = true;
+  propagate_down[1] = false;
+  this->TestAgainstStack(layer_param, propagate_down);
+}
+
+}  // namespace caffe
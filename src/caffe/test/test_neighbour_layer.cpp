@@ -0,0 +1,279 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/neighbour_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NeighbourLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NeighbourLayerTest()
+      : blob_bottom_0_(new Blob<Dtype>(2, 3, 7, 6)),
+        blob_bottom_1_(new Blob<Dtype>(2, 3, 7, 6)),
+        blob_top_0_(new Blob<Dtype>()),
+        blob_top_1_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_0_);
+    filler.Fill(this->blob_bottom_1_);
+    blob_bottom_vec_.push_back(blob_bottom_0_);
+    blob_bottom_vec_.push_back(blob_bottom_1_);
+    blob_top_vec_.push_back(blob_top_0_);
+    blob_top_vec_.push_back(blob_top_1_);
+  }
+  virtual ~NeighbourLayerTest() {
+    delete blob_bottom_0_;
+    delete blob_bottom_1_;
+    delete blob_top_0_;
+    delete blob_top_1_;
+  }
+
+  // Straightforward per-element version of the layer's forward pass:
+  // top(n, c, k * ph + y, k * pw + x) = in(n, c, h, w) -
+  // other(n, c, h + (y - r) * d, w + (x - r) * d) with (h, w) = s * (ph, pw)
+  // and zero padding outside the input.
+  void ReferenceForward(const NeighbourParameter& param,
+      const Blob<Dtype>& in, const Blob<Dtype>& other, Blob<Dtype>* top) {
+    const int k = param.kernel_size();
+    const int s = param.stride();
+    const int d = param.dilation();
+    const int r = (k - 1) / 2;
+    const int out_height = (in.height() - 1) / s + 1;
+    const int out_width = (in.width() - 1) / s + 1;
+    top->Reshape(in.num(), in.channels(), k * out_height, k * out_width);
+    for (int n = 0; n < in.num(); ++n) {
+      for (int c = 0; c < in.channels(); ++c) {
+        for (int ph = 0; ph < out_height; ++ph) {
+          for (int pw = 0; pw < out_width; ++pw) {
+            for (int y = 0; y < k; ++y) {
+              for (int x = 0; x < k; ++x) {
+                const int h = s * ph + (y - r) * d;
+                const int w = s * pw + (x - r) * d;
+                Dtype temp = 0;
+                if (h >= 0 && w >= 0 && h < in.height() && w < in.width()) {
+                  temp = other.data_at(n, c, h, w);
+                }
+                top->mutable_cpu_data()[top->offset(n, c, k * ph + y,
+                    k * pw + x)] = in.data_at(n, c, s * ph, s * pw) - temp;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Per-element version of the layer's backward pass, written as a scatter:
+  // every top element of top_i adds its diff to the centre of its block,
+  // every element of top_other subtracts its diff from the neighbour it
+  // compared against, and each bottom element is averaged over its terms.
+  void ReferenceBackward(const NeighbourParameter& param,
+      const Blob<Dtype>& top, const Blob<Dtype>& other, Blob<Dtype>* bottom) {
+    const int k = param.kernel_size();
+    const int s = param.stride();
+    const int d = param.dilation();
+    const int r = (k - 1) / 2;
+    const int out_height = (bottom->height() - 1) / s + 1;
+    const int out_width = (bottom->width() - 1) / s + 1;
+    Blob<Dtype> counts;
+    counts.ReshapeLike(*bottom);
+    caffe_set(counts.count(), Dtype(0), counts.mutable_cpu_data());
+    caffe_set(bottom->count(), Dtype(0), bottom->mutable_cpu_diff());
+    for (int n = 0; n < bottom->num(); ++n) {
+      for (int c = 0; c < bottom->channels(); ++c) {
+        for (int ph = 0; ph < out_height; ++ph) {
+          for (int pw = 0; pw < out_width; ++pw) {
+            for (int y = 0; y < k; ++y) {
+              for (int x = 0; x < k; ++x) {
+                const int centre = bottom->offset(n, c, s * ph, s * pw);
+                bottom->mutable_cpu_diff()[centre] +=
+                    top.diff_at(n, c, k * ph + y, k * pw + x);
+                counts.mutable_cpu_data()[centre] += 1;
+                const int h = s * ph + (y - r) * d;
+                const int w = s * pw + (x - r) * d;
+                if (h < 0 || w < 0 || h >= bottom->height() ||
+                    w >= bottom->width()) {
+                  continue;
+                }
+                const int neighbour = bottom->offset(n, c, h, w);
+                bottom->mutable_cpu_diff()[neighbour] -=
+                    other.diff_at(n, c, k * ph + y, k * pw + x);
+                counts.mutable_cpu_data()[neighbour] += 1;
+              }
+            }
+          }
+        }
+      }
+    }
+    for (int i = 0; i < bottom->count(); ++i) {
+      if (counts.cpu_data()[i] > 0) {
+        bottom->mutable_cpu_diff()[i] /= counts.cpu_data()[i];
+      }
+    }
+  }
+
+  void TestForward(const LayerParameter& layer_param) {
+    NeighbourLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> expected_0, expected_1;
+    const NeighbourParameter& param = layer_param.neigh_param();
+    ReferenceForward(param, *blob_bottom_0_, *blob_bottom_1_, &expected_0);
+    ReferenceForward(param, *blob_bottom_1_, *blob_bottom_0_, &expected_1);
+    ASSERT_EQ(expected_0.count(), blob_top_0_->count());
+    ASSERT_EQ(expected_1.count(), blob_top_1_->count());
+    for (int i = 0; i < expected_0.count(); ++i) {
+      EXPECT_EQ(expected_0.cpu_data()[i], blob_top_0_->cpu_data()[i]);
+      EXPECT_EQ(expected_1.cpu_data()[i], blob_top_1_->cpu_data()[i]);
+    }
+  }
+
+  void TestBackward(const LayerParameter& layer_param,
+      const vector<bool>& propagate_down) {
+    NeighbourLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_top_0_);
+    filler.Fill(blob_top_1_);
+    caffe_copy(blob_top_0_->count(), blob_top_0_->cpu_data(),
+        blob_top_0_->mutable_cpu_diff());
+    caffe_copy(blob_top_1_->count(), blob_top_1_->cpu_data(),
+        blob_top_1_->mutable_cpu_diff());
+    // Stale bottom diffs must be overwritten, or kept when not propagating.
+    const Dtype kStale = 7;
+    caffe_set(blob_bottom_0_->count(), kStale,
+        blob_bottom_0_->mutable_cpu_diff());
+    caffe_set(blob_bottom_1_->count(), kStale,
+        blob_bottom_1_->mutable_cpu_diff());
+    Blob<Dtype> expected_0, expected_1;
+    expected_0.ReshapeLike(*blob_bottom_0_);
+    expected_1.ReshapeLike(*blob_bottom_1_);
+    const NeighbourParameter& param = layer_param.neigh_param();
+    ReferenceBackward(param, *blob_top_0_, *blob_top_1_, &expected_0);
+    ReferenceBackward(param, *blob_top_1_, *blob_top_0_, &expected_1);
+    if (!propagate_down[0]) {
+      caffe_set(expected_0.count(), kStale, expected_0.mutable_cpu_diff());
+    }
+    if (!propagate_down[1]) {
+      caffe_set(expected_1.count(), kStale, expected_1.mutable_cpu_diff());
+    }
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    for (int i = 0; i < expected_0.count(); ++i) {
+      EXPECT_NEAR(expected_0.cpu_diff()[i], blob_bottom_0_->cpu_diff()[i],
+          1e-5);
+      EXPECT_NEAR(expected_1.cpu_diff()[i], blob_bottom_1_->cpu_diff()[i],
+          1e-5);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_0_;
+  Blob<Dtype>* const blob_bottom_1_;
+  Blob<Dtype>* const blob_top_0_;
+  Blob<Dtype>* const blob_top_1_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(NeighbourLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NeighbourLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  NeighbourLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_0_->num(), 2);
+  EXPECT_EQ(this->blob_top_0_->channels(), 3);
+  EXPECT_EQ(this->blob_top_0_->height(), 35);
+  EXPECT_EQ(this->blob_top_0_->width(), 30);
+  EXPECT_TRUE(this->blob_top_1_->shape() == this->blob_top_0_->shape());
+}
+
+TYPED_TEST(NeighbourLayerTest, TestForward) {
+  LayerParameter layer_param;
+  this->TestForward(layer_param);
+}
+
+TYPED_TEST(NeighbourLayerTest, TestForwardSmall) {
+  // Maps narrower than the window have no interior positions at all.
+  this->blob_bottom_0_->Reshape(1, 2, 3, 2);
+  this->blob_bottom_1_->Reshape(1, 2, 3, 2);
+  FillerParameter filler_param;
+  GaussianFiller<typename TypeParam::Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_0_);
+  filler.Fill(this->blob_bottom_1_);
+  LayerParameter layer_param;
+  this->TestForward(layer_param);
+}
+
+TYPED_TEST(NeighbourLayerTest, TestSetUpStride) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  NeighbourParameter* neigh_param = layer_param.mutable_neigh_param();
+  neigh_param->set_kernel_size(3);
+  neigh_param->set_stride(2);
+  NeighbourLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_0_->height(), 12);
+  EXPECT_EQ(this->blob_top_0_->width(), 9);
+}
+
+TYPED_TEST(NeighbourLayerTest, TestForwardKernel3) {
+  LayerParameter layer_param;
+  layer_param.mutable_neigh_param()->set_kernel_size(3);
+  this->TestForward(layer_param);
+}
+
+TYPED_TEST(NeighbourLayerTest, TestForwardGeneric) {
+  LayerParameter layer_param;
+  NeighbourParameter* neigh_param = layer_param.mutable_neigh_param();
+  neigh_param->set_kernel_size(7);
+  neigh_param->set_stride(2);
+  neigh_param->set_dilation(2);
+  this->TestForward(layer_param);
+}
+
+TYPED_TEST(NeighbourLayerTest, TestBackward) {
+  LayerParameter layer_param;
+  this->TestBackward(layer_param, vector<bool>(2, true));
+}
+
+TYPED_TEST(NeighbourLayerTest, TestBackwardPropagateDown) {
+  LayerParameter layer_param;
+  vector<bool> propagate_down(2, true);
+  propagate_down[1] = false;
+  this->TestBackward(layer_param, propagate_down);
+  propagate_down[0] = false;
+  propagate_down[1] = true;
+  this->TestBackward(layer_param, propagate_down);
+}
+
+TYPED_TEST(NeighbourLayerTest, TestBackwardKernel3Dilation) {
+  LayerParameter layer_param;
+  NeighbourParameter* neigh_param = layer_param.mutable_neigh_param();
+  neigh_param->set_kernel_size(3);
+  neigh_param->set_dilation(2);
+  this->TestBackward(layer_param, vector<bool>(2, true));
+}
+
+TYPED_TEST(NeighbourLayerTest, TestBackwardStride) {
+  LayerParameter layer_param;
+  NeighbourParameter* neigh_param = layer_param.mutable_neigh_param();
+  neigh_param->set_kernel_size(5);
+  neigh_param->set_stride(3);
+  this->TestBackward(layer_param, vector<bool>(2, true));
+}
+
+}  // namespace caffe
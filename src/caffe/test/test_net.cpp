@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/thread.hpp"
+
 #include "google/protobuf/text_format.h"
 
 #include "gtest/gtest.h"
@@ -440,6 +443,202 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // Two towers sharing their weights, fed by one data layer. With random
+  // set, the data is refilled on every pass and each tower has a dropout.
+  virtual void InitTowersNet(int layer_threads, bool random) {
+    ostringstream proto;
+    proto <<
+        "name: 'TowersNetwork' "
+        "force_backward: true "
+        "layer_threads: " << layer_threads << " "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 4 dim: 6 } "
+        "    shape { dim: 4 dim: 6 } ";
+    if (random) {
+      proto <<
+          "  data_filler { type: 'gaussian' } ";
+    } else {
+      proto <<
+          "  data_filler { type: 'constant' value: 1 } "
+          "  data_filler { type: 'constant' value: -2 } ";
+    }
+    proto <<
+        "  } "
+        "  top: 'left' "
+        "  top: 'right' "
+        "} ";
+    const char* towers[] = { "left", "right" };
+    for (int i = 0; i < 2; ++i) {
+      const string tower = towers[i];
+      proto <<
+          "layer { "
+          "  name: 'ip_" << tower << "' "
+          "  type: 'InnerProduct' "
+          "  inner_product_param { "
+          "    num_output: 5 "
+          "    weight_filler { type: 'gaussian' } "
+          "    bias_filler { type: 'gaussian' } "
+          "  } "
+          "  param { name: 'shared_weights' } "
+          "  param { name: 'shared_bias' } "
+          "  bottom: '" << tower << "' "
+          "  top: 'ip_" << tower << "' "
+          "} "
+          "layer { "
+          "  name: 'relu_" << tower << "' "
+          "  type: 'ReLU' "
+          "  bottom: 'ip_" << tower << "' "
+          "  top: 'ip_" << tower << "' "
+          "} ";
+      if (random) {
+        proto <<
+            "layer { "
+            "  name: 'drop_" << tower << "' "
+            "  type: 'Dropout' "
+            "  bottom: 'ip_" << tower << "' "
+            "  top: 'ip_" << tower << "' "
+            "} ";
+      }
+    }
+    proto <<
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip_left' "
+        "  bottom: 'ip_right' "
+        "  top: 'loss' "
+        "} ";
+    InitNetFromProtoString(proto.str());
+  }
+
+  // Runs two passes of forward and backward, then returns the loss and
+  // copies the blobs and the parameter diffs.
+  Dtype RunTowersNet(vector<shared_ptr<Blob<Dtype> > >* blobs,
+      vector<shared_ptr<Blob<Dtype> > >* params) {
+    net_->ClearParamDiffs();
+    net_->ForwardBackward();
+    const Dtype loss = net_->ForwardBackward();
+    const bool kCopyDiff = true;
+    CopyNetBlobs(!kCopyDiff, blobs);
+    CopyNetParams(kCopyDiff, params);
+    return loss;
+  }
+
+  // A chain of inner products and sigmoids; the sigmoids read their top data
+  // in Backward, so training plans have to keep it.
+  virtual void InitChainNet(const string& memory_plan) {
+    ostringstream proto;
+    proto <<
+        "name: 'ChainNetwork' "
+        "memory_plan: " << memory_plan << " "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 4 dim: 8 } "
+        "    shape { dim: 4 dim: 3 } "
+        "    data_filler { type: 'constant' value: 0.5 } "
+        "    data_filler { type: 'constant' value: -0.25 } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'target' "
+        "} ";
+    string bottom = "data";
+    for (int i = 1; i <= 4; ++i) {
+      proto <<
+          "layer { "
+          "  name: 'ip" << i << "' "
+          "  type: 'InnerProduct' "
+          "  inner_product_param { "
+          "    num_output: " << (i < 4 ? 8 : 3) << " "
+          "    weight_filler { type: 'gaussian' } "
+          "    bias_filler { type: 'gaussian' } "
+          "  } "
+          "  bottom: '" << bottom << "' "
+          "  top: 'ip" << i << "' "
+          "} ";
+      bottom = "ip" + string(1, '0' + i);
+      if (i < 4) {
+        proto <<
+            "layer { "
+            "  name: 'sig" << i << "' "
+            "  type: 'Sigmoid' "
+            "  bottom: '" << bottom << "' "
+            "  top: 'sig" << i << "' "
+            "} ";
+        bottom = "sig" + string(1, '0' + i);
+      }
+    }
+    proto <<
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip4' "
+        "  bottom: 'target' "
+        "  top: 'loss' "
+        "} ";
+    InitNetFromProtoString(proto.str());
+  }
+
+  // Max pooling feeding an inner product and a batch norm, which gets a
+  // split layer unless the net is inference-only.
+  virtual void InitBranchNet(bool inference_only) {
+    const string& proto =
+        "name: 'BranchNetwork' "
+        "force_backward: true "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 2 dim: 3 dim: 6 dim: 6 } "
+        "    data_filler { type: 'constant' value: 0.5 } "
+        "  } "
+        "  top: 'data' "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "} "
+        "layer { "
+        "  name: 'pool' "
+        "  type: 'Pooling' "
+        "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+        "  bottom: 'conv' "
+        "  top: 'pool' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { type: 'gaussian' } "
+        "  } "
+        "  bottom: 'pool' "
+        "  top: 'ip' "
+        "} "
+        "layer { "
+        "  name: 'bn' "
+        "  type: 'BatchNorm' "
+        "  batch_norm_param { use_global_stats: false } "
+        "  bottom: 'pool' "
+        "  top: 'bn' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_inference_only(inference_only);
+    net_.reset(new Net<Dtype>(param));
+  }
+
   virtual void InitDiffDataUnsharedWeightsNet() {
     const string& proto =
         "name: 'DiffDataUnsharedWeightsNetwork' "
@@ -502,8 +701,8 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitDiffDataSharedWeightsNet() {
-    const string& proto =
+  virtual void InitDiffDataSharedWeightsNet(bool flat_params = false) {
+    string proto =
         "name: 'DiffDataSharedWeightsNetwork' "
         "layer { "
         "  name: 'data' "
@@ -561,6 +760,9 @@ class NetTest : public MultiDeviceTest<TypeParam> {
         "  bottom: 'data2' "
         "  bottom: 'innerproduct2' "
         "} ";
+    if (flat_params) {
+      proto += "flat_params: true state { phase: TRAIN } ";
+    }
     InitNetFromProtoString(proto);
   }
 
@@ -1216,6 +1418,138 @@ TYPED_TEST(NetTest, TestSharedWeightsDiffNet) {
   }
 }
 
+TYPED_TEST(NetTest, TestLayerThreadsMatchSequential) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<shared_ptr<Blob<Dtype> > > blobs, params;
+  Caffe::set_random_seed(this->seed_);
+  this->InitTowersNet(1, false);
+  const Dtype loss = this->RunTowersNet(&blobs, &params);
+  EXPECT_GT(loss, 0);
+  for (int threads = 2; threads <= 4; ++threads) {
+    vector<shared_ptr<Blob<Dtype> > > threaded_blobs, threaded_params;
+    Caffe::set_random_seed(this->seed_);
+    this->InitTowersNet(threads, false);
+    EXPECT_EQ(loss, this->RunTowersNet(&threaded_blobs, &threaded_params));
+    for (int i = 0; i < blobs.size(); ++i) {
+      for (int j = 0; j < blobs[i]->count(); ++j) {
+        EXPECT_EQ(blobs[i]->cpu_data()[j], threaded_blobs[i]->cpu_data()[j]);
+      }
+    }
+    // Shared weights accumulate in the same order as in sequential runs.
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], threaded_params[i]->cpu_diff()[j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestLayerThreadsDeterministic) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<shared_ptr<Blob<Dtype> > > blobs, params;
+  Caffe::set_random_seed(this->seed_);
+  this->InitTowersNet(3, true);
+  const Dtype loss = this->RunTowersNet(&blobs, &params);
+  for (int run = 0; run < 3; ++run) {
+    vector<shared_ptr<Blob<Dtype> > > other_blobs, other_params;
+    Caffe::set_random_seed(this->seed_);
+    this->InitTowersNet(3, true);
+    EXPECT_EQ(loss, this->RunTowersNet(&other_blobs, &other_params));
+    for (int i = 0; i < blobs.size(); ++i) {
+      for (int j = 0; j < blobs[i]->count(); ++j) {
+        EXPECT_EQ(blobs[i]->cpu_data()[j], other_blobs[i]->cpu_data()[j]);
+      }
+    }
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], other_params[i]->cpu_diff()[j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestMemoryPlanInference) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("NO_PLAN");
+  const Dtype loss = this->net_->ForwardFrom(0);
+  EXPECT_EQ(0, this->net_->unplanned_memory());
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("INFERENCE");
+  for (int pass = 0; pass < 2; ++pass) {
+    EXPECT_EQ(loss, this->net_->ForwardFrom(0));
+  }
+  // Reshaping plans again.
+  this->net_->Reshape();
+  EXPECT_EQ(loss, this->net_->ForwardFrom(0));
+  if (Caffe::mode() == Caffe::CPU) {
+    EXPECT_LT(this->net_->planned_memory(), this->net_->unplanned_memory());
+  }
+}
+
+TYPED_TEST(NetTest, TestMemoryPlanTraining) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<shared_ptr<Blob<Dtype> > > params, planned_params;
+  const bool kCopyDiff = true;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("NO_PLAN");
+  this->net_->ClearParamDiffs();
+  const Dtype loss = this->net_->ForwardBackward();
+  this->CopyNetParams(kCopyDiff, &params);
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("TRAINING");
+  for (int pass = 0; pass < 2; ++pass) {
+    this->net_->ClearParamDiffs();
+    EXPECT_EQ(loss, this->net_->ForwardBackward());
+    this->CopyNetParams(kCopyDiff, &planned_params);
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], planned_params[i]->cpu_diff()[j]);
+      }
+    }
+  }
+  if (Caffe::mode() == Caffe::CPU) {
+    EXPECT_LT(this->net_->planned_memory(), this->net_->unplanned_memory());
+  }
+}
+
+TYPED_TEST(NetTest, TestInferenceOnly) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitBranchNet(false);
+  const int num_layers = this->net_->layers().size();
+  this->net_->Forward();
+  vector<shared_ptr<Blob<Dtype> > > outputs;
+  for (int i = 0; i < this->net_->num_outputs(); ++i) {
+    outputs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    outputs[i]->CopyFrom(*this->net_->output_blobs()[i], false, true);
+  }
+  Caffe::set_random_seed(this->seed_);
+  this->InitBranchNet(true);
+  Net<Dtype>* net = this->net_.get();
+  EXPECT_TRUE(net->inference_only());
+  // The split of 'pool' is gone.
+  EXPECT_EQ(num_layers - 1, net->layers().size());
+  for (int i = 0; i < net->layers().size(); ++i) {
+    EXPECT_FALSE(net->layer_need_backward()[i]);
+  }
+  net->Forward();
+  ASSERT_EQ(outputs.size(), net->num_outputs());
+  for (int i = 0; i < outputs.size(); ++i) {
+    const Blob<Dtype>* output = net->output_blobs()[i];
+    ASSERT_EQ(outputs[i]->count(), output->count());
+    for (int j = 0; j < output->count(); ++j) {
+      EXPECT_EQ(outputs[i]->cpu_data()[j], output->cpu_data()[j]);
+    }
+  }
+  for (int i = 0; i < net->blobs().size(); ++i) {
+    EXPECT_EQ(SyncedMemory::UNINITIALIZED, net->blobs()[i]->diff()->head());
+  }
+  for (int i = 0; i < net->params().size(); ++i) {
+    EXPECT_EQ(SyncedMemory::UNINITIALIZED, net->params()[i]->diff()->head());
+  }
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   typedef typename TypeParam::Dtype Dtype;
   Caffe::set_random_seed(this->seed_);
@@ -1297,6 +1631,179 @@ TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   }
 }
 
+TYPED_TEST(NetTest, TestFlatParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet(true);
+  Blob<Dtype>* flat = this->net_->flat_params();
+  if (Caffe::mode() == Caffe::GPU) {
+    EXPECT_TRUE(flat == NULL);
+    return;
+  }
+  ASSERT_TRUE(flat != NULL);
+  const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+  const vector<int>& offsets = this->net_->flat_param_offsets();
+  ASSERT_EQ(params.size(), offsets.size());
+  const int align = Net<Dtype>::kFlatParamAlignment / sizeof(Dtype);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(flat->cpu_data()) %
+      Net<Dtype>::kFlatParamAlignment);
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(0, offsets[i] % align);
+    EXPECT_EQ(flat->cpu_data() + offsets[i], params[i]->cpu_data());
+    EXPECT_EQ(flat->cpu_diff() + offsets[i], params[i]->cpu_diff());
+  }
+  // The shared weights view the arena as well.
+  Blob<Dtype>* ip2_weights = this->net_->layers()[2]->blobs()[0].get();
+  EXPECT_EQ(flat->cpu_data(), ip2_weights->cpu_data());
+  // Backward and Update through the arena match the params themselves.
+  this->net_->ClearParamDiffs();
+  EXPECT_EQ(0, flat->asum_diff());
+  this->net_->ForwardBackward();
+  vector<shared_ptr<Blob<Dtype> > > expected(params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    expected[i].reset(new Blob<Dtype>());
+    expected[i]->CopyFrom(*params[i], false, true);
+    expected[i]->CopyFrom(*params[i], true, true);
+    expected[i]->Update();
+  }
+  this->net_->Update();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(expected[i]->cpu_data()[j], params[i]->cpu_data()[j]);
+    }
+  }
+  // A param that no longer views the arena turns it off.
+  params[0]->data()->set_cpu_data(expected[0]->mutable_cpu_data());
+  EXPECT_TRUE(this->net_->flat_params() == NULL);
+}
+
+TYPED_TEST(NetTest, TestFlatParamsOutliveNet) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet(true);
+  if (Caffe::mode() == Caffe::GPU) {
+    return;
+  }
+  ASSERT_TRUE(this->net_->flat_params() != NULL);
+  shared_ptr<Blob<Dtype> > weights = this->net_->params()[0];
+  Blob<Dtype> expected;
+  expected.CopyFrom(*weights, false, true);
+  this->net_.reset();
+  for (int i = 0; i < weights->count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], weights->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestFlatParamsTrainOnly) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Off by default.
+  this->InitDiffDataSharedWeightsNet();
+  EXPECT_TRUE(this->net_->flat_params() == NULL);
+  // Test nets are not flattened even when asked to.
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      "flat_params: true state { phase: TEST } "
+      "layer { name: 'data' type: 'DummyData' top: 'data' "
+      "  dummy_data_param { shape { dim: 2 dim: 3 } } } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+      "  inner_product_param { num_output: 2 } } ", &param));
+  Net<Dtype> test_net(param);
+  EXPECT_TRUE(test_net.flat_params() == NULL);
+}
+
+TYPED_TEST(NetTest, TestFlatParamsSharedTrainedLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet(true);
+  if (Caffe::mode() == Caffe::GPU) {
+    return;
+  }
+  shared_ptr<Net<Dtype> > source = this->net_;
+  this->InitDiffDataSharedWeightsNet(true);
+  ASSERT_TRUE(this->net_->flat_params() != NULL);
+  // Sharing every param's data releases the arena, and the params still
+  // work without it.
+  this->net_->ShareTrainedLayersWith(source.get());
+  EXPECT_TRUE(this->net_->flat_params() == NULL);
+  const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(source->learnable_params()[i]->cpu_data(),
+        params[i]->cpu_data());
+  }
+  this->net_->ClearParamDiffs();
+  this->net_->ForwardBackward();
+  this->net_->Update();
+}
+
+// Records the layers that ran Backward, and for each learnable param, the
+// layers that had run and its diff when it was reported final.
+template <typename Dtype>
+class ParamsFinalRecorder : public Net<Dtype>::Callback {
+ public:
+  explicit ParamsFinalRecorder(Net<Dtype>* net)
+      : net_(net), reports_(net->learnable_params().size(), 0),
+        finished_before_(reports_.size()), diffs_(reports_.size()) {}
+
+  vector<int> finished_;
+  vector<int> reports_;
+  vector<vector<int> > finished_before_;
+  vector<vector<Dtype> > diffs_;
+
+ protected:
+  void run(int layer, const vector<int>& learnable_param_ids) {
+    boost::mutex::scoped_lock lock(mutex_);
+    finished_.push_back(layer);
+    for (int i = 0; i < learnable_param_ids.size(); ++i) {
+      const int id = learnable_param_ids[i];
+      const Blob<Dtype>* param = net_->learnable_params()[id];
+      ++reports_[id];
+      finished_before_[id] = finished_;
+      diffs_[id].assign(param->cpu_diff(), param->cpu_diff() + param->count());
+    }
+  }
+
+  Net<Dtype>* net_;
+  boost::mutex mutex_;
+};
+
+TYPED_TEST(NetTest, TestParamGradientsFinal) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The towers share both params, and run Backward in any order when on
+  // several threads.
+  for (int threads = 1; threads <= 3; threads += 2) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitTowersNet(threads, false);
+    ParamsFinalRecorder<Dtype> recorder(this->net_.get());
+    this->net_->add_after_backward(&recorder);
+    this->net_->ClearParamDiffs();
+    this->net_->ForwardBackward();
+    const int left = 1;
+    const int right = 3;
+    EXPECT_EQ("ip_left", this->net_->layer_names()[left]);
+    EXPECT_EQ("ip_right", this->net_->layer_names()[right]);
+    const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+    ASSERT_EQ(2, params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      // Reported once, after both towers accumulated into it, with its
+      // final diff.
+      EXPECT_EQ(1, recorder.reports_[i]);
+      const vector<int>& finished = recorder.finished_before_[i];
+      EXPECT_TRUE(std::find(finished.begin(), finished.end(), left) !=
+          finished.end());
+      EXPECT_TRUE(std::find(finished.begin(), finished.end(), right) !=
+          finished.end());
+      ASSERT_EQ(params[i]->count(), recorder.diffs_[i].size());
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], recorder.diffs_[i][j]);
+      }
+    }
+    if (threads == 1) {
+      // One by one, the last user of the shared params is the first tower.
+      EXPECT_EQ(left, recorder.finished_before_[0].back());
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsResume) {
   typedef typename TypeParam::Dtype Dtype;
 
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/normalized_triplet_loss_layer.hpp"
+#include "caffe/layers/triplet_loss_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NormalizedTripletLossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NormalizedTripletLossLayerTest() : blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < 3; ++i) {
+      Blob<Dtype>* blob = new Blob<Dtype>(10, 4, 5, 2);
+      filler.Fill(blob);
+      blob_bottom_vec_.push_back(blob);
+    }
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~NormalizedTripletLossLayerTest() {
+    for (int i = 0; i < blob_bottom_vec_.size(); ++i) {
+      delete blob_bottom_vec_[i];
+    }
+    delete blob_top_loss_;
+  }
+
+  // Copies each bottom with every sample scaled to unit length.
+  void Normalize(vector<Blob<Dtype>*>* normalized) {
+    const int num = blob_bottom_vec_[0]->num();
+    const int dim = blob_bottom_vec_[0]->count(1);
+    for (int i = 0; i < 3; ++i) {
+      Blob<Dtype>* blob = new Blob<Dtype>();
+      blob->CopyFrom(*blob_bottom_vec_[i], false, true);
+      Dtype* data = blob->mutable_cpu_data();
+      for (int v = 0; v < num; ++v) {
+        Dtype sumsq = 0;
+        for (int k = 0; k < dim; ++k) {
+          sumsq += data[v * dim + k] * data[v * dim + k];
+        }
+        for (int k = 0; k < dim; ++k) {
+          data[v * dim + k] /= sqrt(sumsq);
+        }
+      }
+      normalized->push_back(blob);
+    }
+  }
+
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(NormalizedTripletLossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NormalizedTripletLossLayerTest, TestForwardEuclidean) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kAlpha = 0.5;
+  LayerParameter layer_param;
+  layer_param.mutable_threshold_param()->set_threshold(kAlpha);
+  NormalizedTripletLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_GT(loss, 0);
+
+  // Same as TripletLossLayer on normalized embeddings.
+  vector<Blob<Dtype>*> normalized;
+  this->Normalize(&normalized);
+  TripletLossLayer<Dtype> triplet(layer_param);
+  Blob<Dtype> triplet_loss;
+  vector<Blob<Dtype>*> triplet_top(1, &triplet_loss);
+  triplet.SetUp(normalized, triplet_top);
+  EXPECT_NEAR(triplet.Forward(normalized, triplet_top), loss, 1e-5);
+  for (int i = 0; i < normalized.size(); ++i) {
+    delete normalized[i];
+  }
+}
+
+TYPED_TEST(NormalizedTripletLossLayerTest, TestForwardCosine) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kAlpha = 0.3;
+  LayerParameter layer_param;
+  layer_param.mutable_threshold_param()->set_threshold(kAlpha);
+  layer_param.mutable_triplet_param()->set_distance(
+      TripletParameter_Distance_COSINE);
+  NormalizedTripletLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  vector<Blob<Dtype>*> normalized;
+  this->Normalize(&normalized);
+  const int num = normalized[0]->num();
+  const int dim = normalized[0]->count(1);
+  Dtype expected = 0;
+  for (int v = 0; v < num; ++v) {
+    const Dtype* a = normalized[0]->cpu_data() + v * dim;
+    const Dtype* p = normalized[1]->cpu_data() + v * dim;
+    const Dtype* n = normalized[2]->cpu_data() + v * dim;
+    Dtype ap = 0, an = 0;
+    for (int k = 0; k < dim; ++k) {
+      ap += a[k] * p[k];
+      an += a[k] * n[k];
+    }
+    expected += std::max(Dtype(0), kAlpha + (1 - ap) - (1 - an));
+  }
+  EXPECT_GT(expected, 0);
+  EXPECT_NEAR(expected / num, loss, 1e-5);
+  for (int i = 0; i < normalized.size(); ++i) {
+    delete normalized[i];
+  }
+}
+
+TYPED_TEST(NormalizedTripletLossLayerTest, TestGradientEuclidean) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_threshold_param()->set_threshold(0.5);
+  layer_param.add_loss_weight(3.7);
+  NormalizedTripletLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-3, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+                                  this->blob_top_vec_);
+}
+
+TYPED_TEST(NormalizedTripletLossLayerTest, TestGradientCosine) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_threshold_param()->set_threshold(0.3);
+  layer_param.mutable_triplet_param()->set_distance(
+      TripletParameter_Distance_COSINE);
+  layer_param.add_loss_weight(3.7);
+  NormalizedTripletLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-3, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+                                  this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -0,0 +1,104 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/solver_update.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SolverUpdateTest : public ::testing::Test {
+ protected:
+  // Reserves the storage of the params, so that their pointers stay valid.
+  SolverUpdateTest() {
+    data_.reserve(4);
+    diff_.reserve(4);
+    history_.reserve(4);
+  }
+
+  // Describes a param of count elements with data i, diff 1 and history 2.
+  SolverParamUpdate<Dtype> MakeParam(int count) {
+    data_.push_back(vector<Dtype>(count));
+    diff_.push_back(vector<Dtype>(count, Dtype(1)));
+    history_.push_back(vector<Dtype>(count, Dtype(2)));
+    for (int i = 0; i < count; ++i) {
+      data_.back()[i] = i;
+    }
+    SolverParamUpdate<Dtype> param;
+    param.count = count;
+    param.data = &data_.back()[0];
+    param.diff = &diff_.back()[0];
+    param.history = &history_.back()[0];
+    param.history2 = NULL;
+    param.normalization = 0.5;
+    param.decay = 0.1;
+    param.l1 = false;
+    param.rate = 0.01;
+    param.momentum = 0.9;
+    param.momentum2 = 0.999;
+    param.rms_decay = 0.98;
+    param.delta = 1e-8;
+    return param;
+  }
+
+  vector<vector<Dtype> > data_;
+  vector<vector<Dtype> > diff_;
+  vector<vector<Dtype> > history_;
+};
+
+TYPED_TEST_CASE(SolverUpdateTest, TestDtypes);
+
+TYPED_TEST(SolverUpdateTest, TestSGD) {
+  vector<SolverParamUpdate<TypeParam> > params;
+  params.push_back(this->MakeParam(3));
+  params.push_back(this->MakeParam(5));
+  params[1].l1 = true;
+  caffe_cpu_solver_update(SGD_UPDATE, params);
+  for (int p = 0; p < params.size(); ++p) {
+    for (int i = 0; i < params[p].count; ++i) {
+      const TypeParam w = i;
+      const TypeParam r = params[p].l1 ? TypeParam(i > 0) : w;
+      const TypeParam h = 0.9 * 2 + 0.01 * (0.5 * 1 + 0.1 * r);
+      EXPECT_NEAR(h, params[p].history[i], 1e-6);
+      EXPECT_NEAR(h, params[p].diff[i], 1e-6);
+      EXPECT_NEAR(w - h, params[p].data[i], 1e-6);
+    }
+  }
+}
+
+TYPED_TEST(SolverUpdateTest, TestParallelMatchesSerial) {
+  // Params large enough to be split over the threads, with boundaries that
+  // fall inside chunks, against the same params updated one at a time.
+  const int counts[] = {70000, 1, 90001};
+  vector<SolverParamUpdate<TypeParam> > params;
+  vector<SolverParamUpdate<TypeParam> > serial;
+  for (int p = 0; p < 3; ++p) {
+    params.push_back(this->MakeParam(counts[p]));
+  }
+  serial.push_back(this->MakeParam(counts[0] + counts[1] + counts[2]));
+  ThreadPool pool(4);
+  ScopedThreadPool scoped_pool(&pool);
+  caffe_cpu_solver_update(NESTEROV_UPDATE, params);
+  for (int i = 0, p = 0, offset = 0; i < serial[0].count; ++i) {
+    if (i - offset == counts[p]) {
+      offset += counts[p++];
+    }
+    vector<SolverParamUpdate<TypeParam> > element(1, serial[0]);
+    element[0].count = 1;
+    element[0].data += i;
+    element[0].diff += i;
+    element[0].history += i;
+    // Match the data of element i - offset of param p.
+    *element[0].data = i - offset;
+    caffe_cpu_solver_update(NESTEROV_UPDATE, element);
+    EXPECT_EQ(*element[0].data, params[p].data[i - offset]);
+    EXPECT_EQ(*element[0].diff, params[p].diff[i - offset]);
+    EXPECT_EQ(*element[0].history, params[p].history[i - offset]);
+  }
+}
+
+}  // namespace caffe
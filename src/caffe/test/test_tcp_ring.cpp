@@ -0,0 +1,266 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/solver_factory.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/tcp_ring.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Picks free ports on localhost for num_ranks ranks.
+vector<string> LocalHosts(int num_ranks) {
+  vector<int> fds;
+  vector<string> hosts;
+  for (int i = 0; i < num_ranks; ++i) {
+    fds.push_back(socket(AF_INET, SOCK_STREAM, 0));
+    CHECK_GE(fds.back(), 0);
+    sockaddr_in addr;
+    caffe_memset(sizeof(addr), 0, &addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t length = sizeof(addr);
+    CHECK_EQ(bind(fds.back(), reinterpret_cast<sockaddr*>(&addr),
+        sizeof(addr)), 0);
+    CHECK_EQ(getsockname(fds.back(), reinterpret_cast<sockaddr*>(&addr),
+        &length), 0);
+    std::ostringstream host;
+    host << "127.0.0.1:" << ntohs(addr.sin_port);
+    hosts.push_back(host.str());
+  }
+  // Keep the sockets until all ports are picked, so that they differ.
+  for (int i = 0; i < num_ranks; ++i) {
+    close(fds[i]);
+  }
+  return hosts;
+}
+
+// Waits for a child process and returns whether it exited with status 0.
+bool WaitForRank(pid_t pid) {
+  int status = 0;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+      WEXITSTATUS(status) == 0;
+}
+
+template <typename Dtype>
+class TCPRingTest : public ::testing::Test {
+ protected:
+  typedef bool (*Check)(TCPRing* ring);
+
+  // Runs check on every rank of a ring on localhost, rank 0 in this process
+  // and the others in child processes, and returns whether all passed.
+  bool RunRanks(int num_ranks, Check check) {
+    const vector<string> hosts = LocalHosts(num_ranks);
+    vector<pid_t> children;
+    for (int rank = 1; rank < num_ranks; ++rank) {
+      const pid_t pid = fork();
+      CHECK_GE(pid, 0);
+      if (pid == 0) {
+        TCPRing ring(hosts, rank);
+        _exit(check(&ring) ? 0 : 1);
+      }
+      children.push_back(pid);
+    }
+    bool passed;
+    {
+      TCPRing ring(hosts, 0);
+      passed = check(&ring);
+    }
+    for (int i = 0; i < children.size(); ++i) {
+      passed = WaitForRank(children[i]) && passed;
+    }
+    return passed;
+  }
+
+  // Sums rank * count + i over all ranks.
+  static bool CheckAllreduceSum(TCPRing* ring, int count) {
+    vector<Dtype> data(count);
+    for (int i = 0; i < count; ++i) {
+      data[i] = ring->rank() * count + i;
+    }
+    ring->AllreduceSum(&data[0], count);
+    const int size = ring->size();
+    for (int i = 0; i < count; ++i) {
+      if (data[i] != size * i + count * size * (size - 1) / 2) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool CheckAllreduce(TCPRing* ring) {
+    // Neither count is a multiple of the ranks, and the second leaves some
+    // ranks without a chunk.
+    return CheckAllreduceSum(ring, 1000) && CheckAllreduceSum(ring, 2);
+  }
+
+  static bool CheckBroadcast(TCPRing* ring) {
+    const int count = 1000;
+    vector<Dtype> data(count, Dtype(-1));
+    if (ring->rank() == 0) {
+      for (int i = 0; i < count; ++i) {
+        data[i] = i;
+      }
+    }
+    ring->Broadcast(&data[0], count);
+    for (int i = 0; i < count; ++i) {
+      if (data[i] != i) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+TYPED_TEST_CASE(TCPRingTest, TestDtypes);
+
+TYPED_TEST(TCPRingTest, TestSingleRank) {
+  EXPECT_TRUE(this->RunRanks(1, &TestFixture::CheckAllreduce));
+  EXPECT_TRUE(this->RunRanks(1, &TestFixture::CheckBroadcast));
+}
+
+TYPED_TEST(TCPRingTest, TestAllreduceSum) {
+  EXPECT_TRUE(this->RunRanks(2, &TestFixture::CheckAllreduce));
+  EXPECT_TRUE(this->RunRanks(3, &TestFixture::CheckAllreduce));
+}
+
+TYPED_TEST(TCPRingTest, TestBroadcast) {
+  EXPECT_TRUE(this->RunRanks(3, &TestFixture::CheckBroadcast));
+}
+
+class TCPSyncTest : public ::testing::Test {
+ protected:
+  // Trains a small net on this rank, and returns its flat weights.
+  static vector<float> Train(const vector<string>& hosts, int rank,
+      size_t bucket_bytes) {
+    const string solver_proto =
+        "base_lr: 0.1 "
+        "lr_policy: 'fixed' "
+        "momentum: 0.9 "
+        "max_iter: 5 "
+        "snapshot_after_train: false "
+        "net_param { "
+        "  name: 'TestNetwork' "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'DummyData' "
+        "    dummy_data_param { "
+        "      num: 4 channels: 3 height: 1 width: 1 "
+        "      num: 4 channels: 1 height: 1 width: 1 "
+        "      data_filler { type: 'gaussian' std: 1 } "
+        "      data_filler { type: 'gaussian' std: 1 } "
+        "    } "
+        "    top: 'data' "
+        "    top: 'label' "
+        "  } "
+        "  layer { "
+        "    name: 'ip1' "
+        "    type: 'InnerProduct' "
+        "    inner_product_param { "
+        "      num_output: 5 "
+        "      weight_filler { type: 'gaussian' std: 0.5 } "
+        "      bias_filler { type: 'gaussian' std: 0.5 } "
+        "    } "
+        "    bottom: 'data' "
+        "    top: 'ip1' "
+        "  } "
+        "  layer { "
+        "    name: 'ip2' "
+        "    type: 'InnerProduct' "
+        "    inner_product_param { "
+        "      num_output: 1 "
+        "      weight_filler { type: 'gaussian' std: 0.5 } "
+        "      bias_filler { type: 'gaussian' std: 0.5 } "
+        "    } "
+        "    bottom: 'ip1' "
+        "    top: 'ip2' "
+        "  } "
+        "  layer { "
+        "    name: 'loss' "
+        "    type: 'EuclideanLoss' "
+        "    bottom: 'ip2' "
+        "    bottom: 'label' "
+        "  } "
+        "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(solver_proto, &param));
+    Caffe::set_mode(Caffe::CPU);
+    // Different weights and data on every rank.
+    Caffe::set_random_seed(1701 + rank);
+    // The threads of the global pool do not survive fork.
+    ThreadPool pool(1);
+    ScopedThreadPool scoped_pool(&pool);
+    shared_ptr<Solver<float> > solver(
+        SolverRegistry<float>::CreateSolver(param));
+    TCPSync<float> sync(solver, hosts, rank, bucket_bytes);
+    sync.Run();
+    const Blob<float>* flat = solver->net()->flat_params();
+    return vector<float>(flat->cpu_data(), flat->cpu_data() + flat->count());
+  }
+
+  // Trains on two ranks, checks that they end with the same weights, and
+  // returns them.
+  vector<float> TrainOnTwoRanks(size_t bucket_bytes) {
+    const vector<string> hosts = LocalHosts(2);
+    int fds[2];
+    CHECK_EQ(pipe(fds), 0);
+    const pid_t pid = fork();
+    CHECK_GE(pid, 0);
+    if (pid == 0) {
+      close(fds[0]);
+      const vector<float> weights = Train(hosts, 1, bucket_bytes);
+      const ssize_t bytes = weights.size() * sizeof(float);
+      _exit(write(fds[1], &weights[0], bytes) == bytes ? 0 : 1);
+    }
+    close(fds[1]);
+    const vector<float> weights = Train(hosts, 0, bucket_bytes);
+    vector<float> other(weights.size());
+    char* buffer = reinterpret_cast<char*>(&other[0]);
+    const size_t total = other.size() * sizeof(float);
+    size_t received = 0;
+    while (received < total) {
+      const ssize_t bytes = read(fds[0], buffer + received, total - received);
+      if (bytes <= 0) {
+        break;
+      }
+      received += bytes;
+    }
+    close(fds[0]);
+    EXPECT_TRUE(WaitForRank(pid));
+    EXPECT_EQ(total, received);
+    for (int i = 0; i < weights.size(); ++i) {
+      EXPECT_EQ(weights[i], other[i]);
+    }
+    return weights;
+  }
+};
+
+TEST_F(TCPSyncTest, TestBucketsMatchOneReduce) {
+  // With one bucket per param, buckets are reduced during Backward; with a
+  // single bucket, only once all gradients are ready. The sum of two ranks
+  // does not depend on how the diffs are split, so the weights must match.
+  const vector<float> overlapped = TrainOnTwoRanks(1);
+  const vector<float> whole = TrainOnTwoRanks(1 << 20);
+  ASSERT_EQ(overlapped.size(), whole.size());
+  for (int i = 0; i < whole.size(); ++i) {
+    EXPECT_EQ(whole[i], overlapped[i]);
+  }
+}
+
+}  // namespace caffe
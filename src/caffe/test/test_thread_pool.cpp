@@ -0,0 +1,76 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {};
+
+static void FillIndex(vector<int>* out, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    (*out)[i] += i;
+  }
+}
+
+static void NestedFill(ThreadPool* pool, vector<vector<int> >* out,
+    int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    vector<int>* row = &(*out)[i];
+    pool->ParallelFor(row->size(), boost::bind(&FillIndex, row, _1, _2));
+  }
+}
+
+// Resizes the global pool from the first chunk of a loop running on it.
+static void ResizeAndFill(vector<int>* out, int begin, int end) {
+  if (begin == 0) {
+    ThreadPool::SetGlobalThreads(3);
+  }
+  FillIndex(out, begin, end);
+}
+
+TEST_F(ThreadPoolTest, TestCoversRangeOnce) {
+  for (int threads = 1; threads <= 4; ++threads) {
+    ThreadPool pool(threads);
+    EXPECT_EQ(threads, pool.num_threads());
+    for (int n = 0; n < 37; ++n) {
+      vector<int> out(n, 0);
+      pool.ParallelFor(n, boost::bind(&FillIndex, &out, _1, _2));
+      for (int i = 0; i < n; ++i) {
+        EXPECT_EQ(i, out[i]);
+      }
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestNestedCallsRunSerially) {
+  ThreadPool pool(3);
+  vector<vector<int> > out(6, vector<int>(5, 0));
+  pool.ParallelFor(out.size(),
+      boost::bind(&NestedFill, &pool, &out, _1, _2));
+  for (int i = 0; i < out.size(); ++i) {
+    for (int j = 0; j < out[i].size(); ++j) {
+      EXPECT_EQ(j, out[i][j]);
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestResizeGlobalDuringLoop) {
+  ThreadPool::SetGlobalThreads(2);
+  vector<int> out(16, 0);
+  // The loop keeps the pool it started on.
+  caffe_parallel_for(out.size(), boost::bind(&ResizeAndFill, &out, _1, _2));
+  for (int i = 0; i < out.size(); ++i) {
+    EXPECT_EQ(i, out[i]);
+  }
+  EXPECT_EQ(3, ThreadPool::Global()->num_threads());
+  ThreadPool::SetGlobalThreads(0);
+}
+
+}  // namespace caffe
@@ -0,0 +1,241 @@
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/triplet_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+template <typename TypeParam>
+class TripletDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  TripletDataLayerTest()
+      : backend_(DataParameter_DB_LEVELDB),
+        seed_(1701) {}
+  virtual void SetUp() {
+    filename_.reset(new string());
+    MakeTempDir(filename_.get());
+    *filename_ += "/db";
+    for (int i = 0; i < 4; ++i) {
+      blob_top_vec_.push_back(new Blob<Dtype>());
+    }
+  }
+  virtual ~TripletDataLayerTest() {
+    for (int i = 0; i < blob_top_vec_.size(); ++i) {
+      delete blob_top_vec_[i];
+    }
+  }
+
+  // Fill the DB with label l having l + 1 records, whose pixels all hold
+  // the index of the record.
+  void Fill(DataParameter_DB backend) {
+    backend_ = backend;
+    LOG(INFO) << "Using temporary dataset " << *filename_;
+    scoped_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    label_of_.clear();
+    for (int label = 0; label < 5; ++label) {
+      for (int i = 0; i <= label; ++i) {
+        Datum datum;
+        datum.set_label(label);
+        datum.set_channels(1);
+        datum.set_height(2);
+        datum.set_width(2);
+        datum.set_data(string(4, static_cast<char>(label_of_.size())));
+        string out;
+        CHECK(datum.SerializeToString(&out));
+        txn->Put(format_int(label_of_.size(), 8), out);
+        label_of_.push_back(label);
+      }
+    }
+    txn->Commit();
+    db->Close();
+  }
+
+  LayerParameter MakeParam(TripletDataParameter_Sampling sampling) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    TripletDataParameter* triplet_data_param =
+        param.mutable_triplet_data_param();
+    triplet_data_param->set_sampling(sampling);
+    triplet_data_param->set_num_identities(3);
+    triplet_data_param->set_num_instances(2);
+    triplet_data_param->set_num_triplets(4);
+    return param;
+  }
+
+  // The index of the record in item of blob, checking all its pixels.
+  int Record(const Blob<Dtype>& blob, int item) {
+    const Dtype* data = blob.cpu_data() + blob.offset(item);
+    for (int i = 1; i < 4; ++i) {
+      EXPECT_EQ(data[0], data[i]);
+    }
+    return data[0];
+  }
+
+  void TestSetUp() {
+    LayerParameter param = MakeParam(TripletDataParameter_Sampling_PK);
+    vector<Blob<Dtype>*> top(blob_top_vec_.begin(), blob_top_vec_.begin() + 2);
+    TripletDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, top);
+    ASSERT_EQ(5, layer.labels().size());
+    for (int label = 0; label < 5; ++label) {
+      EXPECT_EQ(label, layer.labels()[label]);
+      EXPECT_EQ(label + 1, layer.num_records(label));
+    }
+    EXPECT_EQ(6, top[0]->num());
+    EXPECT_EQ(1, top[0]->channels());
+    EXPECT_EQ(2, top[0]->height());
+    EXPECT_EQ(2, top[0]->width());
+    EXPECT_EQ(6, top[1]->num());
+  }
+
+  void TestSamplePK() {
+    LayerParameter param = MakeParam(TripletDataParameter_Sampling_PK);
+    vector<Blob<Dtype>*> top(blob_top_vec_.begin(), blob_top_vec_.begin() + 2);
+    TripletDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, top);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, top);
+      std::set<int> identities;
+      for (int p = 0; p < 3; ++p) {
+        const int label = top[1]->cpu_data()[p * 2];
+        EXPECT_TRUE(identities.insert(label).second) << "repeated identity";
+        std::set<int> records;
+        for (int k = 0; k < 2; ++k) {
+          const int item = p * 2 + k;
+          EXPECT_EQ(label, top[1]->cpu_data()[item]);
+          const int record = Record(*top[0], item);
+          EXPECT_EQ(label, label_of_[record]);
+          records.insert(record);
+        }
+        // Label 0 has one record, which is repeated; others have enough.
+        EXPECT_EQ(label == 0 ? 1 : 2, records.size());
+      }
+    }
+  }
+
+  void TestSampleTriplets() {
+    LayerParameter param = MakeParam(TripletDataParameter_Sampling_TRIPLETS);
+    TripletDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_EQ(4, blob_top_vec_[i]->num());
+    }
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int t = 0; t < 4; ++t) {
+        const int anchor = Record(*blob_top_vec_[0], t);
+        const int positive = Record(*blob_top_vec_[1], t);
+        const int negative = Record(*blob_top_vec_[2], t);
+        EXPECT_NE(anchor, positive);
+        EXPECT_EQ(label_of_[anchor], label_of_[positive]);
+        EXPECT_NE(label_of_[anchor], label_of_[negative]);
+        EXPECT_EQ(label_of_[anchor], blob_top_vec_[3]->cpu_data()[t]);
+      }
+    }
+  }
+
+  void TestSeeded(TripletDataParameter_Sampling sampling) {
+    LayerParameter param = MakeParam(sampling);
+    vector<Blob<Dtype>*> top(blob_top_vec_.begin(),
+        blob_top_vec_.begin() + (sampling == TripletDataParameter_Sampling_PK ?
+        1 : 3));
+    vector<int> records;
+    {
+      Caffe::set_random_seed(seed_);
+      TripletDataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, top);
+      for (int iter = 0; iter < 5; ++iter) {
+        layer.Forward(blob_bottom_vec_, top);
+        for (int i = 0; i < top.size(); ++i) {
+          for (int item = 0; item < top[i]->num(); ++item) {
+            records.push_back(Record(*top[i], item));
+          }
+        }
+      }
+    }
+    // The same seed gives the same batches.
+    Caffe::set_random_seed(seed_);
+    TripletDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, top);
+    int index = 0;
+    for (int iter = 0; iter < 5; ++iter) {
+      layer.Forward(blob_bottom_vec_, top);
+      for (int i = 0; i < top.size(); ++i) {
+        for (int item = 0; item < top[i]->num(); ++item) {
+          EXPECT_EQ(records[index++], Record(*top[i], item));
+        }
+      }
+    }
+  }
+
+  DataParameter_DB backend_;
+  shared_ptr<string> filename_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<int> label_of_;
+  int seed_;
+};
+
+TYPED_TEST_CASE(TripletDataLayerTest, TestDtypesAndDevices);
+
+#ifdef USE_LEVELDB
+TYPED_TEST(TripletDataLayerTest, TestSamplePKLevelDB) {
+  this->Fill(DataParameter_DB_LEVELDB);
+  this->TestSamplePK();
+}
+
+TYPED_TEST(TripletDataLayerTest, TestSampleTripletsLevelDB) {
+  this->Fill(DataParameter_DB_LEVELDB);
+  this->TestSampleTriplets();
+}
+#endif  // USE_LEVELDB
+
+#ifdef USE_LMDB
+TYPED_TEST(TripletDataLayerTest, TestSetUpLMDB) {
+  this->Fill(DataParameter_DB_LMDB);
+  this->TestSetUp();
+}
+
+TYPED_TEST(TripletDataLayerTest, TestSamplePKLMDB) {
+  this->Fill(DataParameter_DB_LMDB);
+  this->TestSamplePK();
+}
+
+TYPED_TEST(TripletDataLayerTest, TestSampleTripletsLMDB) {
+  this->Fill(DataParameter_DB_LMDB);
+  this->TestSampleTriplets();
+}
+
+TYPED_TEST(TripletDataLayerTest, TestSeededPKLMDB) {
+  this->Fill(DataParameter_DB_LMDB);
+  this->TestSeeded(TripletDataParameter_Sampling_PK);
+}
+
+TYPED_TEST(TripletDataLayerTest, TestSeededTripletsLMDB) {
+  this->Fill(DataParameter_DB_LMDB);
+  this->TestSeeded(TripletDataParameter_Sampling_TRIPLETS);
+}
+#endif  // USE_LMDB
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
@@ -103,4 +104,139 @@ TYPED_TEST(TripletLossLayerTest, TestGradient) {
                                   this->blob_top_vec_);
 }
 
+template <typename TypeParam>
+class TripletLossMiningTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  TripletLossMiningTest()
+      : blob_bottom_data_(new Blob<Dtype>(6, 3, 2, 1)),
+        blob_bottom_label_(new Blob<Dtype>(6, 1, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    // Three identities with two embeddings each, interleaved.
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = i % 3;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~TripletLossMiningTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_loss_;
+  }
+
+  Dtype Distance(int i, int j) {
+    const int dim = blob_bottom_data_->count(1);
+    const Dtype* data = blob_bottom_data_->cpu_data();
+    Dtype dist = 0;
+    for (int k = 0; k < dim; ++k) {
+      const Dtype d = data[i * dim + k] - data[j * dim + k];
+      dist += d * d;
+    }
+    return dist;
+  }
+
+  // Brute-force mining over explicitly computed distances.
+  Dtype ReferenceLoss(TripletParameter_Mining mining, Dtype alpha) {
+    const int num = blob_bottom_data_->num();
+    const Dtype* label = blob_bottom_label_->cpu_data();
+    Dtype loss = 0;
+    int num_triplets = 0;
+    for (int a = 0; a < num; ++a) {
+      for (int p = 0; p < num; ++p) {
+        if (p == a || label[p] != label[a]) {
+          continue;
+        }
+        const Dtype pos = Distance(a, p);
+        Dtype hardest = -1, semi_hard = -1, farthest = -1;
+        bool is_hardest = true;
+        for (int n = 0; n < num; ++n) {
+          if (label[n] == label[a]) {
+            continue;
+          }
+          const Dtype neg = Distance(a, n);
+          if (hardest < 0 || neg < hardest) {
+            hardest = neg;
+          }
+          if (neg > pos && (semi_hard < 0 || neg < semi_hard)) {
+            semi_hard = neg;
+          }
+          farthest = std::max(farthest, neg);
+        }
+        for (int q = 0; q < num; ++q) {
+          if (q != a && label[q] == label[a] && Distance(a, q) > pos) {
+            is_hardest = false;
+          }
+        }
+        Dtype neg;
+        if (mining == TripletParameter_Mining_BATCH_HARD) {
+          if (!is_hardest) {
+            continue;
+          }
+          neg = hardest;
+        } else {
+          neg = semi_hard >= 0 ? semi_hard : farthest;
+        }
+        loss += std::max(Dtype(0), alpha + pos - neg);
+        ++num_triplets;
+      }
+    }
+    return loss / (2 * num_triplets);
+  }
+
+  void TestForward(TripletParameter_Mining mining) {
+    const Dtype kAlpha = 0.5;
+    LayerParameter layer_param;
+    layer_param.mutable_threshold_param()->set_threshold(kAlpha);
+    layer_param.mutable_triplet_param()->set_mining(mining);
+    TripletLossLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype loss =
+        layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_NEAR(ReferenceLoss(mining, kAlpha), loss, 1e-4);
+    EXPECT_GT(loss, 0);
+  }
+
+  void TestGradient(TripletParameter_Mining mining) {
+    LayerParameter layer_param;
+    layer_param.mutable_threshold_param()->set_threshold(0.5);
+    layer_param.mutable_triplet_param()->set_mining(mining);
+    layer_param.add_loss_weight(3.7);
+    TripletLossLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    GradientChecker<Dtype> checker(1e-3, 1e-2, 1701);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_, 0);
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(TripletLossMiningTest, TestDtypesAndDevices);
+
+TYPED_TEST(TripletLossMiningTest, TestForwardBatchHard) {
+  this->TestForward(TripletParameter_Mining_BATCH_HARD);
+}
+
+TYPED_TEST(TripletLossMiningTest, TestForwardSemiHard) {
+  this->TestForward(TripletParameter_Mining_SEMI_HARD);
+}
+
+TYPED_TEST(TripletLossMiningTest, TestGradientBatchHard) {
+  this->TestGradient(TripletParameter_Mining_BATCH_HARD);
+}
+
+TYPED_TEST(TripletLossMiningTest, TestGradientSemiHard) {
+  this->TestGradient(TripletParameter_Mining_SEMI_HARD);
+}
+
 } // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
@@ -18,98 +19,34 @@ class TripletLossRegLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
 
  protected:
-  TripletLossRegLayerTest()
-      : blob_bottom_anchor_(new Blob<Dtype>(1, 4, 5, 2)),
-        blob_bottom_same_(new Blob<Dtype>(1, 4, 5, 2)),
-        blob_bottom_diff_(new Blob<Dtype>(1, 4, 5, 2)),
-        blob_bottom_label_a_(new Blob<Dtype>(1, 4, 5, 2)),
-        blob_bottom_label_p_(new Blob<Dtype>(1, 4, 5, 2)),
-        blob_bottom_label_n_(new Blob<Dtype>(1, 4, 5, 2)),
-        blob_top_loss_(new Blob<Dtype>()) {
-    // fill the values
+  TripletLossRegLayerTest() : blob_top_loss_(new Blob<Dtype>()) {
     FillerParameter filler_param;
     GaussianFiller<Dtype> filler(filler_param);
-    filler.Fill(this->blob_bottom_anchor_);
-    blob_bottom_vec_.push_back(blob_bottom_anchor_);
-
-    filler.Fill(this->blob_bottom_same_);
-    blob_bottom_vec_.push_back(blob_bottom_same_);
-
-    filler.Fill(this->blob_bottom_diff_);
-    blob_bottom_vec_.push_back(blob_bottom_diff_);
-    
-    filler.Fill(this->blob_bottom_diff_);
-    blob_bottom_vec_.push_back(blob_bottom_label_a_);
-    
-    filler.Fill(this->blob_bottom_diff_);
-    blob_bottom_vec_.push_back(blob_bottom_label_p_);
-    
-    filler.Fill(this->blob_bottom_diff_);
-    blob_bottom_vec_.push_back(blob_bottom_label_n_);
-
+    for (int i = 0; i < 6; ++i) {
+      Blob<Dtype>* blob = new Blob<Dtype>(10, 4, 5, 2);
+      filler.Fill(blob);
+      blob_bottom_vec_.push_back(blob);
+    }
     blob_top_vec_.push_back(blob_top_loss_);
   }
   virtual ~TripletLossRegLayerTest() {
-    delete blob_bottom_anchor_;
-    delete blob_bottom_same_;
-    delete blob_bottom_diff_;
-    delete blob_bottom_label_a_;
-    delete blob_bottom_label_p_;
-    delete blob_bottom_label_n_;
+    for (int i = 0; i < blob_bottom_vec_.size(); ++i) {
+      delete blob_bottom_vec_[i];
+    }
     delete blob_top_loss_;
   }
 
-  void TestForward() {
-    // Get the loss without a specified objective weight -- should be
-    // equivalent to explicitly specifiying a weight of 1.
-    LayerParameter layer_param;
-    TripletLossRegLayer<Dtype> layer_weight_1(layer_param);
-    layer_weight_1.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
-    const Dtype loss_weight_1 =
-        layer_weight_1.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
-
-    // Make sure the loss is non-trivial.
-    const Dtype kNonTrivialAbsThresh = 1e-1;
-    EXPECT_GE(fabs(loss_weight_1), kNonTrivialAbsThresh);
-
-    // Get the loss again with a different objective weight; check that it is
-    // scaled appropriately.
-    const Dtype kLossWeight = 3.7;
-    layer_param.add_loss_weight(kLossWeight);
-    TripletLossRegLayer<Dtype> layer_weight_2(layer_param);
-    layer_weight_2.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
-    const Dtype loss_weight_2 =
-        layer_weight_2.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
-    const Dtype kErrorMargin = 1e-5;
-    EXPECT_NEAR(loss_weight_1 * kLossWeight, loss_weight_2, kErrorMargin);
-
-    // Get the loss again with a different alpha; check that it is changed
-    // appropriately.
-    const Dtype kAlpha = 0.314;
-    layer_param.mutable_triplet_param()->set_alpha(kAlpha);
-    TripletLossRegLayer<Dtype> layer_weight_2_alpha(layer_param);
-    layer_weight_2_alpha.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
-    const Dtype loss_weight_2_alpha = layer_weight_2_alpha.Forward(
-        this->blob_bottom_vec_, this->blob_top_vec_);
-    EXPECT_GE(loss_weight_2_alpha, loss_weight_2);
-    
-    // Get the loss again with a different alpha and gamma; check that it is changed
-    // appropriately.
-    const Dtype kGamma = 0.1;
-    layer_param.mutable_triplet_param()->set_gamma(kGamma);
-    TripletLossRegLayer<Dtype> layer_weight_2_alpha_gamma(layer_param);
-    layer_weight_2_alpha_gamma.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
-    const Dtype loss_weight_2_alpha_gamma = layer_weight_2_alpha_gamma.Forward(
-        this->blob_bottom_vec_, this->blob_top_vec_);
-    EXPECT_GE(loss_weight_2_alpha_gamma, loss_weight_2_alpha); 
+  Dtype Distance(int i, int j, int v) {
+    const int dim = blob_bottom_vec_[0]->count(1);
+    const Dtype* x = blob_bottom_vec_[i]->cpu_data() + v * dim;
+    const Dtype* y = blob_bottom_vec_[j]->cpu_data() + v * dim;
+    Dtype dist = 0;
+    for (int k = 0; k < dim; ++k) {
+      dist += (x[k] - y[k]) * (x[k] - y[k]);
+    }
+    return dist;
   }
 
-  Blob<Dtype>* const blob_bottom_anchor_;
-  Blob<Dtype>* const blob_bottom_same_;
-  Blob<Dtype>* const blob_bottom_diff_;
-  Blob<Dtype>* const blob_bottom_label_a_;
-  Blob<Dtype>* const blob_bottom_label_p_;
-  Blob<Dtype>* const blob_bottom_label_n_;
   Blob<Dtype>* const blob_top_loss_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
@@ -117,22 +54,41 @@ class TripletLossRegLayerTest : public MultiDeviceTest<TypeParam> {
 
 TYPED_TEST_CASE(TripletLossRegLayerTest, TestDtypesAndDevices);
 
-TYPED_TEST(TripletLossRegLayerTest, TestForward) { this->TestForward(); }
+TYPED_TEST(TripletLossRegLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kAlpha = 2;
+  const Dtype kGamma = 0.1;
+  LayerParameter layer_param;
+  layer_param.mutable_triplet_param()->set_alpha(kAlpha);
+  layer_param.mutable_triplet_param()->set_gamma(kGamma);
+  TripletLossRegLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_vec_[0]->num();
+  Dtype expected = 0;
+  for (int v = 0; v < num; ++v) {
+    expected += std::max(Dtype(0), kAlpha + this->Distance(0, 1, v) -
+        this->Distance(0, 2, v));
+    expected += kGamma * (this->Distance(0, 3, v) + this->Distance(1, 4, v) +
+        this->Distance(2, 5, v));
+  }
+  EXPECT_NEAR(expected / num, loss, 1e-4);
+}
 
 TYPED_TEST(TripletLossRegLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
-  const Dtype kGamma = 0.001;
-  const Dtype kAlpha = 1;
-  const Dtype kLossWeight = 3.7;
-  layer_param.add_loss_weight(kLossWeight);
-  layer_param.mutable_triplet_param()->set_gamma(kGamma);
-  layer_param.mutable_triplet_param()->set_alpha(kAlpha);
+  layer_param.mutable_triplet_param()->set_alpha(2);
+  layer_param.mutable_triplet_param()->set_gamma(0.1);
+  layer_param.add_loss_weight(3.7);
   TripletLossRegLayer<Dtype> layer(layer_param);
   layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
   GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
-  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
-                                  this->blob_top_vec_);
+  for (int i = 0; i < 3; ++i) {
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_, i);
+  }
 }
 
 }  // namespace caffe
@@ -0,0 +1,119 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/dag_executor.hpp"
+
+namespace caffe {
+
+class DagExecutor::State {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+  // Ready nodes ordered by (rank, node).
+  std::set<std::pair<int, int> > ready_;
+  // Number of unfinished active predecessors of each node.
+  vector<int> pending_;
+  vector<bool> group_busy_;
+  int remaining_;
+  int running_;
+
+  const vector<vector<int> >* successors_;
+  const vector<bool>* active_;
+  const vector<int>* rank_;
+  const vector<int>* exclusive_group_;
+  const boost::function<void(int)>* run_;
+};
+
+DagExecutor::DagExecutor(int num_threads) : pool_(num_threads) {}
+
+void DagExecutor::Run(const vector<vector<int> >& successors,
+    const vector<bool>& active, const vector<int>& rank,
+    const vector<int>& exclusive_group,
+    const boost::function<void(int)>& run) {
+  const int num_nodes = successors.size();
+  CHECK_EQ(num_nodes, active.size());
+  CHECK_EQ(num_nodes, rank.size());
+  CHECK_EQ(num_nodes, exclusive_group.size());
+  State state;
+  state.pending_.resize(num_nodes, 0);
+  state.remaining_ = 0;
+  state.running_ = 0;
+  int num_groups = 0;
+  for (int i = 0; i < num_nodes; ++i) {
+    if (!active[i]) {
+      continue;
+    }
+    ++state.remaining_;
+    num_groups = std::max(num_groups, exclusive_group[i] + 1);
+    for (int j = 0; j < successors[i].size(); ++j) {
+      if (active[successors[i][j]]) {
+        ++state.pending_[successors[i][j]];
+      }
+    }
+  }
+  for (int i = 0; i < num_nodes; ++i) {
+    if (active[i] && state.pending_[i] == 0) {
+      state.ready_.insert(std::make_pair(rank[i], i));
+    }
+  }
+  state.group_busy_.resize(num_groups, false);
+  state.successors_ = &successors;
+  state.active_ = &active;
+  state.rank_ = &rank;
+  state.exclusive_group_ = &exclusive_group;
+  state.run_ = &run;
+  if (state.remaining_ == 0) {
+    return;
+  }
+  pool_.ParallelFor(std::min(pool_.num_threads(), state.remaining_),
+      boost::bind(&DagExecutor::Worker, this, &state, _1, _2));
+}
+
+void DagExecutor::Worker(State* state, int begin, int end) {
+  boost::mutex::scoped_lock lock(state->mutex_);
+  while (state->remaining_ > 0) {
+    std::set<std::pair<int, int> >::iterator it = state->ready_.begin();
+    for (; it != state->ready_.end(); ++it) {
+      const int group = (*state->exclusive_group_)[it->second];
+      if (group < 0 || !state->group_busy_[group]) {
+        break;
+      }
+    }
+    if (it == state->ready_.end()) {
+      CHECK(state->running_ > 0 || !state->ready_.empty())
+          << "The graph has a cycle.";
+      state->changed_.wait(lock);
+      continue;
+    }
+    const int node = it->second;
+    const int group = (*state->exclusive_group_)[node];
+    state->ready_.erase(it);
+    if (group >= 0) {
+      state->group_busy_[group] = true;
+    }
+    ++state->running_;
+    lock.unlock();
+    (*state->run_)(node);
+    lock.lock();
+    --state->running_;
+    --state->remaining_;
+    if (group >= 0) {
+      state->group_busy_[group] = false;
+    }
+    const vector<int>& successors = (*state->successors_)[node];
+    for (int j = 0; j < successors.size(); ++j) {
+      const int next = successors[j];
+      if ((*state->active_)[next] && --state->pending_[next] == 0) {
+        state->ready_.insert(std::make_pair((*state->rank_)[next], next));
+      }
+    }
+    state->changed_.notify_all();
+  }
+}
+
+}  // namespace caffe
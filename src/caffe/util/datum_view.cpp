@@ -0,0 +1,129 @@
+#include <google/protobuf/io/coded_stream.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+
+#include "caffe/util/datum_view.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe {
+
+using google::protobuf::io::CodedInputStream;
+
+namespace {
+
+// Field numbers and wire types of message Datum in caffe.proto.
+enum DatumField {
+  CHANNELS = 1, HEIGHT = 2, WIDTH = 3, DATA = 4, LABEL = 5, FLOAT_DATA = 6,
+  ENCODED = 7
+};
+const uint32_t kWireVarint = 0;
+const uint32_t kWireLengthDelimited = 2;
+
+// Reads an int32 or bool field.
+inline bool read_varint(CodedInputStream* input, const uint32_t wire_type,
+    int* value) {
+  uint32_t varint;
+  if (wire_type != kWireVarint || !input->ReadVarint32(&varint)) {
+    return false;
+  }
+  *value = static_cast<int32_t>(varint);
+  return true;
+}
+
+}  // namespace
+
+void DatumView::Clear() {
+  channels_ = 0;
+  height_ = 0;
+  width_ = 0;
+  label_ = 0;
+  data_ = NULL;
+  data_size_ = 0;
+  has_datum_ = false;
+}
+
+bool DatumView::Parse(const char* buffer, size_t size) {
+  Clear();
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer), size);
+  bool ok = true;
+  uint32_t tag;
+  while (ok && (tag = input.ReadTag()) != 0) {
+    const uint32_t wire_type = tag & 7;
+    switch (tag >> 3) {
+    case CHANNELS:
+      ok = read_varint(&input, wire_type, &channels_);
+      break;
+    case HEIGHT:
+      ok = read_varint(&input, wire_type, &height_);
+      break;
+    case WIDTH:
+      ok = read_varint(&input, wire_type, &width_);
+      break;
+    case LABEL:
+      ok = read_varint(&input, wire_type, &label_);
+      break;
+    case ENCODED: {
+      // Encoded images are decoded from the full Datum.
+      int encoded;
+      ok = read_varint(&input, wire_type, &encoded) && !encoded;
+      break;
+    }
+    case DATA: {
+      uint32_t length = 0;
+      ok = wire_type == kWireLengthDelimited && input.ReadVarint32(&length);
+      if (ok && length > 0) {
+        // Point at the bytes in place of copying them.
+        const void* data = NULL;
+        int available;
+        ok = input.GetDirectBufferPointer(&data, &available) &&
+            static_cast<uint32_t>(available) >= length && input.Skip(length);
+        data_ = static_cast<const char*>(data);
+      }
+      data_size_ = length;
+      break;
+    }
+    default:
+      // float_data and unknown fields take the full protobuf path.
+      ok = false;
+    }
+  }
+  if (!ok || !input.ConsumedEntireMessage()) {
+    Clear();
+    return false;
+  }
+  return true;
+}
+
+void DatumView::ParseDatum(const char* buffer, size_t size) {
+  Clear();
+  CHECK(datum_.ParseFromArray(buffer, size)) << "Failed to parse Datum";
+  has_datum_ = true;
+}
+
+void DatumView::Read(db::Cursor* cursor) {
+  const char* data;
+  size_t size;
+  if (cursor->value_view(&data, &size)) {
+    if (!Parse(data, size)) {
+      ParseDatum(data, size);
+    }
+  } else {
+    const string value = cursor->value();
+    ParseDatum(value.data(), value.size());
+  }
+}
+
+void DatumView::Swap(DatumView* other) {
+  std::swap(channels_, other->channels_);
+  std::swap(height_, other->height_);
+  std::swap(width_, other->width_);
+  std::swap(label_, other->label_);
+  std::swap(data_, other->data_);
+  std::swap(data_size_, other->data_size_);
+  std::swap(has_datum_, other->has_datum_);
+  datum_.Swap(&other->datum_);
+}
+
+}  // namespace caffe
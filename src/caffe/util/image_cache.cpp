@@ -0,0 +1,170 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+ImageCache::ImageCache(const ImageCacheParameter& param)
+    : memory_capacity_(param.memory_bytes()), spill_capacity_(0),
+      memory_bytes_(0), spill_bytes_(0), hits_(0), misses_(0), spill_(NULL),
+      mutex_(new boost::mutex()) {
+  if (param.spill_file().empty() || param.spill_bytes() == 0) {
+    return;
+  }
+  const string& filename = param.spill_file();
+  const int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  CHECK_GE(fd, 0) << "Failed to create spill file " << filename;
+  CHECK_EQ(ftruncate(fd, param.spill_bytes()), 0)
+      << "Failed to size spill file " << filename;
+  void* spill = mmap(NULL, param.spill_bytes(), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(spill != MAP_FAILED) << "Failed to map spill file " << filename;
+  // The mapping keeps the file alive; nothing is left behind on exit.
+  unlink(filename.c_str());
+  spill_ = static_cast<char*>(spill);
+  spill_capacity_ = param.spill_bytes();
+}
+
+ImageCache::~ImageCache() {
+  if (spill_) {
+    munmap(spill_, spill_capacity_);
+  }
+}
+
+shared_ptr<const CachedImage> ImageCache::Get(const string& key) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  std::map<string, Entry>::iterator entry = entries_.find(key);
+  if (entry != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, entry->second.lru);
+    ++hits_;
+    return entry->second.image;
+  }
+  std::map<string, SpillEntry>::const_iterator spilled = spilled_.find(key);
+  if (spilled == spilled_.end()) {
+    ++misses_;
+    return shared_ptr<const CachedImage>();
+  }
+  ++hits_;
+  const SpillEntry& spill_entry = spilled->second;
+  shared_ptr<CachedImage> image(new CachedImage());
+  image->channels = spill_entry.channels;
+  image->height = spill_entry.height;
+  image->width = spill_entry.width;
+  image->check = spill_entry.check;
+  image->data.assign(spill_ + spill_entry.offset, spill_entry.size);
+  return image;
+}
+
+void ImageCache::Put(const string& key,
+    const shared_ptr<const CachedImage>& image) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  if (entries_.count(key) || spilled_.count(key)) {
+    // Another worker cached the image first.
+    return;
+  }
+  const size_t size = image->data.size();
+  if (size > memory_capacity_) {
+    Spill(key, *image);
+    return;
+  }
+  while (memory_bytes_ + size > memory_capacity_) {
+    std::map<string, Entry>::iterator lru = entries_.find(lru_.back());
+    Spill(lru->first, *lru->second.image);
+    memory_bytes_ -= lru->second.image->data.size();
+    entries_.erase(lru);
+    lru_.pop_back();
+  }
+  lru_.push_front(key);
+  Entry& entry = entries_[key];
+  entry.image = image;
+  entry.lru = lru_.begin();
+  memory_bytes_ += size;
+}
+
+// Must be called holding mutex_.
+void ImageCache::Spill(const string& key, const CachedImage& image) {
+  const size_t size = image.data.size();
+  if (spill_bytes_ + size > spill_capacity_) {
+    return;
+  }
+  SpillEntry& entry = spilled_[key];
+  entry.channels = image.channels;
+  entry.height = image.height;
+  entry.width = image.width;
+  entry.check = image.check;
+  entry.offset = spill_bytes_;
+  entry.size = size;
+  std::copy(image.data.begin(), image.data.end(), spill_ + spill_bytes_);
+  spill_bytes_ += size;
+}
+
+uint64_t ImageCache::hits() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return hits_;
+}
+
+uint64_t ImageCache::misses() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return misses_;
+}
+
+size_t ImageCache::memory_bytes() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return memory_bytes_;
+}
+
+size_t ImageCache::spill_bytes() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return spill_bytes_;
+}
+
+string ImageCache::Stats() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  const uint64_t lookups = hits_ + misses_;
+  std::ostringstream stats;
+  stats << "Image cache hits: " << hits_ << "/" << lookups << " ("
+        << (lookups ? 100. * hits_ / lookups : 0.) << "%), "
+        << entries_.size() << " images in " << memory_bytes_ / 1048576.
+        << " MB of memory, " << spilled_.size() << " in "
+        << spill_bytes_ / 1048576. << " MB spilled";
+  return stats.str();
+}
+
+#ifdef USE_OPENCV
+shared_ptr<const CachedImage> CVMatToCachedImage(const cv::Mat& cv_img,
+    uint64_t check) {
+  CHECK_EQ(cv_img.depth(), CV_8U) << "Image cache requires 8-bit images";
+  shared_ptr<CachedImage> image(new CachedImage());
+  image->channels = cv_img.channels();
+  image->height = cv_img.rows;
+  image->width = cv_img.cols;
+  image->check = check;
+  const size_t row_size = cv_img.cols * cv_img.channels();
+  image->data.reserve(row_size * cv_img.rows);
+  for (int h = 0; h < cv_img.rows; ++h) {
+    const char* row = cv_img.ptr<char>(h);
+    image->data.append(row, row_size);
+  }
+  return image;
+}
+
+cv::Mat CachedImageToCVMat(const CachedImage& image) {
+  return cv::Mat(image.height, image.width, CV_8UC(image.channels),
+      const_cast<char*>(image.data.data()));
+}
+#endif  // USE_OPENCV
+
+}  // namespace caffe
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/memory_planner.hpp"
+
+namespace caffe {
+
+int MemoryPlanner::Add(size_t size, int first, int last) {
+  CHECK_LE(first, last) << "Buffer lifetimes must not be empty.";
+  sizes_.push_back(size);
+  first_.push_back(first);
+  last_.push_back(last);
+  return sizes_.size() - 1;
+}
+
+bool MemoryPlanner::Overlaps(int buffer_id, int arena_id) const {
+  const vector<int>& buffers = arena_buffers_[arena_id];
+  for (int i = 0; i < buffers.size(); ++i) {
+    if (first_[buffer_id] <= last_[buffers[i]] &&
+        first_[buffers[i]] <= last_[buffer_id]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MemoryPlanner::Plan() {
+  const int num_buffers = sizes_.size();
+  // Largest first, ties in the order added so the plan is reproducible.
+  vector<std::pair<size_t, int> > order(num_buffers);
+  for (int i = 0; i < num_buffers; ++i) {
+    order[i] = std::make_pair(sizes_[i], -i);
+  }
+  std::sort(order.rbegin(), order.rend());
+  arenas_.assign(num_buffers, -1);
+  arena_sizes_.clear();
+  arena_buffers_.clear();
+  for (int i = 0; i < num_buffers; ++i) {
+    const int buffer_id = -order[i].second;
+    const size_t size = sizes_[buffer_id];
+    // The smallest free arena that fits, else the largest one to grow.
+    int best = -1;
+    for (int a = 0; a < arena_sizes_.size(); ++a) {
+      if (Overlaps(buffer_id, a)) {
+        continue;
+      }
+      if (best < 0) {
+        best = a;
+      } else if (arena_sizes_[best] >= size) {
+        if (arena_sizes_[a] >= size && arena_sizes_[a] < arena_sizes_[best]) {
+          best = a;
+        }
+      } else if (arena_sizes_[a] > arena_sizes_[best]) {
+        best = a;
+      }
+    }
+    if (best < 0) {
+      best = arena_sizes_.size();
+      arena_sizes_.push_back(0);
+      arena_buffers_.push_back(vector<int>());
+    }
+    arenas_[buffer_id] = best;
+    arena_sizes_[best] = std::max(arena_sizes_[best], size);
+    arena_buffers_[best].push_back(buffer_id);
+  }
+}
+
+size_t MemoryPlanner::total_size() const {
+  size_t total = 0;
+  for (int i = 0; i < sizes_.size(); ++i) {
+    total += sizes_[i];
+  }
+  return total;
+}
+
+size_t MemoryPlanner::planned_size() const {
+  size_t total = 0;
+  for (int a = 0; a < arena_sizes_.size(); ++a) {
+    total += arena_sizes_[a];
+  }
+  return total;
+}
+
+}  // namespace caffe
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/mmap_tensor.hpp"
+
+namespace caffe {
+
+namespace {
+
+const char kMagic[8] = {'C', 'A', 'F', 'F', 'E', 'R', 'A', 'W'};
+const uint32_t kVersion = 1;
+
+// Rounds offset up to a multiple of alignment.
+inline uint64_t align_up(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+size_t record_elements(const MmapTensorHeader& header) {
+  size_t count = 1;
+  for (int i = 0; i < header.num_axes; ++i) {
+    count *= header.shape[i];
+  }
+  return count;
+}
+
+}  // namespace
+
+size_t mmap_tensor_type_size(MmapTensorType type) {
+  switch (type) {
+  case MMAP_TENSOR_UINT8:
+    return sizeof(uint8_t);
+  case MMAP_TENSOR_FLOAT:
+    return sizeof(float);
+  case MMAP_TENSOR_DOUBLE:
+    return sizeof(double);
+  default:
+    LOG(FATAL) << "Unknown raw tensor type " << type;
+  }
+  return 0;
+}
+
+MmapTensorWriter::~MmapTensorWriter() {
+  if (file_) {
+    Close();
+  }
+}
+
+void MmapTensorWriter::Open(const string& filename, const vector<int>& shape,
+    MmapTensorType type) {
+  CHECK(!file_) << "Already writing " << filename_;
+  CHECK_LE(shape.size(), MmapTensorHeader::kMaxAxes);
+  header_ = MmapTensorHeader();
+  std::copy(kMagic, kMagic + sizeof(kMagic), header_.magic);
+  header_.version = kVersion;
+  header_.type = type;
+  header_.data_offset = MmapTensorHeader::kSize;
+  header_.num_axes = shape.size();
+  for (int i = 0; i < shape.size(); ++i) {
+    CHECK_GE(shape[i], 0);
+    header_.shape[i] = shape[i];
+  }
+  record_bytes_ = record_elements(header_) * mmap_tensor_type_size(type);
+  labels_.clear();
+  filename_ = filename;
+  file_ = fopen(filename.c_str(), "wb");
+  CHECK(file_) << "Failed to open " << filename << ": " << strerror(errno);
+  // The header is written last, once the number of records is known.
+  CHECK_EQ(fseek(file_, header_.data_offset, SEEK_SET), 0);
+}
+
+void MmapTensorWriter::Write(const void* data, float label) {
+  CHECK(file_) << "No file is open.";
+  CHECK_EQ(fwrite(data, 1, record_bytes_, file_), record_bytes_)
+      << "Failed to write " << filename_;
+  labels_.push_back(label);
+}
+
+void MmapTensorWriter::Close() {
+  CHECK(file_) << "No file is open.";
+  header_.num = labels_.size();
+  header_.label_offset = align_up(
+      header_.data_offset + header_.num * record_bytes_, sizeof(double));
+  CHECK_EQ(fseek(file_, header_.label_offset, SEEK_SET), 0);
+  if (!labels_.empty()) {
+    CHECK_EQ(fwrite(&labels_[0], sizeof(float), labels_.size(), file_),
+        labels_.size()) << "Failed to write " << filename_;
+  }
+  CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+  CHECK_EQ(fwrite(&header_, sizeof(header_), 1, file_), 1)
+      << "Failed to write " << filename_;
+  CHECK_EQ(fclose(file_), 0) << "Failed to close " << filename_;
+  file_ = NULL;
+}
+
+void MmapTensorReader::Open(const string& filename) {
+  Close();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open " << filename << ": " << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << filename;
+  size_ = st.st_size;
+  CHECK_GE(size_, MmapTensorHeader::kSize) << filename
+      << " is not a raw tensor file.";
+  void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(data != MAP_FAILED) << "Failed to map " << filename << ": "
+      << strerror(errno);
+  data_ = static_cast<const char*>(data);
+  header_ = *reinterpret_cast<const MmapTensorHeader*>(data_);
+  CHECK_EQ(memcmp(header_.magic, kMagic, sizeof(kMagic)), 0) << filename
+      << " is not a raw tensor file.";
+  CHECK_EQ(header_.version, kVersion) << "Unsupported raw tensor version.";
+  CHECK_LE(header_.num_axes, MmapTensorHeader::kMaxAxes);
+  shape_.assign(header_.shape, header_.shape + header_.num_axes);
+  record_count_ = record_elements(header_);
+  record_bytes_ = record_count_ * mmap_tensor_type_size(type());
+  CHECK_GE(header_.label_offset,
+      header_.data_offset + header_.num * record_bytes_);
+  CHECK_LE(header_.label_offset + header_.num * sizeof(float), size_)
+      << filename << " is truncated.";
+  labels_ = reinterpret_cast<const float*>(data_ + header_.label_offset);
+}
+
+void MmapTensorReader::Close() {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+    data_ = NULL;
+    size_ = 0;
+  }
+}
+
+void MmapTensorReader::WillNeed(int begin, int end) const {
+  // madvise takes page-aligned addresses.
+  const uint64_t page = sysconf(_SC_PAGESIZE);
+  const uint64_t first = (record(begin) - data_) / page * page;
+  const uint64_t last = record(end) - data_;
+  madvise(const_cast<char*>(data_) + first, last - first, MADV_WILLNEED);
+}
+
+}  // namespace caffe
@@ -0,0 +1,180 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/util/solver_update.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Flat ranges smaller than this are updated on the calling thread, as waking
+// the pool would cost more than it saves.
+const int kParallelUpdateCount = 1 << 16;
+
+template <typename Dtype, bool kL1>
+inline Dtype regularized_gradient(const SolverParamUpdate<Dtype>& p, int i) {
+  const Dtype w = p.data[i];
+  const Dtype r = kL1 ? Dtype((Dtype(0) < w) - (w < Dtype(0))) : w;
+  return p.decay * r + p.normalization * p.diff[i];
+}
+
+// Each rule below matches the unfused ComputeUpdateValue of its solver.
+template <typename Dtype, bool kL1>
+void sgd_update(const SolverParamUpdate<Dtype>& p, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = regularized_gradient<Dtype, kL1>(p, i);
+    const Dtype h = p.momentum * p.history[i] + p.rate * g;
+    p.history[i] = h;
+    p.diff[i] = h;
+    p.data[i] -= h;
+  }
+}
+
+template <typename Dtype, bool kL1>
+void nesterov_update(const SolverParamUpdate<Dtype>& p, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = regularized_gradient<Dtype, kL1>(p, i);
+    const Dtype h_old = p.history[i];
+    const Dtype h = p.momentum * h_old + p.rate * g;
+    // Step back, then over step.
+    const Dtype u = -p.momentum * h_old + (Dtype(1) + p.momentum) * h;
+    p.history[i] = h;
+    p.diff[i] = u;
+    p.data[i] -= u;
+  }
+}
+
+template <typename Dtype, bool kL1>
+void adagrad_update(const SolverParamUpdate<Dtype>& p, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = regularized_gradient<Dtype, kL1>(p, i);
+    const Dtype h = p.history[i] + g * g;
+    const Dtype u = p.rate * (g / (std::sqrt(h) + p.delta));
+    p.history[i] = h;
+    p.diff[i] = u;
+    p.data[i] -= u;
+  }
+}
+
+template <typename Dtype, bool kL1>
+void rmsprop_update(const SolverParamUpdate<Dtype>& p, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = regularized_gradient<Dtype, kL1>(p, i);
+    const Dtype h = p.rms_decay * p.history[i] +
+        (Dtype(1) - p.rms_decay) * g * g;
+    const Dtype u = p.rate * (g / (std::sqrt(h) + p.delta));
+    p.history[i] = h;
+    p.diff[i] = u;
+    p.data[i] -= u;
+  }
+}
+
+template <typename Dtype, bool kL1>
+void adadelta_update(const SolverParamUpdate<Dtype>& p, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = regularized_gradient<Dtype, kL1>(p, i);
+    const Dtype h = p.momentum * p.history[i] +
+        (Dtype(1) - p.momentum) * g * g;
+    const Dtype h2 = p.history2[i];
+    const Dtype u = g * std::sqrt((h2 + p.delta) / (h + p.delta));
+    p.history[i] = h;
+    p.history2[i] = p.momentum * h2 + (Dtype(1) - p.momentum) * u * u;
+    p.diff[i] = p.rate * u;
+    p.data[i] -= p.rate * u;
+  }
+}
+
+template <typename Dtype, bool kL1>
+void adam_update(const SolverParamUpdate<Dtype>& p, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = regularized_gradient<Dtype, kL1>(p, i);
+    const Dtype m = p.momentum * p.history[i] + (Dtype(1) - p.momentum) * g;
+    const Dtype v = p.momentum2 * p.history2[i] +
+        (Dtype(1) - p.momentum2) * g * g;
+    const Dtype u = p.rate * (m / (std::sqrt(v) + p.delta));
+    p.history[i] = m;
+    p.history2[i] = v;
+    p.diff[i] = u;
+    p.data[i] -= u;
+  }
+}
+
+template <typename Dtype, bool kL1>
+void update_range(SolverUpdateType type, const SolverParamUpdate<Dtype>& p,
+    int begin, int end) {
+  switch (type) {
+  case SGD_UPDATE:
+    sgd_update<Dtype, kL1>(p, begin, end);
+    break;
+  case NESTEROV_UPDATE:
+    nesterov_update<Dtype, kL1>(p, begin, end);
+    break;
+  case ADAGRAD_UPDATE:
+    adagrad_update<Dtype, kL1>(p, begin, end);
+    break;
+  case RMSPROP_UPDATE:
+    rmsprop_update<Dtype, kL1>(p, begin, end);
+    break;
+  case ADADELTA_UPDATE:
+    adadelta_update<Dtype, kL1>(p, begin, end);
+    break;
+  case ADAM_UPDATE:
+    adam_update<Dtype, kL1>(p, begin, end);
+    break;
+  default:
+    LOG(FATAL) << "Unknown solver update type: " << type;
+  }
+}
+
+// Updates the elements [begin, end) of the flat range, where param i starts
+// at offsets[i].
+template <typename Dtype>
+void update_params(SolverUpdateType type,
+    const vector<SolverParamUpdate<Dtype> >* params,
+    const vector<int>* offsets, int begin, int end) {
+  int param_id = std::upper_bound(offsets->begin(), offsets->end(), begin) -
+      offsets->begin() - 1;
+  for (; param_id < params->size() && (*offsets)[param_id] < end;
+       ++param_id) {
+    const SolverParamUpdate<Dtype>& p = (*params)[param_id];
+    const int offset = (*offsets)[param_id];
+    const int from = std::max(begin, offset) - offset;
+    const int to = std::min(end, offset + p.count) - offset;
+    if (p.l1) {
+      update_range<Dtype, true>(type, p, from, to);
+    } else {
+      update_range<Dtype, false>(type, p, from, to);
+    }
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_cpu_solver_update(SolverUpdateType type,
+    const vector<SolverParamUpdate<Dtype> >& params) {
+  vector<int> offsets(params.size());
+  int count = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    offsets[i] = count;
+    count += params[i].count;
+  }
+  if (count < kParallelUpdateCount) {
+    update_params(type, &params, &offsets, 0, count);
+    return;
+  }
+  // Elements are updated independently, so any split gives the same result.
+  caffe_parallel_for(count, boost::bind(&update_params<Dtype>, type, &params,
+      &offsets, _1, _2));
+}
+
+template void caffe_cpu_solver_update<float>(SolverUpdateType type,
+    const vector<SolverParamUpdate<float> >& params);
+template void caffe_cpu_solver_update<double>(SolverUpdateType type,
+    const vector<SolverParamUpdate<double> >& params);
+
+}  // namespace caffe
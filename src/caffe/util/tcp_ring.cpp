@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/tcp_ring.hpp"
+
+namespace caffe {
+
+void ParseHostPort(const string& host_port, string* host, int* port) {
+  const size_t colon = host_port.rfind(':');
+  CHECK(colon != string::npos && colon > 0 && colon + 1 < host_port.size())
+      << "Expected host:port, got " << host_port;
+  *host = host_port.substr(0, colon);
+  *port = atoi(host_port.c_str() + colon + 1);
+  CHECK(*port > 0 && *port < 65536) << "Bad port in " << host_port;
+}
+
+namespace {
+
+const int kConnectRetryMs = 100;
+
+void SetNoDelay(int fd) {
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)), 0)
+      << "Failed to set TCP_NODELAY: " << strerror(errno);
+}
+
+int Listen(int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0) << "Failed to create socket: " << strerror(errno);
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)), 0)
+      << "Failed to set SO_REUSEADDR: " << strerror(errno);
+  sockaddr_in addr;
+  caffe_memset(sizeof(addr), 0, &addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+      << "Failed to bind port " << port << ": " << strerror(errno);
+  CHECK_EQ(listen(fd, 1), 0)
+      << "Failed to listen on port " << port << ": " << strerror(errno);
+  return fd;
+}
+
+// Connects to host_port, retrying while the other rank is not listening yet.
+int Connect(const string& host_port, int timeout_ms) {
+  string host;
+  int port;
+  ParseHostPort(host_port, &host, &port);
+  std::ostringstream service;
+  service << port;
+  addrinfo hints;
+  caffe_memset(sizeof(hints), 0, &hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* info = NULL;
+  const int error = getaddrinfo(host.c_str(), service.str().c_str(), &hints,
+      &info);
+  CHECK_EQ(error, 0) << "Failed to resolve " << host << ": "
+      << gai_strerror(error);
+  for (int waited = 0; ; waited += kConnectRetryMs) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "Failed to create socket: " << strerror(errno);
+    if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) {
+      freeaddrinfo(info);
+      return fd;
+    }
+    const int connect_errno = errno;
+    close(fd);
+    CHECK_LT(waited, timeout_ms) << "Failed to connect to " << host_port
+        << ": " << strerror(connect_errno);
+    usleep(kConnectRetryMs * 1000);
+  }
+}
+
+int Accept(int listen_fd, int timeout_ms) {
+  pollfd fd;
+  fd.fd = listen_fd;
+  fd.events = POLLIN;
+  int ready;
+  do {
+    ready = poll(&fd, 1, timeout_ms);
+  } while (ready < 0 && errno == EINTR);
+  CHECK_GT(ready, 0) << "No connection from the previous rank";
+  const int connection = accept(listen_fd, NULL, NULL);
+  CHECK_GE(connection, 0) << "Failed to accept: " << strerror(errno);
+  return connection;
+}
+
+}  // namespace
+
+TCPRing::TCPRing(const vector<string>& hosts, int rank,
+    int connect_timeout_ms)
+    : rank_(rank), size_(hosts.size()), next_fd_(-1), prev_fd_(-1) {
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, size_) << "Rank " << rank << " is not in the host list";
+  if (size_ == 1) {
+    return;
+  }
+  string host;
+  int port;
+  ParseHostPort(hosts[rank], &host, &port);
+  // Listen first, so that the previous rank can connect while this one
+  // waits for the next.
+  const int listen_fd = Listen(port);
+  next_fd_ = Connect(hosts[(rank + 1) % size_], connect_timeout_ms);
+  prev_fd_ = Accept(listen_fd, connect_timeout_ms);
+  close(listen_fd);
+  SetNoDelay(next_fd_);
+  SetNoDelay(prev_fd_);
+  // Check that all ranks were given the same ring.
+  const int32_t self = rank_;
+  int32_t prev = -1;
+  SendRecv(reinterpret_cast<const char*>(&self), sizeof(self),
+      reinterpret_cast<char*>(&prev), sizeof(prev));
+  CHECK_EQ(prev, (rank_ + size_ - 1) % size_)
+      << "Ranks were started with different host lists";
+  LOG(INFO) << "Rank " << rank_ << " of " << size_ << " connected to "
+            << hosts[(rank + 1) % size_];
+}
+
+TCPRing::~TCPRing() {
+  if (next_fd_ >= 0) {
+    close(next_fd_);
+  }
+  if (prev_fd_ >= 0) {
+    close(prev_fd_);
+  }
+}
+
+void TCPRing::SendRecv(const char* send, size_t send_bytes, char* recv,
+    size_t recv_bytes) {
+  size_t sent = 0;
+  size_t received = 0;
+  while (sent < send_bytes || received < recv_bytes) {
+    pollfd fds[2];
+    int num_fds = 0;
+    if (sent < send_bytes) {
+      fds[num_fds].fd = next_fd_;
+      fds[num_fds++].events = POLLOUT;
+    }
+    if (received < recv_bytes) {
+      fds[num_fds].fd = prev_fd_;
+      fds[num_fds++].events = POLLIN;
+    }
+    const int ready = poll(fds, num_fds, -1);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(ready, 0) << "Failed to poll the ring: " << strerror(errno);
+    for (int i = 0; i < num_fds; ++i) {
+      if (!fds[i].revents) {
+        continue;
+      }
+      const bool sending = fds[i].events == POLLOUT;
+      const ssize_t bytes = sending ?
+          ::send(next_fd_, send + sent, send_bytes - sent,
+              MSG_DONTWAIT | MSG_NOSIGNAL) :
+          ::recv(prev_fd_, recv + received, recv_bytes - received,
+              MSG_DONTWAIT);
+      if (bytes < 0 &&
+          (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        continue;
+      }
+      CHECK_GT(bytes, 0) << "Lost the connection to rank "
+          << (sending ? (rank_ + 1) % size_ : (rank_ + size_ - 1) % size_)
+          << (bytes < 0 ? string(": ") + strerror(errno) : string());
+      (sending ? sent : received) += bytes;
+    }
+  }
+}
+
+template <typename Dtype>
+void TCPRing::AllreduceSum(Dtype* data, int count) {
+  if (size_ == 1 || count == 0) {
+    return;
+  }
+  // Chunk i holds [begin[i], begin[i + 1]).
+  vector<int> begin(size_ + 1);
+  for (int i = 0; i <= size_; ++i) {
+    begin[i] = static_cast<int64_t>(count) * i / size_;
+  }
+  buffer_.resize((count / size_ + 1) * sizeof(Dtype));
+  Dtype* received = reinterpret_cast<Dtype*>(&buffer_[0]);
+  // Reduce-scatter: at step s, pass on chunk rank - s and add the previous
+  // rank's partial sum of chunk rank - s - 1. Chunk rank + 1 is then summed
+  // over all ranks.
+  for (int s = 0; s < size_ - 1; ++s) {
+    const int send_chunk = (rank_ - s + size_) % size_;
+    const int recv_chunk = (rank_ - s - 1 + size_) % size_;
+    const int recv_count = begin[recv_chunk + 1] - begin[recv_chunk];
+    SendRecv(reinterpret_cast<const char*>(data + begin[send_chunk]),
+        (begin[send_chunk + 1] - begin[send_chunk]) * sizeof(Dtype),
+        &buffer_[0], recv_count * sizeof(Dtype));
+    if (recv_count > 0) {
+      caffe_add(recv_count, received, data + begin[recv_chunk],
+          data + begin[recv_chunk]);
+    }
+  }
+  // Allgather: pass the summed chunks on around the ring.
+  for (int s = 0; s < size_ - 1; ++s) {
+    const int send_chunk = (rank_ - s + 1 + size_) % size_;
+    const int recv_chunk = (rank_ - s + size_) % size_;
+    SendRecv(reinterpret_cast<const char*>(data + begin[send_chunk]),
+        (begin[send_chunk + 1] - begin[send_chunk]) * sizeof(Dtype),
+        reinterpret_cast<char*>(data + begin[recv_chunk]),
+        (begin[recv_chunk + 1] - begin[recv_chunk]) * sizeof(Dtype));
+  }
+}
+
+template <typename Dtype>
+void TCPRing::Broadcast(Dtype* data, int count) {
+  if (size_ == 1 || count == 0) {
+    return;
+  }
+  const size_t bytes = count * sizeof(Dtype);
+  if (rank_ != 0) {
+    SendRecv(NULL, 0, reinterpret_cast<char*>(data), bytes);
+  }
+  if (rank_ != size_ - 1) {
+    SendRecv(reinterpret_cast<const char*>(data), bytes, NULL, 0);
+  }
+}
+
+template void TCPRing::AllreduceSum<float>(float* data, int count);
+template void TCPRing::AllreduceSum<double>(double* data, int count);
+template void TCPRing::Broadcast<float>(float* data, int count);
+template void TCPRing::Broadcast<double>(double* data, int count);
+
+}  // namespace caffe
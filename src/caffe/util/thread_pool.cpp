@@ -0,0 +1,177 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable work_;
+  boost::condition_variable done_;
+  // Held by the thread that currently owns the workers.
+  boost::mutex run_mutex_;
+};
+
+// Set on pool workers and on a caller while it runs a ParallelFor, so that
+// nested calls fall back to a serial loop instead of waiting on themselves.
+static boost::thread_specific_ptr<bool> in_parallel_region_;
+
+static bool InParallelRegion() {
+  return in_parallel_region_.get() && *in_parallel_region_;
+}
+
+static void SetInParallelRegion(bool value) {
+  if (!in_parallel_region_.get()) {
+    in_parallel_region_.reset(new bool(false));
+  }
+  *in_parallel_region_ = value;
+}
+
+// The pool installed by the innermost ScopedThreadPool on each thread. The
+// cleanup function is a no-op since the pools are owned elsewhere.
+static void KeepPool(ThreadPool* pool) {}
+static boost::thread_specific_ptr<ThreadPool> current_pool_(&KeepPool);
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(std::max(num_threads, 1)), sync_(new sync()),
+      body_(NULL), n_(0), num_chunks_(0), next_chunk_(0), pending_(0),
+      stop_(false) {
+  // The calling thread works on a share of every loop itself.
+  for (int i = 1; i < num_threads_; ++i) {
+    try {
+      workers_.push_back(shared_ptr<boost::thread>(
+          new boost::thread(&ThreadPool::WorkerEntry, this)));
+    } catch (std::exception& e) {
+      LOG(FATAL) << "Thread exception: " << e.what();
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    stop_ = true;
+  }
+  sync_->work_.notify_all();
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->join();
+  }
+}
+
+void ThreadPool::WorkerEntry() {
+  SetInParallelRegion(true);
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (!stop_ && next_chunk_ >= num_chunks_) {
+        sync_->work_.wait(lock);
+      }
+      if (stop_) {
+        return;
+      }
+    }
+    RunChunks();
+  }
+}
+
+void ThreadPool::RunChunks() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (next_chunk_ < num_chunks_) {
+    const int chunk = next_chunk_++;
+    const int begin = static_cast<int>(
+        static_cast<int64_t>(n_) * chunk / num_chunks_);
+    const int end = static_cast<int>(
+        static_cast<int64_t>(n_) * (chunk + 1) / num_chunks_);
+    const boost::function<void(int, int)>& body = *body_;
+    lock.unlock();
+    body(begin, end);
+    lock.lock();
+    if (--pending_ == 0) {
+      sync_->done_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::ParallelFor(int n,
+    const boost::function<void(int, int)>& body) {
+  if (n <= 0) {
+    return;
+  }
+  if (num_threads_ == 1 || n == 1 || InParallelRegion() ||
+      !sync_->run_mutex_.try_lock()) {
+    body(0, n);
+    return;
+  }
+  SetInParallelRegion(true);
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    body_ = &body;
+    n_ = n;
+    num_chunks_ = std::min(n, num_threads_);
+    next_chunk_ = 0;
+    pending_ = num_chunks_;
+  }
+  sync_->work_.notify_all();
+  RunChunks();
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    while (pending_ > 0) {
+      sync_->done_.wait(lock);
+    }
+    body_ = NULL;
+    num_chunks_ = 0;
+    next_chunk_ = 0;
+  }
+  SetInParallelRegion(false);
+  sync_->run_mutex_.unlock();
+}
+
+static shared_ptr<ThreadPool> global_pool_;
+static boost::mutex global_pool_mutex_;
+
+shared_ptr<ThreadPool> ThreadPool::Global() {
+  boost::mutex::scoped_lock lock(global_pool_mutex_);
+  if (!global_pool_) {
+    global_pool_.reset(new ThreadPool(boost::thread::hardware_concurrency()));
+  }
+  return global_pool_;
+}
+
+void ThreadPool::SetGlobalThreads(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = boost::thread::hardware_concurrency();
+  }
+  boost::mutex::scoped_lock lock(global_pool_mutex_);
+  if (!global_pool_ || global_pool_->num_threads() != num_threads) {
+    global_pool_.reset(new ThreadPool(num_threads));
+  }
+}
+
+shared_ptr<ThreadPool> ThreadPool::Current() {
+  ThreadPool* pool = current_pool_.get();
+  return pool ? shared_ptr<ThreadPool>(pool, &KeepPool) : Global();
+}
+
+ScopedThreadPool::ScopedThreadPool(ThreadPool* pool)
+    : previous_pool_(current_pool_.get()),
+      previous_in_parallel_region_(InParallelRegion()) {
+  current_pool_.reset(pool);
+  SetInParallelRegion(false);
+}
+
+ScopedThreadPool::~ScopedThreadPool() {
+  current_pool_.reset(previous_pool_);
+  SetInParallelRegion(previous_in_parallel_region_);
+}
+
+void caffe_parallel_for(int n, const boost::function<void(int, int)>& body) {
+  // Keeps the pool alive for the whole loop.
+  const shared_ptr<ThreadPool> pool = ThreadPool::Current();
+  pool->ParallelFor(n, body);
+}
+
+}  // namespace caffe
@@ -30,6 +30,22 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(cpu_workers, 1,
+    "Optional; the number of solver replicas to train with in parallel in "
+    "CPU mode, each on its share of the threads. The effective training "
+    "batch size is multiplied by the number of workers. The train net's "
+    "params are flattened (see NetParameter.flat_params) either way.");
+DEFINE_string(hosts, "",
+    "Optional; train in CPU mode on several processes, possibly on "
+    "different machines, given as the host:port of every rank separated by "
+    "','. Each rank should read its own data, e.g. picked with -stage. The "
+    "effective training batch size is multiplied by the number of ranks.");
+DEFINE_int32(rank, 0,
+    "Optional; the rank of this process in -hosts. Only rank 0 tests and "
+    "snapshots.");
+DEFINE_int32(allreduce_bucket_kb, 4096,
+    "Optional; with -hosts, the size of the blocks of gradients summed "
+    "across ranks while the backward pass goes on.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -127,6 +143,15 @@ vector<string> get_stages_from_flags() {
   return stages;
 }
 
+// Parse the hosts of a distributed run from the command line.
+vector<string> get_hosts_from_flags() {
+  vector<string> hosts;
+  if (FLAGS_hosts.size()) {
+    boost::split(hosts, FLAGS_hosts, boost::is_any_of(","));
+  }
+  return hosts;
+}
+
 // caffe commands to call by
 //     caffe <command> <args>
 //
@@ -182,10 +207,26 @@ int train() {
   CHECK(!FLAGS_snapshot.size() || !FLAGS_weights.size())
       << "Give a snapshot to resume training or weights to finetune "
       "but not both.";
+  CHECK_GE(FLAGS_cpu_workers, 1) << "Need at least one CPU worker.";
+  CHECK_GT(FLAGS_allreduce_bucket_kb, 0);
   vector<string> stages = get_stages_from_flags();
+  vector<string> hosts = get_hosts_from_flags();
 
   caffe::SolverParameter solver_param;
   caffe::ReadSolverParamsFromTextFileOrDie(FLAGS_solver, &solver_param);
+  if (hosts.size() > 1) {
+    CHECK_EQ(FLAGS_cpu_workers, 1) << "Use either hosts or cpu_workers.";
+    if (FLAGS_rank > 0) {
+      // Every rank holds the same weights, so leave testing and
+      // snapshotting to rank 0.
+      solver_param.clear_test_net();
+      solver_param.clear_test_net_param();
+      solver_param.clear_test_state();
+      solver_param.clear_test_iter();
+      solver_param.set_snapshot(0);
+      solver_param.set_snapshot_after_train(false);
+    }
+  }
 
   solver_param.mutable_train_state()->set_level(FLAGS_level);
   for (int i = 0; i < stages.size(); i++) {
@@ -209,7 +250,10 @@ int train() {
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(FLAGS_cpu_workers);
   } else {
+    CHECK_EQ(FLAGS_cpu_workers, 1) << "cpu_workers is for CPU mode only.";
+    CHECK_LE(hosts.size(), 1) << "hosts is for CPU mode only.";
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
       s << (i ? ", " : "") << gpus[i];
@@ -247,6 +291,13 @@ int train() {
   if (gpus.size() > 1) {
     caffe::P2PSync<float> sync(solver, NULL, solver->param());
     sync.Run(gpus);
+  } else if (hosts.size() > 1) {
+    caffe::TCPSync<float> sync(solver, hosts, FLAGS_rank,
+        FLAGS_allreduce_bucket_kb * 1024);
+    sync.Run();
+  } else if (FLAGS_cpu_workers > 1) {
+    caffe::CPUSync<float> sync(solver);
+    sync.Run(FLAGS_cpu_workers);
   } else {
     LOG(INFO) << "Starting Optimization";
     solver->Solve();
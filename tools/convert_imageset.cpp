@@ -1,5 +1,6 @@
 // This program converts a set of images to a lmdb/leveldb by storing them
-// as Datum proto buffers.
+// as Datum proto buffers. Images are read, resized and encoded by a pool of
+// threads, one chunk ahead of the writer, which stores them in list order.
 // Usage:
 //   convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME
 //
@@ -14,7 +15,10 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
@@ -23,6 +27,7 @@
 #include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
@@ -32,6 +37,8 @@ DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
+DEFINE_int32(shuffle_seed, -1,
+    "Optional: seed for --shuffle, to make the order reproducible");
 DEFINE_string(backend, "lmdb",
         "The backend {lmdb, leveldb} for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
@@ -42,6 +49,66 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_int32(threads, 0,
+    "Number of threads reading and encoding images; 0 uses every core");
+DEFINE_int32(commit_size, 1000,
+    "Number of images written per database transaction");
+
+#ifdef USE_OPENCV
+// An image of the list, ready to be written
+struct Record {
+  bool status;
+  string key;
+  string value;
+  // The expected data size of the first image, when checking sizes
+  int data_size;
+  size_t stored_size;
+};
+
+// Reads, resizes and encodes lines [first + begin, first + end) of the list
+// into records [begin, end).
+void ReadRecords(const std::vector<std::pair<std::string, int> >* lines,
+    const string* root_folder, int first, std::vector<Record>* records,
+    int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const int line_id = first + i;
+    const string& fn = (*lines)[line_id].first;
+    Record* record = &(*records)[i];
+    std::string enc = FLAGS_encode_type;
+    if (FLAGS_encoded && !enc.size()) {
+      // Guess the encoding type from the file name
+      size_t p = fn.rfind('.');
+      if ( p == fn.npos )
+        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+      enc = fn.substr(p);
+      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+    }
+    Datum datum;
+    record->status = ReadImageToDatum(*root_folder + fn,
+        (*lines)[line_id].second, std::max<int>(0, FLAGS_resize_height),
+        std::max<int>(0, FLAGS_resize_width), !FLAGS_gray, enc, &datum);
+    if (record->status == false) continue;
+    record->data_size = datum.channels() * datum.height() * datum.width();
+    record->stored_size = datum.data().size();
+    // sequential
+    record->key = caffe::format_int(line_id, 8) + "_" + fn;
+    CHECK(datum.SerializeToString(&record->value));
+  }
+}
+
+// Fills records with the chunk of lines starting at first.
+void ReadChunk(ThreadPool* pool,
+    const std::vector<std::pair<std::string, int> >* lines,
+    const string* root_folder, int first, std::vector<Record>* records) {
+  pool->ParallelFor(records->size(), boost::bind(&ReadRecords, lines,
+      root_folder, first, records, _1, _2));
+}
+
+double ElapsedSeconds(const boost::posix_time::ptime& start) {
+  return (boost::posix_time::microsec_clock::local_time() - start)
+      .total_milliseconds() / 1000.;
+}
+#endif  // USE_OPENCV
 
 int main(int argc, char** argv) {
 #ifdef USE_OPENCV
@@ -66,10 +133,11 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const bool is_color = !FLAGS_gray;
   const bool check_size = FLAGS_check_size;
   const bool encoded = FLAGS_encoded;
   const string encode_type = FLAGS_encode_type;
+  const int commit_size = FLAGS_commit_size;
+  CHECK_GT(commit_size, 0);
 
   std::ifstream infile(argv[2]);
   std::vector<std::pair<std::string, int> > lines;
@@ -84,6 +152,9 @@ int main(int argc, char** argv) {
   if (FLAGS_shuffle) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
+    if (FLAGS_shuffle_seed >= 0) {
+      Caffe::set_random_seed(FLAGS_shuffle_seed);
+    }
     shuffle(lines.begin(), lines.end());
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
@@ -91,9 +162,6 @@ int main(int argc, char** argv) {
   if (encode_type.size() && !encoded)
     LOG(INFO) << "encode_type specified, assuming encoded=true.";
 
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
-
   // Create new DB
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
   db->Open(argv[3], db::NEW);
@@ -101,57 +169,70 @@ int main(int argc, char** argv) {
 
   // Storing to db
   std::string root_folder(argv[1]);
-  Datum datum;
+  const int num_threads = FLAGS_threads > 0 ?
+      FLAGS_threads : boost::thread::hardware_concurrency();
+  ThreadPool pool(num_threads);
+  LOG(INFO) << "Reading images with " << pool.num_threads() << " threads.";
+  // Records do not depend on the thread that reads them, so the database is
+  // the same for any number of threads.
+  const int chunk_size = std::max(commit_size, 16 * pool.num_threads());
+  std::vector<Record> chunks[2];
+  chunks[0].resize(std::min<size_t>(chunk_size, lines.size()));
+  ReadChunk(&pool, &lines, &root_folder, 0, &chunks[0]);
   int count = 0;
   int data_size = 0;
   bool data_size_initialized = false;
-
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::local_time();
+
+  for (int first = 0; first < lines.size(); first += chunk_size) {
+    const int chunk = first / chunk_size;
+    const std::vector<Record>& records = chunks[chunk % 2];
+    // Read the next chunk while this one is written.
+    std::vector<Record>* next_records = &chunks[(chunk + 1) % 2];
+    const int next = first + chunk_size;
+    scoped_ptr<boost::thread> reader;
+    if (next < lines.size()) {
+      next_records->resize(std::min<size_t>(chunk_size, lines.size() - next));
+      reader.reset(new boost::thread(&ReadChunk, &pool, &lines, &root_folder,
+          next, next_records));
     }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
-    if (status == false) continue;
-    if (check_size) {
-      if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
-        data_size_initialized = true;
-      } else {
-        const std::string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+    for (int i = 0; i < records.size(); ++i) {
+      const Record& record = records[i];
+      if (record.status == false) continue;
+      if (check_size) {
+        if (!data_size_initialized) {
+          data_size = record.data_size;
+          data_size_initialized = true;
+        } else {
+          CHECK_EQ(record.stored_size, data_size)
+              << "Incorrect data field size " << record.stored_size;
+        }
+      }
+
+      // Put in db
+      txn->Put(record.key, record.value);
+
+      if (++count % commit_size == 0) {
+        // Commit db
+        txn->Commit();
+        txn.reset(db->NewTransaction());
+        LOG(INFO) << "Processed " << count << " files ("
+                  << count / ElapsedSeconds(start) << " files/s).";
       }
     }
-    // sequential
-    string key_str = caffe::format_int(line_id, 8) + "_" + lines[line_id].first;
-
-    // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(key_str, out);
-
-    if (++count % 1000 == 0) {
-      // Commit db
-      txn->Commit();
-      txn.reset(db->NewTransaction());
-      LOG(INFO) << "Processed " << count << " files.";
+    if (reader) {
+      reader->join();
     }
   }
   // write the last batch
-  if (count % 1000 != 0) {
+  if (count % commit_size != 0) {
     txn->Commit();
     LOG(INFO) << "Processed " << count << " files.";
   }
+  const double seconds = ElapsedSeconds(start);
+  LOG(INFO) << "Wrote " << count << " of " << lines.size() << " images in "
+            << seconds << " s (" << count / seconds << " files/s).";
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
 #endif  // USE_OPENCV
@@ -0,0 +1,141 @@
+// This program converts a Datum database, or HDF5 files, to a raw tensor file
+// that MmapDataLayer reads in place.
+// Usage:
+//    convert_mmap_tensor [FLAGS] INPUT OUTPUT
+//
+// where INPUT is a leveldb/lmdb of Datums or, with --backend=hdf5, a text
+// file listing HDF5 files as for HDF5DataLayer. Datums holding uint8 data are
+// stored as uint8, all other records as float.
+
+#include <limits.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mmap_tensor.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
+
+DEFINE_string(backend, "lmdb",
+    "The input backend {lmdb, leveldb, hdf5}");
+DEFINE_string(data_name, "data", "The HDF5 dataset holding the records");
+DEFINE_string(label_name, "label", "The HDF5 dataset holding the labels");
+
+void ConvertDB(const string& input, const string& output) {
+  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  db->Open(input, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  CHECK(cursor->valid()) << "The database " << input << " is empty.";
+  MmapTensorWriter writer;
+  vector<int> shape;
+  MmapTensorType type = MMAP_TENSOR_UINT8;
+  int count = 0;
+  for (; cursor->valid(); cursor->Next()) {
+    Datum datum;
+    CHECK(datum.ParseFromString(cursor->value()));
+    if (datum.encoded()) {
+#ifdef USE_OPENCV
+      CHECK(DecodeDatumNative(&datum));
+#else
+      LOG(FATAL) << "Encoded Datums require OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+    }
+    if (shape.empty()) {
+      shape.push_back(datum.channels());
+      shape.push_back(datum.height());
+      shape.push_back(datum.width());
+      type = datum.data().size() ? MMAP_TENSOR_UINT8 : MMAP_TENSOR_FLOAT;
+      writer.Open(output, shape, type);
+    }
+    CHECK(datum.channels() == shape[0] && datum.height() == shape[1] &&
+        datum.width() == shape[2]) << "Records must have the same shape.";
+    const int size = shape[0] * shape[1] * shape[2];
+    if (type == MMAP_TENSOR_UINT8) {
+      CHECK_EQ(datum.data().size(), size) << "Incorrect data field size";
+      writer.Write(datum.data().data(), datum.label());
+    } else {
+      CHECK_EQ(datum.float_data_size(), size) << "Incorrect data field size";
+      writer.Write(datum.float_data().data(), datum.label());
+    }
+    if (++count % 10000 == 0) {
+      LOG(INFO) << "Processed " << count << " records.";
+    }
+  }
+  writer.Close();
+  LOG(INFO) << "Processed " << count << " records.";
+}
+
+void ConvertHDF5(const string& input, const string& output) {
+  std::ifstream source(input.c_str());
+  CHECK(source.is_open()) << "Failed to open source file " << input;
+  MmapTensorWriter writer;
+  vector<int> shape;
+  int count = 0;
+  string filename;
+  while (source >> filename) {
+    hid_t file_id = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    CHECK_GE(file_id, 0) << "Failed opening HDF5 file: " << filename;
+    Blob<float> data;
+    Blob<float> label;
+    hdf5_load_nd_dataset(file_id, FLAGS_data_name.c_str(), 1, INT_MAX, &data);
+    hdf5_load_nd_dataset(file_id, FLAGS_label_name.c_str(), 1, INT_MAX,
+        &label);
+    CHECK_GE(H5Fclose(file_id), 0) << "Failed to close HDF5 file: "
+                                   << filename;
+    CHECK_EQ(label.num(), data.num()) << "Records and labels differ in number.";
+    CHECK_EQ(label.count(), label.num()) << "Records need a single label.";
+    const vector<int> record_shape(data.shape().begin() + 1,
+        data.shape().end());
+    if (shape.empty()) {
+      shape = record_shape;
+      writer.Open(output, shape, MMAP_TENSOR_FLOAT);
+    }
+    CHECK(record_shape == shape) << "Records must have the same shape.";
+    const int size = data.count(1);
+    for (int i = 0; i < data.num(); ++i) {
+      writer.Write(data.cpu_data() + i * size, label.cpu_data()[i]);
+    }
+    count += data.num();
+    LOG(INFO) << "Processed " << count << " records.";
+  }
+  CHECK(!shape.empty()) << "No HDF5 files listed in " << input;
+  writer.Close();
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert a Datum database or HDF5 files to a raw\n"
+        "tensor file for MmapDataLayer.\n"
+        "Usage:\n"
+        "    convert_mmap_tensor [FLAGS] INPUT OUTPUT\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_mmap_tensor");
+    return 1;
+  }
+  if (FLAGS_backend == "hdf5") {
+    ConvertHDF5(argv[1], argv[2]);
+  } else {
+    ConvertDB(argv[1], argv[2]);
+  }
+  return 0;
+}
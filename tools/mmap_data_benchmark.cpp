@@ -0,0 +1,85 @@
+// Times DataLayer on a Datum database against MmapDataLayer on the same
+// records converted by convert_mmap_tensor, and reports records per second.
+//
+// Usage:
+//    mmap_data_benchmark [FLAGS] DB RAW_FILE
+
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/data_layer.hpp"
+#include "caffe/layers/mmap_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(backend, "lmdb", "The backend {lmdb, leveldb} of DB");
+DEFINE_int32(batch_size, 64, "Number of records per batch.");
+DEFINE_int32(iterations, 200, "Number of timed batches per layer.");
+DEFINE_double(scale, 1, "Scale applied by both layers; 1 leaves records "
+    "untransformed, letting MmapDataLayer read them in place.");
+
+void Benchmark(const string& name, Layer<float>* layer) {
+  Blob<float> data;
+  Blob<float> label;
+  vector<Blob<float>*> bottom;
+  vector<Blob<float>*> top;
+  top.push_back(&data);
+  top.push_back(&label);
+  layer->SetUp(bottom, top);
+  // The first batch includes the prefetch start-up.
+  layer->Forward(bottom, top);
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer->Forward(bottom, top);
+  }
+  timer.Stop();
+  LOG(INFO) << name << ": " << FLAGS_iterations * FLAGS_batch_size /
+      (timer.MilliSeconds() / 1000.) << " records/s";
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Benchmark MmapDataLayer against DataLayer.\n"
+      "Usage:\n"
+      "    mmap_data_benchmark [FLAGS] DB RAW_FILE\n");
+  caffe::GlobalInit(&argc, &argv);
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/mmap_data_benchmark");
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+
+  LayerParameter data_param;
+  data_param.set_phase(TRAIN);
+  data_param.mutable_transform_param()->set_scale(FLAGS_scale);
+  data_param.mutable_data_param()->set_source(argv[1]);
+  data_param.mutable_data_param()->set_batch_size(FLAGS_batch_size);
+  data_param.mutable_data_param()->set_backend(FLAGS_backend == "leveldb" ?
+      DataParameter_DB_LEVELDB : DataParameter_DB_LMDB);
+  {
+    DataLayer<float> layer(data_param);
+    Benchmark("DataLayer", &layer);
+  }
+
+  LayerParameter mmap_param;
+  mmap_param.set_phase(TRAIN);
+  mmap_param.mutable_transform_param()->set_scale(FLAGS_scale);
+  mmap_param.mutable_mmap_data_param()->set_source(argv[2]);
+  mmap_param.mutable_mmap_data_param()->set_batch_size(FLAGS_batch_size);
+  {
+    MmapDataLayer<float> layer(mmap_param);
+    Benchmark("MmapDataLayer", &layer);
+    LOG(INFO) << "MmapDataLayer read the records in place: "
+              << (layer.zero_copy() ? "yes" : "no");
+  }
+  return 0;
+}
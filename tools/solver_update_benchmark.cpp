@@ -0,0 +1,164 @@
+// Times a solver step on synthetic params, done as the separate passes of
+// Normalize, Regularize, ComputeUpdateValue and Net::Update, against the
+// fused caffe_cpu_solver_update, and reports milliseconds per step and the
+// bandwidth of the fused kernel.
+//
+// Usage:
+//    solver_update_benchmark [FLAGS]
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/solver_update.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(type, "SGD", "The solver rule {SGD, Adam}.");
+DEFINE_int32(params, 100, "Number of learnable params.");
+DEFINE_int32(param_count, 100000, "Number of elements per param.");
+DEFINE_int32(iterations, 50, "Number of timed steps per method.");
+
+const float kRate = 0.01;
+const float kMomentum = 0.9;
+const float kMomentum2 = 0.999;
+const float kDecay = 0.0005;
+const float kDelta = 1e-8;
+
+// The CPU passes of the solver before the fused kernel.
+void UnfusedStep(const vector<shared_ptr<Blob<float> > >& params,
+    const vector<shared_ptr<Blob<float> > >& history,
+    const vector<shared_ptr<Blob<float> > >& temp) {
+  const int num_params = params.size();
+  for (int i = 0; i < num_params; ++i) {
+    const int n = params[i]->count();
+    Blob<float>* param = params[i].get();
+    // Normalize and Regularize.
+    caffe_scal(n, 0.5f, param->mutable_cpu_diff());
+    caffe_axpy(n, kDecay, param->cpu_data(), param->mutable_cpu_diff());
+    if (FLAGS_type == "SGD") {
+      caffe_cpu_axpby(n, kRate, param->cpu_diff(), kMomentum,
+          history[i]->mutable_cpu_data());
+      caffe_copy(n, history[i]->cpu_data(), param->mutable_cpu_diff());
+    } else {
+      Blob<float>* m = history[i].get();
+      Blob<float>* v = history[i + num_params].get();
+      Blob<float>* t = temp[i].get();
+      caffe_cpu_axpby(n, 1 - kMomentum, param->cpu_diff(), kMomentum,
+          m->mutable_cpu_data());
+      caffe_mul(n, param->cpu_diff(), param->cpu_diff(),
+          t->mutable_cpu_data());
+      caffe_cpu_axpby(n, 1 - kMomentum2, t->cpu_data(), kMomentum2,
+          v->mutable_cpu_data());
+      caffe_powx(n, v->cpu_data(), 0.5f, t->mutable_cpu_data());
+      caffe_add_scalar(n, kDelta, t->mutable_cpu_data());
+      caffe_div(n, m->cpu_data(), t->cpu_data(), t->mutable_cpu_data());
+      caffe_cpu_scale(n, kRate, t->cpu_data(), param->mutable_cpu_diff());
+    }
+  }
+  // Net::Update.
+  for (int i = 0; i < num_params; ++i) {
+    params[i]->Update();
+  }
+}
+
+void FusedStep(const vector<shared_ptr<Blob<float> > >& params,
+    const vector<shared_ptr<Blob<float> > >& history) {
+  const int num_params = params.size();
+  vector<SolverParamUpdate<float> > updates(num_params);
+  for (int i = 0; i < num_params; ++i) {
+    SolverParamUpdate<float>& update = updates[i];
+    update.count = params[i]->count();
+    update.data = params[i]->mutable_cpu_data();
+    update.diff = params[i]->mutable_cpu_diff();
+    update.history = history[i]->mutable_cpu_data();
+    update.history2 = FLAGS_type == "SGD" ? NULL :
+        history[i + num_params]->mutable_cpu_data();
+    update.normalization = 0.5f;
+    update.decay = kDecay;
+    update.l1 = false;
+    update.rate = kRate;
+    update.momentum = kMomentum;
+    update.momentum2 = kMomentum2;
+    update.rms_decay = 0;
+    update.delta = kDelta;
+  }
+  caffe_cpu_solver_update(FLAGS_type == "SGD" ? SGD_UPDATE : ADAM_UPDATE,
+      updates);
+}
+
+double Benchmark(const string& name, bool fused,
+    const vector<shared_ptr<Blob<float> > >& params,
+    const vector<shared_ptr<Blob<float> > >& history,
+    const vector<shared_ptr<Blob<float> > >& temp) {
+  CPUTimer timer;
+  double milliseconds = 0;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    // Stand-in for the backward pass, which leaves fresh gradients.
+    for (int j = 0; j < params.size(); ++j) {
+      caffe_set(params[j]->count(), 1e-3f, params[j]->mutable_cpu_diff());
+    }
+    timer.Start();
+    if (fused) {
+      FusedStep(params, history);
+    } else {
+      UnfusedStep(params, history, temp);
+    }
+    timer.Stop();
+    milliseconds += timer.MilliSeconds();
+  }
+  milliseconds /= FLAGS_iterations;
+  LOG(INFO) << name << ": " << milliseconds << " ms/step";
+  return milliseconds;
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Benchmark the fused solver update against the "
+      "separate passes of the solvers.\n"
+      "Usage:\n"
+      "    solver_update_benchmark [FLAGS]\n");
+  caffe::GlobalInit(&argc, &argv);
+  CHECK(FLAGS_type == "SGD" || FLAGS_type == "Adam")
+      << "Unknown solver type: " << FLAGS_type;
+  Caffe::set_mode(Caffe::CPU);
+
+  const int num_histories = FLAGS_type == "SGD" ? 1 : 2;
+  FillerParameter filler_param;
+  filler_param.set_std(0.01);
+  GaussianFiller<float> filler(filler_param);
+  vector<int> shape(1, FLAGS_param_count);
+  vector<shared_ptr<Blob<float> > > params;
+  vector<shared_ptr<Blob<float> > > history;
+  vector<shared_ptr<Blob<float> > > temp;
+  for (int i = 0; i < FLAGS_params; ++i) {
+    params.push_back(shared_ptr<Blob<float> >(new Blob<float>(shape)));
+    filler.Fill(params.back().get());
+    temp.push_back(shared_ptr<Blob<float> >(new Blob<float>(shape)));
+  }
+  for (int i = 0; i < num_histories * FLAGS_params; ++i) {
+    history.push_back(shared_ptr<Blob<float> >(new Blob<float>(shape)));
+    caffe_set(FLAGS_param_count, 0.f, history.back()->mutable_cpu_data());
+  }
+  // Warm up both paths, so that all memory is touched before timing.
+  FusedStep(params, history);
+  UnfusedStep(params, history, temp);
+
+  const double unfused = Benchmark("Separate passes", false, params, history,
+      temp);
+  const double fused = Benchmark("Fused update", true, params, history, temp);
+  // The fused kernel reads and writes data, diff and the histories once.
+  const double bytes = 2. * (2 + num_histories) * sizeof(float) *
+      FLAGS_params * FLAGS_param_count;
+  LOG(INFO) << "Speedup: " << unfused / fused << "x, fused bandwidth "
+            << bytes / (fused / 1000.) / 1e9 << " GB/s";
+  return 0;
+}
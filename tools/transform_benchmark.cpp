@@ -0,0 +1,185 @@
+// Times DataTransformer::Transform on uint8 and float Datums for every mirror
+// and mean mode against the straightforward per-pixel loop, reports images
+// per second, and checks that both produce identical outputs.
+//
+// Usage:
+//    transform_benchmark [--channels=3] [--size=256] [--crop_size=227]
+//        [--iterations=200]
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(channels, 3, "Number of image channels.");
+DEFINE_int32(size, 256, "Height and width of the stored images.");
+DEFINE_int32(crop_size, 227, "Crop size; 0 transforms whole images.");
+DEFINE_int32(iterations, 200, "Number of timed transforms per mode.");
+
+// The per-pixel loop the transformer used before, kept as the baseline. Crops
+// are taken from the center, as the transformer does at TEST time.
+void ReferenceTransform(const TransformationParameter& param,
+    const Blob<float>& mean_blob, const Datum& datum, bool do_mirror,
+    float* transformed_data) {
+  const string& data = datum.data();
+  const int datum_channels = datum.channels();
+  const int datum_height = datum.height();
+  const int datum_width = datum.width();
+  const int crop_size = param.crop_size();
+  const float scale = param.scale();
+  const bool has_mean_file = param.has_mean_file();
+  const bool has_uint8 = data.size() > 0;
+  const bool has_mean_values = param.mean_value_size() > 0;
+  const float* mean = mean_blob.cpu_data();
+  const int height = crop_size ? crop_size : datum_height;
+  const int width = crop_size ? crop_size : datum_width;
+  const int h_off = (datum_height - height) / 2;
+  const int w_off = (datum_width - width) / 2;
+  for (int c = 0; c < datum_channels; ++c) {
+    for (int h = 0; h < height; ++h) {
+      for (int w = 0; w < width; ++w) {
+        const int data_index =
+            (c * datum_height + h_off + h) * datum_width + w_off + w;
+        int top_index;
+        if (do_mirror) {
+          top_index = (c * height + h) * width + (width - 1 - w);
+        } else {
+          top_index = (c * height + h) * width + w;
+        }
+        float datum_element;
+        if (has_uint8) {
+          datum_element =
+            static_cast<float>(static_cast<uint8_t>(data[data_index]));
+        } else {
+          datum_element = datum.float_data(data_index);
+        }
+        if (has_mean_file) {
+          transformed_data[top_index] =
+            (datum_element - mean[data_index]) * scale;
+        } else if (has_mean_values) {
+          transformed_data[top_index] =
+            (datum_element - param.mean_value(c)) * scale;
+        } else {
+          transformed_data[top_index] = datum_element * scale;
+        }
+      }
+    }
+  }
+}
+
+void Benchmark(const string& name, const TransformationParameter& param,
+    const Blob<float>& mean_blob, const Datum& datum) {
+  DataTransformer<float> transformer(param, TEST);
+  transformer.InitRand();
+  const int height = param.crop_size() ? param.crop_size() : datum.height();
+  const int width = param.crop_size() ? param.crop_size() : datum.width();
+  Blob<float> transformed(1, datum.channels(), height, width);
+  Blob<float> expected(1, datum.channels(), height, width);
+
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    ReferenceTransform(param, mean_blob, datum, param.mirror(),
+        expected.mutable_cpu_data());
+  }
+  timer.Stop();
+  const double reference_rate =
+      FLAGS_iterations / (timer.MilliSeconds() / 1000.);
+
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    transformer.Transform(datum, &transformed);
+  }
+  timer.Stop();
+  const double rate = FLAGS_iterations / (timer.MilliSeconds() / 1000.);
+
+  // Mirroring is random, so the output must match one of the two references.
+  Blob<float> mirrored(1, datum.channels(), height, width);
+  ReferenceTransform(param, mean_blob, datum, false,
+      expected.mutable_cpu_data());
+  ReferenceTransform(param, mean_blob, datum, true,
+      mirrored.mutable_cpu_data());
+  transformer.Transform(datum, &transformed);
+  int num_plain = 0;
+  int num_mirrored = 0;
+  for (int i = 0; i < transformed.count(); ++i) {
+    num_plain += expected.cpu_data()[i] == transformed.cpu_data()[i];
+    num_mirrored += mirrored.cpu_data()[i] == transformed.cpu_data()[i];
+  }
+  CHECK(num_plain == transformed.count() ||
+      num_mirrored == transformed.count())
+      << name << ": output differs from the reference";
+  LOG(INFO) << name << ": reference " << reference_rate << " images/s, "
+            << "transformer " << rate << " images/s ("
+            << rate / reference_rate << "x)";
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Benchmark DataTransformer on Datums.\n"
+      "Usage:\n"
+      "    transform_benchmark [FLAGS]\n");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+  CHECK_GE(FLAGS_size, FLAGS_crop_size);
+
+  Datum uint8_datum;
+  uint8_datum.set_channels(FLAGS_channels);
+  uint8_datum.set_height(FLAGS_size);
+  uint8_datum.set_width(FLAGS_size);
+  Datum float_datum(uint8_datum);
+  const int size = FLAGS_channels * FLAGS_size * FLAGS_size;
+  string* data = uint8_datum.mutable_data();
+  BlobProto mean_proto;
+  mean_proto.set_num(1);
+  mean_proto.set_channels(FLAGS_channels);
+  mean_proto.set_height(FLAGS_size);
+  mean_proto.set_width(FLAGS_size);
+  for (int i = 0; i < size; ++i) {
+    data->push_back(static_cast<char>(caffe_rng_rand() % 256));
+    float_datum.add_float_data(static_cast<uint8_t>((*data)[i]));
+    mean_proto.add_data(i % 251);
+  }
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  WriteProtoToBinaryFile(mean_proto, mean_file);
+  Blob<float> mean_blob;
+  mean_blob.FromProto(mean_proto);
+
+  const char* datum_names[] = { "uint8", "float" };
+  const Datum* datums[] = { &uint8_datum, &float_datum };
+  const char* mean_names[] = { "no mean", "mean values", "mean file" };
+  for (int d = 0; d < 2; ++d) {
+    for (int mean_mode = 0; mean_mode < 3; ++mean_mode) {
+      for (int mirror = 0; mirror < 2; ++mirror) {
+        TransformationParameter param;
+        param.set_crop_size(FLAGS_crop_size);
+        param.set_scale(0.00390625);
+        param.set_mirror(mirror);
+        if (mean_mode == 1) {
+          for (int c = 0; c < FLAGS_channels; ++c) {
+            param.add_mean_value(104 + 13 * c);
+          }
+        } else if (mean_mode == 2) {
+          param.set_mean_file(mean_file);
+        }
+        Benchmark(string(datum_names[d]) + ", " + mean_names[mean_mode] +
+            (mirror ? ", mirror" : ""), param, mean_blob, *datums[d]);
+      }
+    }
+  }
+  return 0;
+}